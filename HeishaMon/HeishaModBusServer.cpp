@@ -1,7 +1,11 @@
-#include "HeishaModBusServer.h"
+#include "HeishaModbusServer.h"
 #include "gpio.h"
 #include "decode.h"
 #include "commands.h"
+#include "dallas.h"
+#include "s0.h"
+#include "HeishaOT.h"
+#include "src/common/log.h"
 
 #include <ctype.h>
 #include <math.h>
@@ -12,6 +16,10 @@
 extern char actData[DATASIZE];
 extern char actDataExtra[DATASIZE];
 extern char actOptData[OPTDATASIZE];
+extern dallasDataStruct* actDallasData;
+extern int dallasDevicecount;
+extern volatile s0DataStruct actS0Data[NUM_S0_COUNTERS];
+extern volatile s0SettingsStruct actS0Settings[NUM_S0_COUNTERS];
 extern bool send_command(byte* command, int length);
 extern void log_message(char *string);
 
@@ -26,6 +34,46 @@ constexpr uint16_t FLOAT_TOPIC_BASE = 10000;
 constexpr uint16_t FLOAT_EXTRA_TOPIC_BASE = FLOAT_TOPIC_BASE + (NUMBER_OF_TOPICS * 2);
 constexpr uint16_t FLOAT_OPTIONAL_TOPIC_BASE = FLOAT_EXTRA_TOPIC_BASE + (NUMBER_OF_TOPICS_EXTRA * 2);
 
+// Discrete input (FC 0x02) address map
+constexpr uint16_t BIT_OPTIONAL_BASE = 600;
+constexpr uint16_t BIT_FIELD_BASE = 1000;
+constexpr uint16_t BIT_OPTIONAL_FIELD_BASE = 1600;
+constexpr uint8_t BIT_FIELD_WIDTH = 2;
+
+// Read-only raw frame windows: sequence (2 registers), age in ms (2 registers), packed frame bytes
+constexpr uint16_t RAW_FRAME_BASE = 30000;
+constexpr uint16_t RAW_EXTRA_FRAME_BASE = 30200;
+constexpr uint16_t RAW_OPTIONAL_FRAME_BASE = 30400;
+constexpr uint16_t RAW_FRAME_HEADER_WORDS = 4;
+
+// User defined scan list block
+constexpr uint16_t SCAN_LIST_BASE = 20000;
+constexpr uint16_t MAX_SCAN_LIST_REGISTERS = 125;
+
+// Additional unit IDs, read directly from the in-memory structs
+constexpr uint8_t UNIT_HEATPUMP = 1;
+constexpr uint8_t UNIT_DALLAS = 2;
+constexpr uint8_t UNIT_S0 = 3;
+constexpr uint8_t UNIT_OPENTHERM = 4;
+
+constexpr uint16_t DALLAS_COUNT_REGISTER = 0;
+constexpr uint16_t DALLAS_TEMP_BASE = 1;
+constexpr uint16_t DALLAS_FLOAT_BASE = 100;
+constexpr uint16_t DALLAS_AGE_BASE = 200;
+constexpr uint16_t DALLAS_ADDRESS_BASE = 300;
+constexpr uint16_t DALLAS_ADDRESS_WORDS = 4;
+
+constexpr uint16_t S0_WATT_BASE = 0;
+constexpr uint16_t S0_PULSES_TOTAL_BASE = 10;
+constexpr uint16_t S0_WATTHOUR_TOTAL_BASE = 20;
+constexpr uint16_t S0_GOOD_PULSES_BASE = 30;
+constexpr uint16_t S0_BAD_PULSES_BASE = 40;
+
+constexpr uint16_t OPENTHERM_FLOAT_BASE = 100;
+
+constexpr uint16_t RELAY_COIL_COUNT = 3;
+constexpr uint16_t MAX_BIT_COUNT = 2000;
+
 
 
 enum class TopicSource {
@@ -63,6 +111,23 @@ constexpr size_t arraySize(const T (&)[N]) {
   return N;
 }
 
+enum class ScanEncoding : uint8_t {
+  Int16,
+  Float32,
+  Uint32
+};
+
+// One entry per register of the scan list block, compiled by setScanList()
+struct ScanRegister {
+  TopicSource source;
+  uint8_t topicIndex;
+  ScanEncoding encoding;
+  bool highWord;
+};
+
+ScanRegister scanList[MAX_SCAN_LIST_REGISTERS];
+uint16_t scanListRegisters = 0;
+
 bool nonNumericMainReported[NUMBER_OF_TOPICS] = { false };
 bool nonNumericExtraReported[NUMBER_OF_TOPICS_EXTRA] = { false };
 bool nonNumericOptReported[NUMBER_OF_OPT_TOPICS] = { false };
@@ -275,9 +340,7 @@ void logNonNumericTopicValue(TopicSource source, uint16_t topicIndex, uint16_t a
   if (!shouldLogNonNumeric(source, topicIndex)) {
     return;
   }
-  char logMsg[128];
-  snprintf_P(logMsg, sizeof(logMsg), PSTR("Modbus: non-numeric topic value for register %u: %s"), address, topicValue.c_str());
-  log_message(logMsg);
+  log_warn(LOG_MODBUS, "Modbus: non-numeric topic value for register %u: %s", address, topicValue.c_str());
 }
 
 bool topicToRegisterValue(uint16_t address, uint16_t &registerValue) {
@@ -321,6 +384,440 @@ bool topicToFloatRegisterValue(uint16_t address, uint16_t &registerValue) {
   return true;
 }
 
+// Returns the raw bit field of a getBit* decoded main topic (decoded value = field - 1,
+// except for getBit1 which is returned as is).
+bool topicBitField(uint16_t topicIndex, uint8_t &field) {
+  if (topicIndex >= NUMBER_OF_TOPICS) {
+    return false;
+  }
+  topicFP function = (topicFP)pgm_read_ptr(&topicFunctions[topicIndex]);
+  byte input = actData[pgm_read_byte(&topicBytes[topicIndex])];
+  if (function == getBit1) {
+    field = input >> 7;
+  } else if (function == getBit1and2) {
+    field = (input >> 6) & 0b11;
+  } else if (function == getBit3and4) {
+    field = (input >> 4) & 0b11;
+  } else if (function == getBit5and6) {
+    field = (input >> 2) & 0b11;
+  } else if (function == getBit7and8) {
+    field = input & 0b11;
+  } else {
+    return false;
+  }
+  return true;
+}
+
+bool topicBitActive(uint16_t topicIndex) {
+  uint8_t field = 0;
+  if (!topicBitField(topicIndex, field)) {
+    return false;
+  }
+  topicFP function = (topicFP)pgm_read_ptr(&topicFunctions[topicIndex]);
+  return (function == getBit1) ? (field != 0) : (field > 1);
+}
+
+// Same bit layout as getOptDataValue()
+uint8_t optionalBitField(uint16_t topicIndex) {
+  switch (topicIndex) {
+    case 0: return (actOptData[4] >> 7) & 0b1;
+    case 1: return (actOptData[4] >> 5) & 0b11;
+    case 2: return (actOptData[4] >> 4) & 0b1;
+    case 3: return (actOptData[4] >> 2) & 0b11;
+    case 4: return (actOptData[4] >> 1) & 0b1;
+    case 5: return (actOptData[4] >> 0) & 0b1;
+    case 6: return (actOptData[5] >> 0) & 0b1;
+  }
+  return 0;
+}
+
+bool discreteInputValue(uint16_t address, bool &value) {
+  if (address < NUMBER_OF_TOPICS) {
+    // topics that are not bit fields read as 0 so a status block can span them
+    value = topicBitActive(address);
+    return true;
+  }
+  if ((address >= BIT_OPTIONAL_BASE) && (address < BIT_OPTIONAL_BASE + NUMBER_OF_OPT_TOPICS)) {
+    value = optionalBitField(address - BIT_OPTIONAL_BASE) != 0;
+    return true;
+  }
+  if ((address >= BIT_FIELD_BASE) && (address < BIT_FIELD_BASE + (NUMBER_OF_TOPICS * BIT_FIELD_WIDTH))) {
+    uint16_t offset = address - BIT_FIELD_BASE;
+    uint8_t field = 0;
+    topicBitField(offset / BIT_FIELD_WIDTH, field);
+    value = (field >> (offset % BIT_FIELD_WIDTH)) & 0b1;
+    return true;
+  }
+  if ((address >= BIT_OPTIONAL_FIELD_BASE) && (address < BIT_OPTIONAL_FIELD_BASE + (NUMBER_OF_OPT_TOPICS * BIT_FIELD_WIDTH))) {
+    uint16_t offset = address - BIT_OPTIONAL_FIELD_BASE;
+    value = (optionalBitField(offset / BIT_FIELD_WIDTH) >> (offset % BIT_FIELD_WIDTH)) & 0b1;
+    return true;
+  }
+  return false;
+}
+
+bool coilValue(uint16_t address, bool &value) {
+  if (address < RELAY_COIL_COUNT) {
+    //the pin itself, the relay can also be switched over mqtt
+    value = getRelay1();
+    return true;
+  }
+  return false;
+}
+
+// Packs the requested bits LSB first as required for FC 0x01 / 0x02 responses.
+ModbusMessage readBits(ModbusMessage &request, bool (*bitValue)(uint16_t, bool &)) {
+  ModbusMessage response;
+  uint16_t addr = 0;
+  uint16_t count = 0;
+  request.get(2, addr);
+  request.get(4, count);
+
+  if ((count == 0) || (count > MAX_BIT_COUNT)) {
+    response.setError(request.getServerID(), request.getFunctionCode(), ILLEGAL_DATA_VALUE);
+    return response;
+  }
+  if ((uint32_t)addr + count > 65536) {
+    response.setError(request.getServerID(), request.getFunctionCode(), ILLEGAL_DATA_ADDRESS);
+    return response;
+  }
+
+  uint8_t packed[MAX_BIT_COUNT / 8] = { 0 };
+  for (uint16_t i = 0; i < count; ++i) {
+    bool value = false;
+    if (!bitValue(addr + i, value)) {
+      response.setError(request.getServerID(), request.getFunctionCode(), ILLEGAL_DATA_ADDRESS);
+      return response;
+    }
+    if (value) {
+      packed[i / 8] |= (1 << (i % 8));
+    }
+  }
+
+  uint8_t byteCount = (count + 7) / 8;
+  response.add(request.getServerID(), request.getFunctionCode(), byteCount);
+  for (uint8_t i = 0; i < byteCount; ++i) {
+    response.add(packed[i]);
+  }
+  return response;
+}
+
+bool stringToUint32Words(const String &value, uint16_t &msw, uint16_t &lsw) {
+  if (!isNumericValue(value)) {
+    msw = 0;
+    lsw = 0;
+    return false;
+  }
+  long intValue = value.toInt();
+  uint32_t raw = (intValue < 0) ? 0 : static_cast<uint32_t>(intValue);
+  msw = static_cast<uint16_t>(raw >> 16);
+  lsw = static_cast<uint16_t>(raw & 0xFFFF);
+  return true;
+}
+
+bool scanListToRegisterValue(uint16_t address, uint16_t &registerValue) {
+  if ((address < SCAN_LIST_BASE) || (address >= SCAN_LIST_BASE + scanListRegisters)) {
+    return false;
+  }
+  const ScanRegister &entry = scanList[address - SCAN_LIST_BASE];
+  uint16_t topicIndex = entry.topicIndex;
+
+  String topicValue;
+  if (!fetchTopicString(entry.source, topicIndex, topicValue)) {
+    return false;
+  }
+
+  bool numeric = true;
+  uint16_t msw = 0;
+  uint16_t lsw = 0;
+  switch (entry.encoding) {
+    case ScanEncoding::Int16:
+      numeric = stringToRegisterValue(topicValue, registerValue, topicIndex);
+      break;
+    case ScanEncoding::Float32:
+      numeric = stringToFloatWords(topicValue, msw, lsw);
+      registerValue = entry.highWord ? msw : lsw;
+      break;
+    case ScanEncoding::Uint32:
+      numeric = stringToUint32Words(topicValue, msw, lsw);
+      registerValue = entry.highWord ? msw : lsw;
+      break;
+  }
+  if (!numeric) {
+    logNonNumericTopicValue(entry.source, topicIndex, address, topicValue);
+  }
+  return true;
+}
+
+// Parses "TOP5", "XTOP0" or "OPT2"
+bool parseScanTopic(const char *name, TopicSource &source, uint8_t &topicIndex) {
+  uint16_t count = 0;
+  if (strncasecmp_P(name, PSTR("XTOP"), 4) == 0) {
+    source = TopicSource::Extra;
+    count = NUMBER_OF_TOPICS_EXTRA;
+    name += 4;
+  } else if (strncasecmp_P(name, PSTR("TOP"), 3) == 0) {
+    source = TopicSource::Main;
+    count = NUMBER_OF_TOPICS;
+    name += 3;
+  } else if (strncasecmp_P(name, PSTR("OPT"), 3) == 0) {
+    source = TopicSource::Optional;
+    count = NUMBER_OF_OPT_TOPICS;
+    name += 3;
+  } else {
+    return false;
+  }
+  if (!isdigit(static_cast<unsigned char>(*name))) {
+    return false;
+  }
+  char *end = NULL;
+  long index = strtol(name, &end, 10);
+  if ((*end != '\0') || (index >= count)) {
+    return false;
+  }
+  topicIndex = static_cast<uint8_t>(index);
+  return true;
+}
+
+bool parseScanEncoding(const char *name, ScanEncoding &encoding) {
+  if ((*name == '\0') || (strcasecmp_P(name, PSTR("i16")) == 0)) {
+    encoding = ScanEncoding::Int16;
+  } else if (strcasecmp_P(name, PSTR("f32")) == 0) {
+    encoding = ScanEncoding::Float32;
+  } else if (strcasecmp_P(name, PSTR("u32")) == 0) {
+    encoding = ScanEncoding::Uint32;
+  } else {
+    return false;
+  }
+  return true;
+}
+
+void floatToWords(float value, uint16_t &msw, uint16_t &lsw) {
+  uint32_t raw = 0;
+  memcpy(&raw, &value, sizeof(raw));
+  msw = static_cast<uint16_t>(raw >> 16);
+  lsw = static_cast<uint16_t>(raw & 0xFFFF);
+}
+
+uint16_t scaledInt16(float value) {
+  float scaled = value * 100.0f;
+  if (scaled > 32767.0f) {
+    scaled = 32767.0f;
+  }
+  if (scaled < -32768.0f) {
+    scaled = -32768.0f;
+  }
+  return static_cast<uint16_t>(static_cast<int16_t>(roundf(scaled)));
+}
+
+uint16_t uint32Word(uint32_t value, bool highWord) {
+  return highWord ? static_cast<uint16_t>(value >> 16) : static_cast<uint16_t>(value & 0xFFFF);
+}
+
+uint16_t floatWord(float value, bool highWord) {
+  uint16_t msw = 0;
+  uint16_t lsw = 0;
+  floatToWords(value, msw, lsw);
+  return highWord ? msw : lsw;
+}
+
+// Returns true when address lies in [base, base + count * width), with the entry index and word offset
+bool decodeBlock(uint16_t address, uint16_t base, uint16_t count, uint16_t width, uint16_t &index, uint16_t &word) {
+  if ((address < base) || (address >= base + (count * width))) {
+    return false;
+  }
+  index = (address - base) / width;
+  word = (address - base) % width;
+  return true;
+}
+
+// Unit 2: 1-wire sensors in detection order. Missing sensors read as -127 °C like the DS18B20 library.
+bool dallasToRegisterValue(uint16_t address, uint16_t &registerValue) {
+  uint16_t index = 0;
+  uint16_t word = 0;
+
+  if (address == DALLAS_COUNT_REGISTER) {
+    registerValue = static_cast<uint16_t>(dallasDevicecount);
+    return true;
+  }
+
+  if (decodeBlock(address, DALLAS_TEMP_BASE, MAX_DALLAS_SENSORS, 1, index, word)) {
+    float temperature = (index < static_cast<uint16_t>(dallasDevicecount)) ? actDallasData[index].temperature : -127.0f;
+    registerValue = scaledInt16(temperature);
+    return true;
+  }
+
+  if (decodeBlock(address, DALLAS_FLOAT_BASE, MAX_DALLAS_SENSORS, 2, index, word)) {
+    float temperature = (index < static_cast<uint16_t>(dallasDevicecount)) ? actDallasData[index].temperature : -127.0f;
+    registerValue = floatWord(temperature, word == 0);
+    return true;
+  }
+
+  if (decodeBlock(address, DALLAS_AGE_BASE, MAX_DALLAS_SENSORS, 1, index, word)) {
+    unsigned long age = 0xFFFF;
+    if ((index < static_cast<uint16_t>(dallasDevicecount)) && (actDallasData[index].lastgoodtime != 0)) {
+      age = (millis() - actDallasData[index].lastgoodtime) / 1000;
+    }
+    registerValue = (age > 0xFFFF) ? 0xFFFF : static_cast<uint16_t>(age);
+    return true;
+  }
+
+  if (decodeBlock(address, DALLAS_ADDRESS_BASE, MAX_DALLAS_SENSORS, DALLAS_ADDRESS_WORDS, index, word)) {
+    registerValue = 0;
+    if (index < static_cast<uint16_t>(dallasDevicecount)) {
+      const uint8_t *sensor = actDallasData[index].sensor;
+      registerValue = (sensor[word * 2] << 8) | sensor[(word * 2) + 1];
+    }
+    return true;
+  }
+
+  return false;
+}
+
+// Unit 3: S0 counters
+bool s0ToRegisterValue(uint16_t address, uint16_t &registerValue) {
+  uint16_t index = 0;
+  uint16_t word = 0;
+
+  if (decodeBlock(address, S0_WATT_BASE, NUM_S0_COUNTERS, 1, index, word)) {
+    unsigned int watt = actS0Data[index].watt;
+    registerValue = (watt > 0xFFFF) ? 0xFFFF : static_cast<uint16_t>(watt);
+    return true;
+  }
+
+  if (decodeBlock(address, S0_PULSES_TOTAL_BASE, NUM_S0_COUNTERS, 2, index, word)) {
+    registerValue = uint32Word(actS0Data[index].pulsesTotal, word == 0);
+    return true;
+  }
+
+  if (decodeBlock(address, S0_WATTHOUR_TOTAL_BASE, NUM_S0_COUNTERS, 2, index, word)) {
+    float watthourTotal = actS0Data[index].pulsesTotal * (1000.0 / actS0Settings[index].ppkwh);
+    registerValue = floatWord(watthourTotal, word == 0);
+    return true;
+  }
+
+  if (decodeBlock(address, S0_GOOD_PULSES_BASE, NUM_S0_COUNTERS, 2, index, word)) {
+    registerValue = uint32Word(actS0Data[index].goodPulses, word == 0);
+    return true;
+  }
+
+  if (decodeBlock(address, S0_BAD_PULSES_BASE, NUM_S0_COUNTERS, 2, index, word)) {
+    registerValue = uint32Word(actS0Data[index].badPulses, word == 0);
+    return true;
+  }
+
+  return false;
+}
+
+uint16_t openthermCount() {
+  static uint16_t count = 0;
+  if (count == 0) {
+    while (heishaOTDataStruct[count].name != NULL) {
+      count++;
+    }
+  }
+  return count;
+}
+
+float openthermFloatValue(const heishaOTDataStruct_t &member) {
+  switch (member.type) {
+    case TBOOL: return member.value.b ? 1.0f : 0.0f;
+    case TFLOAT: return member.value.f;
+    case TINT8: return member.value.s8;
+  }
+  return 0.0f;
+}
+
+// Unit 4: OpenTherm values in the order of heishaOTDataStruct
+bool openthermToRegisterValue(uint16_t address, uint16_t &registerValue) {
+  uint16_t index = 0;
+  uint16_t word = 0;
+
+  if (decodeBlock(address, 0, openthermCount(), 1, index, word)) {
+    const heishaOTDataStruct_t &member = heishaOTDataStruct[index];
+    if (member.type == TFLOAT) {
+      registerValue = scaledInt16(member.value.f);
+    } else {
+      registerValue = static_cast<uint16_t>(static_cast<int16_t>(openthermFloatValue(member)));
+    }
+    return true;
+  }
+
+  if (decodeBlock(address, OPENTHERM_FLOAT_BASE, openthermCount(), 2, index, word)) {
+    registerValue = floatWord(openthermFloatValue(heishaOTDataStruct[index]), word == 0);
+    return true;
+  }
+
+  return false;
+}
+
+struct RawFrameWindow {
+  uint16_t baseAddress;
+  const char *frame;
+  uint16_t length;
+  const uint32_t *sequence;
+  const unsigned long *receivedMillis;
+};
+
+const RawFrameWindow kRawFrameWindows[] = {
+  { RAW_FRAME_BASE, actData, DATASIZE, &actDataSequence, &actDataMillis },
+  { RAW_EXTRA_FRAME_BASE, actDataExtra, DATASIZE, &actDataExtraSequence, &actDataExtraMillis },
+  { RAW_OPTIONAL_FRAME_BASE, actOptData, OPTDATASIZE, &actOptDataSequence, &actOptDataMillis }
+};
+
+// Frame bytes are packed big endian, two per register. The age reads 0xFFFFFFFF until a frame was received.
+bool rawFrameToRegisterValue(uint16_t address, uint16_t &registerValue) {
+  for (const RawFrameWindow &window : kRawFrameWindows) {
+    uint16_t frameWords = (window.length + 1) / 2;
+    if ((address < window.baseAddress) || (address >= window.baseAddress + RAW_FRAME_HEADER_WORDS + frameWords)) {
+      continue;
+    }
+    uint16_t offset = address - window.baseAddress;
+    if (offset < 2) {
+      registerValue = uint32Word(*window.sequence, offset == 0);
+    } else if (offset < RAW_FRAME_HEADER_WORDS) {
+      uint32_t age = (*window.sequence == 0) ? 0xFFFFFFFF : static_cast<uint32_t>(millis() - *window.receivedMillis);
+      registerValue = uint32Word(age, offset == 2);
+    } else {
+      uint16_t index = (offset - RAW_FRAME_HEADER_WORDS) * 2;
+      registerValue = static_cast<uint8_t>(window.frame[index]) << 8;
+      if (index + 1 < window.length) {
+        registerValue |= static_cast<uint8_t>(window.frame[index + 1]);
+      }
+    }
+    return true;
+  }
+  return false;
+}
+
+bool heatpumpToRegisterValue(uint16_t address, uint16_t &registerValue) {
+  return topicToRegisterValue(address, registerValue) ||
+         topicToFloatRegisterValue(address, registerValue) ||
+         scanListToRegisterValue(address, registerValue) ||
+         rawFrameToRegisterValue(address, registerValue);
+}
+
+ModbusMessage readRegisters(ModbusMessage &request, bool (*registerValue)(uint16_t, uint16_t &)) {
+  ModbusMessage response;
+  uint16_t addr = 0;
+  uint16_t words = 0;
+  request.get(2, addr);
+  request.get(4, words);
+
+  response.add(request.getServerID(), request.getFunctionCode(), (uint8_t)(words * 2));
+
+  for (uint16_t i = 0; i < words; ++i) {
+    uint16_t value = 0;
+    if (!registerValue(addr + i, value)) {
+      response.clear();
+      response.setError(request.getServerID(), request.getFunctionCode(), ILLEGAL_DATA_ADDRESS);
+      return response;
+    }
+    response.add(value);
+  }
+  return response;
+}
+
 bool copyMainCommandTopic(uint16_t address, char *topicName, size_t length) {
   if (length == 0) {
     return false;
@@ -392,28 +889,27 @@ CommandWriteResult handleWriteCommand(uint16_t address, uint16_t registerValue)
 
 }  // namespace
 
-// FC 0x03 / 0x04: Read Holding/Input Registers
-ModbusMessage HeishaModBusServer::FC_03(ModbusMessage request) {
-  ModbusMessage response;
-  uint16_t addr = 0;
-  uint16_t words = 0;
-  request.get(2, addr);
-  request.get(4, words);
+// FC 0x01: Read Coils
+ModbusMessage HeishaModBusServer::FC_01(ModbusMessage request) {
+  return readBits(request, coilValue);
+}
 
-  response.add(request.getServerID(), request.getFunctionCode(), (uint8_t)(words * 2));
+// FC 0x02: Read Discrete Inputs
+ModbusMessage HeishaModBusServer::FC_02(ModbusMessage request) {
+  return readBits(request, discreteInputValue);
+}
 
-  for (uint16_t i = 0; i < words; ++i) {
-    uint16_t registerValue = 0;
-    uint16_t targetAddress = addr + i;
-    if (!topicToRegisterValue(targetAddress, registerValue) &&
-        !topicToFloatRegisterValue(targetAddress, registerValue)) {
-      response.clear();
-      response.setError(request.getServerID(), request.getFunctionCode(), ILLEGAL_DATA_ADDRESS);
-      return response;
-    }
-    response.add(registerValue);
+// FC 0x03 / 0x04: Read Holding/Input Registers
+ModbusMessage HeishaModBusServer::FC_03(ModbusMessage request) {
+  switch (request.getServerID()) {
+    case UNIT_DALLAS:
+      return readRegisters(request, dallasToRegisterValue);
+    case UNIT_S0:
+      return readRegisters(request, s0ToRegisterValue);
+    case UNIT_OPENTHERM:
+      return readRegisters(request, openthermToRegisterValue);
   }
-  return response;
+  return readRegisters(request, heatpumpToRegisterValue);
 }
 
 // FC 0x05: Write Single Coil
@@ -424,7 +920,7 @@ ModbusMessage HeishaModBusServer::FC_05(ModbusMessage request) {
   uint16_t state = 0;
   request.get(2, start, state);
 
-  if (start <= 2) {
+  if (start < RELAY_COIL_COUNT) {
     if (state == 0x0000) {
       setRelay1(0);
       response = ECHO_RESPONSE;
@@ -463,13 +959,85 @@ ModbusMessage HeishaModBusServer::FC_06(ModbusMessage request) {
   return response;
 }
 
-void HeishaModBusServer::setup(bool isOptionalPCB) 
+// Compiles a comma separated list like "TOP1,TOP5:f32,TOP11:u32,XTOP0" into
+// the register table behind SCAN_LIST_BASE.
+static bool compileScanList(const char *list, ScanRegister *compiled, uint16_t &registers)
 {
-  optionalPCB = isOptionalPCB;
+  registers = 0;
+
+  size_t len = strlen(list);
+  char buffer[len + 1];
+  memcpy(buffer, list, len + 1);
+
+  char *saveptr = NULL;
+  for (char *token = strtok_r(buffer, ", ", &saveptr); token != NULL; token = strtok_r(NULL, ", ", &saveptr)) {
+    const char *encodingName = "";
+    char *separator = strchr(token, ':');
+    if (separator != NULL) {
+      *separator = '\0';
+      encodingName = separator + 1;
+    }
+
+    ScanRegister entry;
+    if (!parseScanTopic(token, entry.source, entry.topicIndex) ||
+        !parseScanEncoding(encodingName, entry.encoding)) {
+      log_warn(LOG_MODBUS, "Modbus: invalid scan list entry '%s'", token);
+      return false;
+    }
+
+    uint8_t words = (entry.encoding == ScanEncoding::Int16) ? 1 : 2;
+    if (registers + words > MAX_SCAN_LIST_REGISTERS) {
+      log_warn(LOG_MODBUS, "Modbus: scan list exceeds %u registers", MAX_SCAN_LIST_REGISTERS);
+      return false;
+    }
+    for (uint8_t i = 0; i < words; ++i) {
+      entry.highWord = (i == 0);
+      compiled[registers++] = entry;
+    }
+  }
+  return true;
+}
 
-  _mbServer.registerWorker(1, WRITE_COIL,           &HeishaModBusServer::FC_05);
-  _mbServer.registerWorker(1, READ_HOLD_REGISTER,   &HeishaModBusServer::FC_03);
-  _mbServer.registerWorker(1, WRITE_HOLD_REGISTER,  &HeishaModBusServer::FC_06);
+bool HeishaModBusServer::checkScanList(const char *list)
+{
+  ScanRegister compiled[MAX_SCAN_LIST_REGISTERS];
+  uint16_t registers = 0;
+
+  return compileScanList(list, compiled, registers);
+}
+
+// On error the previous list is kept.
+bool HeishaModBusServer::setScanList(const char *list)
+{
+  ScanRegister compiled[MAX_SCAN_LIST_REGISTERS];
+  uint16_t registers = 0;
+
+  if (!compileScanList(list, compiled, registers)) {
+    return false;
+  }
+
+  memcpy(scanList, compiled, registers * sizeof(ScanRegister));
+  scanListRegisters = registers;
+
+  if (registers > 0) {
+    log_info(LOG_MODBUS, "Modbus: scan list with %u registers at %u", registers, SCAN_LIST_BASE);
+  }
+  return true;
+}
+
+void HeishaModBusServer::setup(bool isOptionalPCB, const char *scanListSetting)
+{
+  optionalPCB = isOptionalPCB;
+  setScanList(scanListSetting);
+
+  _mbServer.registerWorker(UNIT_HEATPUMP,  READ_COIL,            &HeishaModBusServer::FC_01);
+  _mbServer.registerWorker(UNIT_HEATPUMP,  READ_DISCR_INPUT,     &HeishaModBusServer::FC_02);
+  _mbServer.registerWorker(UNIT_HEATPUMP,  WRITE_COIL,           &HeishaModBusServer::FC_05);
+  _mbServer.registerWorker(UNIT_HEATPUMP,  READ_HOLD_REGISTER,   &HeishaModBusServer::FC_03);
+  _mbServer.registerWorker(UNIT_HEATPUMP,  WRITE_HOLD_REGISTER,  &HeishaModBusServer::FC_06);
+  _mbServer.registerWorker(UNIT_DALLAS,    READ_HOLD_REGISTER,   &HeishaModBusServer::FC_03);
+  _mbServer.registerWorker(UNIT_S0,        READ_HOLD_REGISTER,   &HeishaModBusServer::FC_03);
+  _mbServer.registerWorker(UNIT_OPENTHERM, READ_HOLD_REGISTER,   &HeishaModBusServer::FC_03);
   _mbServer.start(502, 1, 20000);
 }
 
@@ -5,11 +5,16 @@
 
 class HeishaModBusServer {
 public:
-    void setup(bool isOptionalPCB);
+    void setup(bool isOptionalPCB, const char *scanList);
+    bool setScanList(const char *scanList);
+    // parses a scan list without changing the active one
+    static bool checkScanList(const char *scanList);
     void loop();
 
 private:
     // Callbacks für eModbus (müssen static sein)
+    static ModbusMessage FC_01(ModbusMessage request);
+    static ModbusMessage FC_02(ModbusMessage request);
     static ModbusMessage FC_03(ModbusMessage request);
     static ModbusMessage FC_05(ModbusMessage request);
     static ModbusMessage FC_06(ModbusMessage request);
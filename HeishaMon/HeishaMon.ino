@@ -35,6 +35,9 @@
 
 #include "lwip/apps/sntp.h"
 #include "src/common/timerqueue.h"
+#include "src/common/idle.h"
+#include "src/common/logqueue.h"
+#include "src/common/mqttqueue.h"
 #include "src/common/stricmp.h"
 #include "src/common/log.h"
 #include "src/common/progmem.h"
@@ -44,6 +47,11 @@
 #include "decode.h"
 #include "commands.h"
 #include "rules.h"
+#include "loopstats.h"
+#include "stats.h"
+#include "logstore.h"
+#include "history.h"
+#include "mqtttransport.h"
 #include "version.h"
 #include "HeishaModbusServer.h"
 
@@ -58,6 +66,7 @@ ADC_MODE(ADC_VCC);
 const byte DNS_PORT = 53;
 
 #define SERIALTIMEOUT 2000 // wait until all 203 bytes are read, must not be too long to avoid blocking the code
+#define LOOPIDLETIME 10 // max ms the main loop sleeps, mqtt, ota, modbus and new http clients are still polled
 
 settingsStruct heishamonSettings;
 
@@ -69,6 +78,9 @@ bool mqttcallbackinprogress = false; // mutex for processing mqtt callback
 bool extraDataBlockAvailable = false; // this will be set to true if, during boot, heishamon detects this heatpump has extra data block (like K and L series do)
 
 #define MQTTRECONNECTTIMER 30000 //it takes 30 secs for each mqtt server reconnect attempt
+#define MQTTCONNECTTIMEOUT 10000 //max ms the lookup and connect, and again the CONNACK, may take in the background
+#define MQTTKEEPALIVE 5 //seconds, fast timeout so a dead connection is noticed quickly
+#define MQTTQUEUERATE 8 //queued mqtt messages sent per loop
 unsigned long lastMqttReconnectAttempt = 0;
 
 unsigned long bootButtonNotPressed = 0;
@@ -82,14 +94,6 @@ unsigned long lastOptionalPCBRunTime = 0;
 unsigned long lastOptionalPCBSave = 0;
 
 unsigned long sendCommandReadTime = 0; //set to millis value during send, allow to wait millis for answer
-unsigned long goodreads = 0;
-unsigned long totalreads = 0;
-unsigned long badcrcread = 0;
-unsigned long badheaderread = 0;
-unsigned long tooshortread = 0;
-unsigned long toolongread = 0;
-unsigned long timeoutread = 0;
-float readpercentage = 0;
 static int uploadpercentage = 0;
 
 // instead of passing array pointers between functions we just define this in the global scope
@@ -110,14 +114,20 @@ char actData[DATASIZE] = { '\0' };
 char actDataExtra[DATASIZE] = { '\0' };
 char actOptData[OPTDATASIZE]  = { '\0' };
 
+// sequence number and millis of the last stored frame, bumped by the decode functions
+uint32_t actDataSequence = 0;
+uint32_t actDataExtraSequence = 0;
+uint32_t actOptDataSequence = 0;
+unsigned long actDataMillis = 0;
+unsigned long actDataExtraMillis = 0;
+unsigned long actOptDataMillis = 0;
+
 // log message to sprintf to
 char log_msg[256];
 
 // mqtt topic to sprintf and then publish to
 char mqtt_topic[256];
 
-static int mqttReconnects = 0;
-
 // can't have too much in buffer due to memory shortage
 #define MAXCOMMANDSINBUFFER 10
 
@@ -135,15 +145,20 @@ static uint8_t cmdnrel = 0;
 HeishaModBusServer modbusServer;
 
 // mqtt
-WiFiClient mqtt_wifi_client;
+MqttTransport mqtt_transport;
 PubSubClient mqtt_client;
 
+// steps of the mqtt (re)connect, see mqtt_reconnect()
+#define MQTT_STATE_IDLE 0
+#define MQTT_STATE_OPENING 1
+#define MQTT_STATE_CONNACK 2
+#define MQTT_STATE_CONNECTED 3
+static uint8_t mqttState = MQTT_STATE_IDLE;
+static unsigned long mqttStateStart = 0;
 
 
-bool firstConnectSinceBoot = true; //if this is true there is no first connection made yet
 
-struct timerqueue_t **timerqueue = NULL;
-int timerqueue_size = 0;
+bool firstConnectSinceBoot = true; //if this is true there is no first connection made yet
 
 #ifdef ESP32
 #define ETH_TYPE        ETH_PHY_W5500
@@ -178,10 +193,10 @@ void check_wifi() {
   if ((wifistatus != WL_CONNECTED) && (WiFi.localIP())) {
     // special case where it seems that we are not connect but we do have working IP (causing the -1% wifi signal), do a reset.
 #ifdef ESP8266
-    log_message(_F("Weird case, WiFi seems disconnected but is not. Resetting WiFi!"));
+    log_warn(LOG_MAIN, "Weird case, WiFi seems disconnected but is not. Resetting WiFi!");
     setupWifi(&heishamonSettings);
 #else
-    log_message(_F("WiFi just got disconnected, still have IP addres."));
+    log_warn(LOG_MAIN, "WiFi just got disconnected, still have IP addres.");
 #endif
   } else if ((wifistatus != WL_CONNECTED) || (!WiFi.localIP())) {
     /*
@@ -240,7 +255,7 @@ void check_wifi() {
         }
 #ifdef ESP8266        
       } else {
-        log_message(_F("Reconnecting to WiFi failed. Waiting a few seconds before trying again."));
+        log_warn(LOG_MAIN, "Reconnecting to WiFi failed. Waiting a few seconds before trying again.");
         WiFi.disconnect(true);
 #endif        
       }
@@ -284,7 +299,9 @@ void check_wifi() {
 
       ntpReload(&heishamonSettings);
       logprintln_P(F("Try to syncing with ntp servers. Checking again in 5 minutes"));
-      timerqueue_insert(300, 0, -6);
+      if (timerqueue_insert(300, 0, -6) == -1) {
+        log_error(LOG_MAIN, "Timer queue full, ntp sync check not scheduled");
+      }
     }
 
     /*
@@ -310,62 +327,171 @@ void check_wifi() {
 }
 
 
+// sends a queued mqtt message, it waits in the queue while the tcp send buffer is too full to take it at once
+int8_t mqttSend(const char *topic, const uint8_t *payload, uint16_t len, uint8_t retain) {
+  if (mqttState != MQTT_STATE_CONNECTED || !mqtt_client.connected()) return -1;
+  //fixed header, length and topic length
+  if (mqtt_transport.space() < strlen(topic) + len + 7) return -1;
+  if (!mqtt_client.publish(topic, payload, len, retain)) {
+    log_warn(LOG_MQTT, "MQTT write failed, closing the connection");
+    mqtt_transport.stop();
+    return -1;
+  }
+  return 0;
+}
+
+void mqtt_publish_stats() {
+  char topic[256];
+  char json[224];
+  struct mqttqueue_stats_t *stats = mqttqueue_stats();
+  sprintf_P(topic, PSTR("%s/mqtt/stats"), heishamonSettings.mqtt_topic_base);
+  snprintf_P(json, sizeof(json), PSTR("{\"reconnects\":%d,\"queued\":%lu,\"coalesced\":%lu,\"dropped\":%lu,\"sent\":%lu,\"pending\":%u,\"history\":%lu,\"history dropped\":%lu}"),
+             heishamonStats.mqttReconnects, (unsigned long)stats->queued, (unsigned long)stats->coalesced, (unsigned long)stats->dropped, (unsigned long)stats->sent, mqttqueue_count(),
+             (unsigned long)history_pending(), (unsigned long)history_dropped());
+  mqttqueue_publish(topic, json, MQTT_RETAIN_VALUES);
+}
+
+void mqtt_subscribe() {
+  char topic[256];
+  if (heishamonSettings.opentherm) {
+    sprintf(topic, "%s/%s/#", heishamonSettings.mqtt_topic_base, mqtt_topic_opentherm_read);
+    mqtt_client.subscribe(topic);
+  }
+  sprintf(topic, "%s/%s/#", heishamonSettings.mqtt_topic_base, mqtt_topic_commands);
+  mqtt_client.subscribe(topic);
+  sprintf(topic, "%s/%s/#", heishamonSettings.mqtt_topic_base, mqtt_topic_gpio);
+  mqtt_client.subscribe(topic);
+  sprintf(topic, "%s/%s", heishamonSettings.mqtt_topic_base, mqtt_send_raw_value_topic);
+  mqtt_client.subscribe(topic);
+  sprintf(topic, "%s/%s", heishamonSettings.mqtt_topic_base, mqtt_willtopic);
+  mqttqueue_publish(topic, "Online", 0);
+  sprintf(topic, "%s/%s", heishamonSettings.mqtt_topic_base, mqtt_iptopic);
+#ifdef ESP8266
+  mqttqueue_publish(topic, WiFi.localIP().toString().c_str(), MQTTQUEUE_RETAIN);
+#else
+  if (ETH.hasIP()) {
+    mqttqueue_publish(topic, ETH.localIP().toString().c_str(), MQTTQUEUE_RETAIN);
+  } else {
+    mqttqueue_publish(topic, WiFi.localIP().toString().c_str(), MQTTQUEUE_RETAIN);
+  }
+#endif
+
+  if (heishamonSettings.use_s0) { // connect to s0 topic to retrieve older watttotal from mqtt
+    sprintf_P(topic, PSTR("%s/%s/WatthourTotal/1"), heishamonSettings.mqtt_topic_base, mqtt_topic_s0);
+    mqtt_client.subscribe(topic);
+    sprintf_P(topic, PSTR("%s/%s/WatthourTotal/2"), heishamonSettings.mqtt_topic_base, mqtt_topic_s0);
+    mqtt_client.subscribe(topic);
+  }
+  if (heishamonStats.mqttReconnects == 1) { //only resend all data on first connect to mqtt so a data bomb like and bad mqtt server will not cause a reconnect bomb everytime
+    if (heishamonSettings.use_1wire) resetlastalldatatime_dallas(); //resend all 1wire values to mqtt
+    resetlastalldatatime(); //resend all heatpump values to mqtt
+  }
+  //use this to receive valid heishamon raw data from other heishamon to debug this OT code
+//#define RAWDEBUG
+#ifdef RAWDEBUG
+  if ( heishamonSettings.listenonly) {
+    mqtt_client.subscribe((char*)"panasonic_heat_pump/raw/data"); //subscribe to raw heatpump data over MQTT
+  }
+#endif
+}
+
+/*
+   The lookup, the tcp connect and the CONNACK all arrive
+   in AsyncTCP callbacks, each loop() only checks whether
+   the current step finished, so a (re)connect never blocks
+   the loop. A step that takes longer than MQTTCONNECTTIMEOUT
+   is given up. Messages published meanwhile wait in the
+   mqtt queue.
+*/
 void mqtt_reconnect()
 {
-  unsigned long now = millis();
-  if ((lastMqttReconnectAttempt == 0) || ((unsigned long)(now - lastMqttReconnectAttempt) > MQTTRECONNECTTIMER)) { //only try reconnect each MQTTRECONNECTTIMER seconds or on boot when lastMqttReconnectAttempt is still 0
-    lastMqttReconnectAttempt = now;
-    if (mqttReconnects == 0) {
-      log_message(_F("Connecting to mqtt server ..."));
-    } else {
-      log_message(_F("Reconnecting to mqtt server ..."));
-    }
-    char topic[256];
-    sprintf(topic, "%s/%s", heishamonSettings.mqtt_topic_base, mqtt_willtopic);
-    if (mqtt_client.connect(heishamonSettings.wifi_hostname, heishamonSettings.mqtt_username, heishamonSettings.mqtt_password, topic, 1, true, "Offline"))
-    {
-      mqttReconnects++;
-      if (heishamonSettings.opentherm) {
-        sprintf(topic, "%s/%s/#", heishamonSettings.mqtt_topic_base, mqtt_topic_opentherm_read);
-        mqtt_client.subscribe(topic);
-      }
-      sprintf(topic, "%s/%s/#", heishamonSettings.mqtt_topic_base, mqtt_topic_commands);
-      mqtt_client.subscribe(topic);
-      sprintf(topic, "%s/%s/#", heishamonSettings.mqtt_topic_base, mqtt_topic_gpio);
-      mqtt_client.subscribe(topic);      
-      sprintf(topic, "%s/%s", heishamonSettings.mqtt_topic_base, mqtt_send_raw_value_topic);
-      mqtt_client.subscribe(topic);
-      sprintf(topic, "%s/%s", heishamonSettings.mqtt_topic_base, mqtt_willtopic);
-      mqtt_client.publish(topic, "Online");
-      sprintf(topic, "%s/%s", heishamonSettings.mqtt_topic_base, mqtt_iptopic);
 #ifdef ESP8266
-      mqtt_client.publish(topic, WiFi.localIP().toString().c_str(), true);
+  bool networkUp = WiFi.isConnected();
 #else
-      if (ETH.hasIP()) {
-        mqtt_client.publish(topic, ETH.localIP().toString().c_str(), true);
-      } else {
-        mqtt_client.publish(topic, WiFi.localIP().toString().c_str(), true);
-      }
+  bool networkUp = WiFi.isConnected() || ETH.connected();
 #endif
 
-      if (heishamonSettings.use_s0) { // connect to s0 topic to retrieve older watttotal from mqtt
-        sprintf_P(mqtt_topic, PSTR("%s/%s/WatthourTotal/1"), heishamonSettings.mqtt_topic_base, mqtt_topic_s0);
-        mqtt_client.subscribe(mqtt_topic);
-        sprintf_P(mqtt_topic, PSTR("%s/%s/WatthourTotal/2"), heishamonSettings.mqtt_topic_base, mqtt_topic_s0);
-        mqtt_client.subscribe(mqtt_topic);
+  if (mqttState == MQTT_STATE_CONNECTED) {
+    if (mqtt_client.connected()) return;
+    log_warn(LOG_MQTT, "Lost MQTT connection!");
+    history_offline(true);
+    mqttState = MQTT_STATE_IDLE;
+  }
+  if (!networkUp) {
+    if (mqttState != MQTT_STATE_IDLE) mqtt_transport.stop();
+    mqttState = MQTT_STATE_IDLE;
+    return;
+  }
+
+  switch (mqttState) {
+    case MQTT_STATE_IDLE: {
+      unsigned long now = millis();
+      //only try reconnect each MQTTRECONNECTTIMER seconds or on boot when lastMqttReconnectAttempt is still 0
+      if ((lastMqttReconnectAttempt != 0) && ((unsigned long)(now - lastMqttReconnectAttempt) <= MQTTRECONNECTTIMER)) return;
+      lastMqttReconnectAttempt = now;
+      if (heishamonStats.mqttReconnects == 0) {
+        log_info(LOG_MQTT, "Connecting to mqtt server ...");
+      } else {
+        log_info(LOG_MQTT, "Reconnecting to mqtt server ...");
       }
-      if (mqttReconnects == 1) { //only resend all data on first connect to mqtt so a data bomb like and bad mqtt server will not cause a reconnect bomb everytime
-        if (heishamonSettings.use_1wire) resetlastalldatatime_dallas(); //resend all 1wire values to mqtt
-        resetlastalldatatime(); //resend all heatpump values to mqtt
+      if (!mqtt_transport.begin(heishamonSettings.mqtt_server, atoi(heishamonSettings.mqtt_port))) {
+        log_warn(LOG_MQTT, "Could not connect to mqtt server %s", heishamonSettings.mqtt_server);
+        mqtt_transport.stop();
+        return;
       }
-      //use this to receive valid heishamon raw data from other heishamon to debug this OT code
-//#define RAWDEBUG
-#ifdef RAWDEBUG
-      if ( heishamonSettings.listenonly) {
-        mqtt_client.subscribe((char*)"panasonic_heat_pump/raw/data"); //subscribe to raw heatpump data over MQTT
+      mqttStateStart = now;
+      mqttState = MQTT_STATE_OPENING;
+    } break;
+    case MQTT_STATE_OPENING: {
+      uint8_t state = mqtt_transport.state();
+      if (state == MQTTTRANSPORT_OPENING) {
+        if ((unsigned long)(millis() - mqttStateStart) <= MQTTCONNECTTIMEOUT) return;
+        state = MQTTTRANSPORT_CLOSED;
       }
-#endif
-    }
+      if (state != MQTTTRANSPORT_OPEN) {
+        log_warn(LOG_MQTT, "Could not connect to mqtt server %s", heishamonSettings.mqtt_server);
+        mqtt_transport.stop();
+        mqttState = MQTT_STATE_IDLE;
+        return;
+      }
+      char topic[256];
+      sprintf(topic, "%s/%s", heishamonSettings.mqtt_topic_base, mqtt_willtopic);
+      //PubSubClient always sends the user name, but the password only with a user name
+      if (!mqtt_transport.sendConnect(heishamonSettings.wifi_hostname, heishamonSettings.mqtt_username, heishamonSettings.mqtt_password, topic, 1, true, "Offline", MQTTKEEPALIVE)) {
+        log_warn(LOG_MQTT, "Could not send the connect to mqtt server %s", heishamonSettings.mqtt_server);
+        mqtt_transport.stop();
+        mqttState = MQTT_STATE_IDLE;
+        return;
+      }
+      mqttStateStart = millis();
+      mqttState = MQTT_STATE_CONNACK;
+    } break;
+    case MQTT_STATE_CONNACK: {
+      int rc = mqtt_transport.connack();
+      if (rc == MQTTTRANSPORT_WAITING) {
+        if ((unsigned long)(millis() - mqttStateStart) <= MQTTCONNECTTIMEOUT) return;
+        rc = MQTTTRANSPORT_INVALID;
+      }
+      bool connected = false;
+      if (rc == 0) {
+        char topic[256];
+        sprintf(topic, "%s/%s", heishamonSettings.mqtt_topic_base, mqtt_willtopic);
+        //the CONNACK is buffered already, the client takes over the open connection without waiting
+        mqtt_transport.replayConnect();
+        connected = mqtt_client.connect(heishamonSettings.wifi_hostname, heishamonSettings.mqtt_username, heishamonSettings.mqtt_password, topic, 1, true, "Offline");
+      }
+      if (!connected) {
+        log_warn(LOG_MQTT, "MQTT server refused the connection (code %d)", rc);
+        mqtt_transport.stop();
+        mqttState = MQTT_STATE_IDLE;
+        return;
+      }
+      heishamonStats.mqttReconnects++;
+      mqttState = MQTT_STATE_CONNECTED;
+      history_offline(false);
+      mqtt_subscribe();
+      mqtt_publish_stats();
+    } break;
   }
 }
 
@@ -383,42 +509,87 @@ void blinkNeoPixel(bool status) {
 
 void log_message(char* string)
 {
-#ifdef ESP32
-  if (!inSetup) blinkNeoPixel(true);
-#endif
-  time_t rawtime;
-  rawtime = time(NULL);
+  if (!log_enabled(LOG_INFO, LOG_MAIN)) {
+    return;
+  }
+  //only queued here, the sinks below write it from the main loop
+  logqueue_add(LOG_INFO, LOG_MAIN, string);
+  if (inSetup) logqueue_drain();
+}
+
+bool logWritten = false; //for the activity led
+
+// formats a queued log message as "time (millis): message"
+void formatLogLine(struct logqueue_record_t *record, char *text, char *line, size_t len) {
+  time_t rawtime = time(NULL) - ((millis() - record->millis) / 1000);
   struct tm *timeinfo = localtime(&rawtime);
   char timestring[32];
   strftime(timestring, 32, "%c", timeinfo);
-  size_t len = strlen(string) + strlen(timestring) + 32; //+32 long enough to contain millis() and the json part later for websocket mesg
-  char* log_line = (char *) malloc(len);
-  snprintf(log_line, len, "%s (%lu): %s", timestring, millis(), string);
+  snprintf(line, len, "%s (%lu): %s", timestring, (unsigned long)record->millis, text);
+}
 
-  if (heishamonSettings.logSerial1) {
-    loggingSerial.println(log_line);
-  }
-  if (heishamonSettings.logMqtt && mqtt_client.connected())
-  {
-    char log_topic[256];
-    sprintf(log_topic, "%s/%s", heishamonSettings.mqtt_topic_base, mqtt_logtopic);
-
-    if (!mqtt_client.publish(log_topic, log_line)) {
-      if (heishamonSettings.logSerial1) {
-        loggingSerial.print(millis());
-        loggingSerial.print(F(": "));
-        loggingSerial.println(F("MQTT publish log message failed!"));
-      }
-      mqtt_client.disconnect();
-    }
+int8_t logSerialSink(struct logqueue_record_t *record, char *text) {
+  if (!heishamonSettings.logSerial1) return 0;
+  char line[LOGQUEUE_LINE + 48];
+  formatLogLine(record, text, line, sizeof(line));
+  //don't wait for a full serial tx buffer, try again on the next loop. lines longer than the
+  //128 byte esp8266 tx fifo are written once most of it is free, the rest blocks only shortly
+  int room = loggingSerial.availableForWrite();
+  if ((room < (int)strlen(line) + 2) && (room < 100)) return -1;
+  loggingSerial.println(line);
+  logWritten = true;
+  return 0;
+}
+
+int8_t logMqttSink(struct logqueue_record_t *record, char *text) {
+  if (!heishamonSettings.logMqtt) return 0;
+  if (mqttState != MQTT_STATE_CONNECTED) return -1;
+  char line[LOGQUEUE_LINE + 48];
+  char log_topic[256];
+  formatLogLine(record, text, line, sizeof(line));
+  sprintf(log_topic, "%s/%s", heishamonSettings.mqtt_topic_base, mqtt_logtopic);
+  //leave it in the log queue while the mqtt queue is full, log lines are never coalesced
+  if (mqttqueue_bytes() + strlen(log_topic) + strlen(line) + 8 > MQTTQUEUE_SIZE) return -1;
+  mqttqueue_publish(log_topic, line, MQTTQUEUE_APPEND);
+  logWritten = true;
+  return 0;
+}
+
+int8_t logWebsocketSink(struct logqueue_record_t *record, char *text) {
+  //don't format the time for nobody
+  if (websocket_clients() == 0) return 0;
+  char line[LOGQUEUE_LINE + 48];
+  char json[sizeof(line) * 2 + 16];
+  formatLogLine(record, text, line, sizeof(line));
+  //the message ends up in a json string
+  size_t len = sprintf_P(json, PSTR("{\"logMsg\":\""));
+  for (char *p = line; *p != '\0'; p++) {
+    if (*p == '"' || *p == '\\') json[len++] = '\\';
+    json[len++] = *p;
   }
-  //send log message to websocket
-  snprintf(log_line, len+12, "{\"logMsg\":\"%s (%lu): %s\"}", timestring, millis(), string);
-  websocket_write_all(log_line, strlen(log_line));
-  free(log_line);
+  strcpy_P(&json[len], PSTR("\"}"));
+  websocket_write_all(json, strlen(json));
+  logWritten = true;
+  return 0;
+}
+
+int8_t logFileSink(struct logqueue_record_t *record, char *text) {
+  if (!heishamonSettings.logFile) return 0;
+  logstore_add(record, text);
+  return 0;
+}
+
+// writes queued log messages, each sink only a few per loop so logging never stalls the loop
+void drainLog() {
+  logWritten = false;
+  logqueue_drain();
+  logstore_flush(false);
 #ifdef ESP32
-  if (!inSetup) blinkNeoPixel(false);
-#endif  
+  if (logWritten && !inSetup) {
+    blinkNeoPixel(true);
+    blinkNeoPixel(false);
+  }
+#endif
 }
 
 void logHex(char *hex, byte hex_len) {
@@ -429,7 +600,7 @@ void logHex(char *hex, byte hex_len) {
     for (int j = 0; ((j < LOGHEXBYTESPERLINE) && ((i + j) < hex_len)); j++) {
       sprintf(&buffer[3 * j], "%02X ", hex[i + j]);
     }
-    sprintf_P(log_msg, PSTR("data: %s"), buffer ); log_message(log_msg);
+    log_info(LOG_SERIAL, "data: %s", buffer);
   }
 }
 
@@ -440,7 +611,7 @@ void mqttPublish(char* topic, char* subtopic, char* value) {
 void mqttPublish(char* topic, char* subtopic, char* value, bool retain) {
   char mqtt_topic[256];
   sprintf_P(mqtt_topic, PSTR("%s/%s/%s"), heishamonSettings.mqtt_topic_base, topic, subtopic);
-  mqtt_client.publish(mqtt_topic, value, retain);
+  mqttqueue_publish(mqtt_topic, value, retain);
 }
 
 
@@ -470,7 +641,7 @@ void readProxy()
     proxydata[proxydata_length + proxylen] = proxySerial.read(); //read available data and place it after the last received data
     proxylen++;
     if ((proxydata[0] != 0x71) and  (proxydata[0] != 0x31) and  (proxydata[0] != 0xF1)) { //wrong header received!
-      log_message(_F("PROXY Received bad header. Ignoring this data!"));
+      log_warn(LOG_SERIAL, "PROXY Received bad header. Ignoring this data!");
       if (heishamonSettings.logHexdump) logHex(proxydata, proxylen);
       proxydata_length = 0;
       return; //return so this while loop does not loop forever if there happens to be a continous invalid data stream
@@ -480,52 +651,51 @@ void readProxy()
   proxydata_length +=  proxylen;
   if (proxydata_length > 1 ) { //should have received length part of header now
     if ((proxydata_length > ( proxydata[1] + 3)) || (proxydata_length >= MAXDATASIZE)) {
-      sprintf_P(log_msg, PSTR("PROXY Received %i bytes proxy %i\n"), proxydata_length, proxydata[1]);
-      log_message(log_msg);
-      log_message(_F("PROXY Received more data than header suggests! Ignoring this as this is bad data."));
+      log_warn(LOG_SERIAL, "PROXY Received %i bytes proxy %i", proxydata_length, proxydata[1]);
+      log_warn(LOG_SERIAL, "PROXY Received more data than header suggests! Ignoring this as this is bad data.");
       proxydata_length = 0;
       if (heishamonSettings.logHexdump) logHex(proxydata, proxydata_length);
       return;
     }
     if (proxydata_length == (proxydata[1] + 3)) { //we received all data (serial2_data[1] is header length field)
-      sprintf_P(log_msg, PSTR("PROXY Received %i bytes"), proxydata_length); log_message(log_msg);
+      log_debug(LOG_SERIAL, "PROXY Received %i bytes", proxydata_length);
       if (heishamonSettings.logHexdump) logHex(proxydata, proxydata_length);
       if (! isValidReceiveChecksum(proxydata,proxydata_length) ) {
-        log_message(_F("PROXY Checksum received false!"));
+        log_warn(LOG_SERIAL, "PROXY Checksum received false!");
         proxydata_length = 0; //for next attempt
         return;
       }      
-      log_message(_F("PROXY Checksum and header received ok!"));
+      log_debug(LOG_SERIAL, "PROXY Checksum and header received ok!");
       if ((proxydata[0]==0x71 or proxydata[0]==0xF1) and proxydata_length == (PANASONICQUERYSIZE+1)) { //this is a query from cztaw on proxy port
         if (proxydata[0]==0xf1) {  //this is a write query, just pass this message forward as new command
-          log_message(_F("PROXY received write query, copy message forward to heatpump"));
+          log_debug(LOG_SERIAL, "PROXY received write query, copy message forward to heatpump");
           send_command((byte*)proxydata,proxydata_length-1); //strip CRC, will be calculated again in send_command
           //then just reply with the current settings, for read and write it is the same as the write is only acknowledged in the next read
           //so we just run to the next if statement
         }
         if (proxydata[3] == 0x10) {
-          log_message(_F("PROXY requests basic data"));
+          log_debug(LOG_SERIAL, "PROXY requests basic data");
           if ((actData[0] == 0x71) && (actData[1] == 0xc8) && (actData[2] == 0x01)) { //don't answer if we don't have data
             proxySerial.write(actData,DATASIZE); //should contain valid checksum also
           }
         } else if (proxydata[3] == 0x21 ) {
-          log_message(_F("PROXY requests extra data"));
+          log_debug(LOG_SERIAL, "PROXY requests extra data");
           if ((actDataExtra[0] == 0x71) && (actDataExtra[1] == 0xc8) && (actDataExtra[2] == 0x01)) { //don't answer if we don't have data
             proxySerial.write(actDataExtra,DATASIZE); //should containt valid checksum also
           }
         } else {
-          log_message(_F("PROXY has sent unknown query! Forwarding to heatpump!"));
+          log_info(LOG_SERIAL, "PROXY has sent unknown query! Forwarding to heatpump!");
           send_command((byte *)proxydata, proxydata_length-1); //strip CRC from end as send_command wil recalculate it
         }
         proxydata_length = 0;
         return;
       } else if (proxydata[0]==0x31) {
-        log_message(_F("PROXY received startup message, forwarding to heatpump!"));
+        log_info(LOG_SERIAL, "PROXY received startup message, forwarding to heatpump!");
         send_command((byte *)proxydata, proxydata_length-1); //strip CRC from end as send_command wil recalculate it
         proxydata_length = 0;
         return;
       } else {
-        log_message(_F("PROXY received unknown message, forwarding it to heatpump anyway!"));
+        log_info(LOG_SERIAL, "PROXY received unknown message, forwarding it to heatpump anyway!");
         send_command((byte *)proxydata, proxydata_length-1); //strip CRC from end as send_command wil recalculate it
         proxydata_length = 0;
         return;
@@ -542,65 +712,65 @@ bool readSerial()
     data[data_length + len] = heatpumpSerial.read(); //read available data and place it after the last received data
     len++;
     if ((data[0] != 0x71) && (data[0] != 0x31)) { //wrong header received!
-      log_message(_F("Received bad header. Ignoring this data!"));
+      log_warn(LOG_SERIAL, "Received bad header. Ignoring this data!");
       if (heishamonSettings.logHexdump) logHex(data, len);
-      badheaderread++;
+      heishamonStats.badheaderread++;
       data_length = 0;
       return false; //return so this while loop does not loop forever if there happens to be a continous invalid data stream
     }
   }
 
-  if ((len > 0) && (data_length == 0 )) totalreads++; //this is the start of a new read
+  if ((len > 0) && (data_length == 0 )) heishamonStats.totalreads++; //this is the start of a new read
   data_length += len;
 
   if (data_length > 1) { //should have received length part of header now
 
     if ((data_length > (data[1] + 3)) || (data_length >= MAXDATASIZE) ) {
-      log_message(_F("Received more data than header suggests! Ignoring this as this is bad data."));
+      log_warn(LOG_SERIAL, "Received more data than header suggests! Ignoring this as this is bad data.");
       if (heishamonSettings.logHexdump) logHex(data, data_length);
       data_length = 0;
-      toolongread++;
+      heishamonStats.toolongread++;
       return false;
     }
 
     if (data_length == (data[1] + 3)) { //we received all data (data[1] is header length field)
-      sprintf_P(log_msg, PSTR("Received %d bytes data"), data_length); log_message(log_msg);
+      log_debug(LOG_SERIAL, "Received %d bytes data", data_length);
       sending = false; //we received an answer after our last command so from now on we can start a new send request again
       if (heishamonSettings.logHexdump) logHex(data, data_length);
       if (! isValidReceiveChecksum(data, data_length) ) {
-        log_message(_F("Checksum received false!"));
+        log_warn(LOG_SERIAL, "Checksum received false!");
         data_length = 0; //for next attempt
-        badcrcread++;
+        heishamonStats.badcrcread++;
         return false;
       }
-      log_message(_F("Checksum and header received ok!"));
-      goodreads++;
+      log_debug(LOG_SERIAL, "Checksum and header received ok!");
+      heishamonStats.goodreads++;
 
       if (data_length == DATASIZE)  {  //receive a full data block
         if  (data[3] == 0x10) { //decode the normal data block
-          decode_heatpump_data(data, actData, mqtt_client, log_message, heishamonSettings.mqtt_topic_base, heishamonSettings.updateAllTime);
+          decode_heatpump_data(data, actData, log_message, heishamonSettings.mqtt_topic_base, heishamonSettings.updateAllTime);
           {
             char mqtt_topic[256];
             sprintf(mqtt_topic, "%s/raw/data", heishamonSettings.mqtt_topic_base);
-            mqtt_client.publish(mqtt_topic, (const uint8_t *)actData, DATASIZE, false); //do not retain this raw data
+            mqttqueue_publish_raw(mqtt_topic, (const uint8_t *)actData, DATASIZE, 0); //do not retain this raw data
           }
           data_length = 0;
           return true;
         } else if (data[3] == 0x21) { //decode the new model extra data block
           extraDataBlockAvailable = true; //set the flag to true so we know we can request this data always
-          decode_heatpump_data_extra(data, actDataExtra, mqtt_client, log_message, heishamonSettings.mqtt_topic_base, heishamonSettings.updateAllTime);
+          decode_heatpump_data_extra(data, actDataExtra, log_message, heishamonSettings.mqtt_topic_base, heishamonSettings.updateAllTime);
           {
             char mqtt_topic[256];
             sprintf(mqtt_topic, "%s/raw/dataextra", heishamonSettings.mqtt_topic_base);
-            mqtt_client.publish(mqtt_topic, (const uint8_t *)actDataExtra, DATASIZE, false); //do not retain this raw data
+            mqttqueue_publish_raw(mqtt_topic, (const uint8_t *)actDataExtra, DATASIZE, 0); //do not retain this raw data
           }
           data_length = 0;
           return true;
         } else {
 #ifdef ESP8266
-          log_message(_F("Received an unknown full size datagram. Can't decode this yet."));
+          log_info(LOG_SERIAL, "Received an unknown full size datagram. Can't decode this yet.");
 #else 
-          log_message(_F("Received a full size datagram but not for me. Forwarding to proxy port."));
+          log_debug(LOG_SERIAL, "Received a full size datagram but not for me. Forwarding to proxy port.");
           proxySerial.write(data,data_length);
 #endif               
           data_length = 0;
@@ -608,16 +778,16 @@ bool readSerial()
         }
       }
       else if (data_length == OPTDATASIZE ) { //optional pcb acknowledge answer
-        log_message(_F("Received optional PCB ack answer. Decoding this in OPT topics."));
-        decode_optional_heatpump_data(data, actOptData, mqtt_client, log_message, heishamonSettings.mqtt_topic_base, heishamonSettings.updateAllTime);
+        log_debug(LOG_SERIAL, "Received optional PCB ack answer. Decoding this in OPT topics.");
+        decode_optional_heatpump_data(data, actOptData, log_message, heishamonSettings.mqtt_topic_base, heishamonSettings.updateAllTime);
         data_length = 0;
         return true;
       }
       else {
 #ifdef ESP8266
-        log_message(_F("Received a shorter datagram. Can't decode this yet."));
+        log_info(LOG_SERIAL, "Received a shorter datagram. Can't decode this yet.");
 #else
-        log_message(_F("Received a shorter datagram but not for me. Forwarding to proxy port."));
+        log_debug(LOG_SERIAL, "Received a shorter datagram but not for me. Forwarding to proxy port.");
         proxySerial.write(data,data_length);
 #endif           
         data_length = 0;
@@ -639,7 +809,7 @@ void popCommandBuffer() {
 
 void pushCommandBuffer(byte* command, int length) {
   if (cmdnrel + 1 > MAXCOMMANDSINBUFFER) {
-    log_message(_F("Too much commands already in buffer. Ignoring this commands.\n"));
+    log_warn(LOG_SERIAL, "Too much commands already in buffer. Ignoring this commands.");
     return;
   }
   cmdbuffer[cmdend].length = length;
@@ -650,11 +820,11 @@ void pushCommandBuffer(byte* command, int length) {
 
 bool send_command(byte* command, int length) {
   if ( heishamonSettings.listenonly ) {
-    log_message(_F("Not sending this command. Heishamon in listen only mode!"));
+    log_info(LOG_SERIAL, "Not sending this command. Heishamon in listen only mode!");
     return false;
   }
   if ( sending ) {
-    log_message(_F("Already sending data. Buffering this send request"));
+    log_debug(LOG_SERIAL, "Already sending data. Buffering this send request");
     pushCommandBuffer(command, length);
     return false;
   }
@@ -663,8 +833,7 @@ bool send_command(byte* command, int length) {
   byte chk = calcChecksum(command, length);
   int bytesSent = heatpumpSerial.write(command, length); //first send command
   bytesSent += heatpumpSerial.write(chk); //then calculcated checksum byte afterwards
-  sprintf_P(log_msg, PSTR("sent bytes: %d including checksum value: %d "), bytesSent, int(chk));
-  log_message(log_msg);
+  log_debug(LOG_SERIAL, "sent bytes: %d including checksum value: %d ", bytesSent, int(chk));
 
   if (heishamonSettings.logHexdump) logHex((char*)command, length);
   sendCommandReadTime = millis(); //set sendCommandReadTime when to timeout the answer of this command
@@ -674,7 +843,7 @@ bool send_command(byte* command, int length) {
 // Callback function that is called when a message has been pushed to one of your topics.
 void mqtt_callback(char* topic, byte* payload, unsigned int length) {
   if (mqttcallbackinprogress) {
-    log_message(_F("Already processing another mqtt callback. Ignoring this one"));
+    log_warn(LOG_MQTT, "Already processing another mqtt callback. Ignoring this one");
   }
   else {
     mqttcallbackinprogress = true; //simple semaphore to make sure we don't have two callbacks at the same time
@@ -690,8 +859,7 @@ void mqtt_callback(char* topic, byte* payload, unsigned int length) {
       rawcommand = (byte *) malloc(length);
       memcpy(rawcommand, msg, length);
 
-      sprintf_P(log_msg, PSTR("sending raw value"));
-      log_message(log_msg);
+      log_info(LOG_MQTT, "sending raw value");
       send_command(rawcommand, length);
       free(rawcommand);
     } else if (strncmp(topic_command, mqtt_topic_s0, strlen(mqtt_topic_s0)) == 0)  // this is a s0 topic, check for watthour topic and restore it
@@ -704,18 +872,22 @@ void mqtt_callback(char* topic, byte* payload, unsigned int length) {
       char mqtt_topic[256];
       sprintf(mqtt_topic, "%s", topic);
       if (mqtt_client.unsubscribe(mqtt_topic)) {
-        log_message(_F("Unsubscribed from S0 watthour restore topic"));
+        log_info(LOG_S0, "Unsubscribed from S0 watthour restore topic");
       }
     } else if (strncmp(topic_command, mqtt_topic_commands, strlen(mqtt_topic_commands)) == 0)  // check for commands to heishamon
     {
       char* topic_sendcommand = topic_command + strlen(mqtt_topic_commands) + 1; //strip the first 9 "commands/" from the topic to get what we need
-      send_heatpump_command(topic_sendcommand, msg, send_command, log_message, heishamonSettings.optionalPCB);
+      if (strcmp(topic_sendcommand, mqtt_topic_batch) == 0) {
+        send_heatpump_batch(msg, send_command, log_message, heishamonSettings.optionalPCB);
+      } else {
+        send_heatpump_command(topic_sendcommand, msg, send_command, log_message, heishamonSettings.optionalPCB);
+      }
     //use this to receive valid heishamon raw data from other heishamon to debug this OT code
 #ifdef RAWDEBUG
     } else if (strcmp((char*)"panasonic_heat_pump/raw/data", topic) == 0) {  // check for raw heatpump input
       sprintf_P(log_msg, PSTR("Received raw heatpump data from MQTT"));
       log_message(log_msg);
-      decode_heatpump_data(msg, actData, mqtt_client, log_message, heishamonSettings.mqtt_topic_base, heishamonSettings.updateAllTime);
+      decode_heatpump_data(msg, actData, log_message, heishamonSettings.mqtt_topic_base, heishamonSettings.updateAllTime);
       memcpy(actData, msg, DATASIZE);
 #endif
     } else if (strncmp(topic_command, mqtt_topic_opentherm_read, strlen(mqtt_topic_opentherm_read)) == 0)  {
@@ -773,7 +945,7 @@ int8_t webserver_cb(struct webserver_t *client, void *dat) {
           client->route = 30;
         } else if (strcmp_P((char *)dat, PSTR("/debug")) == 0) {
           client->route = 40;
-          log_message(_F("Debug URL requested"));
+          log_info(LOG_WEB, "Debug URL requested");
         } else if (strcmp_P((char *)dat, PSTR("/wifiscan")) == 0) {
           client->route = 50;
         } else if (strcmp((char *)dat, "/dallasalias") == 0) {
@@ -839,6 +1011,21 @@ int8_t webserver_cb(struct webserver_t *client, void *dat) {
           client->route = 140;
         } else if (strcmp_P((char *)dat, PSTR("/rules")) == 0) {
           client->route = 160;
+        } else if (strcmp_P((char *)dat, PSTR("/rules/stats")) == 0) {
+          client->route = 190;
+        } else if (strcmp_P((char *)dat, PSTR("/loop/stats")) == 0) {
+          client->route = 200;
+        } else if (strcmp_P((char *)dat, PSTR("/stats")) == 0) {
+          client->route = 220;
+        } else if (strcmp_P((char *)dat, PSTR("/metrics")) == 0) {
+          client->route = 230;
+        } else if (strcmp_P((char *)dat, PSTR("/log")) == 0) {
+          if ((client->userdata = calloc(1, sizeof(struct logstore_reader_t))) == NULL) {
+            loggingSerial.printf(PSTR("Out of memory %s:#%d\n"), __FUNCTION__, __LINE__);
+            ESP.restart();
+            exit(-1);
+          }
+          client->route = 210;
         } else if (strcmp_P((char *)dat, PSTR("/scandallas")) == 0) {
           client->route = 180;          
         } else {
@@ -851,8 +1038,7 @@ int8_t webserver_cb(struct webserver_t *client, void *dat) {
         struct arguments_t *args = (struct arguments_t *)dat;
         switch (client->route) {
           case 60: {
-              sprintf_P(log_msg, PSTR("Dallas alias changed address %s to alias %s"), args->name, args->value);
-              log_message(log_msg);
+              log_info(LOG_WEB, "Dallas alias changed address %s to alias %s", args->name, args->value);
               changeDallasAlias((char *)args->name, (char *)args->value);
               return 0;
             } break;
@@ -865,58 +1051,54 @@ int8_t webserver_cb(struct webserver_t *client, void *dat) {
               memset(&cpy, 0, args->len + 1);
               snprintf((char *)&cpy, args->len + 1, "%.*s", args->len, args->value);
 
-              for (uint8_t x = 0; x < sizeof(commands) / sizeof(commands[0]); x++) {
+              int8_t x = find_command((char *)args->name);
+              if (x > -1) {
                 cmdStruct tmp;
                 memcpy_P(&tmp, &commands[x], sizeof(tmp));
-                if (strcmp((char *)args->name, tmp.name) == 0) {
-                  len = tmp.func(cpy, cmd, log_msg);
-                  if ((client->userdata = realloc(client->userdata, strlen((char *)client->userdata) + strlen(log_msg) + 2)) == NULL) {
-                    loggingSerial.printf(PSTR("Out of memory %s:#%d\n"), __FUNCTION__, __LINE__);
-                    ESP.restart();
-                    exit(-1);
-                  }
-                  strcat((char *)client->userdata, log_msg);
-                  strcat((char *)client->userdata, "\n");
-                  log_message(log_msg);
-                  send_command(cmd, len);
-                }
-              }
-
-              memset(&cmd, 0, 256);
-              memset(&log_msg, 0, 256);
-
-              if (heishamonSettings.optionalPCB) {
+                len = tmp.func(cpy, cmd, log_msg);
+              } else if (heishamonSettings.optionalPCB && (x = find_optional_command((char *)args->name)) > -1) {
                 //optional commands
-                for (uint8_t x = 0; x < sizeof(optionalCommands) / sizeof(optionalCommands[0]); x++) {
-                  optCmdStruct tmp;
-                  memcpy_P(&tmp, &optionalCommands[x], sizeof(tmp));
-                  if (strcmp((char *)args->name, tmp.name) == 0) {
-                    len = tmp.func(cpy, log_msg);
-                    if ((client->userdata = realloc(client->userdata, strlen((char *)client->userdata) + strlen(log_msg) + 2)) == NULL) {
-                      loggingSerial.printf(PSTR("Out of memory %s:#%d\n"), __FUNCTION__, __LINE__);
-                      ESP.restart();
-                      exit(-1);
-                    }
-                    strcat((char *)client->userdata, log_msg);
-                    strcat((char *)client->userdata, "\n");
-                    log_message(log_msg);
-                  }
-                }
+                optCmdStruct tmp;
+                memcpy_P(&tmp, &optionalCommands[x], sizeof(tmp));
+                tmp.func(cpy, log_msg);
+              } else {
+                return 0;
+              }
+              if ((client->userdata = realloc(client->userdata, strlen((char *)client->userdata) + strlen(log_msg) + 2)) == NULL) {
+                loggingSerial.printf(PSTR("Out of memory %s:#%d\n"), __FUNCTION__, __LINE__);
+                ESP.restart();
+                exit(-1);
               }
+              strcat((char *)client->userdata, log_msg);
+              strcat((char *)client->userdata, "\n");
+              log_message(log_msg);
+              if (len > 0) send_command(cmd, len);
             } break;
           case 110: {
               return cacheSettings(client, args);
             } break;
+          case 210: {
+              struct logstore_reader_t *reader = (struct logstore_reader_t *)client->userdata;
+              if (reader != NULL && args->value != NULL) {
+                char value[16];
+                snprintf(value, sizeof(value), "%.*s", args->len, args->value);
+                if (strcmp_P((char *)args->name, PSTR("from")) == 0) {
+                  reader->from = strtoul(value, NULL, 10);
+                } else if (strcmp_P((char *)args->name, PSTR("to")) == 0) {
+                  reader->to = strtoul(value, NULL, 10);
+                }
+              }
+              return 0;
+            } break;
           case 150: {
               if (Update.isRunning() && (!Update.hasError())) {
                 if ((strcmp((char *)args->name, "md5") == 0) && (args->len > 0)) {
                   char md5[args->len + 1];
                   memset(&md5, 0, args->len + 1);
                   snprintf((char *)&md5, args->len + 1, "%.*s", args->len, args->value);
-                  sprintf_P(log_msg, PSTR("Firmware MD5 expected: %s"), md5);
-                  log_message(log_msg);
+                  log_info(LOG_WEB, "Firmware MD5 expected: %s", md5);
                   if (!Update.setMD5(md5)) {
-                    log_message(_F("Failed to set expected update file MD5!"));
+                    log_error(LOG_WEB, "Failed to set expected update file MD5!");
                     Update.end(false);
                   }
                 } else if (strcmp((char *)args->name, "firmware") == 0) {
@@ -926,13 +1108,12 @@ int8_t webserver_cb(struct webserver_t *client, void *dat) {
                   } else {
                     if (uploadpercentage != (unsigned int)(((float)client->readlen / (float)client->totallen) * 20)) {
                       uploadpercentage = (unsigned int)(((float)client->readlen / (float)client->totallen) * 20);
-                      sprintf_P(log_msg, PSTR("Uploading new firmware: %d%%"), uploadpercentage * 5);
-                      log_message(log_msg);
+                      log_info(LOG_WEB, "Uploading new firmware: %d%%", uploadpercentage * 5);
                     }
                   }
                 }
               } else {
-                log_message((char*)"New firmware POST data but update not running anymore!");
+                log_warn(LOG_WEB, "New firmware POST data but update not running anymore!");
               }
             } break;
           case 170: {
@@ -959,7 +1140,7 @@ int8_t webserver_cb(struct webserver_t *client, void *dat) {
               return 0;
             } break;
           case 1: {
-              return handleRoot(client, readpercentage, mqttReconnects, &heishamonSettings);
+              return handleRoot(client, heishamonStats.readpercentage, heishamonStats.mqttReconnects, &heishamonSettings);
             } break;
           case 20: {
               return handleJsonOutput(client, actData, actDataExtra, actOptData, &heishamonSettings, extraDataBlockAvailable);
@@ -1003,6 +1184,12 @@ int8_t webserver_cb(struct webserver_t *client, void *dat) {
             } break;
           case 110: {
               int ret = saveSettings(client, &heishamonSettings);
+              if (client->route == 114) {
+                return settingsInvalidScanList(client);
+              }
+              modbusServer.setScanList(heishamonSettings.modbus_scanlist);
+              logstore_setup(heishamonSettings.logFile ? heishamonSettings.logFileSize : 0);
+              history_setup(heishamonSettings.historyStore, heishamonSettings.historySpill);
               #ifdef ESP8266
               if ((!heishamonSettings.opentherm) && (heishamonSettings.listenonly)) {
                 //make sure we disable TX to heatpump-RX using the mosfet so this line is floating and will not disturb cz-taw1
@@ -1042,6 +1229,9 @@ int8_t webserver_cb(struct webserver_t *client, void *dat) {
           case 112: {
               return settingsReconnectWifi(client, &heishamonSettings);
             } break;
+          case 114: {
+              return settingsInvalidScanList(client);
+            } break;
           case 120: {
               return handleSettings(client);
             } break;
@@ -1052,11 +1242,13 @@ int8_t webserver_cb(struct webserver_t *client, void *dat) {
               return showFirmware(client);
             } break;
           case 150: {
-              log_message((char*)"In /firmware client write part");
+              log_debug(LOG_WEB, "In /firmware client write part");
               if (Update.isRunning()) {
                 if (Update.end(true)) {
                   log_message((char*)"Firmware update success");
-                  timerqueue_insert(2, 0, -2); // Start reboot sequence
+                  if (timerqueue_insert(2, 0, -2) == -1) { // Start reboot sequence
+                    log_error(LOG_MAIN, "Timer queue full, reboot not scheduled");
+                  }
                   return showFirmwareSuccess(client);
                 } else {
                   Update.printError(loggingSerial);
@@ -1068,6 +1260,21 @@ int8_t webserver_cb(struct webserver_t *client, void *dat) {
           case 160: {
               return showRules(client);
             } break;
+          case 190: {
+              return handleRulesStats(client);
+            } break;
+          case 200: {
+              return handleLoopStats(client);
+            } break;
+          case 210: {
+              return handleLogStore(client);
+            } break;
+          case 220: {
+              return handleStats(client);
+            } break;
+          case 230: {
+              return handleMetrics(client);
+            } break;
           case 170: {
               File *f = (File *)client->userdata;
               if (f) {
@@ -1077,7 +1284,9 @@ int8_t webserver_cb(struct webserver_t *client, void *dat) {
                 delete f;
               }
               client->userdata = NULL;
-              timerqueue_insert(0, 1, -4);
+              if (timerqueue_insert(0, 1, -4) == -1) {
+                log_error(LOG_RULES, "Timer queue full, new rules not loaded");
+              }
               webserver_send(client, 301, (char *)"text/plain", 0);
 
             } break;
@@ -1116,7 +1325,8 @@ int8_t webserver_cb(struct webserver_t *client, void *dat) {
       } break;
     case WEBSERVER_CLIENT_CLOSE: {
         switch (client->route) {
-          case 100: {
+          case 100:
+          case 210: {
               if (client->userdata != NULL) {
                 free(client->userdata);
               }
@@ -1242,10 +1452,12 @@ void switchSerial() {
   heatpumpSerial.end();
   heatpumpSerial.begin(9600, SERIAL_8E1,HEATPUMPRX,HEATPUMPTX);
   heatpumpSerial.flush();
+  heatpumpSerial.onReceive(idle_wakeup); //wake up the main loop as soon as data arrives
   proxySerial.flush();
   proxySerial.end();
   proxySerial.begin(9600, SERIAL_8E1,PROXYRX,PROXYTX);
   proxySerial.flush();  
+  proxySerial.onReceive(idle_wakeup);
 #endif
 
   setupGPIO(heishamonSettings.gpioSettings); //switch extra GPIOs to configured mode
@@ -1261,7 +1473,7 @@ void switchSerial() {
   //try to detect if cz-taw1 is connected in parallel
   if (!heishamonSettings.listenonly) {
     if (heatpumpSerial.available() > 0) {
-      log_message(_F("There is data on the line without asking for it. Switching to listen only mode."));
+      log_warn(LOG_SERIAL, "There is data on the line without asking for it. Switching to listen only mode.");
       heishamonSettings.listenonly = true;
     }
     else {
@@ -1273,11 +1485,14 @@ void switchSerial() {
 }
 
 void setupMqtt() {
-  mqtt_client.setClient(mqtt_wifi_client);
+  mqtt_client.setClient(mqtt_transport);
   mqtt_client.setBufferSize(1024);
-  mqtt_client.setSocketTimeout(10); mqtt_client.setKeepAlive(5); //fast timeout, any slower will block the main loop too long
+  //only bounds the wait for the rest of a packet that arrived in parts, this can still block up to a second
+  mqtt_client.setSocketTimeout(1);
+  mqtt_client.setKeepAlive(MQTTKEEPALIVE);
   mqtt_client.setServer(heishamonSettings.mqtt_server, atoi(heishamonSettings.mqtt_port));
   mqtt_client.setCallback(mqtt_callback);
+  mqttqueue_setup(mqttSend);
 }
 
 void setupConditionals() {
@@ -1289,7 +1504,7 @@ void setupConditionals() {
       log_message(_F("Succesfully loaded optional PCB data from saved flash!"));
     }
     else {
-      log_message(_F("Failed to load optional PCB data from flash!"));
+      log_warn(LOG_MAIN, "Failed to load optional PCB data from flash!");
     }
     delay(1500); //need 1.5 sec delay before sending first datagram
     send_optionalpcb_query(); //send one datagram already at start
@@ -1315,7 +1530,9 @@ void timer_cb(int nr) {
           File startupFile = LittleFS.open("/heishamon", "w");
           startupFile.close(); 
           WiFi.disconnect(true);
-          timerqueue_insert(1, 0, -2);
+          if (timerqueue_insert(1, 0, -2) == -1) {
+            ESP.restart();
+          }
         } break;
       case -2: {
           ESP.restart();
@@ -1331,7 +1548,7 @@ void timer_cb(int nr) {
             LittleFS.remove("/rules.new");
             rules_deinitialize();
           } else if (ret == -1) {
-            log_message(_F("Failed to load new rules, reverting back to older rules!"));
+            log_error(LOG_RULES, "Failed to load new rules, reverting back to older rules!");
             rules_parse((char*)"/rules.txt");
           } else {
             if (LittleFS.begin()) {
@@ -1343,7 +1560,9 @@ void timer_cb(int nr) {
       case -5: {
           ntpReload(&heishamonSettings);
           logprintln_P(F("Resynced with NTP servers. Next sync after 24 hours."));
-          timerqueue_insert(86400, 0, -5);
+          if (timerqueue_insert(86400, 0, -5) == -1) {
+            log_error(LOG_MAIN, "Timer queue full, next ntp sync not scheduled");
+          }
         } break;
       case -6: {
           time_t now = time(NULL);
@@ -1354,13 +1573,17 @@ void timer_cb(int nr) {
              */
             ntpReload(&heishamonSettings);
             logprintln_P(F("Still trying to sync with ntp servers. Checking again in 5 minutes"));
-            timerqueue_insert(300, 0, -6);
+            if (timerqueue_insert(300, 0, -6) == -1) {
+              log_error(LOG_MAIN, "Timer queue full, ntp sync check not scheduled");
+            }
           } else {
             /*
              * Wait 300 sec less than a full day
              */
             logprintln_P(F("Successfully synced with ntp servers. Next sync after 24 hours."));
-            timerqueue_insert(86100, 0, -5);
+            if (timerqueue_insert(86100, 0, -5) == -1) {
+              log_error(LOG_MAIN, "Timer queue full, next ntp sync not scheduled");
+            }
           }
         } break;
     }
@@ -1373,12 +1596,17 @@ void setup() {
   //first get total memory before we do anything
   getFreeMemory();
   //set boottime
-  char *up = getUptime();
-  free(up);
+  stats_uptime();
 
   inSetup = true;
 
+  idle_setup();
+
   setupSerial();
+  logqueue_sink(logSerialSink, 8);
+  logqueue_sink(logMqttSink, 4);
+  logqueue_sink(logWebsocketSink, 4);
+  logqueue_sink(logFileSink, 8);
 
   loggingSerial.println();
   loggingSerial.println(F("--- HEISHAMON ---"));
@@ -1440,6 +1668,8 @@ void setup() {
 
   loggingSerial.println(F("Loading config from flash..."));
   loadSettings(&heishamonSettings);
+  logstore_setup(heishamonSettings.logFile ? heishamonSettings.logFileSize : 0);
+  history_setup(heishamonSettings.historyStore, heishamonSettings.historySpill);
 
   loggingSerial.println(F("Setup wifi..."));
   setupWifi(&heishamonSettings);
@@ -1451,7 +1681,7 @@ void setup() {
 #endif
 
   loggingSerial.println(F("Setup ModBusTCP Server.."));
-  modbusServer.setup(heishamonSettings.optionalPCB);
+  modbusServer.setup(heishamonSettings.optionalPCB, heishamonSettings.modbus_scanlist);
 
   loggingSerial.println(F("Setup MQTT..."));
   setupMqtt();
@@ -1535,11 +1765,11 @@ void send_initial_query() {
 }
 
 void send_panasonic_query() {
-  log_message(_F("Requesting new panasonic data"));
+  log_debug(LOG_SERIAL, "Requesting new panasonic data");
   send_command(panasonicQuery, PANASONICQUERYSIZE);
   // rest is for the new data block on new models
   if (extraDataBlockAvailable) {
-    log_message(_F("Requesting new panasonic extra data"));
+    log_debug(LOG_SERIAL, "Requesting new panasonic extra data");
     panasonicQuery[3] = 0x21; //setting 4th byte to 0x21 is a request for extra block
     send_command(panasonicQuery, PANASONICQUERYSIZE);
     panasonicQuery[3] = 0x10; //setting 4th back to 0x10 for normal data request next time
@@ -1553,22 +1783,22 @@ void send_panasonic_query() {
 }
 
 void send_optionalpcb_query() {
-  log_message(_F("Sending optional PCB data"));
+  log_debug(LOG_SERIAL, "Sending optional PCB data");
   send_command(optionalPCBQuery, OPTIONALPCBQUERYSIZE);
 }
 
 
 void readHeatpump() {
   if (sending && ((unsigned long)(millis() - sendCommandReadTime) > SERIALTIMEOUT)) {
-    log_message(_F("Previous read data attempt failed due to timeout!"));
+    log_warn(LOG_SERIAL, "Previous read data attempt failed due to timeout!");
     sprintf_P(log_msg, PSTR("Received %d bytes data"), data_length);
     log_message(log_msg);
     if (heishamonSettings.logHexdump) logHex(data, data_length);
     if (data_length == 0) {
-      timeoutread++;
-      totalreads++; //at at timeout we didn't receive anything but did expect it so need to increase this for the stats
+      heishamonStats.timeoutread++;
+      heishamonStats.totalreads++; //at at timeout we didn't receive anything but did expect it so need to increase this for the stats
     } else {
-      tooshortread++;
+      heishamonStats.tooshortread++;
     }
     data_length = 0; //clear any data in array
     sending = false; //receiving the answer from the send command timed out, so we are allowed to send a new command
@@ -1587,39 +1817,93 @@ void checkBootButton() {
   }
 }
 
+// ms left before a millis() based schedule of the main loop is due
+unsigned long timeLeft(unsigned long since, unsigned long interval) {
+  unsigned long elapsed = millis() - since;
+  return (elapsed > interval) ? 0 : interval - elapsed + 1;
+}
+
+// ms the main loop can sleep before there is work for it
+unsigned long loopIdleTime() {
+  if ((!sending) && (cmdnrel > 0)) return 0;
+  if ((heishamonSettings.listenonly || sending) && (heatpumpSerial.available() > 0)) return 0;
+#ifdef ESP32
+  if (heishamonSettings.proxy && (proxySerial.available() > 0)) return 0;
+#endif
+  if (mqtt_transport.available() > 0) return 0;
+  if (webserver_active()) return 0;
+  //messages the drains left for the next pass
+  if (mqttqueue_pending() || logqueue_pending()) return 0;
+
+  unsigned long wait = LOOPIDLETIME;
+  wait = min(wait, timeLeft(lastRunTime, 1000 * heishamonSettings.waitTime));
+  if (sending) wait = min(wait, timeLeft(sendCommandReadTime, SERIALTIMEOUT));
+  if ((!heishamonSettings.listenonly) && (heishamonSettings.optionalPCB)) wait = min(wait, timeLeft(lastOptionalPCBRunTime, OPTIONALPCBQUERYTIME));
+
+  struct timerqueue_t *node = timerqueue_peek();
+  if (node != NULL) {
+    uint64_t now = timerqueue_micros();
+    if (node->deadline <= now) return 0;
+    wait = min(wait, (unsigned long)((node->deadline - now + 999) / 1000));
+  }
+  return wait;
+}
+
 void loop() {
+  //time spent in each stage, see loopstats.h. Every stage
+  //boundary is timed, also when the stage had nothing to do
+  uint32_t loopStart = micros();
+  uint32_t stageStart = loopStart;
+
   //check boot button state
   checkBootButton();
 
   //webserver function
   webserver_loop();
+  stageStart = loopstats_stage(LOOP_STAGE_WEBSERVER, stageStart);
 
   // check wifi
   check_wifi();
+  stageStart = loopstats_stage(LOOP_STAGE_WIFI, stageStart);
   // Handle OTA first.s
   ArduinoOTA.handle();
+  stageStart = loopstats_stage(LOOP_STAGE_OTA, stageStart);
 
   modbusServer.loop();
+  stageStart = loopstats_stage(LOOP_STAGE_MODBUS, stageStart);
 
   mqtt_client.loop();
+  mqtt_reconnect();
+  mqttqueue_drain(MQTTQUEUERATE);
+  if (mqttState == MQTT_STATE_CONNECTED) history_replay(heishamonSettings.mqtt_topic_base, heishamonSettings.historyRate);
+  stageStart = loopstats_stage(LOOP_STAGE_MQTT, stageStart);
 
   if (heishamonSettings.opentherm) {
-    HeishaOTLoop(actData, mqtt_client, heishamonSettings.mqtt_topic_base);
+    HeishaOTLoop(actData, heishamonSettings.mqtt_topic_base);
   }
+  stageStart = loopstats_stage(LOOP_STAGE_OPENTHERM, stageStart);
 
   readHeatpump();
   #ifdef ESP32
   if (heishamonSettings.proxy) readProxy();
   #endif
+  stageStart = loopstats_stage(LOOP_STAGE_SERIAL, stageStart);
 
   if ((!sending) && (cmdnrel > 0)) { //check if there is a send command in the buffer
     log_message(_F("Sending command from buffer"));
     popCommandBuffer();
   }
+  stageStart = loopstats_stage(LOOP_STAGE_COMMANDS, stageStart);
 
-  if (heishamonSettings.use_1wire) dallasLoop(mqtt_client, log_message, heishamonSettings.mqtt_topic_base);
+  if (heishamonSettings.use_1wire) {
+    dallasLoop(log_message, heishamonSettings.mqtt_topic_base);
+  }
+  stageStart = loopstats_stage(LOOP_STAGE_1WIRE, stageStart);
 
-  if (heishamonSettings.use_s0) s0Loop(mqtt_client, log_message, heishamonSettings.mqtt_topic_base, heishamonSettings.s0Settings);
+  if (heishamonSettings.use_s0) {
+    s0Loop(log_message, heishamonSettings.mqtt_topic_base, heishamonSettings.s0Settings);
+  }
+  stageStart = loopstats_stage(LOOP_STAGE_S0, stageStart);
 
   if ((!sending) && (!heishamonSettings.listenonly) && (heishamonSettings.optionalPCB) && ((unsigned long)(millis() - lastOptionalPCBRunTime) > OPTIONALPCBQUERYTIME) ) {
     lastOptionalPCBRunTime = millis();
@@ -1629,158 +1913,42 @@ void loop() {
       if (saveOptionalPCB(optionalPCBQuery, OPTIONALPCBQUERYSIZE)) {
         log_message((char*)"Succesfully saved optional PCB data to flash!");
       } else {
-        log_message((char*)"Failed to save optional PCB data to flash!");
+        log_error(LOG_MAIN, "Failed to save optional PCB data to flash!");
       }
     }
   }
+  stageStart = loopstats_stage(LOOP_STAGE_OPTIONALPCB, stageStart);
 
   // run the data query only each WAITTIME
   if ((unsigned long)(millis() - lastRunTime) > (1000 * heishamonSettings.waitTime)) {
     lastRunTime = millis();
-    //check mqtt
-  #ifdef ESP8266
-    if ( WiFi.isConnected() && (!mqtt_client.connected()) )
-  #else
-    if ( (WiFi.isConnected() || ETH.connected()) && (!mqtt_client.connected()) )
-  #endif
-    {
-      if (mqttReconnects > 0 ) log_message(_F("Lost MQTT connection!"));
-      mqtt_reconnect();
-    }
 
 
     //log stats
-    if (totalreads > 0 ) readpercentage = (((float)goodreads / (float)totalreads) * 100);
-    String message;
-#ifdef ESP8266
-    message.reserve(384);
-#endif
-    message += F("Heishamon stats: Uptime: ");
-    char *up = getUptime();
-    message += up;
-    free(up);
-    message += F(" ## Free memory: ");
-    message += getFreeMemory();
-#if defined(ESP8266)
-    message += F("% ## Heap fragmentation: ");
-    message += ESP.getHeapFragmentation();
-    message += F("% ## Max free block: ");
-    message += ESP.getMaxFreeBlockSize();
-    message += F(" bytes ## Free heap: ");
-#elif defined(ESP32)
-    message += F("% ## Free PSRAM: ");
-    message += ESP.getFreePsram();
-    message += F(" bytes ## Free heap: ");
-#endif
-    message += ESP.getFreeHeap();
-    message += F(" bytes ## Wifi: ");
-    message += getWifiQuality();
-    message += F("% (RSSI: ");
-    message += WiFi.RSSI();
-#ifdef ESP32
-    message += F(") ## Ethernet: ");
-    if (ETH.phyAddr() != 0) {        
-      if (ETH.connected()) {
-        if (ETH.hasIP()) {
-          message += F("connected (");
-          message += ETH.localIP().toString();
-          message += F(")");
-        } else {
-          message += F("connected (no IP)");
-        }
-      } 
-      else {
-        message += F("not connected");
-      }
-    } else {
-      message += F("not installed");
+    stats_update();
+    {
+      char message[320];
+      stats_log(message, sizeof(message));
+      log_message(message);
     }
-    message += F(" ## Mqtt reconnects: ");
-#else
-    message += F(") ## Mqtt reconnects: ");
-#endif
-    message += mqttReconnects;
-    message += F(" ## Correct data: ");
-    message += readpercentage;
-    message += F("% Rules active: ");
-    message += nrrules;
-    log_message((char*)message.c_str());
-
-    String stats;
-#ifdef ESP8266
-    stats.reserve(384);
-#endif
-    stats += F("{\"uptime\":");
-    stats += String(millis());
-    stats += F(",\"voltage\":");
-#if defined(ESP8266)
-    stats += ESP.getVcc() / 1024.0;
-#else
-    stats += "3.3";
-#endif
-    stats += F(",\"free memory\":");
-    stats += getFreeMemory();
-    stats += F(",\"free heap\":");
-    stats += ESP.getFreeHeap();
-    stats += F(",\"wifi\":");
-    stats += getWifiQuality();
-    stats += F(",\"mqtt reconnects\":");
-    stats += mqttReconnects;
-    stats += F(",\"total reads\":");
-    stats += totalreads;
-    stats += F(",\"good reads\":");
-    stats += goodreads;
-    stats += F(",\"bad crc reads\":");
-    stats += badcrcread;
-    stats += F(",\"bad header reads\":");
-    stats += badheaderread;
-    stats += F(",\"too short reads\":");
-    stats += tooshortread;
-    stats += F(",\"too long reads\":");
-    stats += toolongread;
-    stats += F(",\"timeout reads\":");
-    stats += timeoutread;
-    stats += F(",\"version\":\"");
-    stats += heishamon_version;
-    stats += F("\",\"board\":\"");
-#ifdef ESP8266
-    stats += F("ESP8266");
-#else
-    stats += F("ESP32");
-#endif
-    stats += F("\",\"rules active\":");
-    stats += nrrules;
-    stats += F("}");
-    sprintf_P(mqtt_topic, PSTR("%s/stats"), heishamonSettings.mqtt_topic_base);
-    mqtt_client.publish(mqtt_topic, stats.c_str(), MQTT_RETAIN_VALUES);
 
-    //websocket stats
-#ifdef ESP32
-    String ethernetStat;
-    if (ETH.phyAddr() != 0) {        
-      if (ETH.connected()) {
-        if (ETH.hasIP()) {
-          ethernetStat = F("connected - IP: ");
-          ethernetStat += ETH.localIP().toString();
-        } else {
-          ethernetStat = F("connected - no IP");
+    sprintf_P(mqtt_topic, PSTR("%s/stats"), heishamonSettings.mqtt_topic_base);
+    mqttqueue_publish(mqtt_topic, stats_json(), MQTT_RETAIN_VALUES);
+
+    if (heishamonSettings.rules_stats_mqtt) {
+      //rule names contain # so publish per rule number
+      char rulestats[256];
+      for (uint8_t i = 0; i < nrrules; i++) {
+        int len = rules_stats_json(i, rulestats, sizeof(rulestats));
+        if (len > 0 && len < (int)sizeof(rulestats)) {
+          sprintf_P(mqtt_topic, PSTR("%s/rules/stats/%d"), heishamonSettings.mqtt_topic_base, i + 1);
+          mqttqueue_publish(mqtt_topic, rulestats, MQTT_RETAIN_VALUES);
         }
-      } 
-      else {
-        ethernetStat = F("not connected");
       }
-    } else {
-      ethernetStat = F("not installed");
     }
-    char *getuptime = getUptime();
-    sprintf_P(log_msg, PSTR("{\"data\": {\"stats\": {\"wifi\": %d, \"ethernet\": \"%s\", \"memory\": %d, \"correct\": %.0f,\"mqtt\": %d,\"uptime\": \"%s\"}}}"), getWifiQuality(), ethernetStat.c_str(), getFreeMemory(), readpercentage, mqttReconnects, getuptime);
-    free(getuptime);    
-#else
-    char *getuptime = getUptime();
-    sprintf_P(log_msg, PSTR("{\"data\": {\"stats\": {\"wifi\": %d, \"memory\": %d, \"correct\": %.0f,\"mqtt\": %d,\"uptime\": \"%s\"}}}"), getWifiQuality(), getFreeMemory(), readpercentage, mqttReconnects, getuptime);    
-    free(getuptime);    
-#endif
-    
+
+    //websocket stats
+    stats_websocket(log_msg, sizeof(log_msg));
     websocket_write_all(log_msg, strlen(log_msg));        
 
     //get new data
@@ -1788,7 +1956,7 @@ void loop() {
 
     //Make sure the LWT is set to Online, even if the broker have marked it dead.
     sprintf_P(mqtt_topic, PSTR("%s/%s"), heishamonSettings.mqtt_topic_base, mqtt_willtopic);
-    mqtt_client.publish(mqtt_topic, "Online");
+    mqttqueue_publish(mqtt_topic, "Online", 0);
 
 #ifdef ESP8266
     if (WiFi.isConnected()) {
@@ -1796,9 +1964,15 @@ void loop() {
     }
 #endif
   }
+  stageStart = loopstats_stage(LOOP_STAGE_QUERY, stageStart);
 
   timerqueue_update();
-  #ifdef ESP32
-  delay(1); // to keep watchdog happy
-  #endif
+  stageStart = loopstats_stage(LOOP_STAGE_TIMERS, stageStart);
+
+  drainLog();
+  loopstats_stage(LOOP_STAGE_LOG, stageStart);
+  loopstats_pass(loopStart);
+
+  //sleep until the next deadline, or until an interrupt or received data wakes us up
+  idle_wait(loopIdleTime());
 }
@@ -1,10 +1,13 @@
 #include "src/opentherm/opentherm.h"
 #include "HeishaOT.h"
+#include "HeishaOTData.h"
 #include "decode.h"
 #include "rules.h"
 #include "webfunctions.h"
 #include "src/common/stricmp.h"
 #include "src/common/progmem.h"
+#include "src/common/idle.h"
+#include "src/common/log.h"
 
 OpenTherm ot(inOTPin, outOTPin, true);
 
@@ -14,38 +17,6 @@ const char* mqtt_topic_opentherm_write PROGMEM = "opentherm/write";
 
 unsigned long otResponse = 0;
 
-struct heishaOTDataStruct_t heishaOTDataStruct[] = {
-  //WRITE values
-  { "chEnable", TBOOL, { .b = false }, 3 }, //is central heating enabled by thermostat
-  { "dhwEnable", TBOOL, { .b = false }, 3 }, //is dhw heating enabled by thermostat
-  { "coolingEnable", TBOOL, { .b = false }, 3 }, //is cooling mode enabled by thermostat
-  { "roomTemp", TFLOAT, { .f = -99 }, 3 }, //what is measured room temp by thermostat
-  { "roomTempSet", TFLOAT, { .f = -99 }, 3 }, //what is request room temp setpoint by thermostat
-  { "chSetpoint", TFLOAT, { .f = -99 }, 3 }, //what is calculated Ta setpoint by thermostat
-  { "maxRelativeModulation", TFLOAT, { .f = -99 }, 3 }, //what is requested max relative modulation (0-100%)
-  { "coolingControl", TFLOAT, { .f = -99 }, 3 }, //what is requested cooling amount (0-100%)
-  //READ AND WRITE values
-  { "dhwSetpoint", TFLOAT, { .f = 65 }, 2 }, //what is DHW setpoint by thermostat
-  { "maxTSet", TFLOAT, { .f = 65 }, 2 }, //max ch setpoint
-  //READ values
-  { "chPressure", TFLOAT, { .f = -99 }, 1 }, //provides measured water pressure of central heating
-  { "relativeModulation", TFLOAT, { .f = -99 }, 1 }, //provides the current level of relative modulation (0-100%)
-  { "outsideTemp", TFLOAT, { .f = -99 }, 1 }, //provides measured outside temp to thermostat
-  { "inletTemp", TFLOAT, { .f = -99 }, 1 }, //provides measured Treturn temp to thermostat
-  { "outletTemp", TFLOAT, { .f = -99 }, 1 }, //provides measured Tout (boiler) temp to thermostat
-  { "dhwTemp", TFLOAT, { .f = -99 }, 1 }, //provides measured dhw water temp to to thermostat
-  { "flameState", TBOOL, { .b = false }, 1 }, //provides current flame state to thermostat
-  { "chState", TBOOL, { .b = false }, 1 }, //provides if heatpump is in centrale heating state
-  { "dhwState", TBOOL, { .b = false }, 1 }, //provides if heatpump is in dhw heating state
-  { "coolingState", TBOOL, { .b = false }, 1 }, //provides if heatpump is in cooling state
-  { "roomSetOverride", TFLOAT, { .f = 0 }, 1 }, //provides a room setpoint override ID9 (not implemented completly in heishamon)
-  { "dhwSetUppBound", TINT8, { .s8 = 75 }, 1 }, //provides DHW upper boundary, default to 75 degrees celcius
-  { "dhwSetLowBound", TINT8, { .s8 = 40 }, 1 }, //provides DHW lower boundary, default to 40 degrees celcius
-  { "chSetUppBound", TINT8, { .s8 = 65 }, 1 }, //provides CH upper boundary, default to 65 degrees celcius
-  { "chSetLowBound", TINT8, { .s8 = 20 }, 1 }, //provides CH lower boundary, default to 20 degrees celcius    
-  { NULL, 0, 0, 0 }
-};
-
 void mqttPublish(char* topic, char* subtopic, char* value, bool retain);
 void mqttPublish(char* topic, char* subtopic, char* value);
 
@@ -62,7 +33,7 @@ struct heishaOTDataStruct_t *getOTStructMember(const char *name) {
 
 void processOTRequest(unsigned long request, OpenThermResponseStatus status) {
  if (status != OpenThermResponseStatus::SUCCESS) {
-    log_message(_F("OpenTherm: Request invalid!"));
+    log_warn(LOG_OT, "OpenTherm: Request invalid!");
  } else {
   char log_msg[512];
   {
@@ -101,11 +72,10 @@ void processOTRequest(unsigned long request, OpenThermResponseStatus status) {
           websocket_write_all(log_msg, strlen(log_msg));
         }
 
-        sprintf_P(log_msg, PSTR(
-                "OpenTherm: Received status check: %lu, CH: %u, DHW: %u, Cooling, %u, OTC: %u, CH2: %u, SWMode: %u, DHWBlock: %u"),
+        log_debug(LOG_OT,
+                "OpenTherm: Received status check: %lu, CH: %u, DHW: %u, Cooling, %u, OTC: %u, CH2: %u, SWMode: %u, DHWBlock: %u",
                 data >> 8, CHEnable, DHWEnable, Cooling, OTCEnable, CH2Enable, SWMode, DHWBlock
                );
-        log_message(log_msg);
         //clean slave bits from 2-byte data
         data = ((data >> 8) << 8);
 
@@ -116,11 +86,10 @@ void processOTRequest(unsigned long request, OpenThermResponseStatus status) {
         unsigned int CoolingStatus = (unsigned int)getOTStructMember(_F("coolingState"))->value.b;;
         unsigned int CH2 = false;
         unsigned int DiagInd = false;
-        sprintf_P(log_msg,
-                PSTR("OpenTherm: Send status: CH: %d, Flame:%d, DHW: %d"),
+        log_debug(LOG_OT,
+                "OpenTherm: Send status: CH: %d, Flame:%d, DHW: %d",
                 CHMode, FlameStatus, DHWMode
                );
-        log_message(log_msg);
         unsigned int responsedata = FaultInd | (CHMode << 1) | (DHWMode << 2) | (FlameStatus << 3) | (CoolingStatus << 4) | (CH2 << 5) | (DiagInd << 6);
         otResponse = ot.buildResponse(OpenThermMessageType::READ_ACK, OpenThermMessageID::Status, (data |= responsedata));
         rules_event_cb(_F("?"), _F("chEnable"));
@@ -130,8 +99,7 @@ void processOTRequest(unsigned long request, OpenThermResponseStatus status) {
     case OpenThermMessageID::TSet: { //mandatory
         char str[200];
         sprintf_P((char *)&str, PSTR("%.*f"), 4, ot.getFloat(request));
-        sprintf_P(log_msg, PSTR("OpenTherm: control setpoint TSet: %s"), str);
-        log_message(log_msg);
+        log_debug(LOG_OT, "OpenTherm: control setpoint TSet: %s", str);
         if (getOTStructMember(_F("chSetpoint"))->value.f != ot.getFloat(request)) { //only publish if changed
           getOTStructMember(_F("chSetpoint"))->value.f = ot.getFloat(request);
           mqttPublish((char*)mqtt_topic_opentherm_write, _F("chSetpoint"), str);
@@ -145,16 +113,15 @@ void processOTRequest(unsigned long request, OpenThermResponseStatus status) {
       unsigned long data = ot.getUInt(request);
       unsigned int SmartPower = (data >> 8) & (1 << 0);
       data &= ~(1 << 8); //disable smartpower for now, we don't support it yet
-      sprintf_P(log_msg,
-			  PSTR("OpenTherm: Received master config: %u, Smartpower: %u"),
+      log_debug(LOG_OT,
+			  "OpenTherm: Received master config: %u, Smartpower: %u",
               data >> 8, SmartPower
              );
-      log_message(log_msg);
       otResponse = ot.buildResponse(OpenThermMessageType::WRITE_ACK, OpenThermMessageID::MConfigMMemberIDcode, data);
       //ot.setSmartPower((bool)SmartPower); not working correctly yet
       } break;
     case OpenThermMessageID::SConfigSMemberIDcode: { //mandatory
-        log_message(_F("OpenTherm: Received read slave config"));
+        log_debug(LOG_OT, "OpenTherm: Received read slave config");
         unsigned int DHW = true;
         unsigned int ModulationOrOnOff = false; //false means modulation according to specification v2.2
         unsigned int Cool = true;
@@ -170,8 +137,7 @@ void processOTRequest(unsigned long request, OpenThermResponseStatus status) {
     case OpenThermMessageID::MaxRelModLevelSetting: { //mandatory
         char str[200];
         sprintf_P((char *)&str, PSTR("%.*f"), 4, ot.getFloat(request));
-        sprintf_P(log_msg, PSTR("OpenTherm: Max relative modulation  requested: %s"), str);
-        log_message(log_msg);
+        log_debug(LOG_OT, "OpenTherm: Max relative modulation  requested: %s", str);
         if (getOTStructMember(_F("maxRelativeModulation"))->value.f != ot.getFloat(request)) {
           getOTStructMember(_F("maxRelativeModulation"))->value.f = ot.getFloat(request);
           if ( getOTStructMember(_F("relativeModulation"))->value.f > getOTStructMember(_F("maxRelativeModulation"))->value.f) { //need to change the relative modulation on the fly to comply with max requested
@@ -184,7 +150,7 @@ void processOTRequest(unsigned long request, OpenThermResponseStatus status) {
         otResponse = ot.buildResponse(OpenThermMessageType::WRITE_ACK, OpenThermMessageID::MaxRelModLevelSetting, request & 0xffff); //ACK for mandatory fields
       } break;
     case OpenThermMessageID::RelModLevel: { //mandatory
-        log_message(_F("OpenTherm: Received read relative modulation level"));
+        log_debug(LOG_OT, "OpenTherm: Received read relative modulation level");
         if ((getOTStructMember(_F("relativeModulation"))->value.f >= 0) && (getOTStructMember(_F("relativeModulation"))->value.f <= 100) ) {
           unsigned long data = ot.temperatureToData(getOTStructMember(_F("relativeModulation"))->value.f);
           otResponse = ot.buildResponse(OpenThermMessageType::READ_ACK, OpenThermMessageID::RelModLevel, data);
@@ -194,7 +160,7 @@ void processOTRequest(unsigned long request, OpenThermResponseStatus status) {
         }        
       } break;
     case OpenThermMessageID::Tboiler: { //mandatory
-        log_message(_F("OpenTherm: Received read boiler flow temp (outlet)"));
+        log_debug(LOG_OT, "OpenTherm: Received read boiler flow temp (outlet)");
         if (getOTStructMember(_F("outletTemp"))->value.f > -99) {
           unsigned long data = ot.temperatureToData(getOTStructMember(_F("outletTemp"))->value.f);
           otResponse = ot.buildResponse(OpenThermMessageType::READ_ACK, OpenThermMessageID::Tboiler, data);
@@ -205,7 +171,7 @@ void processOTRequest(unsigned long request, OpenThermResponseStatus status) {
       } break;
     // now adding some more useful, not mandatory, types
     case OpenThermMessageID::RBPflags: { //Pre-Defined Remote Boiler Parameters
-        log_message(_F("OpenTherm: Received Remote Boiler parameters request"));
+        log_debug(LOG_OT, "OpenTherm: Received Remote Boiler parameters request");
         //fixed settings for now
         const unsigned int DHWsetTransfer = true;
         const unsigned int maxCHsetTransfer = true;
@@ -217,8 +183,7 @@ void processOTRequest(unsigned long request, OpenThermResponseStatus status) {
     case OpenThermMessageID::CoolingControl: { //mandatory
         char str[200];
         sprintf_P((char *)&str, PSTR("%.*f"), 4, ot.getFloat(request));
-        sprintf_P(log_msg, PSTR("OpenTherm: cooling control amount requested: %s"), str);
-        log_message(log_msg);
+        log_debug(LOG_OT, "OpenTherm: cooling control amount requested: %s", str);
         if (getOTStructMember(_F("coolingControl"))->value.f != ot.getFloat(request)) {
           getOTStructMember(_F("coolingControl"))->value.f = ot.getFloat(request);  
           mqttPublish((char*)mqtt_topic_opentherm_write, _F("coolingControl"), str);
@@ -229,14 +194,14 @@ void processOTRequest(unsigned long request, OpenThermResponseStatus status) {
         rules_event_cb(_F("?"), _F("coolingControl"));
       } break;
     case OpenThermMessageID::TdhwSetUBTdhwSetLB : { //DHW boundaries
-        log_message(_F("OpenTherm: Received DHW set boundaries request"));
+        log_debug(LOG_OT, "OpenTherm: Received DHW set boundaries request");
         uint16_t result = 0;
         result |= ((getOTStructMember(_F("dhwSetUppBound"))->value.s8 & 0xFF) << 8); 
         result |= (getOTStructMember(_F("dhwSetLowBound"))->value.s8 & 0xFF);
         otResponse = ot.buildResponse(OpenThermMessageType::READ_ACK, OpenThermMessageID::TdhwSetUBTdhwSetLB, result);
       } break;
     case OpenThermMessageID::MaxTSetUBMaxTSetLB  : { //CHset boundaries
-        log_message(_F("OpenTherm: Received CH set boundaries request"));
+        log_debug(LOG_OT, "OpenTherm: Received CH set boundaries request");
         uint16_t result = 0;
         result |= ((getOTStructMember(_F("chSetUppBound"))->value.s8 & 0xFF) << 8); 
         result |= (getOTStructMember(_F("chSetLowBound"))->value.s8 & 0xFF);     
@@ -245,8 +210,7 @@ void processOTRequest(unsigned long request, OpenThermResponseStatus status) {
     case OpenThermMessageID::Tr: {
         char str[200];
         sprintf_P((char *)&str, PSTR("%.*f"), 4, ot.getFloat(request));
-        sprintf_P(log_msg, PSTR("OpenTherm: Room temp: %s"), str);
-        log_message(log_msg);
+        log_debug(LOG_OT, "OpenTherm: Room temp: %s", str);
         if (getOTStructMember(_F("roomTemp"))->value.f != ot.getFloat(request)) {
           mqttPublish((char*)mqtt_topic_opentherm_write, _F("roomTemp"), str);
           getOTStructMember(_F("roomTemp"))->value.f = ot.getFloat(request);
@@ -259,8 +223,7 @@ void processOTRequest(unsigned long request, OpenThermResponseStatus status) {
     case OpenThermMessageID::TrSet: {
         char str[200];
         sprintf_P((char *)&str, PSTR("%.*f"), 4, ot.getFloat(request));
-        sprintf_P(log_msg, PSTR("OpenTherm: Room setpoint: %s"), str);
-        log_message(log_msg);
+        log_debug(LOG_OT, "OpenTherm: Room setpoint: %s", str);
         if (getOTStructMember(_F("roomTempSet"))->value.f != ot.getFloat(request)) {
           getOTStructMember(_F("roomTempSet"))->value.f = ot.getFloat(request);
           mqttPublish((char*)mqtt_topic_opentherm_write, _F("roomTempSet"), str);
@@ -274,8 +237,7 @@ void processOTRequest(unsigned long request, OpenThermResponseStatus status) {
         if (ot.getMessageType(request) == OpenThermMessageType::WRITE_DATA) {
           char str[200];
           sprintf_P((char *)&str, PSTR("%.*f"), 4, ot.getFloat(request));
-          sprintf_P(log_msg, PSTR("OpenTherm: Write request DHW setpoint: %s"), str);
-          log_message(log_msg);
+          log_debug(LOG_OT, "OpenTherm: Write request DHW setpoint: %s", str);
           if (getOTStructMember(_F("dhwSetpoint"))->value.f != ot.getFloat(request)) {
             getOTStructMember(_F("dhwSetpoint"))->value.f = ot.getFloat(request);
             mqttPublish((char*)mqtt_topic_opentherm_write, _F("dhwSetpoint"), str);    
@@ -284,8 +246,7 @@ void processOTRequest(unsigned long request, OpenThermResponseStatus status) {
           }
           otResponse = ot.buildResponse(OpenThermMessageType::WRITE_ACK, OpenThermMessageID::TdhwSet, ot.temperatureToData(getOTStructMember(_F("dhwSetpoint"))->value.f));
         } else { //READ_DATA
-          sprintf_P(log_msg, PSTR("OpenTherm: Read request DHW setpoint"));
-          log_message(log_msg);
+          log_debug(LOG_OT, "OpenTherm: Read request DHW setpoint");
           otResponse = ot.buildResponse(OpenThermMessageType::READ_ACK, OpenThermMessageID::TdhwSet, ot.temperatureToData(getOTStructMember(_F("dhwSetpoint"))->value.f));
           rules_event_cb(_F("?"), _F("dhwsetpoint"));
         }
@@ -294,8 +255,7 @@ void processOTRequest(unsigned long request, OpenThermResponseStatus status) {
         if (ot.getMessageType(request) == OpenThermMessageType::WRITE_DATA) {
           char str[200];
           sprintf_P((char *)&str, PSTR("%.*f"), 4, ot.getFloat(request));
-          sprintf_P(log_msg, PSTR("OpenTherm: Write request Max Ta-set setpoint: %s"), str);
-          log_message(log_msg);
+          log_debug(LOG_OT, "OpenTherm: Write request Max Ta-set setpoint: %s", str);
           if (getOTStructMember(_F("maxTSet"))->value.f != ot.getFloat(request)) {
             getOTStructMember(_F("maxTSet"))->value.f = ot.getFloat(request);
             mqttPublish((char*)mqtt_topic_opentherm_write, _F("maxTSet"), str);
@@ -304,14 +264,13 @@ void processOTRequest(unsigned long request, OpenThermResponseStatus status) {
           }
           otResponse = ot.buildResponse(OpenThermMessageType::WRITE_ACK, OpenThermMessageID::MaxTSet, ot.temperatureToData(getOTStructMember(_F("maxTSet"))->value.f));
         } else { //READ_DATA
-          sprintf_P(log_msg, PSTR("OpenTherm: Read request Max Ta-set setpoint"));
-          log_message(log_msg);
+          log_debug(LOG_OT, "OpenTherm: Read request Max Ta-set setpoint");
           otResponse = ot.buildResponse(OpenThermMessageType::READ_ACK, OpenThermMessageID::MaxTSet, ot.temperatureToData(getOTStructMember(_F("maxTSet"))->value.f));
           rules_event_cb(_F("?"), _F("maxtset"));
         }
       } break;
     case OpenThermMessageID::Tret: {
-        log_message(_F("OpenTherm: Received read boiler flow temp (inlet)"));
+        log_debug(LOG_OT, "OpenTherm: Received read boiler flow temp (inlet)");
         if (getOTStructMember(_F("inletTemp"))->value.f > -99) {
           unsigned long data = ot.temperatureToData(getOTStructMember(_F("inletTemp"))->value.f);
           otResponse = ot.buildResponse(OpenThermMessageType::READ_ACK, OpenThermMessageID::Tret, data);
@@ -320,7 +279,7 @@ void processOTRequest(unsigned long request, OpenThermResponseStatus status) {
         }
       } break;
     case OpenThermMessageID::Tdhw: {
-        log_message(_F("OpenTherm: Received read DHW temp"));
+        log_debug(LOG_OT, "OpenTherm: Received read DHW temp");
         if (getOTStructMember(_F("dhwTemp"))->value.f > -99) {
           unsigned long data = ot.temperatureToData(getOTStructMember(_F("dhwTemp"))->value.f);
           otResponse = ot.buildResponse(OpenThermMessageType::READ_ACK, OpenThermMessageID::Tdhw, data);
@@ -329,7 +288,7 @@ void processOTRequest(unsigned long request, OpenThermResponseStatus status) {
         }
       } break;
     case OpenThermMessageID::CHPressure: {
-        log_message(_F("OpenTherm: Received read water pressure"));
+        log_debug(LOG_OT, "OpenTherm: Received read water pressure");
         if (getOTStructMember(_F("outsideTemp"))->value.f > -99) {
           unsigned long data = ot.temperatureToData(getOTStructMember(_F("chPressure"))->value.f);
           otResponse = ot.buildResponse(OpenThermMessageType::READ_ACK, OpenThermMessageID::CHPressure, data);
@@ -339,7 +298,7 @@ void processOTRequest(unsigned long request, OpenThermResponseStatus status) {
         }
       } break;      
     case OpenThermMessageID::Toutside: {
-        log_message(_F("OpenTherm: Received read outside temp"));
+        log_debug(LOG_OT, "OpenTherm: Received read outside temp");
         if (getOTStructMember(_F("outsideTemp"))->value.f > -99) {
           unsigned long data = ot.temperatureToData(getOTStructMember(_F("outsideTemp"))->value.f);
           otResponse = ot.buildResponse(OpenThermMessageType::READ_ACK, OpenThermMessageID::Toutside, data);
@@ -349,7 +308,7 @@ void processOTRequest(unsigned long request, OpenThermResponseStatus status) {
         }
       } break;
     case OpenThermMessageID::TrOverride: {
-        log_message(_F("OpenTherm: Received read room set override temp"));
+        log_debug(LOG_OT, "OpenTherm: Received read room set override temp");
         if (getOTStructMember(_F("roomSetOverride"))->value.f > -99) {
           unsigned long data = ot.temperatureToData(getOTStructMember(_F("roomSetOverride"))->value.f);
           otResponse = ot.buildResponse(OpenThermMessageType::READ_ACK, OpenThermMessageID::TrOverride, data);
@@ -362,7 +321,7 @@ void processOTRequest(unsigned long request, OpenThermResponseStatus status) {
     //still need to confirm this works correctly. Haven't seen a thermostat which does ask for the time and use it
     case OpenThermMessageID::DayTime: {
         if (ot.getMessageType(request) == OpenThermMessageType::READ_DATA) {
-          log_message(_F("OpenTherm: Received time request"));
+          log_debug(LOG_OT, "OpenTherm: Received time request");
           time_t rawtime;
           rawtime = time(NULL);
           struct tm *timeinfo = localtime(&rawtime);
@@ -372,13 +331,13 @@ void processOTRequest(unsigned long request, OpenThermResponseStatus status) {
           result |= (timeinfo->tm_min & 0xFF);          // Set minutes in the rightmost 8 bits
           otResponse = ot.buildResponse(OpenThermMessageType::READ_ACK, OpenThermMessageID::DayTime, result);
         } else {
-          log_message(_F("OpenTherm: Ignore time information set"));
+          log_debug(LOG_OT, "OpenTherm: Ignore time information set");
           otResponse = ot.buildResponse(OpenThermMessageType::WRITE_ACK, ot.getDataID(request), 0);
         }
       } break;    
     case OpenThermMessageID::Date: {
         if (ot.getMessageType(request) == OpenThermMessageType::READ_DATA) {
-          log_message(_F("OpenTherm: Received date request"));
+          log_debug(LOG_OT, "OpenTherm: Received date request");
           time_t rawtime;
           rawtime = time(NULL);
           struct tm *timeinfo = localtime(&rawtime);
@@ -387,26 +346,25 @@ void processOTRequest(unsigned long request, OpenThermResponseStatus status) {
           result |= (timeinfo->tm_mday & 0xFF);        // Set day of month in the rightmost 8 bits
           otResponse = ot.buildResponse(OpenThermMessageType::READ_ACK, OpenThermMessageID::Date, result);
         } else {
-          log_message(_F("OpenTherm: Ignore date information set"));
+          log_debug(LOG_OT, "OpenTherm: Ignore date information set");
           otResponse = ot.buildResponse(OpenThermMessageType::WRITE_ACK, ot.getDataID(request), 0);
         }
       } break;
     case OpenThermMessageID::Year: {
         if (ot.getMessageType(request) == OpenThermMessageType::READ_DATA) {
-          log_message(_F("OpenTherm: Received year request"));
+          log_debug(LOG_OT, "OpenTherm: Received year request");
           time_t rawtime;
           rawtime = time(NULL);
           struct tm *timeinfo = localtime(&rawtime);
           uint16_t result = timeinfo->tm_year + 1900; //plus 1900 makes it the real year
           otResponse = ot.buildResponse(OpenThermMessageType::READ_ACK, OpenThermMessageID::Year, result);
         } else {
-          log_message(_F("OpenTherm: Ignore year information set"));
+          log_debug(LOG_OT, "OpenTherm: Ignore year information set");
           otResponse = ot.buildResponse(OpenThermMessageType::WRITE_ACK, ot.getDataID(request), 0);
         }
       } break;    
     default: {
-        sprintf_P(log_msg, PSTR("OpenTherm: Unknown data ID: %u (%#010lx)"), (unsigned int)ot.getDataID(request), request);
-        log_message(log_msg);
+        log_debug(LOG_OT, "OpenTherm: Unknown data ID: %u (%#010lx)", (unsigned int)ot.getDataID(request), request);
         otResponse = ot.buildResponse(OpenThermMessageType::UNKNOWN_DATA_ID, ot.getDataID(request), 0);
       } break;
   }
@@ -415,13 +373,14 @@ void processOTRequest(unsigned long request, OpenThermResponseStatus status) {
 
 void IRAM_ATTR handleOTInterrupt() {
   ot.handleInterrupt();
+  idle_wakeup();
 }
 
 void HeishaOTSetup() {
   ot.begin(handleOTInterrupt, processOTRequest);
 }
 
-void HeishaOTLoop(char * actData, PubSubClient &mqtt_client, char* mqtt_topic_base) {
+void HeishaOTLoop(char * actData, char* mqtt_topic_base) {
   // opentherm loop
   if (otResponse && ot.isReady()) {
     ot.sendResponse(otResponse);
@@ -431,106 +390,48 @@ void HeishaOTLoop(char * actData, PubSubClient &mqtt_client, char* mqtt_topic_ba
 }
 
 void mqttOTCallback(char* topic, char* value) {
-  if (strcmp_P(topic,PSTR("chPressure")) == 0) {
-    log_message(_F("OpenTherm: MQTT message received 'chPressure'"));
-    getOTStructMember(_F("chPressure"))->value.f = String(value).toFloat();
-    rules_event_cb(_F("?"), topic);
-  }
-  else if (strcmp_P(topic,PSTR("outsideTemp")) == 0) {
-    log_message(_F("OpenTherm: MQTT message received 'outsideTemp'"));
-    getOTStructMember(_F("outsideTemp"))->value.f = String(value).toFloat();
-    rules_event_cb(_F("?"), topic);
-  }
-  else if (strcmp_P(topic, PSTR("inletTemp")) == 0) {
-    log_message(_F("OpenTherm: MQTT message received 'inletTemp'"));
-    getOTStructMember(_F("inletTemp"))->value.f = String(value).toFloat();
-    rules_event_cb(_F("?"), topic);
-  }
-  else if (strcmp_P(topic, PSTR("outletTemp")) == 0) {
-    log_message(_F("OpenTherm: MQTT message received 'outletTemp'"));
-    getOTStructMember(_F("outletTemp"))->value.f = String(value).toFloat();
-    rules_event_cb(_F("?"), topic);
-  }
-  else if (strcmp_P(topic, PSTR("dhwTemp")) == 0) {
-    log_message(_F("OpenTherm: MQTT message received 'dhwTemp'"));
-    getOTStructMember(_F("dhwTemp"))->value.f = String(value).toFloat();
-    rules_event_cb(_F("?"), topic);
+  struct heishaOTDataStruct_t *member = getOTStructMember(topic);
+
+  //only values provided to the thermostat can be set
+  if ((member == NULL) || (member->rw == 3)) {
+    return;
   }
-  else if (strcmp_P(topic, PSTR("dhwSetpoint")) == 0) {
-    log_message(_F("OpenTherm: MQTT message received 'dhwSetpoint'"));
-    getOTStructMember(_F("dhwSetpoint"))->value.f = String(value).toFloat();
-    rules_event_cb(_F("?"), topic);
+  log_debug(LOG_OT, "OpenTherm: MQTT message received '%s'", member->name);
+  switch (member->type) {
+    case TBOOL: {
+      member->value.b = ((stricmp((char*)"true", value) == 0) || (stricmp((char*)"on", value) == 0) || (String(value).toInt() == 1 ));
+    } break;
+    case TFLOAT: {
+      member->value.f = String(value).toFloat();
+    } break;
+    case TINT8: {
+      member->value.s8 = String(value).toInt();
+    } break;
   }
-  else if (strcmp_P(topic, PSTR("relativeModulation")) == 0) {
-    log_message(_F("OpenTherm: MQTT message received 'relativeModulation'"));
-    getOTStructMember(_F("relativeModulation"))->value.f = String(value).toFloat();
-    if ((getOTStructMember(_F("relativeModulation"))->value.f > getOTStructMember(_F("maxRelativeModulation"))->value.f) && ( getOTStructMember(_F("maxRelativeModulation"))->value.f > -99)) { //need to change the relative modulation on the fly to comply with max requested
-        getOTStructMember(_F("relativeModulation"))->value.f = getOTStructMember(_F("maxRelativeModulation"))->value.f;
+
+  if (strcmp_P(topic, PSTR("relativeModulation")) == 0) {
+    float limit = getOTStructMember(_F("maxRelativeModulation"))->value.f;
+    if ((member->value.f > limit) && (limit > -99)) { //need to change the relative modulation on the fly to comply with max requested
+      member->value.f = limit;
     }
-    rules_event_cb(_F("?"), topic);
-  }  
-  else if (strcmp_P(topic, PSTR("maxTSet")) == 0) {
-    log_message(_F("OpenTherm: MQTT message received 'maxTSet'"));
-    getOTStructMember(_F("maxTSet"))->value.f = String(value).toFloat();
-    if ((getOTStructMember(_F("maxTSet"))->value.f > getOTStructMember(_F("chSetUppBound"))->value.f)) { 
-        getOTStructMember(_F("maxTSet"))->value.f = getOTStructMember(_F("chSetUppBound"))->value.f;
-    } else if ((getOTStructMember(_F("maxTSet"))->value.f < getOTStructMember(_F("chSetLowBound"))->value.f)) { 
-        getOTStructMember(_F("maxTSet"))->value.f = getOTStructMember(_F("chSetLowBound"))->value.f;
-    }           
-    rules_event_cb(_F("?"), topic);
-  }
-  else if (strcmp_P(topic, PSTR("flameState")) == 0) {
-    log_message(_F("OpenTherm: MQTT message received 'flameState'"));
-    getOTStructMember(_F("flameState"))->value.b = ((stricmp((char*)"true", value) == 0) || (stricmp((char*)"on", value) == 0) || (String(value).toInt() == 1 ));
-    rules_event_cb(_F("?"), topic);
-  }
-  else if (strcmp_P(topic, PSTR("chState")) == 0) {
-    log_message(_F("OpenTherm: MQTT message received 'chState'"));
-    getOTStructMember(_F("chState"))->value.b = ((stricmp((char*)"true", value) == 0) || (stricmp((char*)"on", value) == 0) || (String(value).toInt() == 1 ));
-    rules_event_cb(_F("?"), topic);
-  }
-  else if (strcmp_P(topic, PSTR("dhwState")) == 0) {
-    log_message(_F("OpenTherm: MQTT message received 'dhwState'"));
-    getOTStructMember(_F("dhwState"))->value.b = ((stricmp((char*)"true", value) == 0) || (stricmp((char*)"on", value) == 0) || (String(value).toInt() == 1 ));
-    rules_event_cb(_F("?"), topic);
-  }
-  else if (strcmp_P(topic, PSTR("coolingState")) == 0) {
-    log_message(_F("OpenTherm: MQTT message received 'coolingState'"));
-    getOTStructMember(_F("coolingState"))->value.b = ((stricmp((char*)"true", value) == 0) || (stricmp((char*)"on", value) == 0) || (String(value).toInt() == 1 ));
-    rules_event_cb(_F("?"), topic);
-  }  
-  else if (strcmp_P(topic, PSTR("dhwSetUppBound")) == 0) {
-    log_message(_F("OpenTherm: MQTT message received 'dhwSetUppBound'"));
-    getOTStructMember(_F("dhwSetUppBound"))->value.s8 = String(value).toInt();
-    if ((getOTStructMember(_F("dhwSetUppBound"))->value.f < getOTStructMember(_F("dhwSetLowBound"))->value.f)) { 
-        getOTStructMember(_F("dhwSetUppBound"))->value.f = getOTStructMember(_F("dhwSetLowBound"))->value.f;
-    }        
-    rules_event_cb(_F("?"), topic);
-  }
-  else if (strcmp_P(topic, PSTR("dhwSetLowBound")) == 0) {
-    log_message(_F("OpenTherm: MQTT message received 'dhwSetLowBound'"));
-    getOTStructMember(_F("dhwSetLowBound"))->value.s8 = String(value).toInt();
-    if ((getOTStructMember(_F("dhwSetLowBound"))->value.f > getOTStructMember(_F("dhwSetUppBound"))->value.f)) { 
-        getOTStructMember(_F("dhwSetLowBound"))->value.f = getOTStructMember(_F("dhwSetUppBound"))->value.f;
-    }       
-    rules_event_cb(_F("?"), topic);
-  }    
-  else if (strcmp_P(topic, PSTR("chSetUppBound")) == 0) {
-    log_message(_F("OpenTherm: MQTT message received 'chSetUppBound'"));
-    getOTStructMember(_F("chSetUppBound"))->value.s8 = String(value).toInt();
-    if ((getOTStructMember(_F("chSetUppBound"))->value.f < getOTStructMember(_F("chSetLowBound"))->value.f)) { 
-        getOTStructMember(_F("chSetUppBound"))->value.f = getOTStructMember(_F("chSetLowBound"))->value.f;
-    }    
-    rules_event_cb(_F("?"), topic);
+  } else if (strcmp_P(topic, PSTR("maxTSet")) == 0) {
+    int8_t upp = getOTStructMember(_F("chSetUppBound"))->value.s8;
+    int8_t low = getOTStructMember(_F("chSetLowBound"))->value.s8;
+    if (member->value.f > upp) {
+      member->value.f = upp;
+    } else if (member->value.f < low) {
+      member->value.f = low;
+    }
+  } else if (strcmp_P(topic, PSTR("dhwSetUppBound")) == 0) {
+    member->value.s8 = max(member->value.s8, getOTStructMember(_F("dhwSetLowBound"))->value.s8);
+  } else if (strcmp_P(topic, PSTR("dhwSetLowBound")) == 0) {
+    member->value.s8 = min(member->value.s8, getOTStructMember(_F("dhwSetUppBound"))->value.s8);
+  } else if (strcmp_P(topic, PSTR("chSetUppBound")) == 0) {
+    member->value.s8 = max(member->value.s8, getOTStructMember(_F("chSetLowBound"))->value.s8);
+  } else if (strcmp_P(topic, PSTR("chSetLowBound")) == 0) {
+    member->value.s8 = min(member->value.s8, getOTStructMember(_F("chSetUppBound"))->value.s8);
   }
-  else if (strcmp_P(topic, PSTR("chSetLowBound")) == 0) {
-    log_message(_F("OpenTherm: MQTT message received 'chSetLowBound'"));
-    getOTStructMember(_F("chSetLowBound"))->value.s8 = String(value).toInt();
-    if ((getOTStructMember(_F("chSetLowBound"))->value.f > getOTStructMember(_F("chSetUppBound"))->value.f)) { 
-        getOTStructMember(_F("chSetLowBound"))->value.f = getOTStructMember(_F("chSetUppBound"))->value.f;
-    }        
-    rules_event_cb(_F("?"), topic);
-  }      
+  rules_event_cb(_F("?"), topic);
 }
 
 void openthermJsonOutput(struct webserver_t *client) {
@@ -1,7 +1,7 @@
 #ifndef _HEISHA_OT_H_
 #define _HEISHA_OT_H_
 
-#include <PubSubClient.h>
+#include <Arduino.h>
 #include "src/common/webserver.h"
 
 // opentherm
@@ -36,7 +36,7 @@ typedef struct heishaOTDataStruct_t {
 extern struct heishaOTDataStruct_t heishaOTDataStruct[];
 
 void HeishaOTSetup();
-void HeishaOTLoop(char *actDat, PubSubClient &mqtt_client, char* mqtt_topic_base);
+void HeishaOTLoop(char *actDat, char* mqtt_topic_base);
 void mqttOTCallback(char* topic, char* value);
 void openthermJsonOutput(struct webserver_t *client);
 
@@ -0,0 +1,43 @@
+#ifndef _HEISHA_OT_DATA_H_
+#define _HEISHA_OT_DATA_H_
+
+#include "HeishaOT.h"
+
+/*
+ * The opentherm values, defined here and not in HeishaOT.cpp
+ * so the host tools link the same names, types and access
+ * without the opentherm driver. Include it only once.
+ */
+struct heishaOTDataStruct_t heishaOTDataStruct[] = {
+  //WRITE values
+  { "chEnable", TBOOL, { .b = false }, 3 }, //is central heating enabled by thermostat
+  { "dhwEnable", TBOOL, { .b = false }, 3 }, //is dhw heating enabled by thermostat
+  { "coolingEnable", TBOOL, { .b = false }, 3 }, //is cooling mode enabled by thermostat
+  { "roomTemp", TFLOAT, { .f = -99 }, 3 }, //what is measured room temp by thermostat
+  { "roomTempSet", TFLOAT, { .f = -99 }, 3 }, //what is request room temp setpoint by thermostat
+  { "chSetpoint", TFLOAT, { .f = -99 }, 3 }, //what is calculated Ta setpoint by thermostat
+  { "maxRelativeModulation", TFLOAT, { .f = -99 }, 3 }, //what is requested max relative modulation (0-100%)
+  { "coolingControl", TFLOAT, { .f = -99 }, 3 }, //what is requested cooling amount (0-100%)
+  //READ AND WRITE values
+  { "dhwSetpoint", TFLOAT, { .f = 65 }, 2 }, //what is DHW setpoint by thermostat
+  { "maxTSet", TFLOAT, { .f = 65 }, 2 }, //max ch setpoint
+  //READ values
+  { "chPressure", TFLOAT, { .f = -99 }, 1 }, //provides measured water pressure of central heating
+  { "relativeModulation", TFLOAT, { .f = -99 }, 1 }, //provides the current level of relative modulation (0-100%)
+  { "outsideTemp", TFLOAT, { .f = -99 }, 1 }, //provides measured outside temp to thermostat
+  { "inletTemp", TFLOAT, { .f = -99 }, 1 }, //provides measured Treturn temp to thermostat
+  { "outletTemp", TFLOAT, { .f = -99 }, 1 }, //provides measured Tout (boiler) temp to thermostat
+  { "dhwTemp", TFLOAT, { .f = -99 }, 1 }, //provides measured dhw water temp to to thermostat
+  { "flameState", TBOOL, { .b = false }, 1 }, //provides current flame state to thermostat
+  { "chState", TBOOL, { .b = false }, 1 }, //provides if heatpump is in centrale heating state
+  { "dhwState", TBOOL, { .b = false }, 1 }, //provides if heatpump is in dhw heating state
+  { "coolingState", TBOOL, { .b = false }, 1 }, //provides if heatpump is in cooling state
+  { "roomSetOverride", TFLOAT, { .f = 0 }, 1 }, //provides a room setpoint override ID9 (not implemented completly in heishamon)
+  { "dhwSetUppBound", TINT8, { .s8 = 75 }, 1 }, //provides DHW upper boundary, default to 75 degrees celcius
+  { "dhwSetLowBound", TINT8, { .s8 = 40 }, 1 }, //provides DHW lower boundary, default to 40 degrees celcius
+  { "chSetUppBound", TINT8, { .s8 = 65 }, 1 }, //provides CH upper boundary, default to 65 degrees celcius
+  { "chSetLowBound", TINT8, { .s8 = 20 }, 1 }, //provides CH lower boundary, default to 20 degrees celcius    
+  { NULL, 0, 0, 0 }
+};
+
+#endif
@@ -1,5 +1,6 @@
 #include "commands.h"
 #include <LittleFS.h>
+#include "src/common/log.h"
 
 //removed checksum from default query, is calculated in send_command
 byte initialQuery[] = {0x31, 0x05, 0x10, 0x01, 0x00, 0x00, 0x00};
@@ -10,10 +11,12 @@ byte panasonicSendQuery[] PROGMEM = {0xf1, 0x6c, 0x01, 0x10, 0x00, 0x00, 0x00, 0
 const char* mqtt_topic_values PROGMEM = "main";
 const char* mqtt_topic_xvalues PROGMEM = "extra";
 const char* mqtt_topic_commands PROGMEM = "commands";
+const char* mqtt_topic_batch PROGMEM = "batch";
 const char* mqtt_topic_pcbvalues PROGMEM = "optional";
 const char* mqtt_topic_1wire PROGMEM = "1wire";
 const char* mqtt_topic_s0 PROGMEM = "s0";
 const char* mqtt_logtopic PROGMEM = "log";
+const char* mqtt_topic_history PROGMEM = "history";
 
 const char* mqtt_willtopic PROGMEM = "LWT";
 const char* mqtt_iptopic PROGMEM = "ip";
@@ -1037,33 +1040,157 @@ unsigned int set_solar_temp(char *msg, char *log_msg) {
 
 
 
+/*
+ * Command names are found with a perfect hash. The seed is
+ * searched at compile time until every name of a table has
+ * a slot of its own, so a lookup hashes the name once and
+ * compares it with a single candidate.
+ */
+#define COMMANDSLOTS 128
+
+struct cmdTable {
+  uint32_t seed;
+  uint8_t slot[COMMANDSLOTS]; //index + 1, 0 for an empty slot
+};
+
+static constexpr uint8_t command_slot(const char *name, uint32_t seed) {
+  uint32_t hash = 2166136261UL ^ seed;
+  while (*name != '\0') {
+    hash ^= (uint8_t)*name++;
+    hash *= 16777619UL;
+  }
+  return (hash ^ (hash >> 16)) & (COMMANDSLOTS - 1);
+}
+
+template<typename T, size_t N>
+static constexpr cmdTable command_table(const T (&list)[N]) {
+  static_assert(N < COMMANDSLOTS / 2, "too many commands for the hash table");
+  cmdTable table = {};
+  for (uint32_t seed = 1; ; seed++) {
+    table = {};
+    table.seed = seed;
+    size_t i = 0;
+    for (; i < N; i++) {
+      uint8_t slot = command_slot(list[i].name, seed);
+      if (table.slot[slot] != 0) break;
+      table.slot[slot] = i + 1;
+    }
+    if (i == N) return table;
+  }
+}
+
+static constexpr cmdTable commandTable PROGMEM = command_table(commands);
+static constexpr cmdTable optionalCommandTable PROGMEM = command_table(optionalCommands);
+
+int8_t find_command(const char *name) {
+  uint8_t slot = command_slot(name, pgm_read_dword(&commandTable.seed));
+  uint8_t i = pgm_read_byte(&commandTable.slot[slot]);
+  if (i == 0 || strcmp_P(name, commands[i - 1].name) != 0) return -1;
+  return i - 1;
+}
+
+int8_t find_optional_command(const char *name) {
+  uint8_t slot = command_slot(name, pgm_read_dword(&optionalCommandTable.seed));
+  uint8_t i = pgm_read_byte(&optionalCommandTable.slot[slot]);
+  if (i == 0 || strcmp_P(name, optionalCommands[i - 1].name) != 0) return -1;
+  return i - 1;
+}
+
 void send_heatpump_command(char* topic, char *msg, bool (*send_command)(byte*, int), void (*log_message)(char*), bool optionalPCB) {
   unsigned char cmd[256] = { 0 };
   char log_msg[256] = { 0 };
   unsigned int len = 0;
+  int8_t i = find_command(topic);
 
-  for (unsigned int i = 0; i < sizeof(commands) / sizeof(commands[0]); i++) {
+  if (i > -1) {
     cmdStruct tmp;
     memcpy_P(&tmp, &commands[i], sizeof(tmp));
-    if (strcmp(topic, tmp.name) == 0) {
-      len = tmp.func(msg, cmd, log_msg);
-      log_message(log_msg);
-      if (len > 0) send_command(cmd, len);
-    }
+    len = tmp.func(msg, cmd, log_msg);
+    log_message(log_msg);
+    if (len > 0) send_command(cmd, len);
+  } else if (optionalPCB && (i = find_optional_command(topic)) > -1) {
+    optCmdStruct tmp;
+    memcpy_P(&tmp, &optionalCommands[i], sizeof(tmp));
+    len = tmp.func(msg, log_msg);
+    log_message(log_msg);
   }
+}
+
+/*
+ * Runs all commands of a json object like {"SetDHWTemp":50,"SetQuietMode":1}
+ * and sends them as one write. Every command fills its own fields of the
+ * same query, where zero bits mean no change, so they are merged into one.
+ * A command that sets bits of a field already in the merged query is sent
+ * in a new write.
+ */
+void send_heatpump_batch(char *msg, bool (*send_command)(byte*, int), void (*log_message)(char*), bool optionalPCB) {
+  unsigned char merged[sizeof(panasonicSendQuery)];
+  unsigned char cmd[256] = { 0 };
+  char log_msg[256] = { 0 };
+  char value[256];
+  uint8_t nrcommands = 0;
+  uint8_t nrwrites = 0;
+  bool pending = false;
 
-  if (optionalPCB) {
-    //run for optional pcb commands
-    for (unsigned int i = 0; i < sizeof(optionalCommands) / sizeof(optionalCommands[0]); i++) {
+  JsonDocument jsonDoc;
+  DeserializationError error = deserializeJson(jsonDoc, msg);
+  if (error || !jsonDoc.is<JsonObject>()) {
+    log_warn(LOG_MQTT, "Batch command JSON decode failed!");
+    return;
+  }
+
+  memcpy_P(merged, panasonicSendQuery, sizeof(panasonicSendQuery));
+  for (JsonPair kv : jsonDoc.as<JsonObject>()) {
+    const char *name = kv.key().c_str();
+    JsonVariant jsonValue = kv.value();
+
+    if (jsonValue.is<const char *>()) {
+      snprintf(value, sizeof(value), "%s", jsonValue.as<const char *>());
+    } else if (jsonValue.is<bool>()) {
+      snprintf(value, sizeof(value), "%d", jsonValue.as<bool>() ? 1 : 0);
+    } else {
+      serializeJson(jsonValue, value, sizeof(value));
+    }
+
+    int8_t i = find_command(name);
+    if (i > -1) {
+      cmdStruct tmp;
+      memcpy_P(&tmp, &commands[i], sizeof(tmp));
+      log_msg[0] = '\0';
+      if (tmp.func(value, cmd, log_msg) == sizeof(panasonicSendQuery)) {
+        bool overlap = false;
+        for (uint8_t x = 4; x < sizeof(merged); x++) {
+          if (merged[x] & cmd[x]) overlap = true;
+        }
+        if (overlap) {
+          send_command(merged, sizeof(merged));
+          memcpy_P(merged, panasonicSendQuery, sizeof(panasonicSendQuery));
+          nrwrites++;
+        }
+        for (uint8_t x = 4; x < sizeof(merged); x++) {
+          merged[x] |= cmd[x];
+        }
+        pending = true;
+      }
+      log_message(log_msg);
+      nrcommands++;
+    } else if (optionalPCB && (i = find_optional_command(name)) > -1) {
       optCmdStruct tmp;
       memcpy_P(&tmp, &optionalCommands[i], sizeof(tmp));
-      if (strcmp(topic, tmp.name) == 0) {
-        len = tmp.func(msg, log_msg);
-        log_message(log_msg);
-      }
+      log_msg[0] = '\0';
+      tmp.func(value, log_msg);
+      log_message(log_msg);
+      nrcommands++;
+    } else {
+      log_warn(LOG_MQTT, "Unknown command '%s' in batch", name);
     }
   }
-
+  if (pending) {
+    send_command(merged, sizeof(merged));
+    nrwrites++;
+  }
+  snprintf_P(log_msg, sizeof(log_msg), PSTR("Batch of %u commands sent in %u writes"), nrcommands, nrwrites);
+  log_message(log_msg);
 }
 
 
@@ -20,11 +20,13 @@ extern byte optionalPCBQuery[OPTIONALPCBQUERYSIZE];
 extern const char* mqtt_topic_values;
 extern const char* mqtt_topic_xvalues;
 extern const char* mqtt_topic_commands;
+extern const char* mqtt_topic_batch;
 extern const char* mqtt_topic_pcbvalues;
 extern const char* mqtt_topic_1wire;
 extern const char* mqtt_topic_s0;
 extern const char* mqtt_topic_pcb;
 extern const char* mqtt_logtopic;
+extern const char* mqtt_topic_history;
 extern const char* mqtt_willtopic;
 extern const char* mqtt_iptopic;
 extern const char* mqtt_send_raw_value_topic;
@@ -91,7 +93,7 @@ struct cmdStruct {
   unsigned int (*func)(char *msg, unsigned char *cmd, char *log_msg);
 };
 
-const cmdStruct commands[] PROGMEM = {
+constexpr cmdStruct commands[] PROGMEM = {
   // set heatpump state to on by sending 1
   { 1, "SetHeatpump", set_heatpump_state },
   // set Holiday mode by sending 1, off will be 0
@@ -161,7 +163,7 @@ struct optCmdStruct{
   unsigned int (*func)(char *msg, char *log_msg);
 };
 
-const optCmdStruct optionalCommands[] PROGMEM = {
+constexpr optCmdStruct optionalCommands[] PROGMEM = {
   // optional PCB
   { "SetHeatCoolMode", set_heat_cool_mode },
   { "SetCompressorState", set_compressor_state },
@@ -179,6 +181,10 @@ const optCmdStruct optionalCommands[] PROGMEM = {
   { "SetOptPCBByte9", set_byte_9 }
 };
 
+//index in commands[] or optionalCommands[], -1 for an unknown name
+int8_t find_command(const char *name);
+int8_t find_optional_command(const char *name);
 void send_heatpump_command(char* topic, char *msg, bool (*send_command)(byte*, int), void (*log_message)(char*), bool optionalPCB);
+void send_heatpump_batch(char *msg, bool (*send_command)(byte*, int), void (*log_message)(char*), bool optionalPCB);
 bool saveOptionalPCB(byte* command, int length);
 bool loadOptionalPCB(byte* command, int length);
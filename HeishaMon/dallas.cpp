@@ -1,10 +1,11 @@
 #include <OneWire.h>
 #include <DallasTemperature.h>
-#include <PubSubClient.h>
+#include "src/common/mqttqueue.h"
 #include "commands.h"
 #include "dallas.h"
 #include "rules.h"
 #include "src/common/progmem.h"
+#include "src/common/log.h"
 #include <ArduinoJson.h>
 #include <LittleFS.h>
 
@@ -31,16 +32,14 @@ unsigned int dallasTimerWait = 30000; // will be set using heishmonSettings
 void loadDallasAlias();
 
 void initDallasSensors(void (*log_message)(char*), unsigned int updateAllDallasTimeSettings, unsigned int dallasTimerWaitSettings, unsigned int dallasResolution) {
-  char log_msg[256];
   updateAllDallasTime = updateAllDallasTimeSettings;
   dallasTimerWait = dallasTimerWaitSettings;
   DS18B20.begin();
   dallasDevicecount  = DS18B20.getDeviceCount();
-  sprintf_P(log_msg, PSTR("Number of 1wire sensors on bus: %d"), dallasDevicecount); log_message(log_msg);
+  log_info(LOG_1WIRE, "Number of 1wire sensors on bus: %d", dallasDevicecount);
   if ( dallasDevicecount > MAX_DALLAS_SENSORS) {
     dallasDevicecount = MAX_DALLAS_SENSORS;
-    sprintf_P(log_msg, PSTR("Reached max 1wire sensor count. Only %d sensors will provide data."), dallasDevicecount);
-    log_message(log_msg);
+    log_warn(LOG_1WIRE, "Reached max 1wire sensor count. Only %d sensors will provide data.", dallasDevicecount);
   }
 
   //init array
@@ -58,7 +57,7 @@ void initDallasSensors(void (*log_message)(char*), unsigned int updateAllDallasT
       // zero pad the address if necessary
       sprintf(&actDallasData[i].address[x * 2], "%02x", actDallasData[i].sensor[x]);
     }
-    sprintf_P(log_msg, PSTR("Found 1wire sensor: %s"), actDallasData[i].address ); log_message(log_msg);
+    log_info(LOG_1WIRE, "Found 1wire sensor: %s", actDallasData[i].address);
   }
   if (DALLASASYNC) DS18B20.setWaitForConversion(false); //async 1wire during next loops
   loadDallasAlias();
@@ -68,7 +67,7 @@ void resetlastalldatatime_dallas() {
   lastalldatatime_dallas = 0;
 }
 
-void readNewDallasTemp(PubSubClient &mqtt_client, void (*log_message)(char*), char* mqtt_topic_base) {
+void readNewDallasTemp(void (*log_message)(char*), char* mqtt_topic_base) {
   char log_msg[256];
   char mqtt_topic[256];
   char valueStr[80];
@@ -82,26 +81,24 @@ void readNewDallasTemp(PubSubClient &mqtt_client, void (*log_message)(char*), ch
   for (int i = 0; i < dallasDevicecount; i++) {
     float temp = DS18B20.getTempC(actDallasData[i].sensor);
     if (temp < -120.0) {
-      sprintf_P(log_msg, PSTR("Error 1wire sensor offline: %s"), actDallasData[i].address); log_message(log_msg);
+      log_warn(LOG_1WIRE, "Error 1wire sensor offline: %s", actDallasData[i].address);
     } else {
       float allowedtempdiff = (((millis() - actDallasData[i].lastgoodtime)) / 1000.0) * MAXTEMPDIFFPERSEC;
       if ((actDallasData[i].temperature != -127.0) and ((temp > (actDallasData[i].temperature + allowedtempdiff)) or (temp < (actDallasData[i].temperature - allowedtempdiff)))) {
-        sprintf_P(log_msg, PSTR("Filtering 1wire sensor temperature (%s). Delta to high. Current: %.2f Last: %.2f"), actDallasData[i].address, temp, actDallasData[i].temperature);
-        log_message(log_msg);
+        log_info(LOG_1WIRE, "Filtering 1wire sensor temperature (%s). Delta to high. Current: %.2f Last: %.2f", actDallasData[i].address, temp, actDallasData[i].temperature);
       } else {
         actDallasData[i].lastgoodtime = millis();
         if ((updatenow) || (actDallasData[i].temperature != temp )) {  //only update mqtt topic if temp changed or after each update timer
           actDallasData[i].temperature = temp;
-          sprintf(log_msg, PSTR("Received 1wire sensor temperature (%s): %.2f"), actDallasData[i].address, actDallasData[i].temperature);
-          log_message(log_msg);
+          log_debug(LOG_1WIRE, "Received 1wire sensor temperature (%s): %.2f", actDallasData[i].address, actDallasData[i].temperature);
           if (true) {
             sprintf_P(valueStr, PSTR("%.2f"), actDallasData[i].temperature);
-            sprintf_P(mqtt_topic, PSTR("%s/%s/%s"), mqtt_topic_base, mqtt_topic_1wire, actDallasData[i].address); mqtt_client.publish(mqtt_topic, valueStr, MQTT_RETAIN_VALUES);
+            sprintf_P(mqtt_topic, PSTR("%s/%s/%s"), mqtt_topic_base, mqtt_topic_1wire, actDallasData[i].address); mqttqueue_publish(mqtt_topic, valueStr, MQTT_RETAIN_VALUES);
             sprintf_P(valueStr, PSTR("%s"), actDallasData[i].alias);
-            sprintf_P(mqtt_topic, PSTR("%s/%s/%s/alias"), mqtt_topic_base, mqtt_topic_1wire, actDallasData[i].address); mqtt_client.publish(mqtt_topic, valueStr, MQTT_RETAIN_VALUES);
+            sprintf_P(mqtt_topic, PSTR("%s/%s/%s/alias"), mqtt_topic_base, mqtt_topic_1wire, actDallasData[i].address); mqttqueue_publish(mqtt_topic, valueStr, MQTT_RETAIN_VALUES);
           } else {
             sprintf_P(valueStr, PSTR("{\"Temperature\":%.2f,\"Alias\":\"%s\"}"), actDallasData[i].temperature, actDallasData[i].alias);
-            sprintf_P(mqtt_topic, PSTR("%s/%s/%s"), mqtt_topic_base, mqtt_topic_1wire, actDallasData[i].address); mqtt_client.publish(mqtt_topic, valueStr, MQTT_RETAIN_VALUES);
+            sprintf_P(mqtt_topic, PSTR("%s/%s/%s"), mqtt_topic_base, mqtt_topic_1wire, actDallasData[i].address); mqttqueue_publish(mqtt_topic, valueStr, MQTT_RETAIN_VALUES);
           }
           sprintf_P(log_msg, PSTR("{\"data\": {\"dallasvalues\": {\"sensorID\": \"%s\", \"value\": %.2f}}}"), actDallasData[i].address, actDallasData[i].temperature);
           websocket_write_all(log_msg, strlen(log_msg));          
@@ -112,20 +109,20 @@ void readNewDallasTemp(PubSubClient &mqtt_client, void (*log_message)(char*), ch
   }
 }
 
-void dallasLoop(PubSubClient &mqtt_client, void (*log_message)(char*), char* mqtt_topic_base) {
+void dallasLoop(void (*log_message)(char*), char* mqtt_topic_base) {
   if ((unsigned long)(millis() - dallasTimer) > (1000 * dallasTimerWait)) {
-    log_message((char*)"Requesting new 1wire temperatures");
+    log_debug(LOG_1WIRE, "Requesting new 1wire temperatures");
     dallasTimer = millis();
     if (DALLASASYNC){
       DS18B20.requestTemperatures();
       dallasTimer1=millis();
     }else{
-      readNewDallasTemp(mqtt_client, log_message, mqtt_topic_base);
+      readNewDallasTemp(log_message, mqtt_topic_base);
     }
   }
   if ((dallasTimer1!=0) && ((millis() - dallasTimer1)>750)){
     dallasTimer1=0;
-    readNewDallasTemp(mqtt_client, log_message, mqtt_topic_base);
+    readNewDallasTemp(log_message, mqtt_topic_base);
   }   
 }
 
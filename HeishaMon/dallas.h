@@ -1,7 +1,7 @@
 #ifndef _DALLAS_H_
 #define _DALLAS_H_
 
-#include <PubSubClient.h>
+#include <Arduino.h>
 #include <OneWire.h>
 #include <DallasTemperature.h>
 #include "src/common/webserver.h"
@@ -22,7 +22,7 @@ struct dallasDataStruct {
 };
 
 void resetlastalldatatime_dallas();
-void dallasLoop(PubSubClient &mqtt_client, void (*log_message)(char*), char* mqtt_topic_base);
+void dallasLoop(void (*log_message)(char*), char* mqtt_topic_base);
 void initDallasSensors(void (*log_message)(char*), unsigned int updataAllDallasTimeSettings, unsigned int dallasTimerWaitSettings, unsigned int dallasResolution);
 void dallasJsonOutput(struct webserver_t *client);
 void changeDallasAlias(char* address, char* alias);
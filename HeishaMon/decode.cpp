@@ -2,6 +2,9 @@
 #include "commands.h"
 #include "rules.h"
 #include "src/common/progmem.h"
+#include "src/common/log.h"
+#include "src/common/mqttqueue.h"
+#include "history.h"
 
 void websocket_write_all(char *data, uint16_t data_len);
 
@@ -104,7 +107,8 @@ String getOpMode(byte input) {
 }
 
 String getModel(char* data) { // TOP92 //
-  byte model[10] = { data[129], data[130], data[131], data[132], data[133], data[134], data[135], data[136], data[137], data[138]};
+  byte model[10];
+  memcpy(model, &data[129], sizeof(model));
   char modelResult[31];
   for (size_t i = 0; i < 10; ++i) {
     sprintf(&modelResult[i*3], "%02X ", model[i]);
@@ -289,7 +293,7 @@ String getSecondByte(byte input) {
 
 
 // Decode ////////////////////////////////////////////////////////////////////////////
-void decode_heatpump_data(char* data, char* actData, PubSubClient &mqtt_client, void (*log_message)(char*), char* mqtt_topic_base, unsigned int updateAllTime) {
+void decode_heatpump_data(char* data, char* actData, void (*log_message)(char*), char* mqtt_topic_base, unsigned int updateAllTime) {
   bool updateTime = false;
   bool updateTopic[NUMBER_OF_TOPICS] = { false };
 
@@ -306,15 +310,17 @@ void decode_heatpump_data(char* data, char* actData, PubSubClient &mqtt_client,
     }
 
     if (updateTime || updateTopic[Topic_Number]) {
-      char log_msg[256];
       char mqtt_topic[256];
-      sprintf_P(log_msg, PSTR("received TOP%d %s: %s"), Topic_Number, topics[Topic_Number], Topic_Value.c_str());
-      log_message(log_msg);
+      log_debug(LOG_DECODE, "received TOP%d %s: %s", Topic_Number, topics[Topic_Number], Topic_Value.c_str());
       sprintf_P(mqtt_topic, PSTR("%s/%s/%s"), mqtt_topic_base, mqtt_topic_values, topics[Topic_Number]);
-      mqtt_client.publish(mqtt_topic, Topic_Value.c_str(), MQTT_RETAIN_VALUES);
+      mqttqueue_publish(mqtt_topic, Topic_Value.c_str(), MQTT_RETAIN_VALUES);
+      if (updateTopic[Topic_Number]) history_add(HISTORY_MAIN, Topic_Number, Topic_Value.c_str()); //kept while mqtt is offline
     }
   }
   memcpy(actData, data, DATASIZE);
+  actDataSequence++;
+  actDataMillis = millis();
+  rules_frame_begin(RULES_EVENT_TOPIC);
   for (unsigned int Topic_Number = 0 ; Topic_Number < NUMBER_OF_TOPICS ; Topic_Number++) {
     if(updateTopic[Topic_Number]) {
       char log_msg[256];
@@ -330,12 +336,13 @@ void decode_heatpump_data(char* data, char* actData, PubSubClient &mqtt_client,
         sprintf_P(log_msg, PSTR("{\"data\": {\"heishavalues\": {\"topic\": \"TOP%u\", \"value\": %s, \"description\": \"%s\"}}}"), Topic_Number, dataValue.c_str(),topicDescription[Topic_Number][dataValue.toInt() + 1]);
       }
       websocket_write_all(log_msg, strlen(log_msg));          
-      rules_event_cb(_F("@"), topics[Topic_Number]);
+      rules_topic_event_cb(RULES_EVENT_TOPIC, Topic_Number);
     }
   }
+  rules_frame_end(RULES_EVENT_TOPIC);
 }
 
-void decode_heatpump_data_extra(char* data, char* actDataExtra, PubSubClient &mqtt_client, void (*log_message)(char*), char* mqtt_topic_base, unsigned int updateAllTime) {
+void decode_heatpump_data_extra(char* data, char* actDataExtra, void (*log_message)(char*), char* mqtt_topic_base, unsigned int updateAllTime) {
   bool updateTime = false;
   bool updateTopic[NUMBER_OF_TOPICS_EXTRA] = { false };
 
@@ -352,15 +359,17 @@ void decode_heatpump_data_extra(char* data, char* actDataExtra, PubSubClient &mq
     }
 
     if (updateTime || updateTopic[Topic_Number]) {
-      char log_msg[256];
       char mqtt_topic[256];
-      sprintf_P(log_msg, PSTR("received XTOP%d %s: %s"), Topic_Number, xtopics[Topic_Number], Topic_Value.c_str());
-      log_message(log_msg);
+      log_debug(LOG_DECODE, "received XTOP%d %s: %s", Topic_Number, xtopics[Topic_Number], Topic_Value.c_str());
       sprintf_P(mqtt_topic, PSTR("%s/%s/%s"), mqtt_topic_base, mqtt_topic_xvalues, xtopics[Topic_Number]);
-      mqtt_client.publish(mqtt_topic, Topic_Value.c_str(), MQTT_RETAIN_VALUES);
+      mqttqueue_publish(mqtt_topic, Topic_Value.c_str(), MQTT_RETAIN_VALUES);
+      if (updateTopic[Topic_Number]) history_add(HISTORY_EXTRA, Topic_Number, Topic_Value.c_str());
     }
   }
   memcpy(actDataExtra, data, DATASIZE);
+  actDataExtraSequence++;
+  actDataExtraMillis = millis();
+  rules_frame_begin(RULES_EVENT_XTOPIC);
   for (unsigned int Topic_Number = 0 ; Topic_Number < NUMBER_OF_TOPICS_EXTRA ; Topic_Number++) {
     if(updateTopic[Topic_Number]) {
       char log_msg[256];
@@ -372,12 +381,13 @@ void decode_heatpump_data_extra(char* data, char* actDataExtra, PubSubClient &mq
         sprintf_P(log_msg, PSTR("{\"data\": {\"heishavalues\": {\"topic\": \"XTOP%u\", \"value\": %s, \"description\": \"%s\"}}}"), Topic_Number, dataValue.c_str(),xtopicDescription[Topic_Number][dataValue.toInt() + 1]);
       }
       websocket_write_all(log_msg, strlen(log_msg));         
-      rules_event_cb(_F("@"), xtopics[Topic_Number]);
+      rules_topic_event_cb(RULES_EVENT_XTOPIC, Topic_Number);
     }
   }
+  rules_frame_end(RULES_EVENT_XTOPIC);
 }
 
-void decode_optional_heatpump_data(char* data, char* actOptData, PubSubClient & mqtt_client, void (*log_message)(char*), char* mqtt_topic_base, unsigned int updateAllTime) {
+void decode_optional_heatpump_data(char* data, char* actOptData, void (*log_message)(char*), char* mqtt_topic_base, unsigned int updateAllTime) {
   bool updateTime = false;
   bool updateTopic[NUMBER_OF_OPT_TOPICS] = { false };
 
@@ -394,12 +404,11 @@ void decode_optional_heatpump_data(char* data, char* actOptData, PubSubClient &
     }
 
     if (updateTime || updateTopic[Topic_Number]) {
-      char log_msg[256];
       char mqtt_topic[256];
-      sprintf_P(log_msg, PSTR("received OPT%d %s: %s"), Topic_Number, optTopics[Topic_Number], Topic_Value.c_str());
-      log_message(log_msg);
+      log_debug(LOG_DECODE, "received OPT%d %s: %s", Topic_Number, optTopics[Topic_Number], Topic_Value.c_str());
       sprintf_P(mqtt_topic, PSTR("%s/%s/%s"), mqtt_topic_base, mqtt_topic_pcbvalues, optTopics[Topic_Number]);
-      mqtt_client.publish(mqtt_topic, Topic_Value.c_str(), MQTT_RETAIN_VALUES);
+      mqttqueue_publish(mqtt_topic, Topic_Value.c_str(), MQTT_RETAIN_VALUES);
+      if (updateTopic[Topic_Number]) history_add(HISTORY_OPTIONAL, Topic_Number, Topic_Value.c_str());
 
     }
   }
@@ -410,6 +419,9 @@ void decode_optional_heatpump_data(char* data, char* actOptData, PubSubClient &
   optionalPCBQuery[5] = valueByte5;
 
   memcpy(actOptData, data, OPTDATASIZE);
+  actOptDataSequence++;
+  actOptDataMillis = millis();
+  rules_frame_begin(RULES_EVENT_OPTTOPIC);
   for (unsigned int Topic_Number = 0 ; Topic_Number < NUMBER_OF_OPT_TOPICS ; Topic_Number++) {
     if(updateTopic[Topic_Number]) {
       char log_msg[256];
@@ -421,8 +433,9 @@ void decode_optional_heatpump_data(char* data, char* actOptData, PubSubClient &
         sprintf_P(log_msg, PSTR("{\"data\": {\"heishavalues\": {\"topic\": \"OPT%u\", \"value\": %s, \"description\": \"%s\"}}}"), Topic_Number, dataValue.c_str(),opttopicDescription[Topic_Number][dataValue.toInt() + 1]);
       }      
       websocket_write_all(log_msg, strlen(log_msg));
-      rules_event_cb(_F("@"), optTopics[Topic_Number]);
+      rules_topic_event_cb(RULES_EVENT_OPTTOPIC, Topic_Number);
     }
   }
+  rules_frame_end(RULES_EVENT_OPTTOPIC);
 
 }
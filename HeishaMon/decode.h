@@ -1,18 +1,26 @@
 #include <ArduinoJson.h>
-#include <PubSubClient.h>
+#include <Arduino.h>
 
 #define MQTT_RETAIN_VALUES 1
 
 void resetlastalldatatime();
 void websocket_write_all(char *data, uint16_t data_len);
 
+// bumped by the decode functions as soon as a new frame is stored in the act* buffers
+extern uint32_t actDataSequence;
+extern uint32_t actDataExtraSequence;
+extern uint32_t actOptDataSequence;
+extern unsigned long actDataMillis;
+extern unsigned long actDataExtraMillis;
+extern unsigned long actOptDataMillis;
+
 
 String getDataValue(char* data, unsigned int Topic_Number);
 String getDataValueExtra(char* data, unsigned int Topic_Number);
 String getOptDataValue(char* data, unsigned int Topic_Number);
-void decode_heatpump_data(char* data, char* actData, PubSubClient &mqtt_client, void (*log_message)(char*), char* mqtt_topic_base, unsigned int updateAllTime);
-void decode_heatpump_data_extra(char* data, char* actDataExtra, PubSubClient &mqtt_client, void (*log_message)(char*), char* mqtt_topic_base, unsigned int updateAllTime);
-void decode_optional_heatpump_data(char* data, char* actOptDat, PubSubClient &mqtt_client, void (*log_message)(char*), char* mqtt_topic_base, unsigned int updateAllTime);
+void decode_heatpump_data(char* data, char* actData, void (*log_message)(char*), char* mqtt_topic_base, unsigned int updateAllTime);
+void decode_heatpump_data_extra(char* data, char* actDataExtra, void (*log_message)(char*), char* mqtt_topic_base, unsigned int updateAllTime);
+void decode_optional_heatpump_data(char* data, char* actOptDat, void (*log_message)(char*), char* mqtt_topic_base, unsigned int updateAllTime);
 
 String unknown(byte input);
 String getBit1(byte input);
@@ -33,4 +33,14 @@ void setRelay1(bool state)
 void setRelay2(bool state)
 {
   digitalWrite(relayTwoPin, state);
+}
+
+bool getRelay1()
+{
+  return digitalRead(relayOnePin) == HIGH;
+}
+
+bool getRelay2()
+{
+  return digitalRead(relayTwoPin) == HIGH;
 }
\ No newline at end of file
@@ -27,4 +27,7 @@ void setupGPIO(gpioSettingsStruct gpioSettings);
 void mqttGPIOCallback(char* topic, char* value);
 void setRelay1(bool state);
 void setRelay2(bool state);
+//the level the relay pin is driven at
+bool getRelay1();
+bool getRelay2();
 
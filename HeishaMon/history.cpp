@@ -0,0 +1,302 @@
+#include "history.h"
+#include "commands.h"
+#include "src/common/mqttqueue.h"
+#include "src/common/progmem.h"
+
+#include <LittleFS.h>
+#include <time.h>
+
+#define HISTORY_EPOCH 1577836800UL //2020-01-01, an earlier clock was not set yet
+#define HISTORY_FILE "/history.bin"
+//replayed part of the spill file, so a reboot doesn't send it again
+#define HISTORY_POS_FILE "/history.pos"
+
+struct historyRecord {
+  uint32_t time; //seconds since epoch, 0 when the clock was not set yet
+  uint8_t table;
+  uint8_t nr;
+  uint8_t len; //followed by len bytes of value
+};
+
+static const char historyNames[HISTORY_S0 + 1][5] PROGMEM = {
+  "TOP", "XTOP", "OPT", "S0_"
+};
+
+/*
+ * Positions only grow, the ring offset is the
+ * position modulo the size. Records between
+ * first and head are not replayed yet.
+ */
+static uint8_t *historyRing = NULL;
+static uint32_t historySize = 0;
+static uint32_t historyHead = 0;
+static uint32_t historyFirst = 0;
+static bool historySpill = false;
+//replayed part and size of the spill file
+static uint32_t historySpillPos = 0;
+static uint32_t historySpillSize = 0;
+//nothing is connected before the first mqtt connect
+static bool historyOffline = true;
+static uint32_t historyDropped = 0;
+static unsigned long lastHistoryReplay = 0;
+
+static void history_read(uint32_t pos, void *dst, uint16_t len) {
+  uint32_t offset = pos % historySize;
+  uint32_t part = historySize - offset;
+
+  if (part >= len) {
+    memcpy(dst, &historyRing[offset], len);
+  } else {
+    memcpy(dst, &historyRing[offset], part);
+    memcpy(&((uint8_t *)dst)[part], historyRing, len - part);
+  }
+}
+
+static void history_write(uint32_t pos, const void *src, uint16_t len) {
+  uint32_t offset = pos % historySize;
+  uint32_t part = historySize - offset;
+
+  if (part >= len) {
+    memcpy(&historyRing[offset], src, len);
+  } else {
+    memcpy(&historyRing[offset], src, part);
+    memcpy(historyRing, &((const uint8_t *)src)[part], len - part);
+  }
+}
+
+static void history_clear(void) {
+  historyHead = 0;
+  historyFirst = 0;
+  historySpillPos = 0;
+  historySpillSize = 0;
+  LittleFS.remove(HISTORY_FILE);
+  LittleFS.remove(HISTORY_POS_FILE);
+}
+
+static void history_save_pos(void) {
+  File f = LittleFS.open(HISTORY_POS_FILE, "w");
+  if (f) {
+    f.write((const uint8_t *)&historySpillPos, sizeof(historySpillPos));
+    f.close();
+  }
+}
+
+//a spill file left before a reboot is replayed from where it stopped
+static void history_load_spill(void) {
+  historySpillPos = 0;
+  historySpillSize = 0;
+  if (!LittleFS.exists(HISTORY_FILE)) return;
+  File f = LittleFS.open(HISTORY_FILE, "r");
+  if (f) {
+    historySpillSize = f.size();
+    f.close();
+  }
+  f = LittleFS.open(HISTORY_POS_FILE, "r");
+  if (f) {
+    uint32_t pos = 0;
+    if ((f.read((uint8_t *)&pos, sizeof(pos)) == sizeof(pos)) && (pos <= historySpillSize)) {
+      historySpillPos = pos;
+    }
+    f.close();
+  }
+}
+
+void history_setup(bool enabled, bool spill) {
+  historySpill = enabled && spill;
+  if (!enabled) {
+    if (historyRing != NULL) {
+      free(historyRing);
+      historyRing = NULL;
+      historySize = 0;
+    }
+    history_clear();
+    return;
+  }
+  if (historyRing == NULL) {
+#if defined(ESP32)
+    if (psramFound()) {
+      historyRing = (uint8_t *)ps_malloc(HISTORY_PSRAM_SIZE);
+      historySize = HISTORY_PSRAM_SIZE;
+    }
+#endif
+    if (historyRing == NULL) {
+      historyRing = (uint8_t *)malloc(HISTORY_RAM_SIZE);
+      historySize = (historyRing != NULL) ? HISTORY_RAM_SIZE : 0;
+    }
+    historyHead = 0;
+    historyFirst = 0;
+    //saving the settings again keeps the replay position
+    history_load_spill();
+  }
+}
+
+void history_offline(bool offline) {
+  historyOffline = offline;
+}
+
+//moves the oldest half of the ring to the spill file
+static bool history_spill(void) {
+  struct historyRecord record;
+  uint32_t end = historyFirst;
+
+  if (!historySpill || (historySpillSize >= HISTORY_SPILL_SIZE)) return false;
+  while ((end < historyHead) && (end - historyFirst < historySize / 2)) {
+    history_read(end, &record, sizeof(record));
+    end += sizeof(record) + record.len;
+  }
+
+  File f = LittleFS.open(HISTORY_FILE, "a");
+  if (!f) return false;
+  uint32_t offset = historyFirst % historySize;
+  uint32_t len = end - historyFirst;
+  uint32_t part = min(len, historySize - offset);
+  bool written = (f.write(&historyRing[offset], part) == part);
+  if (written && (part < len)) {
+    written = (f.write(historyRing, len - part) == len - part);
+  }
+  historySpillSize = f.size();
+  f.close();
+  if (!written) return false;
+  historyFirst = end;
+  return true;
+}
+
+void history_add(uint8_t table, uint8_t nr, const char *value) {
+  struct historyRecord record;
+
+  if (!historyOffline || (historyRing == NULL)) return;
+
+  size_t len = strlen(value);
+  if (len > HISTORY_VALUE) len = HISTORY_VALUE;
+  time_t now = time(NULL);
+  record.time = ((uint32_t)now > HISTORY_EPOCH) ? (uint32_t)now : 0;
+  record.table = table;
+  record.nr = nr;
+  record.len = len;
+
+  uint16_t size = sizeof(record) + len;
+  if ((historyHead - historyFirst) + size > historySize) {
+    history_spill();
+  }
+  //without room on flash the oldest values are lost
+  while ((historyHead - historyFirst) + size > historySize) {
+    struct historyRecord old;
+    history_read(historyFirst, &old, sizeof(old));
+    historyFirst += sizeof(old) + old.len;
+    historyDropped++;
+  }
+  history_write(historyHead, &record, sizeof(record));
+  history_write(historyHead + sizeof(record), value, len);
+  historyHead += size;
+}
+
+static uint16_t history_format(struct historyRecord *record, char *value, uint32_t start, bool first, char *buf, uint16_t len) {
+  char name[5];
+  char offset[12];
+
+  //the value ends up in a json string
+  uint8_t i = 0, x = 0;
+  for (i = 0; i < record->len; i++) {
+    if ((value[i] != '"') && (value[i] != '\\')) value[x++] = value[i];
+  }
+  value[x] = '\0';
+
+  strcpy_P(name, historyNames[(record->table <= HISTORY_S0) ? record->table : HISTORY_MAIN]);
+  if ((start > 0) && (record->time > 0)) {
+    snprintf_P(offset, sizeof(offset), PSTR("%ld"), (long)(record->time - start));
+  } else {
+    strcpy_P(offset, PSTR("null"));
+  }
+  int n = snprintf_P(buf, len, PSTR("%s[%s,\"%s%u\",\"%s\"]"), first ? "" : ",", offset, name, record->nr, value);
+  return ((n > 0) && (n < len)) ? n : 0;
+}
+
+void history_replay(const char *mqtt_topic_base, uint16_t rate) {
+  struct historyRecord record;
+  char value[HISTORY_VALUE + 1];
+  char payload[MQTTQUEUE_MESSAGE];
+  char topic[256];
+  File f;
+
+  if ((historyRing == NULL) || (rate == 0)) return;
+  if ((historySpillPos >= historySpillSize) && (historyFirst == historyHead)) return;
+  if ((unsigned long)(millis() - lastHistoryReplay) < 60000UL / rate) return;
+  //live values go first
+  if (mqttqueue_count() > 0) return;
+  lastHistoryReplay = millis();
+  snprintf_P(topic, sizeof(topic), PSTR("%s/%s"), mqtt_topic_base, mqtt_topic_history);
+
+  if (historySpillPos < historySpillSize) {
+    f = LittleFS.open(HISTORY_FILE, "r");
+    if (!f) {
+      LittleFS.remove(HISTORY_POS_FILE);
+      historySpillPos = 0;
+      historySpillSize = 0;
+      return;
+    }
+    f.seek(historySpillPos, SeekSet);
+  }
+
+  //the fixed header of a publish and the topic don't count for the payload
+  uint16_t max = sizeof(payload) - strlen(topic) - 8;
+  uint16_t len = 0;
+  uint32_t spillPos = historySpillPos;
+  uint32_t first = historyFirst;
+  uint32_t start = 0;
+  bool empty = true;
+
+  while (true) {
+    if (f && (spillPos < historySpillSize)) {
+      if ((f.read((uint8_t *)&record, sizeof(record)) != sizeof(record)) || (record.len > HISTORY_VALUE) ||
+          (f.read((uint8_t *)value, record.len) != record.len)) {
+        //a broken tail, e.g. after a power loss
+        spillPos = historySpillSize;
+        continue;
+      }
+    } else if (first < historyHead) {
+      history_read(first, &record, sizeof(record));
+      history_read(first + sizeof(record), value, record.len);
+    } else {
+      break;
+    }
+    if (empty) {
+      start = record.time;
+      len = snprintf_P(payload, max, PSTR("{\"time\":%lu,\"values\":["), (unsigned long)start);
+    }
+    uint16_t n = history_format(&record, value, start, empty, &payload[len], max - len - 2);
+    if (n == 0) break;
+    len += n;
+    empty = false;
+    if (f && (spillPos < historySpillSize)) {
+      spillPos += sizeof(record) + record.len;
+    } else {
+      first += sizeof(record) + record.len;
+    }
+  }
+  if (f) f.close();
+
+  if (!empty) {
+    strcpy_P(&payload[len], PSTR("]}"));
+    //batches all have the same topic and must not replace each other
+    if (mqttqueue_publish(topic, payload, MQTTQUEUE_APPEND) == -1) return;
+  }
+  bool spillReplayed = (spillPos != historySpillPos);
+  historySpillPos = spillPos;
+  historyFirst = first;
+  if ((historySpillSize > 0) && (historySpillPos >= historySpillSize)) {
+    LittleFS.remove(HISTORY_FILE);
+    LittleFS.remove(HISTORY_POS_FILE);
+    historySpillPos = 0;
+    historySpillSize = 0;
+  } else if (spillReplayed) {
+    history_save_pos();
+  }
+}
+
+uint32_t history_pending(void) {
+  return (historyHead - historyFirst) + (historySpillSize - historySpillPos);
+}
+
+uint32_t history_dropped(void) {
+  return historyDropped;
+}
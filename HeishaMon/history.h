@@ -0,0 +1,44 @@
+#ifndef _HISTORY_H_
+#define _HISTORY_H_
+
+#include <Arduino.h>
+
+/*
+ * Store-and-forward of measurements during MQTT outages.
+ * While the connection is down, changed values and S0
+ * increments are kept with their time in a RAM ring, in
+ * PSRAM when the ESP32 has it. Optionally the oldest part
+ * of a full ring spills to a file on LittleFS. After a
+ * reconnect they are replayed as batched JSON messages.
+ */
+#define HISTORY_MAIN 0
+#define HISTORY_EXTRA 1
+#define HISTORY_OPTIONAL 2
+#define HISTORY_S0 3
+
+#if defined(ESP32)
+  #define HISTORY_PSRAM_SIZE 262144
+  #define HISTORY_RAM_SIZE 8192
+#else
+  #define HISTORY_RAM_SIZE 2048
+#endif
+//largest spill file on flash
+#define HISTORY_SPILL_SIZE 262144
+//longer values are truncated
+#define HISTORY_VALUE 32
+
+void history_setup(bool enabled, bool spill);
+//values are only kept while offline
+void history_offline(bool offline);
+void history_add(uint8_t table, uint8_t nr, const char *value);
+/*
+ * Queues the next batch for <base>/history when one is
+ * due, at most rate batches a minute and only when no
+ * live messages are waiting in the mqtt queue.
+ */
+void history_replay(const char *mqtt_topic_base, uint16_t rate);
+//bytes still to replay, in RAM and on flash
+uint32_t history_pending(void);
+uint32_t history_dropped(void);
+
+#endif
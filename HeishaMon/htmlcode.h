@@ -488,6 +488,12 @@ static const char webBodySettingsResetPasswordWarning[] PROGMEM =
   "Do a factory reset to reset it to<br />the its default password: heisha</p>"
   "</div>";
 
+static const char webBodySettingsScanListWarning[] PROGMEM =
+  "<div class=\"w3-container w3-center\">"
+  "<p><b>Invalid modbus scan list</b><br /><br />"
+  "The settings are not saved, use topics<br />like TOP1,TOP5:f32,TOP11:u32</p>"
+  "</div>";
+
 static const char webBodySettingsSaveMessage[] PROGMEM =
   "<div class=\"w3-container w3-center\">"
   "<p><b>Configuration saved</b><br /><br />"
@@ -889,6 +895,13 @@ static const char settingsForm1[] PROGMEM =
   "      </tr>"
   "      <tr>"
   "        <td style=\"text-align:right; width: 50%\">"
+  "          Modbus scan list (e.g. TOP1,TOP5:f32,TOP11:u32):</td>"
+  "        <td style=\"text-align:left\">"
+  "          <input type=\"text\" name=\"modbus_scanlist\" maxlength=\"253\" value=\"\">"
+  "        </td>"
+  "      </tr>"
+  "      <tr>"
+  "        <td style=\"text-align:right; width: 50%\">"
   "          Timezone:</td>"
   "        <td style=\"text-align:left\">"
   "          <select name=\"timezone\">";
@@ -914,6 +927,27 @@ static const char settingsForm2[] PROGMEM =
   "      </tr>"
   "      <tr>"
   "        <td style=\"text-align:right; width: 50%\">"
+  "          Keep changed values while MQTT is offline and send them afterwards:</td>"
+  "        <td style=\"text-align:left\">"
+  "          <input type=\"checkbox\" name=\"historyStore\" value=\"enabled\">"
+  "        </td>"
+  "      </tr>"
+  "      <tr>"
+  "        <td style=\"text-align:right; width: 50%\">"
+  "          Move kept values to flash when memory is full:</td>"
+  "        <td style=\"text-align:left\">"
+  "          <input type=\"checkbox\" name=\"historySpill\" value=\"enabled\">"
+  "        </td>"
+  "      </tr>"
+  "      <tr>"
+  "        <td style=\"text-align:right; width: 50%\">"
+  "          Max messages with kept values sent per minute:</td>"
+  "        <td style=\"text-align:left\">"
+  "          <input type=\"number\" name=\"historyRate\" min=\"1\" max=\"600\" value=\"\">"
+  "        </td>"
+  "      </tr>"
+  "      <tr>"
+  "        <td style=\"text-align:right; width: 50%\">"
   "          Enable WiFi hotspot when not connected:</td>"
   "        <td style=\"text-align:left\">"
   "          <input type=\"checkbox\" name=\"hotspot\" value=\"enabled\">"
@@ -942,6 +976,20 @@ static const char settingsForm2[] PROGMEM =
   "      </tr>"
   "      <tr>"
   "        <td style=\"text-align:right; width: 50%\">"
+  "          Debug log to a file on flash (read at <a href=\"/log\">/log</a>):</td>"
+  "        <td style=\"text-align:left\">"
+  "          <input type=\"checkbox\" name=\"logFile\" value=\"enabled\">"
+  "        </td>"
+  "      </tr>"
+  "      <tr>"
+  "        <td style=\"text-align:right; width: 50%\">"
+  "          Flash used for the log file:</td>"
+  "        <td style=\"text-align:left\">"
+  "          <input type=\"number\" name=\"logFileSize\" min=\"32\" max=\"256\" value=\"\"> kB"
+  "        </td>"
+  "      </tr>"
+  "      <tr>"
+  "        <td style=\"text-align:right; width: 50%\">"
   "          Emulate optional PCB (does not work in listen only mode):</td>"
   "        <td style=\"text-align:left\">"
   "          <input type=\"checkbox\" name=\"optionalPCB\" value=\"enabled\">"
@@ -961,6 +1009,53 @@ static const char settingsForm2[] PROGMEM =
   "          <input type=\"checkbox\" name=\"force_rules\" value=\"enabled\">"
   "        </td>"
   "      </tr>"
+  "      <tr>"
+  "        <td style=\"text-align:right; width: 50%\">"
+  "          Run each rule block once per frame (after decoding):</td>"
+  "        <td style=\"text-align:left\">"
+  "          <input type=\"checkbox\" name=\"coalesce_rules\" value=\"enabled\">"
+  "        </td>"
+  "      </tr>"
+  "      <tr>"
+  "        <td style=\"text-align:right; width: 50%\">"
+  "          Publish rule execution stats on MQTT:</td>"
+  "        <td style=\"text-align:left\">"
+  "          <input type=\"checkbox\" name=\"rules_stats_mqtt\" value=\"enabled\">"
+  "        </td>"
+  "      </tr>"
+  "      <tr>"
+  "        <td style=\"text-align:right; width: 50%\">"
+  "          Rules logging:</td>"
+  "        <td style=\"text-align:left\">"
+  "          <input type=\"radio\" id=\"rules-log-0\" name=\"rules_loglevel\" value=\"0\"><label for=\"rules-log-0\"> off </label>"
+  "          <input type=\"radio\" id=\"rules-log-1\" name=\"rules_loglevel\" value=\"1\"><label for=\"rules-log-1\"> timing </label>"
+  "          <input type=\"radio\" id=\"rules-log-2\" name=\"rules_loglevel\" value=\"2\"><label for=\"rules-log-2\"> timing and variables </label>"
+  "        </td>"
+  "      </tr>"
+  "      <tr>"
+  "        <td style=\"text-align:right; width: 50%\">"
+  "          Warn when a main loop stage takes longer than:</td>"
+  "        <td style=\"text-align:left\">"
+  "          <input type=\"number\" name=\"loop_budget\" value=\"\"> ms (0 = off)"
+  "        </td>"
+  "      </tr>"
+  "      <tr>"
+  "        <td style=\"text-align:right; width: 50%\">"
+  "          Log level:</td>"
+  "        <td style=\"text-align:left\">"
+  "          <input type=\"radio\" id=\"log-level-0\" name=\"log_level\" value=\"0\"><label for=\"log-level-0\"> error </label>"
+  "          <input type=\"radio\" id=\"log-level-1\" name=\"log_level\" value=\"1\"><label for=\"log-level-1\"> warn </label>"
+  "          <input type=\"radio\" id=\"log-level-2\" name=\"log_level\" value=\"2\"><label for=\"log-level-2\"> info </label>"
+  "          <input type=\"radio\" id=\"log-level-3\" name=\"log_level\" value=\"3\"><label for=\"log-level-3\"> debug </label>"
+  "        </td>"
+  "      </tr>"
+  "      <tr>"
+  "        <td style=\"text-align:right; width: 50%\">"
+  "          Only log these subsystems (e.g. serial,decode,mqtt,modbus,rules,ot,1wire,s0,web, empty is all):</td>"
+  "        <td style=\"text-align:left\">"
+  "          <input type=\"text\" name=\"log_subsystems\" maxlength=\"79\" value=\"\">"
+  "        </td>"
+  "      </tr>"
   "    </table>"
   "    <table style=\"width:100%\">"
   "      <tr>"
@@ -1100,6 +1195,27 @@ static const char settingsForm2[] PROGMEM =
   "        </td>"
   "      </tr>"
   "      <tr>"
+  "        <td style=\"text-align:right; width: 50%\">"
+  "          Keep changed values while MQTT is offline and send them afterwards:</td>"
+  "        <td style=\"text-align:left\">"
+  "          <input type=\"checkbox\" name=\"historyStore\" value=\"enabled\">"
+  "        </td>"
+  "      </tr>"
+  "      <tr>"
+  "        <td style=\"text-align:right; width: 50%\">"
+  "          Move kept values to flash when memory is full:</td>"
+  "        <td style=\"text-align:left\">"
+  "          <input type=\"checkbox\" name=\"historySpill\" value=\"enabled\">"
+  "        </td>"
+  "      </tr>"
+  "      <tr>"
+  "        <td style=\"text-align:right; width: 50%\">"
+  "          Max messages with kept values sent per minute:</td>"
+  "        <td style=\"text-align:left\">"
+  "          <input type=\"number\" name=\"historyRate\" min=\"1\" max=\"600\" value=\"\">"
+  "        </td>"
+  "      </tr>"
+  "      <tr>"
   "      <tr>"
   "        <td style=\"text-align:right; width: 50%\">"
   "          Enable WiFi hotspot when not connected:</td>"
@@ -1129,6 +1245,20 @@ static const char settingsForm2[] PROGMEM =
   "      </tr>"
   "      <tr>"
   "        <td style=\"text-align:right; width: 50%\">"
+  "          Debug log to a file on flash (read at <a href=\"/log\">/log</a>):</td>"
+  "        <td style=\"text-align:left\">"
+  "          <input type=\"checkbox\" name=\"logFile\" value=\"enabled\">"
+  "        </td>"
+  "      </tr>"
+  "      <tr>"
+  "        <td style=\"text-align:right; width: 50%\">"
+  "          Flash used for the log file:</td>"
+  "        <td style=\"text-align:left\">"
+  "          <input type=\"number\" name=\"logFileSize\" min=\"32\" max=\"256\" value=\"\"> kB"
+  "        </td>"
+  "      </tr>"
+  "      <tr>"
+  "        <td style=\"text-align:right; width: 50%\">"
   "          Emulate optional PCB (does not work in listen only mode):</td>"
   "        <td style=\"text-align:left\">"
   "          <input type=\"checkbox\" name=\"optionalPCB\" value=\"enabled\">"
@@ -1154,7 +1284,54 @@ static const char settingsForm2[] PROGMEM =
   "        <td style=\"text-align:left\">"
   "          <input type=\"checkbox\" name=\"force_rules\" value=\"enabled\">"
   "        </td>"
+  "      </tr>"
+  "      <tr>"
+  "        <td style=\"text-align:right; width: 50%\">"
+  "          Run each rule block once per frame (after decoding):</td>"
+  "        <td style=\"text-align:left\">"
+  "          <input type=\"checkbox\" name=\"coalesce_rules\" value=\"enabled\">"
+  "        </td>"
+  "      </tr>"
+  "      <tr>"
+  "        <td style=\"text-align:right; width: 50%\">"
+  "          Publish rule execution stats on MQTT:</td>"
+  "        <td style=\"text-align:left\">"
+  "          <input type=\"checkbox\" name=\"rules_stats_mqtt\" value=\"enabled\">"
+  "        </td>"
+  "      </tr>"
+  "      <tr>"
+  "        <td style=\"text-align:right; width: 50%\">"
+  "          Rules logging:</td>"
+  "        <td style=\"text-align:left\">"
+  "          <input type=\"radio\" id=\"rules-log-0\" name=\"rules_loglevel\" value=\"0\"><label for=\"rules-log-0\"> off </label>"
+  "          <input type=\"radio\" id=\"rules-log-1\" name=\"rules_loglevel\" value=\"1\"><label for=\"rules-log-1\"> timing </label>"
+  "          <input type=\"radio\" id=\"rules-log-2\" name=\"rules_loglevel\" value=\"2\"><label for=\"rules-log-2\"> timing and variables </label>"
+  "        </td>"
   "      </tr>"  
+  "      <tr>"
+  "        <td style=\"text-align:right; width: 50%\">"
+  "          Warn when a main loop stage takes longer than:</td>"
+  "        <td style=\"text-align:left\">"
+  "          <input type=\"number\" name=\"loop_budget\" value=\"\"> ms (0 = off)"
+  "        </td>"
+  "      </tr>"
+  "      <tr>"
+  "        <td style=\"text-align:right; width: 50%\">"
+  "          Log level:</td>"
+  "        <td style=\"text-align:left\">"
+  "          <input type=\"radio\" id=\"log-level-0\" name=\"log_level\" value=\"0\"><label for=\"log-level-0\"> error </label>"
+  "          <input type=\"radio\" id=\"log-level-1\" name=\"log_level\" value=\"1\"><label for=\"log-level-1\"> warn </label>"
+  "          <input type=\"radio\" id=\"log-level-2\" name=\"log_level\" value=\"2\"><label for=\"log-level-2\"> info </label>"
+  "          <input type=\"radio\" id=\"log-level-3\" name=\"log_level\" value=\"3\"><label for=\"log-level-3\"> debug </label>"
+  "        </td>"
+  "      </tr>"
+  "      <tr>"
+  "        <td style=\"text-align:right; width: 50%\">"
+  "          Only log these subsystems (e.g. serial,decode,mqtt,modbus,rules,ot,1wire,s0,web, empty is all):</td>"
+  "        <td style=\"text-align:left\">"
+  "          <input type=\"text\" name=\"log_subsystems\" maxlength=\"79\" value=\"\">"
+  "        </td>"
+  "      </tr>"
   "    </table>"
   "    <table style=\"width:100%\">"
   "      <tr>"
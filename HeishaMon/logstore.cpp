@@ -0,0 +1,340 @@
+#include "logstore.h"
+#include "src/common/log.h"
+#include "src/common/progmem.h"
+
+#include <LittleFS.h>
+#include <time.h>
+
+#define LOGSTORE_MAGIC 0x474F4C48UL //"HLOG"
+#define LOGSTORE_EPOCH 1577836800UL //2020-01-01, an earlier clock was not set yet
+
+/*
+ * Every segment file starts with a header. The sequence
+ * number grows with each new segment and decides which
+ * file of the ring (seq % segments) it is written to.
+ */
+struct logStoreHeader {
+  uint32_t magic;
+  uint32_t seq;
+};
+
+struct logStoreRecord {
+  uint32_t time; //seconds since epoch, 0 when the clock was not set yet
+  uint32_t millis;
+  uint8_t level;
+  uint8_t subsystem;
+  uint16_t len; //followed by len bytes of text, without a terminating zero
+};
+
+static const char logLevelNames[LOG_TRACE + 1][6] PROGMEM = {
+  "error", "warn", "info", "debug", "trace"
+};
+
+static File logFile;
+static uint8_t logSegments = 0; //0 while the store is closed
+static uint32_t logSeq = 0;
+static uint32_t logSize = 0;
+static char logBuffer[LOGSTORE_BUFFER];
+static uint16_t logBuffered = 0;
+static unsigned long logBufferedSince = 0;
+static bool logUrgent = false;
+
+static void logstore_path(uint8_t slot, char *path) {
+  sprintf_P(path, PSTR("/log%u.bin"), slot);
+}
+
+//sequence number of the segment in a slot, 0 when there is none
+static uint32_t logstore_segment(uint8_t slot) {
+  struct logStoreHeader header;
+  char path[16];
+
+  logstore_path(slot, path);
+  if (!LittleFS.exists(path)) return 0;
+  File f = LittleFS.open(path, "r");
+  if (!f) return 0;
+  size_t len = f.read((uint8_t *)&header, sizeof(header));
+  f.close();
+  if ((len != sizeof(header)) || (header.magic != LOGSTORE_MAGIC)) return 0;
+  return header.seq;
+}
+
+//slot of the oldest segment after seq, -1 when there is none
+static int8_t logstore_next(uint32_t seq, uint32_t *next) {
+  int8_t found = -1;
+
+  for (uint8_t slot = 0; slot < LOGSTORE_MAX_SEGMENTS; slot++) {
+    uint32_t s = logstore_segment(slot);
+    if ((s > seq) && ((found == -1) || (s < *next))) {
+      found = slot;
+      *next = s;
+    }
+  }
+  return found;
+}
+
+//time of the first record of a segment, 0 when it is unknown
+static uint32_t logstore_first(uint8_t slot, uint32_t seq) {
+  struct logStoreHeader header;
+  struct logStoreRecord record;
+  char path[16];
+  uint32_t time = 0;
+
+  logstore_path(slot, path);
+  File f = LittleFS.open(path, "r");
+  if (!f) return 0;
+  if ((f.read((uint8_t *)&header, sizeof(header)) == sizeof(header)) && (header.magic == LOGSTORE_MAGIC) && (header.seq == seq) &&
+      (f.read((uint8_t *)&record, sizeof(record)) == sizeof(record))) {
+    time = record.time;
+  }
+  f.close();
+  return time;
+}
+
+//length of a segment up to its last complete record
+static uint32_t logstore_valid(File &f) {
+  struct logStoreRecord record;
+  uint32_t size = f.size();
+  uint32_t pos = sizeof(struct logStoreHeader);
+
+  while (pos + sizeof(record) <= size) {
+    f.seek(pos, SeekSet);
+    if (f.read((uint8_t *)&record, sizeof(record)) != sizeof(record)) break;
+    if ((record.len > LOGQUEUE_LINE) || (pos + sizeof(record) + record.len > size)) break;
+    pos += sizeof(record) + record.len;
+  }
+  return pos;
+}
+
+static void logstore_close(void) {
+  if (logFile) logFile.close();
+  logSegments = 0;
+}
+
+//starts a new segment, overwriting the oldest one
+static bool logstore_rotate(uint32_t seq) {
+  struct logStoreHeader header = { LOGSTORE_MAGIC, seq };
+  char path[16];
+
+  if (logFile) logFile.close();
+  logstore_path(seq % logSegments, path);
+  logFile = LittleFS.open(path, "w");
+  //a full or broken filesystem is not retried on every flush
+  if (!logFile || (logFile.write((uint8_t *)&header, sizeof(header)) != sizeof(header))) {
+    logstore_close();
+    return false;
+  }
+  logSeq = seq;
+  logSize = sizeof(header);
+  return true;
+}
+
+void logstore_setup(uint16_t size) {
+  uint8_t segments = 0;
+
+  if (size > 0) {
+    segments = constrain(size / (LOGSTORE_SEGMENT / 1024), 2, LOGSTORE_MAX_SEGMENTS);
+  }
+  if (segments == logSegments) return;
+
+  logstore_flush(true);
+  logstore_close();
+  if ((segments == 0) || !LittleFS.begin()) return;
+
+  //segments left by a ring of another size would be read out of order
+  uint32_t last = 0;
+  for (uint8_t slot = 0; slot < LOGSTORE_MAX_SEGMENTS; slot++) {
+    uint32_t seq = logstore_segment(slot);
+    if (seq == 0) continue;
+    if ((slot >= segments) || ((seq % segments) != slot)) {
+      char path[16];
+      logstore_path(slot, path);
+      LittleFS.remove(path);
+    } else if (seq > last) {
+      last = seq;
+    }
+  }
+  logSegments = segments;
+
+  if (last == 0) {
+    logstore_rotate(1);
+    return;
+  }
+
+  //continue the newest segment, unless a power loss cut its last record short
+  char path[16];
+  logstore_path(last % segments, path);
+  File f = LittleFS.open(path, "r");
+  uint32_t length = f ? f.size() : 0;
+  uint32_t valid = f ? logstore_valid(f) : 0;
+  if (f) f.close();
+  if ((length > 0) && (valid == length) && (length < LOGSTORE_SEGMENT)) {
+    logFile = LittleFS.open(path, "a");
+    if (logFile) {
+      logSeq = last;
+      logSize = length;
+      return;
+    }
+  }
+  logstore_rotate(last + 1);
+}
+
+void logstore_add(struct logqueue_record_t *record, char *text) {
+  struct logStoreRecord node;
+
+  if (logSegments == 0) return;
+
+  uint16_t len = strlen(text);
+  if (len > LOGQUEUE_LINE) len = LOGQUEUE_LINE;
+
+  time_t now = time(NULL);
+  node.time = ((uint32_t)now > LOGSTORE_EPOCH) ? (uint32_t)now - ((millis() - record->millis) / 1000) : 0;
+  node.millis = record->millis;
+  node.level = record->level;
+  node.subsystem = record->subsystem;
+  node.len = len;
+
+  if (logBuffered + sizeof(node) + len > LOGSTORE_BUFFER) {
+    logstore_flush(true);
+  }
+  if (logBuffered == 0) {
+    logBufferedSince = millis();
+  }
+  memcpy(&logBuffer[logBuffered], &node, sizeof(node));
+  logBuffered += sizeof(node);
+  memcpy(&logBuffer[logBuffered], text, len);
+  logBuffered += len;
+
+  if (record->level <= LOG_WARN) {
+    logUrgent = true;
+  }
+}
+
+void logstore_flush(bool force) {
+  if (logBuffered == 0) return;
+
+  unsigned long age = millis() - logBufferedSince;
+  if (!force && (logBuffered < (LOGSTORE_BUFFER * 3) / 4) && (age < LOGSTORE_FLUSH_TIME) && !(logUrgent && (age >= LOGSTORE_URGENT_TIME))) {
+    return;
+  }
+
+  if ((logSegments > 0) && (logSize + logBuffered > LOGSTORE_SEGMENT)) {
+    logstore_rotate(logSeq + 1);
+  }
+  if (logSegments > 0) {
+    if (logFile.write((uint8_t *)logBuffer, logBuffered) == logBuffered) {
+      logFile.flush();
+      logSize += logBuffered;
+    } else {
+      logstore_close();
+    }
+  }
+  logBuffered = 0;
+  logUrgent = false;
+}
+
+void logstore_reader(struct logstore_reader_t *reader) {
+  //what is still buffered should be part of the result
+  logstore_flush(true);
+
+  int8_t slot = logstore_next(0, &reader->seq);
+  if (slot == -1) {
+    reader->seq = 0;
+    reader->slot = 0;
+  } else {
+    reader->slot = slot;
+  }
+  reader->offset = sizeof(struct logStoreHeader);
+}
+
+static uint16_t logstore_format(struct logStoreRecord *record, char *text, char *line, uint16_t len) {
+  char timestring[24];
+  char level[6];
+  char subsystem[8];
+
+  if (record->time > 0) {
+    time_t rawtime = record->time;
+    strftime(timestring, sizeof(timestring), "%Y-%m-%d %H:%M:%S", localtime(&rawtime));
+  } else {
+    strcpy_P(timestring, PSTR("-"));
+  }
+  strcpy_P(level, logLevelNames[(record->level <= LOG_TRACE) ? record->level : LOG_TRACE]);
+  log_subsystem_name(record->subsystem, subsystem);
+
+  int n = snprintf_P(line, len, PSTR("%s (%lu) %s %s: %s\n"), timestring, (unsigned long)record->millis, level, subsystem, text);
+  if (n < 0) return 0;
+  return (n < len) ? n : len - 1;
+}
+
+/*
+ * Segments that end before from are skipped by the time
+ * of the first record of the next one, the read ends at
+ * the first record after to. A call reads at most the
+ * segment with the next match and the one before it,
+ * more only while segments hold nothing but records
+ * written before the clock was set.
+ */
+uint16_t logstore_read(struct logstore_reader_t *reader, char *buf, uint16_t len) {
+  struct logStoreHeader header;
+  struct logStoreRecord record;
+  char text[LOGQUEUE_LINE + 1];
+  char line[LOGSTORE_LINE];
+  char path[16];
+  uint16_t pos = 0;
+  uint32_t nextseq = 0;
+
+  while ((reader->seq > 0) && (pos == 0)) {
+    while ((reader->from > 0) && (reader->offset == sizeof(struct logStoreHeader))) {
+      int8_t next = logstore_next(reader->seq, &nextseq);
+      if (next == -1) break;
+      uint32_t first = logstore_first(next, nextseq);
+      if ((first == 0) || (first >= reader->from)) break;
+      reader->seq = nextseq;
+      reader->slot = next;
+    }
+
+    logstore_path(reader->slot, path);
+    File f;
+    if (LittleFS.exists(path)) {
+      f = LittleFS.open(path, "r");
+    }
+    //the segment can be overwritten by a rotation while it is read
+    if (f && (f.read((uint8_t *)&header, sizeof(header)) == sizeof(header)) && (header.magic == LOGSTORE_MAGIC) && (header.seq == reader->seq)) {
+      uint32_t size = f.size();
+      f.seek(reader->offset, SeekSet);
+      while (reader->offset + sizeof(record) <= size) {
+        if (f.read((uint8_t *)&record, sizeof(record)) != sizeof(record)) break;
+        if ((record.len > LOGQUEUE_LINE) || (reader->offset + sizeof(record) + record.len > size)) break;
+        if (f.read((uint8_t *)text, record.len) != record.len) break;
+        text[record.len] = '\0';
+
+        //records are written in time order, nothing after this one matches
+        if ((reader->to > 0) && (record.time > reader->to)) {
+          f.close();
+          reader->seq = 0;
+          return pos;
+        }
+        if (((reader->from == 0) || (record.time >= reader->from)) && ((reader->to == 0) || (record.time > 0))) {
+          uint16_t n = logstore_format(&record, text, line, sizeof(line));
+          if (pos + n > len) {
+            //the same record is decoded again on the next read
+            f.close();
+            return pos;
+          }
+          memcpy(&buf[pos], line, n);
+          pos += n;
+        }
+        reader->offset += sizeof(record) + record.len;
+      }
+    }
+    if (f) f.close();
+
+    int8_t slot = logstore_next(reader->seq, &reader->seq);
+    if (slot == -1) {
+      reader->seq = 0;
+    } else {
+      reader->slot = slot;
+      reader->offset = sizeof(struct logStoreHeader);
+    }
+  }
+  return pos;
+}
@@ -0,0 +1,52 @@
+#ifndef _LOGSTORE_H_
+#define _LOGSTORE_H_
+
+#include <Arduino.h>
+#include "src/common/logqueue.h"
+
+/*
+ * Persistent log on LittleFS. Messages are kept as binary
+ * records in a ring of fixed size segment files, the oldest
+ * segment is overwritten when the ring is full. Records are
+ * collected in RAM and written in batches, so the flash sees
+ * a few large appends instead of a write per message.
+ */
+#define LOGSTORE_SEGMENT 16384
+#define LOGSTORE_MAX_SEGMENTS 16
+#if defined(ESP32)
+  #define LOGSTORE_BUFFER 1024
+#else
+  #define LOGSTORE_BUFFER 512
+#endif
+//write buffered messages at least this often (ms)
+#define LOGSTORE_FLUSH_TIME 60000
+//but errors and warnings within a second
+#define LOGSTORE_URGENT_TIME 1000
+//longest decoded text line
+#define LOGSTORE_LINE (LOGQUEUE_LINE + 64)
+
+typedef struct logstore_reader_t {
+  //time range in seconds since epoch, 0 is open ended
+  uint32_t from;
+  uint32_t to;
+  uint32_t seq;
+  uint32_t offset;
+  uint8_t slot;
+} logstore_reader_t;
+
+//opens the store with room for size kB, 0 closes it
+void logstore_setup(uint16_t size);
+void logstore_add(struct logqueue_record_t *record, char *text);
+//writes the buffered records when they are due, or now when forced
+void logstore_flush(bool force);
+//starts reading at the oldest record, set from and to first
+void logstore_reader(struct logstore_reader_t *reader);
+/*
+ * Decodes the next records of the reader as text lines
+ * into buf, which should hold at least LOGSTORE_LINE
+ * bytes. Returns the number of bytes written, 0 when
+ * all records have been read.
+ */
+uint16_t logstore_read(struct logstore_reader_t *reader, char *buf, uint16_t len);
+
+#endif
@@ -0,0 +1,122 @@
+#include "loopstats.h"
+#include "webfunctions.h"
+#include "src/common/progmem.h"
+#include "src/common/log.h"
+
+extern settingsStruct heishamonSettings;
+
+static const char loopStageNames[LOOP_STAGES][12] PROGMEM = {
+  "webserver", "wifi", "ota", "modbus", "mqtt", "opentherm", "serial", "commands",
+  "1wire", "s0", "optionalpcb", "query", "timers", "rules", "log"
+};
+
+/*
+ * Budgets in ms of the stages that only handle buffered
+ * data and should never wait for I/O. The other stages,
+ * 0 here, use the loop_budget setting, which is also the
+ * upper bound. A loop_budget of 0 turns the watchdog off.
+ */
+static const uint16_t loopStageBudgets[LOOP_STAGES] PROGMEM = {
+  0, 0, 0, 50, 0, 0, 50, 50,
+  0, 20, 0, 0, 0, 0, 50
+};
+
+static uint16_t loopstats_budget(uint8_t stage) {
+  uint16_t budget = pgm_read_word(&loopStageBudgets[stage]);
+
+  if (heishamonSettings.loop_budget == 0) {
+    return 0;
+  }
+  return (budget > 0 && budget < heishamonSettings.loop_budget) ? budget : heishamonSettings.loop_budget;
+}
+
+/*
+ * Histogram buckets of a whole loop pass, without the idle
+ * sleep: < 100us, < 1ms, < 10ms, < 100ms, < 1s and slower.
+ */
+#define LOOPSTATS_BUCKETS 6
+
+struct loopStageStruct {
+  uint64_t total = 0;
+  uint32_t calls = 0;
+  uint32_t max = 0;
+  uint32_t over = 0; //times the budget was exceeded
+};
+
+static loopStageStruct loopStages[LOOP_STAGES];
+static uint32_t loopPasses = 0;
+static uint32_t loopMax = 0;
+static uint64_t loopTotal = 0;
+static uint32_t loopHistogram[LOOPSTATS_BUCKETS] = { 0 };
+static bool loopWarning = false;
+
+void loopstats_record(uint8_t stage, uint32_t duration) {
+  loopStageStruct *node = &loopStages[stage];
+
+  node->calls++;
+  node->total += duration;
+  if (duration > node->max) {
+    node->max = duration;
+  }
+  uint16_t budget = loopstats_budget(stage);
+  if ((budget > 0) && (duration > 1000UL * budget)) {
+    node->over++;
+    //the warning itself is logged, so don't warn about that again
+    if (!loopWarning) {
+      char name[12];
+      loopWarning = true;
+      strcpy_P(name, loopStageNames[stage]);
+      log_warn(LOG_MAIN, "Loop watchdog: %s took %lu ms, budget is %u ms", name, (unsigned long)(duration / 1000), budget);
+      loopWarning = false;
+    }
+  }
+}
+
+// records the time since start and returns the start of the next stage
+uint32_t loopstats_stage(uint8_t stage, uint32_t start) {
+  uint32_t now = micros();
+  loopstats_record(stage, now - start);
+  return now;
+}
+
+void loopstats_pass(uint32_t start) {
+  static const uint32_t buckets[LOOPSTATS_BUCKETS - 1] = { 100, 1000, 10000, 100000, 1000000 };
+  uint32_t duration = micros() - start;
+  uint8_t i = 0;
+
+  loopPasses++;
+  loopTotal += duration;
+  if (duration > loopMax) {
+    loopMax = duration;
+  }
+  while (i < LOOPSTATS_BUCKETS - 1 && duration >= buckets[i]) {
+    i++;
+  }
+  loopHistogram[i]++;
+}
+
+int loopstats_json(char *buf, uint16_t len) {
+  return snprintf_P(buf, len,
+    PSTR("{\"passes\":%lu,\"avg\":%lu,\"max\":%lu,\"budget\":%u,\"histogram\":[%lu,%lu,%lu,%lu,%lu,%lu]}"),
+    (unsigned long)loopPasses, (unsigned long)(loopPasses > 0 ? loopTotal / loopPasses : 0), (unsigned long)loopMax,
+    heishamonSettings.loop_budget,
+    (unsigned long)loopHistogram[0], (unsigned long)loopHistogram[1], (unsigned long)loopHistogram[2],
+    (unsigned long)loopHistogram[3], (unsigned long)loopHistogram[4], (unsigned long)loopHistogram[5]);
+}
+
+int loopstats_stage_json(uint8_t stage, char *buf, uint16_t len) {
+  loopStageStruct *node = NULL;
+  char name[12];
+
+  if (stage >= LOOP_STAGES) {
+    return -1;
+  }
+  node = &loopStages[stage];
+  strcpy_P(name, loopStageNames[stage]);
+
+  //total in ms, everything else in us
+  return snprintf_P(buf, len,
+    PSTR("{\"stage\":\"%s\",\"calls\":%lu,\"total\":%lu,\"max\":%lu,\"avg\":%lu,\"over\":%lu,\"budget\":%u}"),
+    name, (unsigned long)node->calls, (unsigned long)(node->total / 1000), (unsigned long)node->max,
+    (unsigned long)(node->calls > 0 ? node->total / node->calls : 0), (unsigned long)node->over, loopstats_budget(stage));
+}
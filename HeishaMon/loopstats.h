@@ -0,0 +1,38 @@
+#ifndef _LOOPSTATS_H_
+#define _LOOPSTATS_H_
+
+#include <Arduino.h>
+
+/*
+ * Stages of the main loop. The rules stage is nested,
+ * its time is also part of the stage that ran the rule.
+ * The log stage writes the queued log messages. A stage
+ * is timed every pass, also when it was skipped, so its
+ * calls are loop passes.
+ */
+typedef enum {
+  LOOP_STAGE_WEBSERVER = 0,
+  LOOP_STAGE_WIFI,
+  LOOP_STAGE_OTA,
+  LOOP_STAGE_MODBUS,
+  LOOP_STAGE_MQTT,
+  LOOP_STAGE_OPENTHERM,
+  LOOP_STAGE_SERIAL,
+  LOOP_STAGE_COMMANDS,
+  LOOP_STAGE_1WIRE,
+  LOOP_STAGE_S0,
+  LOOP_STAGE_OPTIONALPCB,
+  LOOP_STAGE_QUERY,
+  LOOP_STAGE_TIMERS,
+  LOOP_STAGE_RULES,
+  LOOP_STAGE_LOG,
+  LOOP_STAGES
+} loop_stage_t;
+
+void loopstats_record(uint8_t stage, uint32_t duration);
+uint32_t loopstats_stage(uint8_t stage, uint32_t start);
+void loopstats_pass(uint32_t start);
+int loopstats_json(char *buf, uint16_t len);
+int loopstats_stage_json(uint8_t stage, char *buf, uint16_t len);
+
+#endif
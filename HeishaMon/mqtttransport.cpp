@@ -0,0 +1,285 @@
+#include "mqtttransport.h"
+#include "src/common/idle.h"
+
+#if defined(ESP32)
+  //the AsyncTCP callbacks run in their own task
+  #define MQTTTRANSPORT_LOCK() portENTER_CRITICAL(&_lock)
+  #define MQTTTRANSPORT_UNLOCK() portEXIT_CRITICAL(&_lock)
+#else
+  //the ESPAsyncTCP callbacks run between two loop() calls
+  #define MQTTTRANSPORT_LOCK()
+  #define MQTTTRANSPORT_UNLOCK()
+#endif
+
+#define MQTT_CONNECT 0x10
+#define MQTT_CONNACK 0x20
+
+MqttTransport::MqttTransport() {
+  _state = MQTTTRANSPORT_IDLE;
+  _replay = false;
+  _head = 0;
+  _tail = 0;
+  _count = 0;
+#if defined(ESP32)
+  _lock = portMUX_INITIALIZER_UNLOCKED;
+#endif
+  _client.onConnect(&MqttTransport::onConnect, this);
+  _client.onDisconnect(&MqttTransport::onDisconnect, this);
+  _client.onError(&MqttTransport::onError, this);
+  _client.onData(&MqttTransport::onData, this);
+}
+
+void MqttTransport::onConnect(void *arg, AsyncClient *client) {
+  ((MqttTransport *)arg)->_state = MQTTTRANSPORT_OPEN;
+  idle_wakeup();
+}
+
+void MqttTransport::onDisconnect(void *arg, AsyncClient *client) {
+  ((MqttTransport *)arg)->_state = MQTTTRANSPORT_CLOSED;
+}
+
+void MqttTransport::onError(void *arg, AsyncClient *client, int8_t error) {
+  ((MqttTransport *)arg)->_state = MQTTTRANSPORT_CLOSED;
+}
+
+void MqttTransport::onData(void *arg, AsyncClient *client, void *data, size_t len) {
+  MqttTransport *self = (MqttTransport *)arg;
+  bool overflow = false;
+
+#if defined(ESP32)
+  portENTER_CRITICAL(&self->_lock);
+#endif
+  if (len > (size_t)(MQTTTRANSPORT_RXSIZE - self->_count)) {
+    overflow = true;
+  } else {
+    for (size_t i = 0; i < len; i++) {
+      self->_rx[self->_head] = ((uint8_t *)data)[i];
+      self->_head = (self->_head + 1) % MQTTTRANSPORT_RXSIZE;
+    }
+    self->_count += len;
+  }
+#if defined(ESP32)
+  portEXIT_CRITICAL(&self->_lock);
+#endif
+  //PubSubClient can't skip a packet, so a lost one ends the connection
+  if (overflow) {
+    self->_state = MQTTTRANSPORT_CLOSED;
+    client->close(true);
+  }
+  //the loop may be sleeping, the data is read from there
+  idle_wakeup();
+}
+
+bool MqttTransport::begin(const char *host, uint16_t port) {
+  IPAddress ip;
+  bool started = false;
+
+  stop();
+  _state = MQTTTRANSPORT_OPENING;
+  if (ip.fromString(host)) {
+    started = _client.connect(ip, port);
+  } else {
+    started = _client.connect(host, port);
+  }
+  if (!started) {
+    _state = MQTTTRANSPORT_CLOSED;
+  }
+  return started;
+}
+
+uint8_t MqttTransport::state() {
+  return _state;
+}
+
+static bool mqttAddString(AsyncClient *client, const char *str) {
+  uint16_t len = strlen(str);
+  uint8_t header[2] = { (uint8_t)(len >> 8), (uint8_t)(len & 0xFF) };
+
+  return client->add((const char *)header, 2) == 2 && (len == 0 || client->add(str, len) == len);
+}
+
+/*
+ * The same CONNECT PubSubClient builds for MQTT 3.1.1
+ * with a clean session. Like PubSubClient, an empty
+ * user name is still sent and the password only with
+ * a user name.
+ */
+bool MqttTransport::sendConnect(const char *id, const char *user, const char *pass, const char *willTopic, uint8_t willQos, bool willRetain, const char *willMessage, uint16_t keepAlive) {
+  uint8_t header[5 + 10];
+  uint32_t remaining = 10 + 2 + strlen(id);
+  uint8_t flags = 0x02;
+  uint8_t pos = 0;
+
+  if (_state != MQTTTRANSPORT_OPEN) {
+    return false;
+  }
+  if (willTopic != NULL) {
+    flags |= 0x04 | (willQos << 3) | (willRetain ? 0x20 : 0);
+    remaining += 2 + strlen(willTopic) + 2 + strlen(willMessage);
+  }
+  if (user != NULL) {
+    flags |= 0x80;
+    remaining += 2 + strlen(user);
+    if (pass != NULL) {
+      flags |= 0x40;
+      remaining += 2 + strlen(pass);
+    }
+  }
+
+  header[pos++] = MQTT_CONNECT;
+  do {
+    uint8_t digit = remaining % 128;
+    remaining /= 128;
+    header[pos++] = digit | ((remaining > 0) ? 0x80 : 0);
+  } while (remaining > 0 && pos < 5);
+  const uint8_t variable[10] = { 0x00, 0x04, 'M', 'Q', 'T', 'T', 0x04, flags, (uint8_t)(keepAlive >> 8), (uint8_t)(keepAlive & 0xFF) };
+  memcpy(&header[pos], variable, sizeof(variable));
+  pos += sizeof(variable);
+
+  if (_client.space() < (size_t)pos + 2 + strlen(id)) {
+    return false;
+  }
+  bool added = _client.add((const char *)header, pos) == pos && mqttAddString(&_client, id);
+  if (added && willTopic != NULL) {
+    added = mqttAddString(&_client, willTopic) && mqttAddString(&_client, willMessage);
+  }
+  if (added && user != NULL) {
+    added = mqttAddString(&_client, user) && (pass == NULL || mqttAddString(&_client, pass));
+  }
+  return added && _client.send();
+}
+
+int MqttTransport::connack() {
+  int ret = MQTTTRANSPORT_WAITING;
+
+  MQTTTRANSPORT_LOCK();
+  if (_count >= 4) {
+    if (_rx[_tail] != MQTT_CONNACK || _rx[(_tail + 1) % MQTTTRANSPORT_RXSIZE] != 2) {
+      ret = MQTTTRANSPORT_INVALID;
+    } else {
+      ret = _rx[(_tail + 3) % MQTTTRANSPORT_RXSIZE];
+    }
+  }
+  MQTTTRANSPORT_UNLOCK();
+  if (ret == MQTTTRANSPORT_WAITING && _state != MQTTTRANSPORT_OPEN) {
+    ret = MQTTTRANSPORT_INVALID;
+  }
+  return ret;
+}
+
+void MqttTransport::replayConnect() {
+  _replay = true;
+}
+
+size_t MqttTransport::space() {
+  if (_state != MQTTTRANSPORT_OPEN) {
+    return 0;
+  }
+  return _client.space();
+}
+
+//PubSubClient finds the connection open, it only connects through begin()
+int MqttTransport::connect(IPAddress ip, uint16_t port) {
+  return 0;
+}
+
+int MqttTransport::connect(const char *host, uint16_t port) {
+  return 0;
+}
+
+#if defined(ESP32)
+int MqttTransport::connect(IPAddress ip, uint16_t port, int32_t timeout) {
+  return 0;
+}
+
+int MqttTransport::connect(const char *host, uint16_t port, int32_t timeout) {
+  return 0;
+}
+#endif
+
+size_t MqttTransport::write(uint8_t b) {
+  return write(&b, 1);
+}
+
+/*
+ * Never waits for room in the send buffer, a packet
+ * that doesn't fit is refused as a whole.
+ */
+size_t MqttTransport::write(const uint8_t *buf, size_t size) {
+  if (_replay) {
+    _replay = false;
+    return size;
+  }
+  if (_state != MQTTTRANSPORT_OPEN || _client.space() < size) {
+    return 0;
+  }
+  size_t written = _client.add((const char *)buf, size);
+  _client.send();
+  return written;
+}
+
+int MqttTransport::available() {
+  return _count;
+}
+
+int MqttTransport::read() {
+  int b = -1;
+
+  MQTTTRANSPORT_LOCK();
+  if (_count > 0) {
+    b = _rx[_tail];
+    _tail = (_tail + 1) % MQTTTRANSPORT_RXSIZE;
+    _count--;
+  }
+  MQTTTRANSPORT_UNLOCK();
+  return b;
+}
+
+int MqttTransport::read(uint8_t *buf, size_t size) {
+  size_t n = 0;
+
+  MQTTTRANSPORT_LOCK();
+  while (n < size && _count > 0) {
+    buf[n++] = _rx[_tail];
+    _tail = (_tail + 1) % MQTTTRANSPORT_RXSIZE;
+    _count--;
+  }
+  MQTTTRANSPORT_UNLOCK();
+  return n;
+}
+
+int MqttTransport::peek() {
+  int b = -1;
+
+  MQTTTRANSPORT_LOCK();
+  if (_count > 0) {
+    b = _rx[_tail];
+  }
+  MQTTTRANSPORT_UNLOCK();
+  return b;
+}
+
+//written data is handed to the tcp stack at once
+void MqttTransport::flush() {
+}
+
+void MqttTransport::stop() {
+  _replay = false;
+  if (_state == MQTTTRANSPORT_OPENING || _state == MQTTTRANSPORT_OPEN) {
+    _client.close(true);
+  }
+  _state = MQTTTRANSPORT_IDLE;
+  MQTTTRANSPORT_LOCK();
+  _head = 0;
+  _tail = 0;
+  _count = 0;
+  MQTTTRANSPORT_UNLOCK();
+}
+
+uint8_t MqttTransport::connected() {
+  return _state == MQTTTRANSPORT_OPEN;
+}
+
+MqttTransport::operator bool() {
+  return connected();
+}
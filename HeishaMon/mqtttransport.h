@@ -0,0 +1,91 @@
+#ifndef _MQTTTRANSPORT_H_
+#define _MQTTTRANSPORT_H_
+
+#include <Arduino.h>
+#include <Client.h>
+#if defined(ESP8266)
+  #include <ESPAsyncTCP.h>
+#else
+  #include <AsyncTCP.h>
+#endif
+
+/*
+ * The connection PubSubClient talks through. The name
+ * lookup, the tcp connect and the wait for the CONNACK
+ * all finish in AsyncTCP callbacks, the main loop only
+ * polls for the result, so a (re)connect never waits
+ * for the network.
+ *
+ * PubSubClient only returns from connect() after the
+ * CONNACK, so the CONNECT is sent by sendConnect()
+ * first. Once the server accepted it, the CONNECT that
+ * PubSubClient writes is dropped and it reads the
+ * CONNACK that is already buffered.
+ */
+#if defined(ESP32)
+  #define MQTTTRANSPORT_RXSIZE 2048
+#else
+  #define MQTTTRANSPORT_RXSIZE 1280
+#endif
+
+#define MQTTTRANSPORT_IDLE 0
+#define MQTTTRANSPORT_OPENING 1
+#define MQTTTRANSPORT_OPEN 2
+#define MQTTTRANSPORT_CLOSED 3
+
+//connack() while no answer is there yet
+#define MQTTTRANSPORT_WAITING -1
+//the server didn't answer with a CONNACK
+#define MQTTTRANSPORT_INVALID 0xFF
+
+class MqttTransport : public Client {
+public:
+    MqttTransport();
+
+    //starts the lookup of host and the connect to it
+    bool begin(const char *host, uint16_t port);
+    uint8_t state();
+    bool sendConnect(const char *id, const char *user, const char *pass, const char *willTopic, uint8_t willQos, bool willRetain, const char *willMessage, uint16_t keepAlive);
+    //the CONNACK return code, MQTTTRANSPORT_WAITING or MQTTTRANSPORT_INVALID
+    int connack();
+    //drops the next write, the CONNECT of PubSubClient
+    void replayConnect();
+    //bytes that can be written now without waiting
+    size_t space();
+
+    int connect(IPAddress ip, uint16_t port);
+    int connect(const char *host, uint16_t port);
+#if defined(ESP32)
+    int connect(IPAddress ip, uint16_t port, int32_t timeout);
+    int connect(const char *host, uint16_t port, int32_t timeout);
+#endif
+    size_t write(uint8_t b);
+    size_t write(const uint8_t *buf, size_t size);
+    int available();
+    int read();
+    int read(uint8_t *buf, size_t size);
+    int peek();
+    void flush();
+    void stop();
+    uint8_t connected();
+    operator bool();
+
+private:
+    static void onConnect(void *arg, AsyncClient *client);
+    static void onDisconnect(void *arg, AsyncClient *client);
+    static void onError(void *arg, AsyncClient *client, int8_t error);
+    static void onData(void *arg, AsyncClient *client, void *data, size_t len);
+
+    AsyncClient _client;
+    volatile uint8_t _state;
+    bool _replay;
+    uint8_t _rx[MQTTTRANSPORT_RXSIZE];
+    volatile uint16_t _head;
+    volatile uint16_t _tail;
+    volatile uint16_t _count;
+#if defined(ESP32)
+    portMUX_TYPE _lock;
+#endif
+};
+
+#endif
@@ -21,15 +21,19 @@
 #include "src/common/timerqueue.h"
 #include "src/common/progmem.h"
 #include "src/rules/rules.h"
+#include "rules.h"
+#include "loopstats.h"
 
 #include "dallas.h"
 #include "webfunctions.h"
 #include "decode.h"
 #include "HeishaOT.h"
 #include "commands.h"
+#include "version.h"
 
 #define MAXCOMMANDSINBUFFER 10
 #define OPTDATASIZE 20
+#define RULES_IMAGE_FILE "/rules.bin"
 
 bool send_command(byte* command, int length);
 
@@ -42,7 +46,7 @@ extern char actDataExtra[DATASIZE];
 extern String openTherm[2];
 static uint8_t parsing = 0;
 
-static struct rules_t **rules = NULL;
+struct rules_t **rules = NULL;
 uint8_t nrrules = 0;
 
 struct rule_options_t rule_options;
@@ -65,17 +69,125 @@ typedef struct array_t {
   uint8_t type;
 } array_t;
 
-typedef struct varstack_t {
-  struct array_t *array;
-  uint16_t nr;
-} varstack_t;
+/*
+ * Local and global variables are resolved to a slot while
+ * parsing as well. Globals live in a table with an entry
+ * per #name, locals in a frame per rule block. A $name
+ * keeps the same frame index in every rule block using
+ * it, see rules_alloc_frames. All frames share one
+ * allocation and neither table grows while the rules are
+ * running.
+ */
+typedef struct rules_frame_t {
+  uint16_t offset;
+  uint8_t size;
+} rules_frame_t;
+
+static struct array_t *globals = NULL;
+static uint8_t nrglobals = 0;
+static struct array_t *locals = NULL;
+static uint8_t nrlocals = 0;
+static struct rules_frame_t *frames = NULL;
+static uint8_t nrframes = 0;
+//set when a variable didn't get a slot, the rules are rejected
+static uint8_t slotsfull = 0;
+
+/*
+ * Heatpump, opentherm, dallas and clock variables are
+ * resolved to a slot once while parsing, so reading them
+ * at runtime is an indexed lookup instead of a name scan.
+ * Decoded heatpump values are cached per slot until the
+ * next frame arrives.
+ */
+typedef enum {
+  SLOT_TOPIC = 1,
+  SLOT_XTOPIC,
+  SLOT_OPTTOPIC,
+  SLOT_OPENTHERM,
+  SLOT_DALLAS,
+  SLOT_HOUR,
+  SLOT_MINUTE,
+  SLOT_MONTH,
+  SLOT_DAY,
+  SLOT_LOCAL,
+  SLOT_GLOBAL
+} rules_slot_kinds;
+
+typedef struct rules_slot_t {
+  uint8_t kind;
+  uint8_t index;
+  uint8_t type;
+  //the index of a local in the frames
+  uint8_t frameidx;
+  uint32_t sequence;
+  union {
+    int i;
+    float f;
+  } val;
+} rules_slot_t;
+
+static struct rules_slot_t *slots = NULL;
+static uint8_t nrslots = 0;
+
+/*
+ * Event subscriptions are compiled into lookup tables
+ * when the rules are parsed, so a value change without
+ * a listening rule block costs a single table lookup.
+ * Entries hold the rule index + 1, 0 means no listener,
+ * the engine keeps the rule index below 127. Names match
+ * without regard to case, like rule_by_name does.
+ */
+typedef struct rules_timer_event_t {
+  int nr;
+  uint8_t rule;
+} rules_timer_event_t;
+
+static uint8_t topic_events[NUMBER_OF_TOPICS] = { 0 };
+static uint8_t xtopic_events[NUMBER_OF_TOPICS_EXTRA] = { 0 };
+static uint8_t opttopic_events[NUMBER_OF_OPT_TOPICS] = { 0 };
+static uint8_t *ot_events = NULL;
+static uint8_t nr_ot_events = 0;
+static struct rules_timer_event_t *timer_events = NULL;
+static uint8_t nr_timer_events = 0;
+static uint8_t dallas_events = 0;
+
+/*
+ * Topics changed by the last decoded frame and, when
+ * coalesce_rules is set, the rule blocks waiting to
+ * run once that frame is fully decoded.
+ */
+static uint8_t topic_changed[(NUMBER_OF_TOPICS+7)/8] = { 0 };
+static uint8_t xtopic_changed[(NUMBER_OF_TOPICS_EXTRA+7)/8] = { 0 };
+static uint8_t opttopic_changed[(NUMBER_OF_OPT_TOPICS+7)/8] = { 0 };
+static uint8_t pending_rules[256/8] = { 0 };
+//the table of the frame being decoded, -1 outside a frame
+static int8_t frame_table = -1;
 
-static struct varstack_t global_varstack = { .array = NULL, .nr = 0 };
+/*
+ * Execution stats per rule block, the histogram
+ * buckets are < 100us, < 1ms, < 10ms, < 100ms
+ * and anything slower.
+ */
+#define RULES_STATS_BUCKETS 5
+
+typedef struct rules_stats_t {
+  uint32_t calls;
+  uint32_t total;
+  uint32_t max;
+  uint32_t ops;
+  uint16_t stackpeak;
+  uint16_t histogram[RULES_STATS_BUCKETS];
+} rules_stats_t;
+
+static struct rules_stats_t *stats = NULL;
+static uint16_t mempool_used = 0;
 
 #if defined(ESP8266)
 unsigned char *mempool = (unsigned char *)MEMPOOL_ADDRESS;
 #elif defined(ESP32)
 unsigned char *mempool; //malloc in runtime
+#else
+unsigned char mempool[MEMPOOL_SIZE] __attribute__((aligned(4)));
 #endif
 unsigned int memptr = 0;
 
@@ -115,7 +227,7 @@ unsigned int memptr = 0;
 static int8_t is_variable(char *text, uint16_t size) {
   uint16_t i = 1, x = 0, match = 0;
 
-  if(size == strlen_P(PSTR("ds18b20#2800000000000000")) && strncmp_P(text, PSTR("ds18b20#"), 8) == 0) {
+  if(size == strlen_P(PSTR("ds18b20#2800000000000000")) && strnicmp(text, _F("ds18b20#"), 8) == 0) {
     return 24;
   } else if(text[0] == '$' || text[0] == '#' || text[0] == '@' || text[0] == '%' || text[0] == '?') {
     while(isalnum(text[i])) {
@@ -216,7 +328,7 @@ static int8_t is_variable(char *text, uint16_t size) {
         x++;
       }
       if(match == 0) {
-        logprintf_P(F("err: %s %d"), __FUNCTION__, __LINE__);
+        log_error(LOG_RULES, "err: %s %d", __FUNCTION__, __LINE__);
         return -1;
       }
     }
@@ -317,7 +429,7 @@ static int8_t is_event(char *text, uint16_t size) {
     return i;
   }
 
-  if(size == strlen_P(PSTR("ds18b20#2800000000000000")) && strncmp_P((const char *)text, PSTR("ds18b20#"), 8) == 0) {
+  if(size == strlen_P(PSTR("ds18b20#2800000000000000")) && strnicmp(text, _F("ds18b20#"), 8) == 0) {
     return 24;
   }
 
@@ -336,9 +448,7 @@ static void rule_done_cb(struct rules_t *obj) {
 static int8_t event_cb(struct rules_t *obj, char *name) {
   int8_t nr = rule_by_name(rules, nrrules, name);
   if(nr == -1) {
-    char msg[100];
-    sprintf_P((char *)&msg, PSTR("Rule block '%s' not found"), name);
-    log_message(name);
+    log_warn(LOG_RULES, "Rule block '%s' not found", name);
     return -1;
   }
 
@@ -379,181 +489,598 @@ static int8_t check_is_number(const char *str) {
   return 0;
 }
 
-static int8_t vm_value_get(struct rules_t *obj) {
-  int16_t x = 0;
-
-  if(rules_gettop(obj) < 1) {
-    return -1;
-  }
-  if(rules_type(obj, -1) != VCHAR) {
-    return -1;
-  }
-
-  const char *key = rules_tostring(obj, -1);
-
-  if(key[0] == '?') {
-    int x = 0;
-    while(heishaOTDataStruct[x].name != NULL) {
-      if(heishaOTDataStruct[x].rw >= 2 &&
-         stricmp((char *)&key[1], heishaOTDataStruct[x].name) == 0) {
-        if(heishaOTDataStruct[x].type == TBOOL) {
-          rules_pushinteger(obj, (int)heishaOTDataStruct[x].value.b);
-          return 0;
-        }
-        if(heishaOTDataStruct[x].type == TFLOAT) {
-          rules_pushfloat(obj, heishaOTDataStruct[x].value.f);
-          return 0;
-        }
-        break;
+/*
+ * Resolve a variable name to the value it reads. Used
+ * once per name while parsing and as fallback for names
+ * that did not get a slot.
+ */
+static int8_t rules_resolve_slot(const char *name, struct rules_slot_t *slot) {
+  uint16_t i = 0;
+
+  memset(slot, 0, sizeof(struct rules_slot_t));
+
+  if(name[0] == '?') {
+    while(heishaOTDataStruct[i].name != NULL) {
+      if(stricmp((char *)&name[1], heishaOTDataStruct[i].name) == 0) {
+        slot->kind = SLOT_OPENTHERM;
+        slot->index = i;
+        return 0;
       }
-      x++;
+      i++;
     }
-    logprintf_P(F("err: %s %d"), __FUNCTION__, __LINE__);
-  } else if(key[0] == '%') {
-    time_t now = time(NULL);
-    struct tm *tm_struct = localtime(&now);
-    if(stricmp((char *)&key[1], "hour") == 0) {
-      rules_pushinteger(obj, (int)tm_struct->tm_hour);
+  } else if(name[0] == '%') {
+    if(stricmp((char *)&name[1], "hour") == 0) {
+      slot->kind = SLOT_HOUR;
       return 0;
-    } else if(stricmp((char *)&key[1], "minute") == 0) {
-      rules_pushinteger(obj, (int)tm_struct->tm_min);
+    } else if(stricmp((char *)&name[1], "minute") == 0) {
+      slot->kind = SLOT_MINUTE;
       return 0;
-    } else if(stricmp((char *)&key[1], "month") == 0) {
-      rules_pushinteger(obj, (int)tm_struct->tm_mon);
+    } else if(stricmp((char *)&name[1], "month") == 0) {
+      slot->kind = SLOT_MONTH;
       return 0;
-    } else if(stricmp((char *)&key[1], "day") == 0) {
-      rules_pushinteger(obj, (int)tm_struct->tm_wday+1);
+    } else if(stricmp((char *)&name[1], "day") == 0) {
+      slot->kind = SLOT_DAY;
       return 0;
     }
-  } else if(strnicmp((const char *)key, _F("ds18b20#"), 8) == 0) {
-    uint8_t i = 0;
-    for(i=0;i<dallasDevicecount;i++) {
-      if(strncmp(actDallasData[i].address, (const char *)&key[8], 16) == 0) {
-        rules_pushfloat(obj, actDallasData[i].temperature);
-        return 0;
-      }
-    }
-    rules_pushnil(obj);
+  } else if(strnicmp(name, _F("ds18b20#"), 8) == 0) {
+    slot->kind = SLOT_DALLAS;
+    slot->index = 0xFF;
     return 0;
-  } else if(key[0] == '@') {
-    uint16_t i = 0;
+  } else if(name[0] == '@') {
     for(i=0;i<NUMBER_OF_TOPICS;i++) {
       char cpy[MAX_TOPIC_LEN];
       memcpy_P(&cpy, topics[i], MAX_TOPIC_LEN);
-      if(stricmp(cpy, (char *)&key[1]) == 0) {
-        String dataValue = actData[0] == '\0' ? "" : getDataValue(actData, i);
-        char *str = (char *)dataValue.c_str();
-        if(strlen(str) == 0) {
-          rules_pushnil(obj);
-        } else if(check_is_number(str) == 0) {
-          float var = atof(str);
-          float nr = 0;
-
-          if(modff(var, &nr) == 0) {
-            rules_pushinteger(obj, (int)var);
-            return 0;
-          } else {
-            rules_pushfloat(obj, var);
-            return 0;
-          }
-        } else {
-          rules_pushstring(obj, str);
-        }
+      if(stricmp(cpy, (char *)&name[1]) == 0) {
+        slot->kind = SLOT_TOPIC;
+        slot->index = i;
+        return 0;
       }
     }
     for(i=0;i<NUMBER_OF_OPT_TOPICS;i++) {
       char cpy[MAX_TOPIC_LEN];
-      memcpy_P(&cpy, topics[i], MAX_TOPIC_LEN);
-      if(stricmp(cpy, (char *)&key[1]) == 0) {
-        String dataValue = actOptData[0] == '\0' ? "" : getOptDataValue(actOptData, i);
-        char *str = (char *)dataValue.c_str();
-        if(strlen(str) == 0) {
-          rules_pushnil(obj);
-        } else if(check_is_number(str) == 0) {
-          float var = atof(str);
-          float nr = 0;
-
-          if(modff(var, &nr) == 0) {
-            rules_pushinteger(obj, (int)var);
-            return 0;
-          } else {
-            rules_pushfloat(obj, var);
-            return 0;
-          }
-        } else {
-          rules_pushstring(obj, str);
-        }
+      memcpy_P(&cpy, optTopics[i], MAX_TOPIC_LEN);
+      if(stricmp(cpy, (char *)&name[1]) == 0) {
+        slot->kind = SLOT_OPTTOPIC;
+        slot->index = i;
+        return 0;
       }
     }
     for(i=0;i<NUMBER_OF_TOPICS_EXTRA;i++) {
       char cpy[MAX_TOPIC_LEN];
       memcpy_P(&cpy, xtopics[i], MAX_TOPIC_LEN);
-      if(stricmp(cpy, (char *)&key[1]) == 0) {
-        String dataValue = actDataExtra[0] == '\0' ? "" : getDataValueExtra(actDataExtra, i);
-        char *str = (char *)dataValue.c_str();
-        if(strlen(str) == 0) {
-          rules_pushnil(obj);
-        } else if(check_is_number(str) == 0) {
-          float var = atof(str);
-          float nr = 0;
+      if(stricmp(cpy, (char *)&name[1]) == 0) {
+        slot->kind = SLOT_XTOPIC;
+        slot->index = i;
+        return 0;
+      }
+    }
+  }
+  return -1;
+}
 
-          if(modff(var, &nr) == 0) {
-            rules_pushinteger(obj, (int)var);
-            return 0;
-          } else {
-            rules_pushfloat(obj, var);
-            return 0;
+static uint8_t vm_value_slot(const char *name) {
+  struct rules_slot_t slot;
+
+  if(nrslots == 255) {
+    /*
+     * Topics fall back to a name scan, variables
+     * can't be stored without a slot.
+     */
+    if(slotsfull == 0 && (name[0] == '#' || name[0] == '$')) {
+      log_error(LOG_RULES, "rules: no slot left for %s, at most 255 variables and topics", name);
+      slotsfull = 1;
+    }
+    return 0;
+  }
+
+  if(name[0] == '#') {
+    if((globals = (struct array_t *)REALLOC(globals, sizeof(struct array_t)*(nrglobals+1))) == NULL) {
+      OUT_OF_MEMORY
+    }
+    memset(&globals[nrglobals], 0, sizeof(struct array_t));
+    globals[nrglobals].key = name;
+
+    memset(&slot, 0, sizeof(struct rules_slot_t));
+    slot.kind = SLOT_GLOBAL;
+    slot.index = nrglobals++;
+  } else if(name[0] == '$') {
+    memset(&slot, 0, sizeof(struct rules_slot_t));
+    slot.kind = SLOT_LOCAL;
+    slot.index = nrlocals++;
+  } else if(rules_resolve_slot(name, &slot) == -1) {
+    return 0;
+  }
+
+  if((slots = (struct rules_slot_t *)REALLOC(slots, sizeof(struct rules_slot_t)*(nrslots+1))) == NULL) {
+    OUT_OF_MEMORY
+  }
+  memcpy(&slots[nrslots], &slot, sizeof(struct rules_slot_t));
+  nrslots++;
+
+  return nrslots;
+}
+
+static void rules_free_slots(void) {
+  FREE(slots);
+  nrslots = 0;
+  slotsfull = 0;
+}
+
+static void rules_free_events(void) {
+  memset(&pending_rules, 0, sizeof(pending_rules));
+  memset(&topic_events, 0, sizeof(topic_events));
+  memset(&xtopic_events, 0, sizeof(xtopic_events));
+  memset(&opttopic_events, 0, sizeof(opttopic_events));
+  FREE(ot_events);
+  nr_ot_events = 0;
+  FREE(timer_events);
+  nr_timer_events = 0;
+  dallas_events = 0;
+}
+
+static void rules_free_vars(void) {
+  FREE(globals);
+  nrglobals = 0;
+  FREE(locals);
+  FREE(frames);
+  nrlocals = 0;
+  nrframes = 0;
+}
+
+static void rules_free_compiled(void) {
+  rules_free_slots();
+  rules_free_vars();
+  rules_free_events();
+  FREE(stats);
+  mempool_used = 0;
+}
+
+static void rules_set_event(uint8_t *event, uint8_t rule) {
+  /*
+   * Like rule_by_name, the first block
+   * with a matching name wins.
+   */
+  if(*event == 0) {
+    *event = rule+1;
+  }
+}
+
+static void rules_build_events(void) {
+  struct rules_slot_t slot;
+  uint8_t i = 0;
+
+  rules_free_events();
+
+  while(heishaOTDataStruct[nr_ot_events].name != NULL) {
+    nr_ot_events++;
+  }
+  if((ot_events = (uint8_t *)MALLOC(nr_ot_events)) == NULL) {
+    OUT_OF_MEMORY
+  }
+  memset(ot_events, 0, nr_ot_events);
+
+  for(i=0;i<nrrules;i++) {
+    const char *name = rules[i]->name;
+    if(name == NULL) {
+      continue;
+    }
+    if(strnicmp(name, _F("timer="), 6) == 0) {
+      //only a number, timer=1abc never fires
+      char *end = NULL;
+      long nr = isdigit((unsigned char)name[6]) ? strtol(&name[6], &end, 10) : 0;
+      if(end == NULL || *end != '\0') {
+        log_warn(LOG_RULES, "Rule block '%s' is not a valid timer", name);
+        continue;
+      }
+      if((timer_events = (struct rules_timer_event_t *)REALLOC(timer_events, sizeof(struct rules_timer_event_t)*(nr_timer_events+1))) == NULL) {
+        OUT_OF_MEMORY
+      }
+      timer_events[nr_timer_events].nr = nr;
+      timer_events[nr_timer_events].rule = i;
+      nr_timer_events++;
+    } else if(rules_resolve_slot(name, &slot) == 0) {
+      switch(slot.kind) {
+        case SLOT_TOPIC: {
+          rules_set_event(&topic_events[slot.index], i);
+        } break;
+        case SLOT_XTOPIC: {
+          rules_set_event(&xtopic_events[slot.index], i);
+        } break;
+        case SLOT_OPTTOPIC: {
+          rules_set_event(&opttopic_events[slot.index], i);
+        } break;
+        case SLOT_OPENTHERM: {
+          rules_set_event(&ot_events[slot.index], i);
+        } break;
+        case SLOT_DALLAS: {
+          dallas_events++;
+        } break;
+      }
+    }
+  }
+}
+
+static void rules_clear_vars(struct array_t *vars, uint8_t nr) {
+  uint8_t i = 0;
+  for(i=0;i<nr;i++) {
+    if(vars[i].type == VCHAR && vars[i].val.s != NULL) {
+      rules_unref(vars[i].val.s);
+    }
+    vars[i].val.n = NULL;
+    vars[i].type = 0;
+  }
+}
+
+/*
+ * A rule block points its userdata to its frame on
+ * first use, so only the frames actually used are
+ * cleared after a run.
+ */
+void rules_free_stack(void) {
+  uint8_t x = 0;
+  for(x=0;x<nrrules;x++) {
+    struct array_t *frame = (struct array_t *)rules[x]->userdata;
+    if(frame != NULL && x < nrframes) {
+      rules_clear_vars(frame, frames[x].size);
+      memset(frame, 0, sizeof(struct array_t)*frames[x].size);
+    }
+    rules[x]->userdata = NULL;
+  }
+}
+
+/*
+ * Lists the slots of the locals a rule block reads or
+ * writes at vars, in order of first use. Without vars
+ * they are only counted.
+ */
+static uint8_t rules_frame_vars(struct rules_t *obj, uint8_t *vars) {
+  uint8_t used[32];
+  uint8_t nr = 0;
+  uint16_t pos = 0;
+  int16_t slot = 0;
+
+  memset(&used, 0, sizeof(used));
+  while((slot = rules_nextslot(obj, &pos)) > -1) {
+    if(slot == 0 || slot > nrslots || slots[slot-1].kind != SLOT_LOCAL) {
+      continue;
+    }
+    uint8_t idx = slot-1;
+    if((used[idx >> 3] & (1 << (idx & 7))) == 0) {
+      used[idx >> 3] |= (1 << (idx & 7));
+      if(vars != NULL) {
+        vars[nr] = idx;
+      }
+      nr++;
+    }
+  }
+  return nr;
+}
+
+/*
+ * Gives every local the lowest frame index that no other
+ * local of a rule block using it has, so a local is found
+ * at the same index in each frame. A frame is as large as
+ * the highest index of its locals, which can leave unused
+ * entries in it.
+ */
+static void rules_alloc_frames(uint8_t nr) {
+  uint8_t *vars = NULL;
+  uint8_t taken[32];
+  uint16_t size = 0;
+  uint8_t x = 0, y = 0, i = 0, j = 0;
+
+  rules_free_stack();
+  FREE(locals);
+  FREE(frames);
+  nrframes = 0;
+
+  if(nr == 0 || nrlocals == 0) {
+    return;
+  }
+  if((frames = (struct rules_frame_t *)CALLOC(nr, sizeof(struct rules_frame_t))) == NULL) {
+    OUT_OF_MEMORY
+  }
+  for(x=0;x<nr;x++) {
+    frames[x].offset = size;
+    frames[x].size = rules_frame_vars(rules[x], NULL);
+    size += frames[x].size;
+  }
+  if(size > 0) {
+    if((vars = (uint8_t *)MALLOC(size)) == NULL) {
+      OUT_OF_MEMORY
+    }
+    for(x=0;x<nr;x++) {
+      rules_frame_vars(rules[x], &vars[frames[x].offset]);
+    }
+    for(x=0;x<nr;x++) {
+      for(i=0;i<frames[x].size;i++) {
+        slots[vars[frames[x].offset+i]].frameidx = 0xFF;
+      }
+    }
+    for(x=0;x<nr;x++) {
+      for(i=0;i<frames[x].size;i++) {
+        struct rules_slot_t *slot = &slots[vars[frames[x].offset+i]];
+        if(slot->frameidx != 0xFF) {
+          continue;
+        }
+        memset(&taken, 0, sizeof(taken));
+        for(y=0;y<nr;y++) {
+          uint8_t *list = &vars[frames[y].offset];
+          uint8_t found = 0;
+          for(j=0;j<frames[y].size;j++) {
+            if(&slots[list[j]] == slot) {
+              found = 1;
+              break;
+            }
           }
-        } else {
-          rules_pushstring(obj, str);
+          if(found == 0) {
+            continue;
+          }
+          for(j=0;j<frames[y].size;j++) {
+            uint8_t idx = slots[list[j]].frameidx;
+            if(idx != 0xFF) {
+              taken[idx >> 3] |= (1 << (idx & 7));
+            }
+          }
+        }
+        uint8_t idx = 0;
+        while((taken[idx >> 3] & (1 << (idx & 7))) != 0) {
+          idx++;
         }
+        slot->frameidx = idx;
       }
     }
-  } else {
-    struct varstack_t *table = NULL;
-    struct array_t *array = NULL;
-    if(key[0] == '$') {
-      table = (struct varstack_t *)obj->userdata;
-    } else if(key[0] == '#') {
-      table = &global_varstack;
+  }
+
+  size = 0;
+  for(x=0;x<nr;x++) {
+    uint8_t len = 0;
+    for(i=0;i<frames[x].size;i++) {
+      uint8_t idx = slots[vars[frames[x].offset+i]].frameidx;
+      if(idx+1 > len) {
+        len = idx+1;
+      }
     }
-    if(table == NULL) {
-      rules_pushnil(obj);
+    frames[x].offset = size;
+    frames[x].size = len;
+    size += len;
+  }
+  FREE(vars);
+
+  if(size > 0) {
+    if((locals = (struct array_t *)CALLOC(size, sizeof(struct array_t))) == NULL) {
+      OUT_OF_MEMORY
+    }
+  }
+  nrframes = nr;
+}
+
+static struct array_t *rules_frame(struct rules_t *obj) {
+  uint8_t nr = obj->nr-1;
+
+  if(obj->userdata != NULL) {
+    return (struct array_t *)obj->userdata;
+  }
+  /*
+   * While parsing, every new rule block can add
+   * names, so the frames are only final afterwards.
+   */
+  if(parsing == 1 && nrframes != nrrules) {
+    rules_alloc_frames(nrrules);
+  }
+  if(nr >= nrframes || frames[nr].size == 0) {
+    return NULL;
+  }
+  obj->userdata = &locals[frames[nr].offset];
+  return (struct array_t *)obj->userdata;
+}
+
+static struct array_t *rules_var(struct rules_t *obj, struct rules_slot_t *slot) {
+  switch(slot->kind) {
+    case SLOT_GLOBAL: {
+      return &globals[slot->index];
+    } break;
+    case SLOT_LOCAL: {
+      struct array_t *frame = rules_frame(obj);
+      if(frame != NULL && slot->frameidx < frames[obj->nr-1].size) {
+        return &frame[slot->frameidx];
+      }
+    } break;
+  }
+  return NULL;
+}
+
+static int8_t vm_value_get_topic(struct rules_t *obj, struct rules_slot_t *slot) {
+  uint32_t sequence = 0;
+  char *data = NULL;
+
+  switch(slot->kind) {
+    case SLOT_TOPIC: {
+      data = actData;
+      sequence = actDataSequence;
+    } break;
+    case SLOT_XTOPIC: {
+      data = actDataExtra;
+      sequence = actDataExtraSequence;
+    } break;
+    case SLOT_OPTTOPIC: {
+      data = actOptData;
+      sequence = actOptDataSequence;
+    } break;
+  }
+
+  if(data[0] == '\0') {
+    rules_pushnil(obj);
+    return 0;
+  }
+
+  /*
+   * The decoded value stays valid until the
+   * next frame is stored in the act* buffer.
+   */
+  if(slot->type == 0 || slot->sequence != sequence) {
+    String dataValue;
+    switch(slot->kind) {
+      case SLOT_TOPIC: {
+        dataValue = getDataValue(data, slot->index);
+      } break;
+      case SLOT_XTOPIC: {
+        dataValue = getDataValueExtra(data, slot->index);
+      } break;
+      case SLOT_OPTTOPIC: {
+        dataValue = getOptDataValue(data, slot->index);
+      } break;
+    }
+
+    char *str = (char *)dataValue.c_str();
+    if(strlen(str) == 0) {
+      slot->type = VNULL;
+    } else if(check_is_number(str) == 0) {
+      float var = atof(str);
+      float nr = 0;
+
+      if(modff(var, &nr) == 0) {
+        slot->type = VINTEGER;
+        slot->val.i = (int)var;
+      } else {
+        slot->type = VFLOAT;
+        slot->val.f = var;
+      }
     } else {
-      for(x=0;x<table->nr;x++) {
-        if(strcmp(table->array[x].key, key) == 0) {
-          array = &table->array[x];
-          break;
+      /*
+       * Strings are not cached, they live
+       * in the rules varstack.
+       */
+      slot->type = 0;
+      rules_pushstring(obj, str);
+      return 0;
+    }
+    slot->sequence = sequence;
+  }
+
+  switch(slot->type) {
+    case VINTEGER: {
+      rules_pushinteger(obj, slot->val.i);
+    } break;
+    case VFLOAT: {
+      rules_pushfloat(obj, slot->val.f);
+    } break;
+    default: {
+      rules_pushnil(obj);
+    } break;
+  }
+  return 0;
+}
+
+static int8_t vm_value_get_slot(struct rules_t *obj, struct rules_slot_t *slot, const char *key) {
+  switch(slot->kind) {
+    case SLOT_TOPIC:
+    case SLOT_XTOPIC:
+    case SLOT_OPTTOPIC: {
+      return vm_value_get_topic(obj, slot);
+    } break;
+    case SLOT_OPENTHERM: {
+      struct heishaOTDataStruct_t *ot = &heishaOTDataStruct[slot->index];
+      if(ot->rw >= 2) {
+        if(ot->type == TBOOL) {
+          rules_pushinteger(obj, (int)ot->value.b);
+          return 0;
+        }
+        if(ot->type == TFLOAT) {
+          rules_pushfloat(obj, ot->value.f);
+          return 0;
         }
       }
-      if(array == NULL) {
-        rules_pushnil(obj);
-      } else {
-        switch(array->type) {
-          case VINTEGER: {
-            rules_pushinteger(obj, array->val.i);
-          } break;
-          case VFLOAT: {
-            rules_pushfloat(obj, array->val.f);
-          } break;
-          case VCHAR: {
-            rules_pushstring(obj, (char *)array->val.s);
-          } break;
-          case VNULL: {
-            rules_pushnil(obj);
-          } break;
+      log_error(LOG_RULES, "err: %s %d", __FUNCTION__, __LINE__);
+    } break;
+    case SLOT_DALLAS: {
+      uint8_t i = slot->index;
+      /*
+       * The sensor list can be rebuilt at runtime,
+       * so the remembered index is only a hint.
+       */
+      if(i >= dallasDevicecount || strncmp(actDallasData[i].address, &key[8], 16) != 0) {
+        for(i=0;i<dallasDevicecount;i++) {
+          if(strncmp(actDallasData[i].address, &key[8], 16) == 0) {
+            break;
+          }
+        }
+        if(i == dallasDevicecount) {
+          rules_pushnil(obj);
+          return 0;
         }
+        slot->index = i;
       }
-    }
+      rules_pushfloat(obj, actDallasData[i].temperature);
+    } break;
+    case SLOT_LOCAL:
+    case SLOT_GLOBAL: {
+      struct array_t *var = rules_var(obj, slot);
+      switch(var == NULL ? VNULL : var->type) {
+        case VINTEGER: {
+          rules_pushinteger(obj, var->val.i);
+        } break;
+        case VFLOAT: {
+          rules_pushfloat(obj, var->val.f);
+        } break;
+        case VCHAR: {
+          rules_pushstring(obj, (char *)var->val.s);
+        } break;
+        default: {
+          rules_pushnil(obj);
+        } break;
+      }
+    } break;
+    case SLOT_HOUR:
+    case SLOT_MINUTE:
+    case SLOT_MONTH:
+    case SLOT_DAY: {
+      time_t now = time(NULL);
+      struct tm *tm_struct = localtime(&now);
+      switch(slot->kind) {
+        case SLOT_HOUR: {
+          rules_pushinteger(obj, (int)tm_struct->tm_hour);
+        } break;
+        case SLOT_MINUTE: {
+          rules_pushinteger(obj, (int)tm_struct->tm_min);
+        } break;
+        case SLOT_MONTH: {
+          rules_pushinteger(obj, (int)tm_struct->tm_mon);
+        } break;
+        case SLOT_DAY: {
+          rules_pushinteger(obj, (int)tm_struct->tm_wday+1);
+        } break;
+      }
+    } break;
+  }
+  return 0;
+}
+
+static int8_t vm_value_get(struct rules_t *obj) {
+  struct rules_slot_t tmp;
+  uint8_t nr = 0;
+
+  if(rules_gettop(obj) < 1) {
+    return -1;
   }
+  if(rules_type(obj, -1) != VCHAR) {
+    return -1;
+  }
+
+  const char *key = rules_tostring(obj, -1);
+
+  if((nr = rules_toslot(obj, -1)) > 0 && nr <= nrslots) {
+    return vm_value_get_slot(obj, &slots[nr-1], key);
+  } else if(rules_resolve_slot(key, &tmp) == 0) {
+    return vm_value_get_slot(obj, &tmp, key);
+  }
+  rules_pushnil(obj);
 
   return 0;
 }
 
 static int8_t vm_value_set(struct rules_t *obj) {
-  struct varstack_t *table = NULL;
-  uint16_t x = 0;
-  uint8_t type = 0;
+  uint8_t type = 0, nr = 0;
 
   if(rules_gettop(obj) < 2) {
     return -1;
@@ -657,35 +1184,12 @@ static int8_t vm_value_set(struct rules_t *obj) {
       x++;
     }
   } else {
-    if(key[0] == '$') {
-      table = (struct varstack_t *)obj->userdata;
-      if(table == NULL) {
-        if((table = (struct varstack_t *)MALLOC(sizeof(struct varstack_t))) == NULL) {
-          OUT_OF_MEMORY
-        }
-        memset(table, 0, sizeof(struct varstack_t));
-        obj->userdata = table;
-      }
-    } else if(key[0] == '#') {
-      table = (struct varstack_t *)&global_varstack;
-    }
-
     struct array_t *array = NULL;
-    for(x=0;x<table->nr;x++) {
-      if(strcmp(table->array[x].key, key) == 0) {
-        array = &table->array[x];
-        break;
-      }
+    if((nr = rules_toslot(obj, -2)) > 0 && nr <= nrslots) {
+      array = rules_var(obj, &slots[nr-1]);
     }
-
     if(array == NULL) {
-      if((table->array = (struct array_t *)REALLOC(table->array, sizeof(struct array_t)*(table->nr+1))) == NULL) {
-        OUT_OF_MEMORY
-      }
-      array = &table->array[table->nr];
-      memset(array, 0, sizeof(struct array_t));
-      table->nr++;
-      rules_ref(key);
+      return 0;
     }
 
     array->key = key;
@@ -732,51 +1236,39 @@ static int8_t vm_value_set(struct rules_t *obj) {
   return 0;
 }
 
-static void rules_free_stack(void) {
-  int x = 0;
-  for(x=0;x<nrrules;x++) {
-    struct varstack_t *node = (struct varstack_t *)rules[x]->userdata;
-    if(node != NULL) {
-      FREE(node->array);
-      FREE(node);
-    }
-    rules[x]->userdata = NULL;
-  }
-}
-
-static void rules_print_stack(struct varstack_t *table) {
+static void rules_print_vars(struct array_t *vars, uint8_t nr) {
   struct array_t *array = NULL;
-  if(table == NULL) {
+  if(vars == NULL) {
     return;
   } else {
-    uint16_t x = 0;
-    for(x=0;x<table->nr;x++) {
-      array = &table->array[x];
+    uint8_t x = 0;
+    for(x=0;x<nr;x++) {
+      array = &vars[x];
       switch(array->type) {
         case VINTEGER: {
 #if defined(ESP8266) || defined(ESP32)
-          logprintf_P(F("%2d %s = %d"), x, array->key, array->val.i);
+          log_info(LOG_RULES, "%2d %s = %d", x, array->key, array->val.i);
 #else
           printf("%2d %s = %d\n", x, array->key, array->val.i);
 #endif
         } break;
         case VFLOAT: {
 #if defined(ESP8266) || defined(ESP32)
-          logprintf_P(F("%2d %s = %g"), x, array->key, array->val.f);
+          log_info(LOG_RULES, "%2d %s = %g", x, array->key, array->val.f);
 #else
           printf("%2d %s = %g\n", x, array->key, array->val.f);
 #endif
         } break;
         case VCHAR: {
 #if defined(ESP8266) || defined(ESP32)
-          logprintf_P(F("%2d %s = %s"), x, array->key, array->val.s);
+          log_info(LOG_RULES, "%2d %s = %s", x, array->key, array->val.s);
 #else
           printf("%2d %s = %s\n", x, array->key, array->val.s);
 #endif
         } break;
         case VNULL: {
 #if defined(ESP8266) || defined(ESP32)
-          logprintf_P(F("%d %s = NULL"), x, array->key);
+          log_info(LOG_RULES, "%d %s = NULL", x, array->key);
 #else
           printf("%2d %s = NULL\n", x, array->key);
 #endif
@@ -786,61 +1278,115 @@ static void rules_print_stack(struct varstack_t *table) {
   }
 }
 
-void rules_timer_cb(int nr) {
-  char *name = NULL;
-  int x = 0, i = 0;
+static void rules_update_stats(uint8_t nr, uint32_t duration) {
+  static const uint32_t buckets[RULES_STATS_BUCKETS-1] = { 100, 1000, 10000, 100000 };
+  struct rules_stats_t *node = NULL;
+  uint8_t i = 0;
 
-  i = snprintf_P(NULL, 0, PSTR("timer=%d"), nr);
-  if((name = (char *)MALLOC(i+2)) == NULL) {
-    OUT_OF_MEMORY
+  loopstats_record(LOOP_STAGE_RULES, duration);
+
+  if(stats == NULL) {
+    return;
   }
-  memset(name, 0, i+2);
-  snprintf_P(name, i+1, PSTR("timer=%d"), nr);
+  node = &stats[nr];
 
-  // logprintf_P(F("_______ %s %s"), __FUNCTION__, name);
+  node->calls++;
+  node->total += duration;
+  node->ops += rules_nrops();
+  if(duration > node->max) {
+    node->max = duration;
+  }
+  if(rules_stackpeak() > node->stackpeak) {
+    node->stackpeak = rules_stackpeak();
+  }
+  while(i < RULES_STATS_BUCKETS-1 && duration >= buckets[i]) {
+    i++;
+  }
+  if(node->histogram[i] < UINT16_MAX) {
+    node->histogram[i]++;
+  }
+}
 
-  nr = rule_by_name(rules, nrrules, name);
-  if(nr > -1) {
-    logprintf_P(F("%s %s %s"), F("===="), name, F("===="));
+static void rules_run_event(uint8_t nr, const char *name) {
+  if(heishamonSettings.rules_loglevel >= 1) {
+    log_info(LOG_RULES, "==== %s ====", name);
+  }
 
-    timestamp.first = micros();
+  timestamp.first = micros();
 
-    int ret = rule_run(rules[nr], 0);
+  int ret = rule_run(rules[nr], 0);
 
-    timestamp.second = micros();
+  timestamp.second = micros();
 
-    if(ret == 0) {
-      logprintf_P(F("%s%d %s %d %s"), F("rule #"), rules[nr]->nr, F("was executed in"), timestamp.second - timestamp.first, F("microseconds"));
+  rules_update_stats(nr, timestamp.second - timestamp.first);
 
-      logprintf_P(F("\n>>> local variables\n"));
-      rules_print_stack((struct varstack_t *)rules[nr]->userdata);
-      logprintf_P(F("\n>>> global variables\n"));
-      rules_print_stack(&global_varstack);
-      rules_free_stack();
+  if(ret == 0) {
+    if(heishamonSettings.rules_loglevel >= 1) {
+      log_info(LOG_RULES, "rule #%d was executed in %d microseconds", rules[nr]->nr, (int)(timestamp.second - timestamp.first));
     }
+    if(heishamonSettings.rules_loglevel >= 2) {
+      log_info(LOG_RULES, "\n>>> local variables\n");
+      rules_print_vars((struct array_t *)rules[nr]->userdata, (nr < nrframes) ? frames[nr].size : 0);
+      log_info(LOG_RULES, "\n>>> global variables\n");
+      rules_print_vars(globals, nrglobals);
+    }
+    rules_free_stack();
   }
-  FREE(name);
 }
 
-void rules_setup(void) {
-  if(!LittleFS.begin()) {
-    return;
+int rules_stats_json(uint8_t nr, char *buf, uint16_t len) {
+  struct rules_stats_t *node = NULL;
+
+  if(stats == NULL || nr >= nrrules) {
+    return -1;
+  }
+  node = &stats[nr];
+
+  return snprintf_P(buf, len,
+    PSTR("{\"rule\":%d,\"name\":\"%s\",\"calls\":%lu,\"total\":%lu,\"max\":%lu,\"avg\":%lu,"
+         "\"ops\":%lu,\"stack\":%u,\"heap\":%u,\"bytecode\":%u,\"histogram\":[%u,%u,%u,%u,%u]}"),
+    nr+1, rules[nr]->name == NULL ? "" : rules[nr]->name,
+    (unsigned long)node->calls, (unsigned long)node->total, (unsigned long)node->max,
+    (unsigned long)(node->calls > 0 ? node->total / node->calls : 0),
+    (unsigned long)node->ops, node->stackpeak, rules_heapsize(rules[nr]), rules_bcsize(rules[nr]),
+    node->histogram[0], node->histogram[1], node->histogram[2], node->histogram[3], node->histogram[4]);
+}
+
+uint16_t rules_mempool_used(void) {
+  return mempool_used;
+}
+
+uint16_t rules_mempool_size(void) {
+  return MEMPOOL_SIZE;
+}
+
+void rules_timer_cb(int nr) {
+  uint8_t x = 0;
+
+  for(x=0;x<nr_timer_events;x++) {
+    if(timer_events[x].nr == nr) {
+      rules_run_event(timer_events[x].rule, rules[timer_events[x].rule]->name);
+      return;
+    }
   }
+}
+
+void rules_setup(void) {
     if (rule_options.event_cb == NULL) { //check if not initialized before
 #ifdef ESP32
       if (mempool == NULL) { //make sure we only malloc if not done before
         mempool = (unsigned char *)ps_malloc(MEMPOOL_SIZE);  //in arduino IDE normal malloc causes big block to go to PSRAM if PSRAM is enabled. But seems to be unstable so for now don't enable PSRAM
         if (mempool == NULL) {
-          logprintln_P(F("Mempool OOM"));
+          log_error(LOG_RULES, "Mempool OOM");
           OUT_OF_MEMORY
         }
       }
 #endif  
     memset(mempool, 0, MEMPOOL_SIZE);
 
-    logprintf_P(F("rules mempool size: %d"), MEMPOOL_SIZE);
+    log_info(LOG_RULES, "rules mempool size: %d", MEMPOOL_SIZE);
 
-    logprintln_P(F("reading rules"));
+    log_info(LOG_RULES, "reading rules");
 
     memset(&rule_options, 0, sizeof(struct rule_options_t));
     rule_options.is_variable_cb = is_variable;
@@ -848,6 +1394,7 @@ void rules_setup(void) {
     rule_options.done_cb = rule_done_cb;
     rule_options.vm_value_set = vm_value_set;
     rule_options.vm_value_get = vm_value_get;
+    rule_options.vm_value_slot = vm_value_slot;
     rule_options.event_cb = event_cb;
 
   }
@@ -864,158 +1411,393 @@ bool existsRulesFile(char *file) {
   return false;
 }
 
-int rules_parse(char *file) {
-  if (existsRulesFile(file)) { //only parse an existing and not empty, file
-    rules_setup(); //check there if done already
-	
-    File frules = LittleFS.open(file, "r");
-    parsing = 1;
+static int8_t rules_image_write_cb(void *ptr, uint16_t len, void *userdata) {
+  File *f = (File *)userdata;
+  if(f->write((const uint8_t *)ptr, len) != len) {
+    return -1;
+  }
+  return 0;
+}
+
+static int8_t rules_image_read_cb(void *ptr, uint16_t len, void *userdata) {
+  File *f = (File *)userdata;
+  if(f->readBytes((char *)ptr, len) != len) {
+    return -1;
+  }
+  return 0;
+}
+
+/*
+ * Restore the compiled rules of the last parse of this
+ * very same rules file, skipping the lexer and compiler.
+ */
+static int rules_image_read(uint32_t hash, struct pbuf *mem) {
+  if(!LittleFS.exists(RULES_IMAGE_FILE)) {
+    return -1;
+  }
+  File f = LittleFS.open(RULES_IMAGE_FILE, "r");
+  if(!f) {
+    return -1;
+  }
+
+  timestamp.first = micros();
+  int ret = rules_image_load(&rules, &nrrules, mem, hash, rules_image_read_cb, &f);
+  timestamp.second = micros();
+  f.close();
+
+  if(ret == 0) {
+    log_info(LOG_RULES, "rules loaded from compiled image in %d microseconds", timestamp.second - timestamp.first);
+  } else {
+    //a rejected image can already have handed out slots
+    rules_free_compiled();
+  }
+  return ret;
+}
+
+static void rules_image_write(uint32_t hash, struct pbuf *mem) {
+  File f = LittleFS.open(RULES_IMAGE_FILE, "w");
+  if(!f) {
+    return;
+  }
+  int ret = rules_image_save(rules, nrrules, mem, hash, rules_image_write_cb, &f);
+  f.close();
+
+  if(ret == -1) {
+    LittleFS.remove(RULES_IMAGE_FILE);
+  }
+}
+
+/*
+ * Forget the current rules before new ones are
+ * loaded into the mempool.
+ */
+static void rules_parse_begin(void) {
+  rules_setup(); //check there if done already
+  parsing = 1;
+
+  if(nrrules > 0) {
+    rules_free_stack();
+    rules_gc(&rules, &nrrules);
+  }
+  rules_free_compiled();
+  memset(mempool, 0, MEMPOOL_SIZE);
+}
 
+/*
+ * Compiles the len bytes of rules text that were
+ * placed at txtoffset at the end of the mempool.
+ */
+static int rules_compile(struct pbuf *mem, unsigned int txtoffset, int len) {
+  struct pbuf input;
+  int ret = 0;
+
+  memset(&input, 0, sizeof(struct pbuf));
+  input.payload = &mempool[txtoffset];
+  input.len = txtoffset;
+  input.tot_len = len;
+
+  while((ret = rule_initialize(&input, &rules, &nrrules, mem, NULL)) == 0) {
+    input.payload = &mempool[input.len];
+  }
+  if(slotsfull == 1) {
+    ret = -1;
+  }
+  return ret;
+}
+
+static int rules_parse_end(struct pbuf *mem, int ret) {
+  log_info(LOG_RULES, "rules memory used: %d / %d", mem->len, mem->tot_len);
+  mempool_used = mem->len;
+
+  /*
+   * Clear all timers
+   */
+  timerqueue_clear();
+
+  if(ret == -1) {
     if(nrrules > 0) {
       rules_free_stack();
       rules_gc(&rules, &nrrules);
-
-      struct varstack_t *table = (struct varstack_t *)&global_varstack;
-      if(table->array != NULL) {
-        FREE(table->array);
-      }
-      table->nr = 0;
     }
-    memset(mempool, 0, MEMPOOL_SIZE);
+    rules_free_compiled();
+    return -1;
+  }
+
+  /*
+   * Forget what the validation runs stored
+   */
+  rules_clear_vars(globals, nrglobals);
+  rules_alloc_frames(nrrules);
+  rules_build_events();
+
+  if((stats = (struct rules_stats_t *)CALLOC(nrrules, sizeof(struct rules_stats_t))) == NULL) {
+    OUT_OF_MEMORY
+  }
+
+  parsing = 0;
+  return 0;
+}
+
+int rules_parse(char *file) {
+  if (existsRulesFile(file)) { //only parse an existing and not empty, file
+    File frules = LittleFS.open(file, "r");
+    rules_parse_begin();
 
 #define BUFFER_SIZE 128
     char content[BUFFER_SIZE];
     memset(content, 0, BUFFER_SIZE);
     int len = frules.size();
     int chunk = 0, len1 = 0;
+    //an image of another firmware is compiled again
+    uint32_t hash = rules_hash(0, (const unsigned char *)heishamon_version, strlen(heishamon_version));
 
-    unsigned int txtoffset = alignedbuffer(MEMPOOL_SIZE-len-5);
-	
     while(chunk*BUFFER_SIZE < len) {
-      memset(content, 0, BUFFER_SIZE);
-      frules.seek(chunk*BUFFER_SIZE, SeekSet);
       len1 = frules.readBytes(content, BUFFER_SIZE);
-      memcpy(&mempool[txtoffset+(chunk*BUFFER_SIZE)], &content, alignedbuffer(len1));
+      if(len1 <= 0) {
+        break;
+      }
+      hash = rules_hash(hash, (unsigned char *)content, len1);
       chunk++;
     }
-    frules.close();
 
     struct pbuf mem;
-    struct pbuf input;
     memset(&mem, 0, sizeof(struct pbuf));
-    memset(&input, 0, sizeof(struct pbuf));
 
     mem.payload = mempool;
     mem.len = 0;
     mem.tot_len = MEMPOOL_SIZE;
 
-    input.payload = &mempool[txtoffset];
-    input.len = txtoffset;
-    input.tot_len = len;
-
     int ret = 0;
-    while((ret = rule_initialize(&input, &rules, &nrrules, &mem, NULL)) == 0) {
-      input.payload = &mempool[input.len];
-    }
-
-    logprintf_P(F("rules memory used: %d / %d"), mem.len, mem.tot_len);
-
-    /*
-     * Clear all timers
-     */
-    struct timerqueue_t *node = NULL;
-    while((node = timerqueue_pop()) != NULL) {
-      FREE(node);
-    }
-
-    struct varstack_t *table = (struct varstack_t *)&global_varstack;
-    if(table->array != NULL) {
-      FREE(table->array);
-    }
-    table->nr = 0;
+    if(rules_image_read(hash, &mem) == 0) {
+      frules.close();
+      ret = 1;
+    } else {
+      memset(mempool, 0, MEMPOOL_SIZE);
+      mem.len = 0;
+      chunk = 0;
+
+      unsigned int txtoffset = alignedbuffer(MEMPOOL_SIZE-len-5);
+
+      while(chunk*BUFFER_SIZE < len) {
+        memset(content, 0, BUFFER_SIZE);
+        frules.seek(chunk*BUFFER_SIZE, SeekSet);
+        len1 = frules.readBytes(content, BUFFER_SIZE);
+        memcpy(&mempool[txtoffset+(chunk*BUFFER_SIZE)], &content, alignedbuffer(len1));
+        chunk++;
+      }
+      frules.close();
 
-    if(ret == -1) {
-      if(nrrules > 0) {
-        rules_free_stack();
-        rules_gc(&rules, &nrrules);
+      ret = rules_compile(&mem, txtoffset, len);
+      if(ret != -1) {
+        rules_image_write(hash, &mem);
       }
-      return -1;
     }
 
-    parsing = 0;
-    return 0;
+    return rules_parse_end(&mem, ret);
   } else {
 	  return -2; //empty file or not existing
   }
 }
 
+int rules_parse_text(const char *text, uint16_t len) {
+  struct pbuf mem;
+
+  if(len == 0) {
+    return -2;
+  }
+  if(len+5 > MEMPOOL_SIZE) {
+    return -1;
+  }
+  rules_parse_begin();
+
+  memset(&mem, 0, sizeof(struct pbuf));
+  mem.payload = mempool;
+  mem.len = 0;
+  mem.tot_len = MEMPOOL_SIZE;
+
+  unsigned int txtoffset = alignedbuffer(MEMPOOL_SIZE-len-5);
+  memcpy(&mempool[txtoffset], text, len);
+
+  return rules_parse_end(&mem, rules_compile(&mem, txtoffset, len));
+}
+
 void rules_event_cb(const char *prefix, const char *name) {
-  uint8_t len = strlen(name), len1 = strlen(prefix), tlen = 0;
+  struct rules_slot_t slot;
   char buf[100] = { '\0' };
+  int8_t nr = -1;
+
+  if(nrrules == 0) {
+    return;
+  }
+
   snprintf_P((char *)&buf, 100, PSTR("%s%s"), prefix, name);
-  int8_t nr = rule_by_name(rules, nrrules, (char *)buf);
-  if(nr > -1) {
-    logprintf_P(F("%s %s %s"), F("===="), name, F("===="));
 
-    timestamp.first = micros();
+  if(rules_resolve_slot(buf, &slot) == 0) {
+    switch(slot.kind) {
+      case SLOT_TOPIC: {
+        nr = topic_events[slot.index]-1;
+      } break;
+      case SLOT_XTOPIC: {
+        nr = xtopic_events[slot.index]-1;
+      } break;
+      case SLOT_OPTTOPIC: {
+        nr = opttopic_events[slot.index]-1;
+      } break;
+      case SLOT_OPENTHERM: {
+        if(slot.index < nr_ot_events) {
+          nr = ot_events[slot.index]-1;
+        }
+      } break;
+      case SLOT_DALLAS: {
+        if(dallas_events > 0) {
+          nr = rule_by_name(rules, nrrules, (char *)buf);
+        }
+      } break;
+    }
+  } else {
+    nr = rule_by_name(rules, nrrules, (char *)buf);
+  }
 
-    int ret = rule_run(rules[nr], 0);
+  if(nr > -1) {
+    rules_run_event(nr, name);
+  }
+}
 
-    timestamp.second = micros();
+static uint8_t *rules_changed_table(uint8_t table) {
+  switch(table) {
+    case RULES_EVENT_TOPIC: {
+      return topic_changed;
+    } break;
+    case RULES_EVENT_XTOPIC: {
+      return xtopic_changed;
+    } break;
+    case RULES_EVENT_OPTTOPIC: {
+      return opttopic_changed;
+    } break;
+  }
+  return NULL;
+}
 
-    if(ret == 0) {
-      logprintf_P(F("%s%d %s %d %s"), F("rule #"), rules[nr]->nr, F("was executed in"), timestamp.second - timestamp.first, F("microseconds"));
+void rules_frame_begin(uint8_t table) {
+  switch(table) {
+    case RULES_EVENT_TOPIC: {
+      memset(&topic_changed, 0, sizeof(topic_changed));
+    } break;
+    case RULES_EVENT_XTOPIC: {
+      memset(&xtopic_changed, 0, sizeof(xtopic_changed));
+    } break;
+    case RULES_EVENT_OPTTOPIC: {
+      memset(&opttopic_changed, 0, sizeof(opttopic_changed));
+    } break;
+  }
+  frame_table = table;
+}
 
-      logprintf_P(F("\n>>> local variables\n"));
-      rules_print_stack((struct varstack_t *)rules[nr]->userdata);
-      logprintf_P(F("\n>>> global variables\n"));
-      rules_print_stack(&global_varstack);
-      rules_free_stack();
-    }
+void rules_frame_end(uint8_t table) {
+  uint16_t i = 0;
 
+  if(frame_table != table) {
     return;
   }
+  frame_table = -1;
+
+  for(i=0;i<nrrules;i++) {
+    if((pending_rules[i/8] & (1 << (i%8))) != 0) {
+      pending_rules[i/8] &= ~(1 << (i%8));
+      rules_run_event(i, rules[i]->name);
+    }
+  }
 }
 
-void rules_boot(void) {
-  int8_t nr = rule_by_name(rules, nrrules, (char *)"System#Boot");
-  if(nr > -1) {
-    logprintf_P(F("%s %s %s"), F("===="), F("System#Boot"), F("===="));
+int8_t rules_topic_changed(const char *name) {
+  struct rules_slot_t slot;
+  char buf[MAX_TOPIC_LEN+1] = { '\0' };
+  uint8_t *changed = NULL;
 
-    timestamp.first = micros();
+  if(name[0] == '@') {
+    snprintf_P((char *)&buf, sizeof(buf), PSTR("%s"), name);
+  } else {
+    snprintf_P((char *)&buf, sizeof(buf), PSTR("@%s"), name);
+  }
 
-    int ret = rule_run(rules[nr], 0);
+  if(rules_resolve_slot(buf, &slot) == -1) {
+    return -1;
+  }
 
-    timestamp.second = micros();
+  switch(slot.kind) {
+    case SLOT_TOPIC: {
+      changed = rules_changed_table(RULES_EVENT_TOPIC);
+    } break;
+    case SLOT_XTOPIC: {
+      changed = rules_changed_table(RULES_EVENT_XTOPIC);
+    } break;
+    case SLOT_OPTTOPIC: {
+      changed = rules_changed_table(RULES_EVENT_OPTTOPIC);
+    } break;
+    default: {
+      return -1;
+    } break;
+  }
 
-    if(ret == 0) {
-      logprintf_P(F("%s%d %s %d %s"), F("rule #"), rules[nr]->nr, F("was executed in"), timestamp.second - timestamp.first, F("microseconds"));
+  return (changed[slot.index/8] & (1 << (slot.index%8))) != 0;
+}
 
-      logprintf_P(F("\n>>> local variables\n"));
-      rules_print_stack((struct varstack_t *)rules[nr]->userdata);
-      logprintf_P(F("\n>>> global variables\n"));
-      rules_print_stack(&global_varstack);
-      rules_free_stack();
+void rules_topic_event_cb(uint8_t table, uint16_t nr) {
+  uint8_t rule = 0, *changed = rules_changed_table(table);
+  const char *name = NULL;
+
+  if(changed == NULL) {
+    return;
+  }
+  changed[nr/8] |= (1 << (nr%8));
+
+  switch(table) {
+    case RULES_EVENT_TOPIC: {
+      rule = topic_events[nr];
+      name = topics[nr];
+    } break;
+    case RULES_EVENT_XTOPIC: {
+      rule = xtopic_events[nr];
+      name = xtopics[nr];
+    } break;
+    case RULES_EVENT_OPTTOPIC: {
+      rule = opttopic_events[nr];
+      name = optTopics[nr];
+    } break;
+  }
+
+  if(rule > 0) {
+    if(frame_table == table && heishamonSettings.coalesce_rules) {
+      pending_rules[(rule-1)/8] |= (1 << ((rule-1)%8));
+    } else {
+      rules_run_event(rule-1, name);
     }
   }
 }
 
+void rules_boot(void) {
+  int8_t nr = rule_by_name(rules, nrrules, (char *)"System#Boot");
+  if(nr > -1) {
+    rules_run_event(nr, rules[nr]->name);
+  }
+}
+
 void rules_deinitialize() {
   if (rule_options.event_cb != NULL) { 
-    logprintln_P(F("Deinitialize rules engine..."));
+    log_info(LOG_RULES, "Deinitialize rules engine...");
 #ifdef ESP32
     FREE(mempool);
 #endif 
     if(nrrules > 0) {
-      for(int i=0;i<nrrules;i++) {
-        if(rules[i]->userdata != NULL) {
-          FREE(rules[i]->userdata);
-        }
-      }
+      rules_free_stack();
       rules_gc(&rules, &nrrules);
-	  rules_free_stack();
     }
+    rules_free_compiled();
+
 
+    if (LittleFS.begin()) {
+      LittleFS.remove(RULES_IMAGE_FILE);
+    }
 
     // set this to NULL so a new initialize can start if necessary. 
     rule_options.event_cb = NULL;
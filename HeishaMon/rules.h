@@ -17,14 +17,34 @@
 
 #include "src/common/mem.h"
 
+extern struct rules_t **rules;
 extern uint8_t nrrules;
 
+typedef enum {
+  RULES_EVENT_TOPIC = 0,
+  RULES_EVENT_XTOPIC,
+  RULES_EVENT_OPTTOPIC
+} rules_event_tables;
+
 void rules_boot(void);
 void rules_deinitialize(void);
 int rules_parse(char *file);
+/*
+ * Parses rules text from memory, without the compiled
+ * image. Returns the same as rules_parse.
+ */
+int rules_parse_text(const char *text, uint16_t len);
+/* Clears the locals of the rule blocks that ran */
+void rules_free_stack(void);
 void rules_setup(void);
 void rules_timer_cb(int nr);
 void rules_event_cb(const char *prefix, const char *name);
+void rules_topic_event_cb(uint8_t table, uint16_t nr);
+void rules_frame_begin(uint8_t table);
+void rules_frame_end(uint8_t table);
+int rules_stats_json(uint8_t nr, char *buf, uint16_t len);
+uint16_t rules_mempool_used(void);
+uint16_t rules_mempool_size(void);
 void rules_execute(void);
 
 #endif
@@ -1,6 +1,9 @@
-#include <PubSubClient.h>
+#include "src/common/mqttqueue.h"
+#include "history.h"
 #include "commands.h"
 #include "s0.h"
+#include "src/common/idle.h"
+#include "src/common/log.h"
 
 #define MQTT_RETAIN_VALUES 1 // do we retain 1wire values?
 
@@ -40,6 +43,7 @@ IRAM_ATTR void countPulse(int i) {
       actS0Data[i].watt = (3600000000.0 / pulseInterval) / actS0Settings[i].ppkwh;
       if ((unsigned long)(actS0Data[i].nextReport - newEdgeS0) > MINREPORTEDS0TIME) { //pulse seen in standby interval so report directly
         actS0Data[i].nextReport = 0; // report now
+        idle_wakeup();
       }
     }
     actS0Data[i].lastPulse = newEdgeS0; // store this edge to compare in next pulses for valid pulse and calculate watt
@@ -107,7 +111,7 @@ void restore_s0_Watthour(int s0Port, float watthour) {
 
 
 
-void s0Loop(PubSubClient &mqtt_client, void (*log_message)(char*), char* mqtt_topic_base, s0SettingsStruct s0Settings[]) {
+void s0Loop(void (*log_message)(char*), char* mqtt_topic_base, s0SettingsStruct s0Settings[]) {
 
   unsigned long millisThisLoop = millis();
 
@@ -160,25 +164,22 @@ void s0Loop(PubSubClient &mqtt_client, void (*log_message)(char*), char* mqtt_to
       */
       //end debug
 
-      sprintf_P(log_msg, PSTR("Pulses seen on S0 port %d: Good: %lu Bad: %lu Average good pulse width: %i"), (i + 1),  actS0Data[i].goodPulses, actS0Data[i].badPulses, actS0Data[i].avgPulseWidth);
-      log_message(log_msg);
+      log_debug(LOG_S0, "Pulses seen on S0 port %d: Good: %lu Bad: %lu Average good pulse width: %i", (i + 1),  actS0Data[i].goodPulses, actS0Data[i].badPulses, actS0Data[i].avgPulseWidth);
 
-      sprintf_P(log_msg, PSTR("Measured Watthour on S0 port %d: %.2f"), (i + 1),  Watthour );
-      log_message(log_msg);
+      log_debug(LOG_S0, "Measured Watthour on S0 port %d: %.2f", (i + 1),  Watthour);
       sprintf(valueStr, "%.2f", Watthour);
       sprintf_P(mqtt_topic, PSTR("%s/%s/Watthour/%d"), mqtt_topic_base, mqtt_topic_s0, (i + 1));
-      mqtt_client.publish(mqtt_topic, valueStr, MQTT_RETAIN_VALUES);
+      mqttqueue_publish(mqtt_topic, valueStr, MQTT_RETAIN_VALUES);
+      if (Watthour > 0) history_add(HISTORY_S0, i + 1, valueStr);
 
-      sprintf(log_msg, PSTR("Measured total Watthour on S0 port %d: %.2f"), (i + 1),  WatthourTotal );
-      log_message(log_msg);
+      log_debug(LOG_S0, "Measured total Watthour on S0 port %d: %.2f", (i + 1),  WatthourTotal);
       sprintf(valueStr, "%.2f", WatthourTotal);
       sprintf(mqtt_topic, PSTR("%s/%s/WatthourTotal/%d"), mqtt_topic_base, mqtt_topic_s0, (i + 1));
-      mqtt_client.publish(mqtt_topic, valueStr, MQTT_RETAIN_VALUES);
-      sprintf(log_msg, PSTR("Calculated Watt on S0 port %d: %u"), (i + 1), actS0Data[i].watt);
-      log_message(log_msg);
+      mqttqueue_publish(mqtt_topic, valueStr, MQTT_RETAIN_VALUES);
+      log_debug(LOG_S0, "Calculated Watt on S0 port %d: %u", (i + 1), actS0Data[i].watt);
       sprintf(valueStr, "%u",  actS0Data[i].watt);
       sprintf(mqtt_topic, PSTR("%s/%s/Watt/%d"), mqtt_topic_base, mqtt_topic_s0, (i + 1));
-      mqtt_client.publish(mqtt_topic, valueStr, MQTT_RETAIN_VALUES);
+      mqttqueue_publish(mqtt_topic, valueStr, MQTT_RETAIN_VALUES);
       //update GUI over websocket
       sprintf_P(log_msg, PSTR("{\"data\": {\"s0values\": {\"s0port\": %d, \"Watt\": %u, \"Watthour\": %.2f, \"WatthourTotal\": %.2f}}}"), i+1, actS0Data[i].watt,Watthour,WatthourTotal);
       websocket_write_all(log_msg, strlen(log_msg));         
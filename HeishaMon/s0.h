@@ -1,4 +1,7 @@
-#include <PubSubClient.h>
+#ifndef _S0_H_
+#define _S0_H_
+
+#include <Arduino.h>
 #include "src/common/webserver.h"
 
 #define NUM_S0_COUNTERS 2
@@ -31,5 +34,7 @@ struct s0DataStruct {
 
 void initS0Sensors(s0SettingsStruct s0Settings[]);
 void restore_s0_Watthour(int s0Port, float watthour);
-void s0Loop(PubSubClient &mqtt_client, void (*log_message)(char*), char* mqtt_topic_base, s0SettingsStruct s0Settings[]);
+void s0Loop(void (*log_message)(char*), char* mqtt_topic_base, s0SettingsStruct s0Settings[]);
 void s0JsonOutput(struct webserver_t *client);
+
+#endif
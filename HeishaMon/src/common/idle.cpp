@@ -0,0 +1,78 @@
+/*
+  Copyright (C) CurlyMo
+
+  This Source Code Form is subject to the terms of the Mozilla Public
+  License, v. 2.0. If a copy of the MPL was not distributed with this
+  file, You can obtain one at http://mozilla.org/MPL/2.0/.
+*/
+
+#if defined(ESP8266) || defined(ESP32)
+  #include <Arduino.h>
+#endif
+#if defined(ESP32)
+  #include <freertos/FreeRTOS.h>
+  #include <freertos/semphr.h>
+#endif
+
+#include "idle.h"
+
+#ifndef IRAM_ATTR
+  #define IRAM_ATTR
+#endif
+
+#if defined(ESP32)
+static SemaphoreHandle_t wakeup = NULL;
+#endif
+
+void idle_setup(void) {
+#if defined(ESP32)
+  if(wakeup == NULL) {
+    wakeup = xSemaphoreCreateBinary();
+  }
+#endif
+}
+
+void IRAM_ATTR idle_wakeup(void) {
+#if defined(ESP8266)
+  /*
+   * Resumes the loop when it is suspended in delay(),
+   * otherwise the next delay() returns right away.
+   */
+  esp_schedule();
+#elif defined(ESP32)
+  if(wakeup == NULL) {
+    return;
+  }
+  if(xPortInIsrContext()) {
+    BaseType_t woken = pdFALSE;
+    xSemaphoreGiveFromISR(wakeup, &woken);
+    if(woken == pdTRUE) {
+      portYIELD_FROM_ISR();
+    }
+  } else {
+    xSemaphoreGive(wakeup);
+  }
+#endif
+}
+
+void idle_wait(uint32_t ms) {
+#if defined(ESP8266)
+  if(ms > 0) {
+    delay(ms);
+  }
+#elif defined(ESP32)
+  /*
+   * Always block for at least a tick, the idle task
+   * has to run to keep the task watchdog happy.
+   */
+  TickType_t ticks = pdMS_TO_TICKS(ms);
+  if(ticks == 0) {
+    ticks = 1;
+  }
+  if(wakeup == NULL) {
+    vTaskDelay(ticks);
+  } else {
+    xSemaphoreTake(wakeup, ticks);
+  }
+#endif
+}
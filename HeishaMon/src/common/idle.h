@@ -0,0 +1,24 @@
+/*
+  Copyright (C) CurlyMo
+
+  This Source Code Form is subject to the terms of the Mozilla Public
+  License, v. 2.0. If a copy of the MPL was not distributed with this
+  file, You can obtain one at http://mozilla.org/MPL/2.0/.
+*/
+
+#ifndef _IDLE_H_
+#define _IDLE_H_
+
+#include <stdint.h>
+
+/*
+ * Lets the main loop block until its next deadline
+ * instead of spinning. Interrupts and callbacks that
+ * leave work for the loop call idle_wakeup(), which
+ * is safe from ISR context and ends the wait early.
+ */
+void idle_setup(void);
+void idle_wakeup(void);
+void idle_wait(uint32_t ms);
+
+#endif
\ No newline at end of file
@@ -6,6 +6,8 @@
   file, You can obtain one at http://mozilla.org/MPL/2.0/.
 */
 
+#include <stdarg.h>
+#include <stdio.h>
 #include <stdlib.h>
 #include <sys/time.h>
 #include <time.h>
@@ -13,30 +15,34 @@
 #include <Arduino.h>
 
 #include "mem.h"
-#include "../../webfunctions.h"
+#include "strnicmp.h"
+#include "log.h"
 
-extern settingsStruct heishamonSettings;
-extern PubSubClient mqtt_client;
-extern const char* mqtt_logtopic;
+uint8_t log_level = LOG_INFO;
+uint16_t log_subsystems = 0xFFFF;
 
+static const char logSubsystemNames[LOG_SUBSYSTEMS][8] PROGMEM = {
+  "main", "serial", "decode", "mqtt", "modbus", "rules", "ot", "1wire", "s0", "web"
+};
+
+/*
+ * The unleveled messages log as info of the main
+ * subsystem and are filtered before formatting.
+ */
 void _logprintln(const char *file, unsigned int line, char *msg) {
-  if(heishamonSettings.logSerial1) {
-#if defined(ESP8266)
-    Serial1.print(millis());
-    Serial1.print(": ");
-    Serial1.println(msg);
-#elif defined(ESP32)
-    Serial.print(millis());
-    Serial.print(": ");
-    Serial.println(msg);
-#endif	  
+  if(!log_enabled(LOG_INFO, LOG_MAIN)) {
+    return;
   }
-  websocket_write_all(msg, strlen(msg));
+  logqueue_add(LOG_INFO, LOG_MAIN, msg);
 }
 
 void _logprintf(const char *file, unsigned int line, char *fmt, ...) {
   char *str = NULL;
 
+  if(!log_enabled(LOG_INFO, LOG_MAIN)) {
+    return;
+  }
+
   va_list ap, apcpy;
   va_copy(apcpy, ap);
   va_start(apcpy, fmt);
@@ -57,6 +63,9 @@ void _logprintf(const char *file, unsigned int line, char *fmt, ...) {
 }
 
 void _logprintln_P(const char *file, unsigned int line, const __FlashStringHelper *msg) {
+  if(!log_enabled(LOG_INFO, LOG_MAIN)) {
+    return;
+  }
   PGM_P p = (PGM_P)msg;
   int len = strlen_P((const char *)p);
   char *str = (char *)MALLOC(len+1);
@@ -71,6 +80,9 @@ void _logprintln_P(const char *file, unsigned int line, const __FlashStringHelpe
 }
 
 void _logprintf_P(const char *file, unsigned int line, const __FlashStringHelper *fmt, ...) {
+  if(!log_enabled(LOG_INFO, LOG_MAIN)) {
+    return;
+  }
   PGM_P p = (PGM_P)fmt;
   int len = strlen_P((const char *)p);
   char *foo = (char *)MALLOC(len+1);
@@ -99,4 +111,53 @@ void _logprintf_P(const char *file, unsigned int line, const __FlashStringHelper
 
   FREE(foo);
   FREE(str);
+}
+
+void _logleveled_P(uint8_t level, uint8_t subsystem, const char *fmt, ...) {
+  char str[LOGQUEUE_LINE];
+
+  va_list ap;
+  va_start(ap, fmt);
+  vsnprintf_P(str, sizeof(str), fmt, ap);
+  va_end(ap);
+
+  logqueue_add(level, subsystem, str);
+}
+
+void log_filter(uint8_t level, const char *subsystems) {
+  log_level = (level > LOG_TRACE) ? LOG_TRACE : level;
+  log_subsystems = 0;
+
+  const char *p = subsystems;
+  while(p != NULL && *p != '\0') {
+    while(*p == ' ' || *p == ',') {
+      p++;
+    }
+    size_t len = 0;
+    while(p[len] != '\0' && p[len] != ',' && p[len] != ' ') {
+      len++;
+    }
+    if(len == 0) {
+      break;
+    }
+    for(uint8_t i = 0; i < LOG_SUBSYSTEMS; i++) {
+      char name[8];
+      strcpy_P(name, logSubsystemNames[i]);
+      if(strlen(name) == len && strnicmp(p, name, len) == 0) {
+        log_subsystems |= (1 << i);
+      }
+    }
+    p += len;
+  }
+
+  if(log_subsystems == 0) {
+    log_subsystems = 0xFFFF;
+  }
+}
+
+void log_subsystem_name(uint8_t subsystem, char *name) {
+  if(subsystem >= LOG_SUBSYSTEMS) {
+    subsystem = LOG_MAIN;
+  }
+  strcpy_P(name, logSubsystemNames[subsystem]);
 }
\ No newline at end of file
@@ -11,6 +11,77 @@
 
 #include <Arduino.h>
 
+#include "logqueue.h"
+
+/*
+ * Leveled messages above this level are compiled
+ * out, their arguments are not even evaluated.
+ */
+#ifndef LOG_COMPILE_LEVEL
+  #define LOG_COMPILE_LEVEL LOG_DEBUG
+#endif
+
+typedef enum {
+  LOG_MAIN = 0,
+  LOG_SERIAL,
+  LOG_DECODE,
+  LOG_MQTT,
+  LOG_MODBUS,
+  LOG_RULES,
+  LOG_OT,
+  LOG_1WIRE,
+  LOG_S0,
+  LOG_WEB,
+  LOG_SUBSYSTEMS
+} log_subsystem_t;
+
+extern uint8_t log_level;
+extern uint16_t log_subsystems;
+
+/*
+ * Errors and warnings pass the subsystem mask,
+ * only the runtime level can hide them.
+ */
+#define log_enabled(level, subsystem) \
+  ((level) <= log_level && ((level) <= LOG_WARN || (log_subsystems & (1 << (subsystem)))))
+
+/*
+ * Messages that do not pass the runtime filter
+ * return before anything is formatted.
+ */
+#define _logleveled(level, subsystem, fmt, ...) \
+  do { \
+    if(log_enabled(level, subsystem)) { \
+      _logleveled_P(level, subsystem, PSTR(fmt), ##__VA_ARGS__); \
+    } \
+  } while(0)
+
+#if LOG_COMPILE_LEVEL >= LOG_ERROR
+  #define log_error(subsystem, fmt, ...) _logleveled(LOG_ERROR, subsystem, fmt, ##__VA_ARGS__)
+#else
+  #define log_error(subsystem, fmt, ...) do { } while(0)
+#endif
+#if LOG_COMPILE_LEVEL >= LOG_WARN
+  #define log_warn(subsystem, fmt, ...) _logleveled(LOG_WARN, subsystem, fmt, ##__VA_ARGS__)
+#else
+  #define log_warn(subsystem, fmt, ...) do { } while(0)
+#endif
+#if LOG_COMPILE_LEVEL >= LOG_INFO
+  #define log_info(subsystem, fmt, ...) _logleveled(LOG_INFO, subsystem, fmt, ##__VA_ARGS__)
+#else
+  #define log_info(subsystem, fmt, ...) do { } while(0)
+#endif
+#if LOG_COMPILE_LEVEL >= LOG_DEBUG
+  #define log_debug(subsystem, fmt, ...) _logleveled(LOG_DEBUG, subsystem, fmt, ##__VA_ARGS__)
+#else
+  #define log_debug(subsystem, fmt, ...) do { } while(0)
+#endif
+#if LOG_COMPILE_LEVEL >= LOG_TRACE
+  #define log_trace(subsystem, fmt, ...) _logleveled(LOG_TRACE, subsystem, fmt, ##__VA_ARGS__)
+#else
+  #define log_trace(subsystem, fmt, ...) do { } while(0)
+#endif
+
 #define logprintln(a) _logprintln(__FILE__, __LINE__, a)
 #define logprintf(a, ...) _logprintf(__FILE__, __LINE__, a, ##__VA_ARGS__)
 #define logprintln_P(a) _logprintln_P(__FILE__, __LINE__, a)
@@ -20,5 +91,15 @@ void _logprintln(const char *file, unsigned int line, char *msg);
 void _logprintf(const char *file, unsigned int line, char *fmt, ...);
 void _logprintln_P(const char *file, unsigned int line, const __FlashStringHelper *msg);
 void _logprintf_P(const char *file, unsigned int line, const __FlashStringHelper *fmt, ...);
+void _logleveled_P(uint8_t level, uint8_t subsystem, const char *fmt, ...);
+
+/*
+ * Sets the runtime level and the comma separated
+ * subsystems that log info and below, e.g.
+ * "decode,mqtt". An empty list selects them all.
+ */
+void log_filter(uint8_t level, const char *subsystems);
+/* Copies the name of a subsystem, name holds 8 bytes */
+void log_subsystem_name(uint8_t subsystem, char *name);
 
 #endif
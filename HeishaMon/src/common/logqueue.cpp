@@ -0,0 +1,204 @@
+/*
+  Copyright (C) CurlyMo
+
+  This Source Code Form is subject to the terms of the Mozilla Public
+  License, v. 2.0. If a copy of the MPL was not distributed with this
+  file, You can obtain one at http://mozilla.org/MPL/2.0/.
+*/
+
+#if defined(ESP8266) || defined(ESP32)
+  #include <Arduino.h>
+#endif
+
+#include <stdio.h>
+#include <stdlib.h>
+#include <string.h>
+#include <time.h>
+
+#include "logqueue.h"
+
+typedef struct logqueue_sink_t {
+  logqueue_sink_cb *cb;
+  uint8_t rate;
+  uint32_t pos;
+  uint32_t seq;
+  uint32_t dropped;
+  uint8_t busy;
+} logqueue_sink_t;
+
+/*
+ * Positions and sequence numbers only grow, the
+ * buffer offset is the position modulo the size.
+ * Records between first and head are valid.
+ */
+/*
+ * The positions wrap at 2^32, the offset only
+ * stays continuous when the size divides that.
+ */
+static_assert((LOGQUEUE_SIZE & (LOGQUEUE_SIZE - 1)) == 0, "LOGQUEUE_SIZE must be a power of two");
+static uint8_t buffer[LOGQUEUE_SIZE];
+static uint32_t head = 0;
+static uint32_t headseq = 0;
+static uint32_t first = 0;
+static uint32_t firstseq = 0;
+static struct logqueue_sink_t sinks[LOGQUEUE_SINKS];
+static uint8_t nrsinks = 0;
+
+/*
+ * The modbus workers log from another task on
+ * the ESP32, the ESP8266 is single threaded.
+ */
+#if defined(ESP32)
+static portMUX_TYPE lock = portMUX_INITIALIZER_UNLOCKED;
+  #define LOGQUEUE_LOCK() portENTER_CRITICAL(&lock)
+  #define LOGQUEUE_UNLOCK() portEXIT_CRITICAL(&lock)
+#else
+  #define LOGQUEUE_LOCK()
+  #define LOGQUEUE_UNLOCK()
+#endif
+
+#if !defined(ESP8266) && !defined(ESP32)
+static uint32_t millis(void) {
+  struct timespec ts;
+  clock_gettime(CLOCK_MONOTONIC, &ts);
+
+  return ts.tv_sec * 1000 + ts.tv_nsec / 1000000;
+}
+#endif
+
+static void logqueue_read(uint32_t pos, void *dst, uint16_t len) {
+  uint16_t offset = pos % LOGQUEUE_SIZE;
+  uint16_t part = LOGQUEUE_SIZE - offset;
+
+  if(part >= len) {
+    memcpy(dst, &buffer[offset], len);
+  } else {
+    memcpy(dst, &buffer[offset], part);
+    memcpy(&((uint8_t *)dst)[part], buffer, len - part);
+  }
+}
+
+static void logqueue_write(uint32_t pos, const void *src, uint16_t len) {
+  uint16_t offset = pos % LOGQUEUE_SIZE;
+  uint16_t part = LOGQUEUE_SIZE - offset;
+
+  if(part >= len) {
+    memcpy(&buffer[offset], src, len);
+  } else {
+    memcpy(&buffer[offset], src, part);
+    memcpy(buffer, &((const uint8_t *)src)[part], len - part);
+  }
+}
+
+void logqueue_add(uint8_t level, uint8_t subsystem, const char *msg) {
+  struct logqueue_record_t record;
+  size_t len = strlen(msg);
+
+  if(len > LOGQUEUE_LINE) {
+    len = LOGQUEUE_LINE;
+  }
+  record.millis = millis();
+  record.level = level;
+  record.subsystem = subsystem;
+  record.len = len;
+
+  uint16_t size = sizeof(record) + len;
+
+  LOGQUEUE_LOCK();
+  while((head - first) + size > LOGQUEUE_SIZE) {
+    struct logqueue_record_t old;
+    logqueue_read(first, &old, sizeof(old));
+    first += sizeof(old) + old.len;
+    firstseq++;
+  }
+  logqueue_write(head, &record, sizeof(record));
+  logqueue_write(head + sizeof(record), msg, len);
+  head += size;
+  headseq++;
+  LOGQUEUE_UNLOCK();
+}
+
+int8_t logqueue_sink(logqueue_sink_cb *cb, uint8_t rate) {
+  if(nrsinks >= LOGQUEUE_SINKS) {
+    return -1;
+  }
+  LOGQUEUE_LOCK();
+  sinks[nrsinks].cb = cb;
+  sinks[nrsinks].rate = rate;
+  sinks[nrsinks].pos = first;
+  sinks[nrsinks].seq = firstseq;
+  sinks[nrsinks].dropped = 0;
+  sinks[nrsinks].busy = 0;
+  LOGQUEUE_UNLOCK();
+
+  return nrsinks++;
+}
+
+void logqueue_drain(void) {
+  struct logqueue_record_t record;
+  char text[LOGQUEUE_LINE+1];
+  uint8_t i = 0, x = 0;
+
+  for(i=0;i<nrsinks;i++) {
+    struct logqueue_sink_t *sink = &sinks[i];
+
+    sink->busy = 0;
+    for(x=0;x<sink->rate;x++) {
+      LOGQUEUE_LOCK();
+      if((int32_t)(firstseq - sink->seq) > 0) {
+        sink->dropped += firstseq - sink->seq;
+        sink->pos = first;
+        sink->seq = firstseq;
+      }
+      if(sink->seq == headseq) {
+        LOGQUEUE_UNLOCK();
+        break;
+      }
+      logqueue_read(sink->pos, &record, sizeof(record));
+      logqueue_read(sink->pos + sizeof(record), text, record.len);
+      LOGQUEUE_UNLOCK();
+
+      text[record.len] = 0;
+      if(sink->cb(&record, text) == -1) {
+        sink->busy = 1;
+        break;
+      }
+      LOGQUEUE_LOCK();
+      if((int32_t)(firstseq - sink->seq) > 0) {
+        /*
+         * Overwritten while the sink was writing it,
+         * everything after it up to first is lost.
+         */
+        sink->dropped += firstseq - sink->seq - 1;
+        sink->pos = first;
+        sink->seq = firstseq;
+      } else {
+        sink->pos += sizeof(record) + record.len;
+        sink->seq++;
+      }
+      LOGQUEUE_UNLOCK();
+    }
+  }
+}
+
+uint8_t logqueue_pending(void) {
+  uint8_t i = 0, pending = 0;
+
+  LOGQUEUE_LOCK();
+  for(i=0;i<nrsinks;i++) {
+    if(sinks[i].busy == 0 && sinks[i].seq != headseq) {
+      pending = 1;
+      break;
+    }
+  }
+  LOGQUEUE_UNLOCK();
+
+  return pending;
+}
+
+uint32_t logqueue_dropped(uint8_t sink) {
+  if(sink >= nrsinks) {
+    return 0;
+  }
+  return sinks[sink].dropped;
+}
@@ -0,0 +1,73 @@
+/*
+  Copyright (C) CurlyMo
+
+  This Source Code Form is subject to the terms of the Mozilla Public
+  License, v. 2.0. If a copy of the MPL was not distributed with this
+  file, You can obtain one at http://mozilla.org/MPL/2.0/.
+*/
+
+#ifndef _LOGQUEUE_H_
+#define _LOGQUEUE_H_
+
+#include <stdint.h>
+
+/*
+ * Log messages are appended to a fixed ring buffer
+ * and written to the sinks later from the main loop.
+ * When the buffer is full the oldest messages are
+ * overwritten, sinks that did not write them yet
+ * count them as dropped.
+ */
+#ifndef LOGQUEUE_SIZE
+  #if defined(ESP32)
+    #define LOGQUEUE_SIZE 8192
+  #else
+    #define LOGQUEUE_SIZE 2048
+  #endif
+#endif
+
+/* Longer messages are truncated */
+#define LOGQUEUE_LINE 256
+#define LOGQUEUE_SINKS 4
+
+/*
+ * Log levels, lower is more important. Defines
+ * instead of an enum, so the preprocessor can
+ * compare them for the compile time level.
+ */
+#define LOG_ERROR 0
+#define LOG_WARN  1
+#define LOG_INFO  2
+#define LOG_DEBUG 3
+#define LOG_TRACE 4
+
+typedef struct logqueue_record_t {
+  uint32_t millis;
+  uint8_t level;
+  uint8_t subsystem;
+  uint16_t len;
+} logqueue_record_t;
+
+/*
+ * Returns 0 when the message was written or skipped
+ * and -1 when the sink is busy, the same message is
+ * offered again on the next drain.
+ */
+typedef int8_t (logqueue_sink_cb)(struct logqueue_record_t *record, char *text);
+
+void logqueue_add(uint8_t level, uint8_t subsystem, const char *msg);
+/*
+ * Registers a sink that writes at most rate messages
+ * per drain. It starts with the oldest buffered message.
+ */
+int8_t logqueue_sink(logqueue_sink_cb *cb, uint8_t rate);
+void logqueue_drain(void);
+/*
+ * Whether a sink has messages left that it can write
+ * on the next drain. Sinks that refused a message are
+ * not counted, they only become ready again later.
+ */
+uint8_t logqueue_pending(void);
+uint32_t logqueue_dropped(uint8_t sink);
+
+#endif
\ No newline at end of file
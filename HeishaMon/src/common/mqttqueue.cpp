@@ -0,0 +1,223 @@
+/*
+  Copyright (C) CurlyMo
+
+  This Source Code Form is subject to the terms of the Mozilla Public
+  License, v. 2.0. If a copy of the MPL was not distributed with this
+  file, You can obtain one at http://mozilla.org/MPL/2.0/.
+*/
+
+#if defined(ESP8266) || defined(ESP32)
+  #include <Arduino.h>
+#endif
+
+#include <stdio.h>
+#include <stdlib.h>
+#include <string.h>
+
+#include "mqttqueue.h"
+
+/* Set on records replaced by a newer message */
+#define MQTTQUEUE_DEAD 0x80
+
+/*
+ * A record is followed by the zero terminated
+ * topic and the payload. Records between head
+ * and tail are in the order they were queued,
+ * the space of dead records is reclaimed when
+ * the head passes them or the buffer is compacted.
+ */
+typedef struct mqttqueue_record_t {
+  uint16_t hash;
+  uint16_t len;
+  uint8_t topiclen;
+  uint8_t flags;
+} mqttqueue_record_t;
+
+static uint8_t buffer[MQTTQUEUE_SIZE];
+static uint16_t head = 0;
+static uint16_t tail = 0;
+/* Bytes and number of the records still to send */
+static uint16_t used = 0;
+static uint16_t nrrecords = 0;
+static struct mqttqueue_stats_t stats;
+static mqttqueue_send_cb *sender = NULL;
+static uint8_t refused = 0;
+
+static uint16_t mqttqueue_hash(const char *topic, uint8_t len) {
+  uint32_t hash = 2166136261UL;
+  uint8_t i = 0;
+
+  for(i=0;i<len;i++) {
+    hash ^= (uint8_t)topic[i];
+    hash *= 16777619UL;
+  }
+  return (hash >> 16) ^ (hash & 0xFFFF);
+}
+
+static uint16_t mqttqueue_size(struct mqttqueue_record_t *record) {
+  return sizeof(struct mqttqueue_record_t) + record->topiclen + 1 + record->len;
+}
+
+static int32_t mqttqueue_find(const char *topic, uint8_t topiclen, uint16_t hash) {
+  struct mqttqueue_record_t record;
+  uint16_t pos = head;
+
+  while(pos < tail) {
+    memcpy(&record, &buffer[pos], sizeof(record));
+    if((record.flags & (MQTTQUEUE_DEAD | MQTTQUEUE_APPEND)) == 0 &&
+       record.hash == hash && record.topiclen == topiclen &&
+       memcmp(&buffer[pos + sizeof(record)], topic, topiclen) == 0) {
+      return pos;
+    }
+    pos += mqttqueue_size(&record);
+  }
+  return -1;
+}
+
+static void mqttqueue_compact(void) {
+  struct mqttqueue_record_t record;
+  uint16_t pos = head, dst = 0;
+
+  while(pos < tail) {
+    memcpy(&record, &buffer[pos], sizeof(record));
+    uint16_t size = mqttqueue_size(&record);
+    if((record.flags & MQTTQUEUE_DEAD) == 0) {
+      if(dst != pos) {
+        memmove(&buffer[dst], &buffer[pos], size);
+      }
+      dst += size;
+    }
+    pos += size;
+  }
+  head = 0;
+  tail = dst;
+}
+
+int8_t mqttqueue_publish_raw(const char *topic, const uint8_t *payload, uint16_t len, uint8_t flags) {
+  struct mqttqueue_record_t record;
+  size_t topiclen = strlen(topic);
+
+  /* Same limit as the client: 5 bytes fixed header and the topic length */
+  if(topiclen > 0xFF || 7 + topiclen + len > MQTTQUEUE_MESSAGE) {
+    stats.dropped++;
+    return -1;
+  }
+
+  /* Nothing to keep in order with */
+  if(head == tail && sender != NULL && sender(topic, payload, len, flags & MQTTQUEUE_RETAIN) == 0) {
+    stats.queued++;
+    stats.sent++;
+    return 0;
+  }
+
+  uint16_t hash = mqttqueue_hash(topic, topiclen);
+  uint16_t size = sizeof(record) + topiclen + 1 + len;
+  uint16_t room = MQTTQUEUE_SIZE - used;
+  int32_t old = -1;
+
+  if((flags & MQTTQUEUE_APPEND) == 0 && (old = mqttqueue_find(topic, topiclen, hash)) > -1) {
+    memcpy(&record, &buffer[old], sizeof(record));
+    if(record.len == len) {
+      /* Same length, the new value keeps the place in the queue */
+      memcpy(&buffer[old + sizeof(record) + topiclen + 1], payload, len);
+      record.flags = flags & MQTTQUEUE_RETAIN;
+      memcpy(&buffer[old], &record, sizeof(record));
+      stats.queued++;
+      stats.coalesced++;
+      return 0;
+    }
+    room += mqttqueue_size(&record);
+  }
+
+  if(size > room) {
+    stats.dropped++;
+    return -1;
+  }
+
+  if(old > -1) {
+    record.flags |= MQTTQUEUE_DEAD;
+    memcpy(&buffer[old], &record, sizeof(record));
+    used -= mqttqueue_size(&record);
+    nrrecords--;
+    stats.coalesced++;
+  }
+  if(tail + size > MQTTQUEUE_SIZE) {
+    mqttqueue_compact();
+  }
+
+  record.hash = hash;
+  record.len = len;
+  record.topiclen = topiclen;
+  record.flags = flags & (MQTTQUEUE_RETAIN | MQTTQUEUE_APPEND);
+  memcpy(&buffer[tail], &record, sizeof(record));
+  memcpy(&buffer[tail + sizeof(record)], topic, topiclen + 1);
+  memcpy(&buffer[tail + sizeof(record) + topiclen + 1], payload, len);
+  tail += size;
+  used += size;
+  nrrecords++;
+  stats.queued++;
+
+  return 0;
+}
+
+int8_t mqttqueue_publish(const char *topic, const char *payload, uint8_t flags) {
+  return mqttqueue_publish_raw(topic, (const uint8_t *)payload, strlen(payload), flags);
+}
+
+void mqttqueue_setup(mqttqueue_send_cb *cb) {
+  sender = cb;
+}
+
+void mqttqueue_drain(uint8_t rate) {
+  struct mqttqueue_record_t record;
+  uint8_t x = 0;
+
+  if(sender == NULL) {
+    return;
+  }
+  refused = 0;
+  while(x < rate && head < tail) {
+    memcpy(&record, &buffer[head], sizeof(record));
+    uint16_t size = mqttqueue_size(&record);
+
+    if((record.flags & MQTTQUEUE_DEAD) == 0) {
+      const char *topic = (const char *)&buffer[head + sizeof(record)];
+      if(sender(topic, (const uint8_t *)&topic[record.topiclen + 1], record.len, record.flags & MQTTQUEUE_RETAIN) == -1) {
+        refused = 1;
+        break;
+      }
+      used -= size;
+      nrrecords--;
+      stats.sent++;
+      x++;
+    }
+    head += size;
+  }
+  if(head == tail) {
+    head = 0;
+    tail = 0;
+  }
+}
+
+void mqttqueue_clear(void) {
+  head = 0;
+  tail = 0;
+  used = 0;
+  nrrecords = 0;
+}
+
+uint16_t mqttqueue_count(void) {
+  return nrrecords;
+}
+
+uint8_t mqttqueue_pending(void) {
+  return nrrecords > 0 && refused == 0;
+}
+
+uint16_t mqttqueue_bytes(void) {
+  return used;
+}
+
+struct mqttqueue_stats_t *mqttqueue_stats(void) {
+  return &stats;
+}
\ No newline at end of file
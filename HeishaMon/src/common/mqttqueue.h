@@ -0,0 +1,77 @@
+/*
+  Copyright (C) CurlyMo
+
+  This Source Code Form is subject to the terms of the Mozilla Public
+  License, v. 2.0. If a copy of the MPL was not distributed with this
+  file, You can obtain one at http://mozilla.org/MPL/2.0/.
+*/
+
+#ifndef _MQTTQUEUE_H_
+#define _MQTTQUEUE_H_
+
+#include <stdint.h>
+
+/*
+ * Outgoing MQTT messages are sent at once while
+ * nothing is queued and the client takes them,
+ * otherwise they are queued in a fixed buffer and
+ * sent from the main loop. A message for a topic
+ * that is still queued replaces the older one, so
+ * only the latest value is sent. When the buffer
+ * is full new messages are dropped.
+ */
+#ifndef MQTTQUEUE_SIZE
+  #if defined(ESP32)
+    #define MQTTQUEUE_SIZE 8192
+  #else
+    #define MQTTQUEUE_SIZE 3072
+  #endif
+#endif
+
+/* Larger messages don't fit the client buffer */
+#ifndef MQTTQUEUE_MESSAGE
+  #define MQTTQUEUE_MESSAGE 1024
+#endif
+
+#define MQTTQUEUE_RETAIN 0x01
+/* Keep every message for this topic, e.g. log lines */
+#define MQTTQUEUE_APPEND 0x02
+
+typedef struct mqttqueue_stats_t {
+  uint32_t queued;
+  uint32_t coalesced;
+  uint32_t dropped;
+  uint32_t sent;
+} mqttqueue_stats_t;
+
+/*
+ * Returns 0 when the message was sent and -1 when
+ * the client is busy or disconnected, the same
+ * message is offered again on the next drain.
+ */
+typedef int8_t (mqttqueue_send_cb)(const char *topic, const uint8_t *payload, uint16_t len, uint8_t retain);
+
+void mqttqueue_setup(mqttqueue_send_cb *cb);
+
+/*
+ * Both return -1 when the message was dropped
+ * because the queue is full or it is too large.
+ */
+int8_t mqttqueue_publish(const char *topic, const char *payload, uint8_t flags);
+int8_t mqttqueue_publish_raw(const char *topic, const uint8_t *payload, uint16_t len, uint8_t flags);
+/*
+ * Sends at most rate messages, oldest first, and
+ * stops at the first message the client refuses.
+ */
+void mqttqueue_drain(uint8_t rate);
+void mqttqueue_clear(void);
+uint16_t mqttqueue_count(void);
+/*
+ * Whether the next drain can send a queued message,
+ * false while the client refuses them.
+ */
+uint8_t mqttqueue_pending(void);
+uint16_t mqttqueue_bytes(void);
+struct mqttqueue_stats_t *mqttqueue_stats(void);
+
+#endif
\ No newline at end of file
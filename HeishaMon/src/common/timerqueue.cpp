@@ -9,225 +9,202 @@
 #if defined(ESP8266) || defined(ESP32)
   #include <Arduino.h>
 #endif
+#if defined(ESP32)
+  #include <esp_timer.h>
+#endif
 
 #include <stdio.h>
 #include <stdlib.h>
 #include <string.h>
 #include <time.h>
-#include <unistd.h>
-#include <sys/time.h>
 
-#include "mem.h"
 #include "timerqueue.h"
 
-static unsigned int lasttime = 0;
-static unsigned int *calls = NULL;
-static unsigned int nrcalls = 0;
+/*
+ * The timers live in a fixed pool. The heap holds
+ * pool indexes ordered by deadline and every timer
+ * knows its heap position, so a timer found through
+ * the buckets can be moved or removed in O(log n).
+ * Bucket and next references are 1-based, so zero
+ * initialized memory is an empty queue.
+ */
+static struct timerqueue_t timers[TIMERQUEUE_SIZE];
+static uint16_t heap[TIMERQUEUE_SIZE];
+static uint16_t buckets[TIMERQUEUE_SIZE];
+static uint16_t nrtimers = 0;
+//timers with a nr of zero or more
+static uint16_t nrpublic = 0;
+static uint16_t nrpool = 0;
+static uint16_t freelist = 0;
+
+uint64_t timerqueue_micros(void) {
+#if defined(ESP8266)
+  return micros64();
+#elif defined(ESP32)
+  return (uint64_t)esp_timer_get_time();
+#else
+  struct timespec ts;
+  clock_gettime(CLOCK_MONOTONIC, &ts);
 
-#if !defined(ESP8266) && !defined(ESP32)
-static unsigned int micros() {
-  struct timeval tv;
-  gettimeofday(&tv,NULL);
+  return (uint64_t)ts.tv_sec * 1000000 + ts.tv_nsec / 1000;
+#endif
+}
 
-  return 1000000 * tv.tv_sec + tv.tv_usec;;
+static uint16_t timerqueue_bucket(int nr) {
+  return (unsigned int)nr % TIMERQUEUE_SIZE;
 }
-#endif
 
-static void timerqueue_sort() {
-  int matched = 1;
-  while(matched) {
-    int a = 0;
-    matched = 0;
-    for(a=0;a<timerqueue_size-1;a++) {
-      if(timerqueue[a]->remove < timerqueue[a+1]->remove ||
-         (timerqueue[a]->remove == timerqueue[a+1]->remove && timerqueue[a]->sec > timerqueue[a+1]->sec) ||
-         (timerqueue[a]->remove == timerqueue[a+1]->remove && timerqueue[a]->sec == timerqueue[a+1]->sec && timerqueue[a]->usec > timerqueue[a+1]->usec)) {
-        struct timerqueue_t *node = timerqueue[a+1];
-        timerqueue[a+1] = timerqueue[a];
-        timerqueue[a] = node;
-        matched = 1;
-        break;
-      }
+static int timerqueue_find(int nr) {
+  uint16_t i = buckets[timerqueue_bucket(nr)];
+  while(i > 0) {
+    if(timers[i-1].nr == nr) {
+      return i-1;
     }
+    i = timers[i-1].next;
   }
+  return -1;
 }
 
-struct timerqueue_t *timerqueue_pop() {
-  if(timerqueue_size == 0) {
-    return NULL;
-  }
-  struct timerqueue_t *x = timerqueue[0];
-  timerqueue[0] = timerqueue[timerqueue_size-1];
-
-  timerqueue_size--;
+static void timerqueue_set(uint16_t pos, uint16_t idx) {
+  heap[pos] = idx;
+  timers[idx].pos = pos;
+}
 
-  if(timerqueue_size == 0) {
-    free(timerqueue);
-    timerqueue = NULL;
-  } else {
-    if((timerqueue = (struct timerqueue_t **)realloc(timerqueue, sizeof(struct timerqueue_t *)*timerqueue_size)) == NULL) {
-  #if defined(ESP8266) || defined(ESP32)
-      //loggingSerial.printf("Out of memory %s:#%d\n", __FUNCTION__, __LINE__);
-      ESP.restart();
-      exit(-1);
-  #else
-      fprintf(stderr, "Out of memory %s:#%d\n", __FUNCTION__, __LINE__);
-      exit(-1);
-  #endif
+static void timerqueue_up(uint16_t pos) {
+  uint16_t idx = heap[pos];
+  while(pos > 0) {
+    uint16_t parent = (pos-1)/2;
+    if(timers[heap[parent]].deadline <= timers[idx].deadline) {
+      break;
     }
+    timerqueue_set(pos, heap[parent]);
+    pos = parent;
   }
+  timerqueue_set(pos, idx);
+}
 
-  int a = 0;
-  for(a=0;a<timerqueue_size;a++) {
-    timerqueue[a]->sec -= x->sec;
-    timerqueue[a]->usec -= x->usec;
-    if(timerqueue[a]->usec < 0) {
-      timerqueue[a]->sec -= 1;
-      timerqueue[a]->usec += 1000000;
+static void timerqueue_down(uint16_t pos) {
+  uint16_t idx = heap[pos];
+  while(1) {
+    uint16_t child = pos*2+1;
+    if(child >= nrtimers) {
+      break;
     }
+    if(child+1 < nrtimers && timers[heap[child+1]].deadline < timers[heap[child]].deadline) {
+      child++;
+    }
+    if(timers[idx].deadline <= timers[heap[child]].deadline) {
+      break;
+    }
+    timerqueue_set(pos, heap[child]);
+    pos = child;
   }
-
-  timerqueue_sort();
-
-  return x;
+  timerqueue_set(pos, idx);
 }
 
-struct timerqueue_t *timerqueue_peek() {
-  if(timerqueue_size == 0) {
-    return NULL;
-  }
-  return timerqueue[0];
-}
+static void timerqueue_remove(uint16_t idx) {
+  uint16_t *ref = &buckets[timerqueue_bucket(timers[idx].nr)];
+  uint16_t pos = timers[idx].pos;
 
-void timerqueue_insert(int sec, int usec, int nr) {
-  struct timerqueue_t *node = NULL;
-  int a = 0, matched = 0, x = 0, y = 0;
-
-  for(a=0;a<timerqueue_size;a++) {
-    if(timerqueue[a]->nr == nr) {
-      timerqueue[a]->sec = sec;
-      timerqueue[a]->usec = usec;
-      if(sec <= 0 && usec <= 0) {
-        timerqueue[a]->remove = 1;
-        for(x=0;x<nrcalls;x++) {
-          if(calls[x] == timerqueue[a]->nr) {
-            if(nrcalls > 0) {
-              for(y=x;y<nrcalls-1;y++) {
-                calls[y] = calls[y+1];
-              }
-              nrcalls--;
-            }
-            break;
-          }
-        }
-      }
-      timerqueue_sort();
-      matched = 1;
-      break;
-    }
+  while(*ref != idx+1) {
+    ref = &timers[*ref-1].next;
   }
+  *ref = timers[idx].next;
 
-  if(matched == 1) {
-    while((node = timerqueue_peek()) != NULL) {
-      if(node->remove == 1) {
-        struct timerqueue_t *node = timerqueue_pop();
-        free(node);
-      } else {
-        break;
-      }
-    }
-
-    return;
-  } else if(sec == 0 && usec == 0) {
-    return;
+  timers[idx].next = freelist;
+  freelist = idx+1;
+  if(timers[idx].nr >= 0) {
+    nrpublic--;
   }
 
-  if((timerqueue = (struct timerqueue_t **)realloc(timerqueue, sizeof(struct timerqueue_t *)*(timerqueue_size+1))) == NULL) {
-#if defined(ESP8266) || defined(ESP32)
-    //loggingSerial.printf("Out of memory %s:#%d\n", __FUNCTION__, __LINE__);
-    ESP.restart();
-    exit(-1);
-#else
-    fprintf(stderr, "Out of memory %s:#%d\n", __FUNCTION__, __LINE__);
-    exit(-1);
-#endif
+  if(pos != --nrtimers) {
+    uint16_t last = heap[nrtimers];
+    timerqueue_set(pos, last);
+    timerqueue_down(pos);
+    timerqueue_up(timers[last].pos);
   }
+}
 
-  node = (struct timerqueue_t *)malloc(sizeof(struct timerqueue_t));
-  if(node == NULL) {
-#if defined(ESP8266) || defined(ESP32)
-    //loggingSerial.printf("Out of memory %s:#%d\n", __FUNCTION__, __LINE__);
-    ESP.restart();
-    exit(-1);
-#else
-    fprintf(stderr, "Out of memory %s:#%d\n", __FUNCTION__, __LINE__);
-    exit(-1);
-#endif
+struct timerqueue_t *timerqueue_peek(void) {
+  if(nrtimers == 0) {
+    return NULL;
   }
-  memset(node, 0, sizeof(struct timerqueue_t));
-  node->sec = sec;
-  node->usec = usec;
-  node->nr = nr;
+  return &timers[heap[0]];
+}
 
-  timerqueue[timerqueue_size++] = node;
-  timerqueue_sort();
+uint16_t timerqueue_size(void) {
+  return nrtimers;
 }
 
-void timerqueue_update(void) {
-  struct timeval tv;
-  unsigned int curtime = 0;
+void timerqueue_clear(void) {
+  memset(buckets, 0, sizeof(buckets));
+  nrtimers = 0;
+  nrpublic = 0;
+  nrpool = 0;
+  freelist = 0;
+}
 
-  curtime = micros();
+int8_t timerqueue_insert(int sec, int usec, int nr) {
+  int idx = timerqueue_find(nr);
 
-  unsigned int diff = curtime - lasttime;
-  unsigned int sec = diff / 1000000;
-  unsigned int usec = diff - ((diff / 1000000) * 1000000);
-  int a = 0, x = 0;
+  if(sec <= 0 && usec <= 0) {
+    if(idx > -1) {
+      timerqueue_remove(idx);
+    }
+    return 0;
+  }
 
-  lasttime = curtime;
+  uint64_t deadline = timerqueue_micros() + (int64_t)sec * 1000000 + usec;
 
-  for(a=0;a<timerqueue_size;a++) {
-    timerqueue[a]->sec -= sec;
-    timerqueue[a]->usec -= usec;
-    if(timerqueue[a]->usec < 0) {
-      timerqueue[a]->usec = 1000000 + timerqueue[a]->usec;
-      timerqueue[a]->sec -= 1;
+  if(idx > -1) {
+    uint64_t old = timers[idx].deadline;
+    timers[idx].deadline = deadline;
+    if(deadline < old) {
+      timerqueue_up(timers[idx].pos);
+    } else {
+      timerqueue_down(timers[idx].pos);
     }
+    return 0;
+  }
 
-    if(timerqueue[a]->sec < 0 || (timerqueue[a]->sec == 0 && timerqueue[a]->usec <= 0)) {
-      int nr = timerqueue[a]->nr;
-      if((calls = (unsigned int *)realloc(calls, (nrcalls+1)*sizeof(unsigned int))) == NULL) {
-#if defined(ESP8266) || defined(ESP32)
-        ///loggingSerial.printf("Out of memory %s:#%d\n", __FUNCTION__, __LINE__);
-        ESP.restart();
-        exit(-1);
-#else
-        fprintf(stderr, "Out of memory %s:#%d\n", __FUNCTION__, __LINE__);
-        exit(-1);
-#endif
-      }
-      calls[nrcalls++] = nr;
-    }
+  if(nr >= 0 && nrpublic >= TIMERQUEUE_SIZE-TIMERQUEUE_RESERVED) {
+    return -1;
   }
-  for(a=0;a<timerqueue_size;a++) {
-    if(timerqueue[a]->sec < 0 || (timerqueue[a]->sec == 0 && timerqueue[a]->usec == 0)) {
-      struct timerqueue_t *node = timerqueue_pop();
-      free(node);
-      a--;
-    }
+  if(freelist > 0) {
+    idx = freelist-1;
+    freelist = timers[idx].next;
+  } else if(nrpool < TIMERQUEUE_SIZE) {
+    idx = nrpool++;
+  } else {
+    return -1;
   }
-  while(nrcalls > 0) {
-    timer_cb(calls[0]);
-    if(nrcalls > 0) {
-      for(a=0;a<nrcalls-1;a++) {
-        calls[a] = calls[a+1];
-      }
-      nrcalls--;
-    }
+
+  uint16_t bucket = timerqueue_bucket(nr);
+  timers[idx].deadline = deadline;
+  timers[idx].nr = nr;
+  timers[idx].next = buckets[bucket];
+  buckets[bucket] = idx+1;
+
+  if(nr >= 0) {
+    nrpublic++;
   }
-  if(calls != NULL) {
-    free(calls);
-    calls = NULL;
+
+  timerqueue_set(nrtimers, idx);
+  timerqueue_up(nrtimers++);
+
+  return 0;
+}
+
+void timerqueue_update(void) {
+  /*
+   * Timers (re)scheduled by a callback get a deadline
+   * after now, so they wait for the next update.
+   */
+  uint64_t now = timerqueue_micros();
+
+  while(nrtimers > 0 && timers[heap[0]].deadline <= now) {
+    int nr = timers[heap[0]].nr;
+    timerqueue_remove(heap[0]);
+    timer_cb(nr);
   }
-  nrcalls = 0;
 }
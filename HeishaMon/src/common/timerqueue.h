@@ -11,21 +11,49 @@
 
 #include <stdint.h>
 
+/*
+ * Maximum number of pending timers. The queue is
+ * a fixed binary min-heap, so this is all the
+ * memory it will ever use.
+ */
+#ifndef TIMERQUEUE_SIZE
+  #define TIMERQUEUE_SIZE 32
+#endif
+
+/*
+ * Slots only the firmware timers with a negative
+ * nr can use, so rules can't keep a reboot or ntp
+ * sync from being scheduled.
+ */
+#ifndef TIMERQUEUE_RESERVED
+  #define TIMERQUEUE_RESERVED 8
+#endif
+
 typedef struct timerqueue_t {
-	int sec;
-	int usec;
+  /* Absolute deadline in microseconds */
+  uint64_t deadline;
   int nr;
-  int remove;
+  /* Position in the heap */
+  uint16_t pos;
+  /* Next timer in the same bucket or free list, 1-based */
+  uint16_t next;
 } timerqueue_t;
 
-extern struct timerqueue_t **timerqueue;
-extern int timerqueue_size;
 extern void timer_cb(int nr);
 
-struct timerqueue_t *timerqueue_pop();
-struct timerqueue_t *timerqueue_peek();
+uint64_t timerqueue_micros(void);
+struct timerqueue_t *timerqueue_peek(void);
+uint16_t timerqueue_size(void);
+void timerqueue_clear(void);
 void timerqueue_update(void);
-void timerqueue_insert(int sec, int usec, int nr);
+/*
+ * (Re)schedules timer nr, or cancels it when
+ * both sec and usec are zero or less. Returns
+ * -1 when the queue is full, for timers with a
+ * positive nr that leaves TIMERQUEUE_RESERVED
+ * slots.
+ */
+int8_t timerqueue_insert(int sec, int usec, int nr);
 
 
 #endif
\ No newline at end of file
@@ -1903,6 +1903,16 @@ void websocket_write_all(char *data, uint16_t data_len) {
   }
 }
 
+uint8_t websocket_clients(void) {
+  uint8_t i = 0, nr = 0;
+  for(i=0;i<WEBSERVER_MAX_CLIENTS;i++) {
+    if(clients[i].data.is_websocket == 1 && clients[i].data.step != WEBSERVER_CLIENT_CLOSE) {
+      nr++;
+    }
+  }
+  return nr;
+}
+
 void websocket_write_all_P(PGM_P data, uint16_t data_len) {
   uint8_t i = 0;
   for(i=0;i<WEBSERVER_MAX_CLIENTS;i++) {
@@ -2368,6 +2378,33 @@ void webserver_loop(void) {
 #endif
 }
 
+/*
+ * Synchronous clients are only served from webserver_loop,
+ * so the main loop should not sleep while one of them still
+ * has work. Idle websockets do not count.
+ */
+uint8_t webserver_active(void) {
+  uint8_t i = 0;
+
+  for(i=0;i<WEBSERVER_MAX_CLIENTS;i++) {
+    if(clients[i].data.step == 0 || clients[i].data.async == 1) {
+      continue;
+    }
+#if defined(ESP8266) || defined(ESP32)
+    if(clients[i].data.step == WEBSERVER_CLIENT_WEBSOCKET && clients[i].data.client->available() == 0) {
+      continue;
+    }
+#endif
+    return 1;
+  }
+#if defined(ESP8266) || defined(ESP32)
+  if(sync_server.hasClient()) {
+    return 1;
+  }
+#endif
+  return 0;
+}
+
 int8_t webserver_start(int port, webserver_cb_t *callback, uint8_t async) {
   uint8_t i = 0;
 
@@ -62,12 +62,20 @@
 typedef struct tcp_pcb {
 } tcp_pcb;
 
+#ifndef LWIP_HDR_PBUF_H
+#define LWIP_HDR_PBUF_H
+/* The same stand-in as src/rules/rules.h */
 typedef struct pbuf {
-  unsigned int len;
-  void *payload;
   struct pbuf *next;
+  void *payload;
+  uint16_t tot_len;
+  uint16_t len;
+  uint8_t type;
+  uint8_t flags;
+  uint16_t ref;
 } pbuf;
 #endif
+#endif
 
 typedef struct header_t {
   unsigned char *buffer;
@@ -170,8 +178,10 @@ enum {
 
 int8_t webserver_start(int port, webserver_cb_t *callback, uint8_t async);
 void webserver_loop(void);
+uint8_t webserver_active(void);
 void websocket_write_all_P(PGM_P data, uint16_t data_len);
 void websocket_write_all(char *data, uint16_t data_len);
+uint8_t websocket_clients(void);
 void websocket_write_P(struct webserver_t *client, PGM_P data, uint16_t data_len);
 void websocket_write(struct webserver_t *client, char *data, uint16_t data_len);
 void websocket_send_header(struct webserver_t *client, uint8_t opcode, uint16_t data_len);
@@ -34,6 +34,11 @@
 #include "functions/concat.h"
 #include "functions/print.h"
 #include "functions/gpio.h"
+#include "functions/changed.h"
+#include "functions/ema.h"
+#include "functions/pid.h"
+#include "functions/interp.h"
+#include "functions/hysteresis.h"
 
 struct rule_function_t rule_functions[] = {
   { "max", rule_function_max_callback },
@@ -46,7 +51,12 @@ struct rule_function_t rule_functions[] = {
   { "isset", rule_function_isset_callback },
   { "print", rule_function_print_callback },
   { "concat", rule_function_concat_callback },
-  { "gpio", rule_function_gpio_callback }
+  { "gpio", rule_function_gpio_callback },
+  { "changed", rule_function_changed_callback },
+  { "ema", rule_function_ema_callback, sizeof(struct ema_state_t) },
+  { "pid", rule_function_pid_callback, sizeof(struct pid_state_t) },
+  { "interp", rule_function_interp_callback },
+  { "hysteresis", rule_function_hysteresis_callback, sizeof(struct hysteresis_state_t) }
 };
 
 uint16_t nr_rule_functions = sizeof(rule_functions)/sizeof(rule_functions[0]);
@@ -14,6 +14,11 @@
 struct rule_function_t {
   const char *name;
   int8_t (*callback)(struct rules_t *obj);
+  /*
+   * Bytes of state the function keeps per call
+   * site, reserved with the rule block.
+   */
+  uint8_t state;
 } __attribute__((packed));
 
 extern struct rule_function_t rule_functions[];
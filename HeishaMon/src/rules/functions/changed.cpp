@@ -0,0 +1,43 @@
+/*
+  Copyright (C) CurlyMo
+
+  This Source Code Form is subject to the terms of the Mozilla Public
+  License, v. 2.0. If a copy of the MPL was not distributed with this
+  file, You can obtain one at http://mozilla.org/MPL/2.0/.
+*/
+
+
+#include <stdio.h>
+#include <stdlib.h>
+#include <string.h>
+#include <math.h>
+
+#include "../function.h"
+#include "../rules.h"
+#include "changed.h"
+
+int8_t rule_function_changed_callback(struct rules_t *obj) {
+  int8_t ret = 0;
+
+  if(rules_gettop(obj) != 1) {
+    return -1;
+  }
+
+  if(rules_type(obj, -1) != VCHAR) {
+    return -1;
+  }
+
+  ret = rules_topic_changed(rules_tostring(obj, -1));
+#ifdef DEBUG
+  printf("\tchanged(%s) = %d\n", rules_tostring(obj, -1), ret);
+#endif
+
+  if(ret == -1) {
+    return -1;
+  }
+
+  rules_remove(obj, -1);
+  rules_pushinteger(obj, ret);
+
+  return 0;
+}
@@ -0,0 +1,24 @@
+/*
+  Copyright (C) CurlyMo
+
+  This Source Code Form is subject to the terms of the Mozilla Public
+  License, v. 2.0. If a copy of the MPL was not distributed with this
+  file, You can obtain one at http://mozilla.org/MPL/2.0/.
+*/
+
+#ifndef _RULES_CHANGED_H_
+#define _RULES_CHANGED_H_
+
+#include <stdint.h>
+#include "../rules.h"
+
+/*
+ * Implemented by the firmware, returns 1 when the
+ * topic changed in the last decoded frame, 0 when
+ * it did not and -1 for an unknown topic.
+ */
+int8_t rules_topic_changed(const char *name);
+
+int8_t rule_function_changed_callback(struct rules_t *obj);
+
+#endif
@@ -0,0 +1,93 @@
+/*
+  Copyright (C) CurlyMo
+
+  This Source Code Form is subject to the terms of the Mozilla Public
+  License, v. 2.0. If a copy of the MPL was not distributed with this
+  file, You can obtain one at http://mozilla.org/MPL/2.0/.
+*/
+
+
+#include <stdio.h>
+#include <stdlib.h>
+#include <string.h>
+#include <math.h>
+
+#include "../../common/uint32float.h"
+#include "../function.h"
+#include "../rules.h"
+#include "ema.h"
+
+/*
+ * ema(x, alpha)
+ *
+ * Exponential moving average of x, the first value
+ * is taken as is. An alpha of 1 follows x directly,
+ * smaller values smooth more.
+ */
+int8_t rule_function_ema_callback(struct rules_t *obj) {
+  struct ema_state_t *state = NULL;
+  float x = 0, alpha = 0, z = 0;
+  uint8_t nr = rules_gettop(obj), isnull = 0;
+
+  if(nr != 2) {
+    return -1;
+  }
+
+  switch(rules_type(obj, 2)) {
+    case VINTEGER: {
+      alpha = (float)rules_tointeger(obj, 2);
+    } break;
+    case VFLOAT: {
+      alpha = rules_tofloat(obj, 2);
+    } break;
+    default: {
+      isnull = 1;
+    } break;
+  }
+  switch(rules_type(obj, 1)) {
+    case VINTEGER: {
+      x = (float)rules_tointeger(obj, 1);
+    } break;
+    case VFLOAT: {
+      x = rules_tofloat(obj, 1);
+    } break;
+    default: {
+      isnull = 1;
+    } break;
+  }
+  rules_remove(obj, 2);
+  rules_remove(obj, 1);
+
+  if((state = (struct ema_state_t *)rules_state(obj, sizeof(struct ema_state_t))) == NULL) {
+    return -1;
+  }
+
+  if(isnull == 0) {
+    alpha = MIN(MAX(alpha, 0.0f), 1.0f);
+    if(state->set == 0) {
+      state->value = x;
+      state->set = 1;
+    } else {
+      state->value += alpha * (x - state->value);
+    }
+  }
+
+  if(state->set == 0) {
+#ifdef DEBUG
+    printf("\tema = NULL\n");
+#endif
+    rules_pushnil(obj);
+  } else if(modff(state->value, &z) == 0) {
+#ifdef DEBUG
+    printf("\tema = %d\n", (int)state->value);
+#endif
+    rules_pushinteger(obj, state->value);
+  } else {
+#ifdef DEBUG
+    printf("\tema = %f\n", state->value);
+#endif
+    rules_pushfloat(obj, state->value);
+  }
+
+  return 0;
+}
@@ -0,0 +1,68 @@
+/*
+  Copyright (C) CurlyMo
+
+  This Source Code Form is subject to the terms of the Mozilla Public
+  License, v. 2.0. If a copy of the MPL was not distributed with this
+  file, You can obtain one at http://mozilla.org/MPL/2.0/.
+*/
+
+
+#include <stdio.h>
+#include <stdlib.h>
+#include <string.h>
+#include <math.h>
+
+#include "../function.h"
+#include "../rules.h"
+#include "hysteresis.h"
+
+/*
+ * hysteresis(x, lo, hi)
+ *
+ * Becomes 1 once x reaches hi and 0 once x drops
+ * to lo, in between it keeps its last value. It
+ * starts at 0.
+ */
+int8_t rule_function_hysteresis_callback(struct rules_t *obj) {
+  struct hysteresis_state_t *state = NULL;
+  float args[3] = { 0, 0, 0 };
+  uint8_t nr = rules_gettop(obj), isnull = 0;
+
+  if(nr != 3) {
+    return -1;
+  }
+
+  while(nr > 0) {
+    switch(rules_type(obj, nr)) {
+      case VINTEGER: {
+        args[nr-1] = (float)rules_tointeger(obj, nr);
+      } break;
+      case VFLOAT: {
+        args[nr-1] = rules_tofloat(obj, nr);
+      } break;
+      default: {
+        isnull = 1;
+      } break;
+    }
+    rules_remove(obj, nr--);
+  }
+
+  if((state = (struct hysteresis_state_t *)rules_state(obj, sizeof(struct hysteresis_state_t))) == NULL) {
+    return -1;
+  }
+
+  if(isnull == 0) {
+    if(args[0] >= args[2]) {
+      state->on = 1;
+    } else if(args[0] <= args[1]) {
+      state->on = 0;
+    }
+  }
+
+#ifdef DEBUG
+  printf("\thysteresis = %d\n", state->on);
+#endif
+  rules_pushinteger(obj, state->on);
+
+  return 0;
+}
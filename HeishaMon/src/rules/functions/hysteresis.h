@@ -0,0 +1,21 @@
+/*
+  Copyright (C) CurlyMo
+
+  This Source Code Form is subject to the terms of the Mozilla Public
+  License, v. 2.0. If a copy of the MPL was not distributed with this
+  file, You can obtain one at http://mozilla.org/MPL/2.0/.
+*/
+
+#ifndef _RULES_HYSTERESIS_H_
+#define _RULES_HYSTERESIS_H_
+
+#include <stdint.h>
+#include "../rules.h"
+
+typedef struct hysteresis_state_t {
+  uint8_t on;
+} __attribute__((aligned(4))) hysteresis_state_t;
+
+int8_t rule_function_hysteresis_callback(struct rules_t *obj);
+
+#endif
\ No newline at end of file
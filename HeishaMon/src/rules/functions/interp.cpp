@@ -0,0 +1,92 @@
+/*
+  Copyright (C) CurlyMo
+
+  This Source Code Form is subject to the terms of the Mozilla Public
+  License, v. 2.0. If a copy of the MPL was not distributed with this
+  file, You can obtain one at http://mozilla.org/MPL/2.0/.
+*/
+
+
+#include <stdio.h>
+#include <stdlib.h>
+#include <string.h>
+#include <math.h>
+
+#include "../function.h"
+#include "../rules.h"
+
+/*
+ * interp(x, x1, y1, x2, y2, ...)
+ *
+ * Linear interpolation between the points, which are
+ * given in ascending order of x. Outside the points
+ * the first or last y is returned.
+ */
+static int8_t interp_value(struct rules_t *obj, uint8_t pos, float *out) {
+  switch(rules_type(obj, pos)) {
+    case VINTEGER: {
+      *out = (float)rules_tointeger(obj, pos);
+    } break;
+    case VFLOAT: {
+      *out = rules_tofloat(obj, pos);
+    } break;
+    default: {
+      return -1;
+    } break;
+  }
+  return 0;
+}
+
+int8_t rule_function_interp_callback(struct rules_t *obj) {
+  float x = 0, x1 = 0, y1 = 0, x2 = 0, y2 = 0, out = 0, z = 0;
+  uint8_t nr = rules_gettop(obj), i = 0, found = 0, isnull = 0;
+
+  if(nr < 3 || (nr % 2) == 0) {
+    return -1;
+  }
+
+  if(interp_value(obj, 1, &x) == -1) {
+    isnull = 1;
+  }
+
+  for(i=2;i<nr && isnull == 0 && found == 0;i+=2) {
+    if(interp_value(obj, i, &x2) == -1 || interp_value(obj, i+1, &y2) == -1) {
+      isnull = 1;
+    } else if(x <= x2) {
+      if(i == 2 || x2 <= x1) {
+        out = y2;
+      } else {
+        out = y1 + (y2 - y1) * (x - x1) / (x2 - x1);
+      }
+      found = 1;
+    }
+    x1 = x2;
+    y1 = y2;
+  }
+  if(found == 0) {
+    out = y2;
+  }
+
+  while(nr > 0) {
+    rules_remove(obj, nr--);
+  }
+
+  if(isnull == 1) {
+#ifdef DEBUG
+    printf("\tinterp = NULL\n");
+#endif
+    rules_pushnil(obj);
+  } else if(modff(out, &z) == 0) {
+#ifdef DEBUG
+    printf("\tinterp = %d\n", (int)out);
+#endif
+    rules_pushinteger(obj, out);
+  } else {
+#ifdef DEBUG
+    printf("\tinterp = %f\n", out);
+#endif
+    rules_pushfloat(obj, out);
+  }
+
+  return 0;
+}
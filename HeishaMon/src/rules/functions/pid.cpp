@@ -0,0 +1,113 @@
+/*
+  Copyright (C) CurlyMo
+
+  This Source Code Form is subject to the terms of the Mozilla Public
+  License, v. 2.0. If a copy of the MPL was not distributed with this
+  file, You can obtain one at http://mozilla.org/MPL/2.0/.
+*/
+
+
+#include <stdio.h>
+#include <stdlib.h>
+#include <string.h>
+#include <math.h>
+#include <time.h>
+
+#include "../function.h"
+#include "../rules.h"
+#include "pid.h"
+
+/*
+ * pid(setpoint, value, kp, ki, kd[, min, max])
+ *
+ * The integral and derivative use the time between
+ * two calls from the same place in the rules. With
+ * min and max the output is clamped and the integral
+ * does not grow while the output is clamped.
+ */
+static uint32_t pid_millis(void) {
+#if defined(ESP8266) || defined(ESP32)
+  return millis();
+#else
+  struct timespec ts;
+  clock_gettime(CLOCK_MONOTONIC, &ts);
+  return (ts.tv_sec * 1000) + (ts.tv_nsec / 1000000);
+#endif
+}
+
+int8_t rule_function_pid_callback(struct rules_t *obj) {
+  struct pid_state_t *state = NULL;
+  float args[7] = { 0, 0, 0, 0, 0, 0, 0 };
+  float error = 0, integral = 0, dt = 0, out = 0, z = 0;
+  uint8_t nr = rules_gettop(obj), y = nr, isnull = 0;
+  uint32_t now = pid_millis();
+
+  if(nr != 5 && nr != 7) {
+    return -1;
+  }
+
+  while(nr > 0) {
+    switch(rules_type(obj, nr)) {
+      case VINTEGER: {
+        args[nr-1] = (float)rules_tointeger(obj, nr);
+      } break;
+      case VFLOAT: {
+        args[nr-1] = rules_tofloat(obj, nr);
+      } break;
+      default: {
+        isnull = 1;
+      } break;
+    }
+    rules_remove(obj, nr--);
+  }
+
+  if((state = (struct pid_state_t *)rules_state(obj, sizeof(struct pid_state_t))) == NULL) {
+    return -1;
+  }
+
+  if(isnull == 1) {
+#ifdef DEBUG
+    printf("\tpid = NULL\n");
+#endif
+    rules_pushnil(obj);
+    return 0;
+  }
+
+  error = args[0] - args[1];
+  integral = state->integral;
+  if(state->set == 1) {
+    dt = (float)(now - state->last) / 1000;
+    integral += error * dt;
+  }
+
+  out = (args[2] * error) + (args[3] * integral);
+  if(dt > 0) {
+    out += args[4] * (error - state->error) / dt;
+  }
+
+  if(y == 7 && out > args[6]) {
+    out = args[6];
+  } else if(y == 7 && out < args[5]) {
+    out = args[5];
+  } else {
+    state->integral = integral;
+  }
+
+  state->error = error;
+  state->last = now;
+  state->set = 1;
+
+  if(modff(out, &z) == 0) {
+#ifdef DEBUG
+    printf("\tpid = %d\n", (int)out);
+#endif
+    rules_pushinteger(obj, out);
+  } else {
+#ifdef DEBUG
+    printf("\tpid = %f\n", out);
+#endif
+    rules_pushfloat(obj, out);
+  }
+
+  return 0;
+}
@@ -0,0 +1,24 @@
+/*
+  Copyright (C) CurlyMo
+
+  This Source Code Form is subject to the terms of the Mozilla Public
+  License, v. 2.0. If a copy of the MPL was not distributed with this
+  file, You can obtain one at http://mozilla.org/MPL/2.0/.
+*/
+
+#ifndef _RULES_PID_H_
+#define _RULES_PID_H_
+
+#include <stdint.h>
+#include "../rules.h"
+
+typedef struct pid_state_t {
+  float integral;
+  float error;
+  uint32_t last;
+  uint8_t set;
+} __attribute__((aligned(4))) pid_state_t;
+
+int8_t rule_function_pid_callback(struct rules_t *obj);
+
+#endif
\ No newline at end of file
@@ -61,7 +61,7 @@ int8_t rule_function_print_callback(struct rules_t *obj) {
         } break;
       }
     }
-    logprintf(out);
+    log_info(LOG_RULES, "%s", out);
   }
 
   while(nr > 0) {
@@ -21,8 +21,6 @@
 #include "../../common/timerqueue.h"
 
 int8_t rule_function_set_timer_callback(struct rules_t *obj) {
-  struct timerqueue_t *node = NULL;
-  struct itimerval it_val;
   uint16_t sec = 0, nr = 0;
   uint8_t x = rules_gettop(obj);
 
@@ -58,9 +56,21 @@ int8_t rule_function_set_timer_callback(struct rules_t *obj) {
     } break;
   }
 
-  timerqueue_insert(sec, 0, nr);
+  /*
+   * The firmware uses the negative timers
+   * and timer 0 never fires a rule.
+   */
+  if(nr < 1) {
+    log_warn(LOG_RULES, "timer #%d not set, rule timers start at 1", nr);
+    return 0;
+  }
+
+  if(timerqueue_insert(sec, 0, nr) == -1) {
+    log_warn(LOG_RULES, "timer #%d not set, too many timers", nr);
+    return 0;
+  }
 
-  logprintf_P(F("timer #%d set to %d seconds"), nr, sec);
+  log_info(LOG_RULES, "timer #%d set to %d seconds", nr, sec);
 
   return 0;
 }
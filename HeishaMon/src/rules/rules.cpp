@@ -76,7 +76,15 @@ typedef struct vm_vchar_t {
   uint8_t type;
   uint8_t fixed;
   uint8_t len;
-  uint8_t ref;
+  union {
+    /*
+     * Non fixed strings are reference counted,
+     * fixed variable names carry the slot handed
+     * out by the vm_value_slot callback.
+     */
+    uint8_t ref;
+    uint8_t slot;
+  };
   char *value;
 #if defined(ESP8266) || defined(ESP32)
 } __attribute__((packed, aligned(4))) vm_vchar_t;
@@ -216,6 +224,29 @@ static struct rule_timer_t timestamp;
 
 static uint8_t group = 1;
 
+/*
+ * Profiling counters of the last rule_run
+ */
+static uint32_t nrops = 0;
+static uint16_t stackpeak = 0;
+
+/*
+ * Bytes saved by the optimizer and unused heap given
+ * back after it, both since the last rules_gc
+ */
+static uint16_t optsaved = 0;
+static uint16_t optreleased = 0;
+
+/*
+ * The state of the function being called. An OP_CALL
+ * with c 1 calls a rule block. For a function c >> 1
+ * is 0 when it keeps no state, else one more than the
+ * word after the heap values where its state starts.
+ */
+#define RULE_STATE_MAX 126
+static unsigned char *callstate = NULL;
+static uint8_t callstatesize = 0;
+
 // static uint32_t align(uint32_t p, uint8_t b) {
   // return (p + b) - ((p + b) % b);
 // }
@@ -470,7 +501,7 @@ static int16_t lexer_peek(char **text, uint16_t skip, uint8_t *type, uint16_t *s
       } break;
       /* LCOV_EXCL_START*/
       default: {
-        logprintf_P(F("FATAL: Internal error in %s #%d"), __FUNCTION__, __LINE__);
+        log_error(LOG_RULES, "FATAL: Internal error in %s #%d", __FUNCTION__, __LINE__);
         return -1;
       } break;
       /* LCOV_EXCL_STOP*/
@@ -505,6 +536,18 @@ static int32_t varstack_find(char **text, uint16_t start, uint16_t len) {
   return -1;
 }
 
+/*
+ * The bytecode addresses the varstack with a signed byte,
+ * setters store the index plus one.
+ */
+static int8_t varstack_full(void) {
+  if(varstack->nrbytes > 127*sizeof(struct vm_vchar_t)) {
+    log_error(LOG_RULES, "FATAL #%d: ruleset too large, more than 127 names and strings", __LINE__);
+    return 1;
+  }
+  return 0;
+}
+
 static uint16_t varstack_add(char **text, uint16_t start, uint16_t len, uint8_t fixed) {
   uint16_t a = varstack->nrbytes;
   int32_t i = -1;
@@ -573,6 +616,9 @@ static uint16_t varstack_add(char **text, uint16_t start, uint16_t len, uint8_t
   setval(value->len, len);
   setval(value->ref, 0);
   setval(value->fixed, fixed);
+  if(fixed == 1 && rule_options.vm_value_slot != NULL) {
+    setval(value->slot, rule_options.vm_value_slot(value->value));
+  }
   if(i == -1) {
     setval(varstack->nrbytes, a+sizeof(struct vm_vchar_t));
   }
@@ -612,17 +658,17 @@ static int8_t rule_prepare(char **text,
         if(ret == -1) {
           if((*len - pos) > 5) {
             /* LCOV_EXCL_START*/
-            logprintf_P(F("ERROR: no ending quotes found for '%.5s...'"), &(*text)[s]);
+            log_error(LOG_RULES, "ERROR: no ending quotes found for '%.5s...'", &(*text)[s]);
             /* LCOV_EXCL_STOP*/
           } else {
-            logprintf_P(F("ERROR: no ending quotes found for '%.5s'"), &(*text)[s]);
+            log_error(LOG_RULES, "ERROR: no ending quotes found for '%.5s'", &(*text)[s]);
           }
         } else if(ret == -2) {
           if((*len - pos) > 5) {
-            logprintf_P(F("ERROR: found invalid ASCII at '%.5s...'"), &(*text)[s]);
+            log_error(LOG_RULES, "ERROR: found invalid ASCII at '%.5s...'", &(*text)[s]);
           } else {
             /* LCOV_EXCL_START*/
-            logprintf_P(F("ERROR: found invalid ASCII at '%.5s'"), &(*text)[s]);
+            log_error(LOG_RULES, "ERROR: found invalid ASCII at '%.5s'", &(*text)[s]);
             /* LCOV_EXCL_STOP*/
           }
         }
@@ -708,9 +754,9 @@ static int8_t rule_prepare(char **text,
         /* LCOV_EXCL_START*/
         /* FIXME */
         if((*len - pos) > 5) {
-          logprintf_P(F("ERROR: event arguments can only contain variables at '%.5s...'"), &(*text)[pos]);
+          log_error(LOG_RULES, "ERROR: event arguments can only contain variables at '%.5s...'", &(*text)[pos]);
         } else {
-          logprintf_P(F("ERROR: event arguments can only contain variables at '%.5s'"), &(*text)[pos]);
+          log_error(LOG_RULES, "ERROR: event arguments can only contain variables at '%.5s'", &(*text)[pos]);
         }
         /* LCOV_EXCL_STOP*/
         return -1;
@@ -793,7 +839,7 @@ static int8_t rule_prepare(char **text,
               } break;
               /* LCOV_EXCL_START*/
               default: {
-                logprintf_P(F("FATAL: Internal error in %s #%d"), __FUNCTION__, __LINE__);
+                log_error(LOG_RULES, "FATAL: Internal error in %s #%d", __FUNCTION__, __LINE__);
                 return -1;
               } break;
               /* LCOV_EXCL_STOP*/
@@ -855,7 +901,7 @@ static int8_t rule_prepare(char **text,
           setval((*text)[tpos], VINTEGER); tpos++;
           x = (uint32_t)var;
           if((var < 0 && var < -8388608) || (var > 0 && var > 16777215)) {
-            logprintf_P(F("FATAL: Integer %g is out of range"), __FUNCTION__, __LINE__, var);
+            log_error(LOG_RULES, "FATAL: Integer %g is out of range", var);
             return -1;
           }
         } else {
@@ -960,7 +1006,7 @@ static int8_t rule_prepare(char **text,
       lexer_parse_string((*text), *len, &pos);
 
       if(ctx == TCEVENT || ctx == TTHEN) {
-        logprintf_P(F("ERROR: nested 'on' block"));
+        log_error(LOG_RULES, "ERROR: nested 'on' block");
         return -1;
       }
 
@@ -1075,9 +1121,9 @@ static int8_t rule_prepare(char **text,
         /* LCOV_EXCL_START*/
         /* FIXME */
         if((*len - pos) > 5) {
-          logprintf_P(F("ERROR: missing matching '(' at '%.5s...'"), &(*text)[pos]);
+          log_error(LOG_RULES, "ERROR: missing matching '(' at '%.5s...'", &(*text)[pos]);
         } else {
-          logprintf_P(F("ERROR: missing matching '(' at '%.5s'"), &(*text)[pos]);
+          log_error(LOG_RULES, "ERROR: missing matching '(' at '%.5s'", &(*text)[pos]);
         }
         /* LCOV_EXCL_STOP*/
         return -1;
@@ -1319,9 +1365,9 @@ static int8_t rule_prepare(char **text,
         }
       } else {
         if((*len - pos) > 5) {
-          logprintf_P(F("ERROR: unknown token '%.5s...'"), &(*text)[pos]);
+          log_error(LOG_RULES, "ERROR: unknown token '%.5s...'", &(*text)[pos]);
         } else {
-          logprintf_P(F("ERROR: unknown token '%.5s'"), &(*text)[pos]);
+          log_error(LOG_RULES, "ERROR: unknown token '%.5s'", &(*text)[pos]);
         }
         return -1;
       }
@@ -1331,7 +1377,7 @@ static int8_t rule_prepare(char **text,
       if(nrhooks > 0) {
         /* LCOV_EXCL_START*/
         /* FIXME */
-        logprintf_P(F("ERROR: missing matching ')'"), &(*text)[pos]);
+        log_error(LOG_RULES, "ERROR: missing matching ')'", &(*text)[pos]);
         /* LCOV_EXCL_STOP*/
         return -1;
       }
@@ -1363,7 +1409,7 @@ static int8_t rule_prepare(char **text,
   if(nrhooks > 0) {
     /* LCOV_EXCL_START*/
     /* FIXME */
-    logprintf_P(F("ERROR: missing matching ')'"), &(*text)[pos]);
+    log_error(LOG_RULES, "ERROR: missing matching ')'", &(*text)[pos]);
     return -1;
     /* LCOV_EXCL_STOP*/
   }
@@ -1393,6 +1439,10 @@ static uint32_t vm_stack_push(struct rules_t *obj, uint16_t pos, unsigned char *
   setval(stack->nrbytes, size);
   setval(stack->bufsize, MAX(getval(stack->bufsize), size));
 
+  if(size > stackpeak) {
+    stackpeak = size;
+  }
+
   if(type == VCHAR) {
     struct vm_vptr_t *value = (struct vm_vptr_t *)&stack->buffer[ret];
     setval(value->type, VPTR);
@@ -1553,6 +1603,25 @@ const char *rules_tostring(struct rules_t *obj, int8_t pos) {
   return NULL;
 }
 
+uint8_t rules_toslot(struct rules_t *obj, int8_t pos) {
+  int16_t offset = vm_val_pos(pos);
+  if(pos < 0) {
+    offset = getval(stack->nrbytes)-offset;
+  }
+  if(offset >= 4) {
+    if(getval(stack->buffer[offset]) == VPTR) {
+      struct vm_vptr_t *node = (struct vm_vptr_t *)&stack->buffer[offset];
+      uint16_t pos = getval(node->value)*sizeof(struct vm_top_t);
+      struct vm_vchar_t *var = (struct vm_vchar_t *)&varstack->buffer[pos];
+
+      if(getval(var->fixed) == 1) {
+        return getval(var->slot);
+      }
+    }
+  }
+  return 0;
+}
+
 int rules_tointeger(struct rules_t *obj, int8_t pos) {
   int16_t offset = vm_val_pos(pos);
   if(pos < 0) {
@@ -1603,6 +1672,70 @@ float rules_tofloat(struct rules_t *obj, int8_t pos) {
   return 0;
 }
 
+uint32_t rules_nrops(void) {
+  return nrops;
+}
+
+uint16_t rules_stackpeak(void) {
+  return stackpeak;
+}
+
+uint16_t rules_optimized(void) {
+  return optsaved;
+}
+
+uint16_t rules_released(void) {
+  return optreleased;
+}
+
+void *rules_state(struct rules_t *obj, uint8_t size) {
+  if(callstate == NULL || size > callstatesize) {
+    return NULL;
+  }
+  return (void *)callstate;
+}
+
+static void rule_state_clear(struct rules_t *obj) {
+  uint16_t nrbytes = getval(obj->heap->nrbytes);
+  uint16_t bufsize = getval(obj->heap->bufsize);
+
+  if(bufsize > nrbytes) {
+    memset(&obj->heap->buffer[nrbytes], 0, bufsize-nrbytes);
+  }
+}
+
+uint16_t rules_heapsize(struct rules_t *obj) {
+  return getval(obj->heap->nrbytes);
+}
+
+uint16_t rules_bcsize(struct rules_t *obj) {
+  return getval(obj->bc.nrbytes);
+}
+
+int16_t rules_nextslot(struct rules_t *obj, uint16_t *pos) {
+  while(*pos < getval(obj->bc.nrbytes)) {
+    struct vm_top_t *node = (struct vm_top_t *)&obj->bc.buffer[*pos];
+    int8_t var = -1;
+
+    *pos += sizeof(struct vm_top_t);
+    switch(gettype(node->type)) {
+      case OP_GETVAL: {
+        var = (int8_t)getval(node->b);
+      } break;
+      case OP_SETVAL: {
+        var = (int8_t)getval(node->a);
+      } break;
+    }
+    if(var >= 0) {
+      struct vm_vchar_t *vchar = (struct vm_vchar_t *)&varstack->buffer[var*sizeof(struct vm_vchar_t)];
+      if(getval(vchar->fixed) == 1) {
+        return getval(vchar->slot);
+      }
+    }
+  }
+  return -1;
+}
+
 uint8_t rules_gettop(struct rules_t *obj) {
   return (getval(stack->nrbytes)-4) / rule_max_var_bytes();
 }
@@ -1840,7 +1973,7 @@ static uint32_t vm_heap_push(struct rules_t *obj, uint8_t type, char **text, uin
     } break;
     /* LCOV_EXCL_START*/
     default: {
-      logprintf_P(F("FATAL: Internal error in %s #%d"), __FUNCTION__, __LINE__);
+      log_error(LOG_RULES, "FATAL: Internal error in %s #%d", __FUNCTION__, __LINE__);
       return -1;
     } break;
     /* LCOV_EXCL_STOP*/
@@ -1872,7 +2005,7 @@ static int32_t vm_heap_next(struct rules_t *obj, uint8_t type, uint8_t skip) {
     } break;
     /* LCOV_EXCL_START*/
     default: {
-      logprintf_P(F("FATAL: Internal error in %s #%d"), __FUNCTION__, __LINE__);
+      log_error(LOG_RULES, "FATAL: Internal error in %s #%d", __FUNCTION__, __LINE__);
       return -1;
     } break;
     /* LCOV_EXCL_STOP*/
@@ -1894,7 +2027,7 @@ static uint16_t bc_whatfirst(struct rules_t *obj, char **text, uint16_t pos, uin
      */
     /* LCOV_EXCL_START*/
     if(lexer_peek(text, pos, &type, &start, &len) < 0) {
-      logprintf_P(F("FATAL: Internal error in %s #%d"), __FUNCTION__, __LINE__);
+      log_error(LOG_RULES, "FATAL: Internal error in %s #%d", __FUNCTION__, __LINE__);
       break;
     }
     /* LCOV_EXCL_STOP*/
@@ -1918,7 +2051,7 @@ static uint16_t bc_whatfirst(struct rules_t *obj, char **text, uint16_t pos, uin
   while(1) {
     /* LCOV_EXCL_START*/
     if(lexer_peek(text, pos, &type, &start, &len) < 0) {
-      logprintf_P(F("FATAL: Internal error in %s #%d"), __FUNCTION__, __LINE__);
+      log_error(LOG_RULES, "FATAL: Internal error in %s #%d", __FUNCTION__, __LINE__);
       break;
     }
     /* LCOV_EXCL_STOP*/
@@ -1937,7 +2070,7 @@ static uint16_t bc_whatfirst(struct rules_t *obj, char **text, uint16_t pos, uin
   if(has_paren > 0) {
     /* LCOV_EXCL_START*/
     if(lexer_peek(text, has_paren-1, &type, &start, &len) < 0) {
-      logprintf_P(F("FATAL: Internal error in %s #%d"), __FUNCTION__, __LINE__);
+      log_error(LOG_RULES, "FATAL: Internal error in %s #%d", __FUNCTION__, __LINE__);
       return -1;
     }
     /* LCOV_EXCL_STOP*/
@@ -2246,7 +2379,7 @@ static void bc_math_move_closest(struct rules_t *obj, int16_t limit) {
 
           if((tmp1B = bc_next(obj, tmp1B)) == -1) {
             /* LCOV_EXCL_START*/
-            logprintf_P(F("FATAL: Internal error in %s #%d %d"), __FUNCTION__, __LINE__);
+            log_error(LOG_RULES, "FATAL: Internal error in %s #%d %d", __FUNCTION__, __LINE__);
             exit(-1);
             /* LCOV_EXCL_STOP*/
           }
@@ -2313,7 +2446,7 @@ static void bc_math_move_closest(struct rules_t *obj, int16_t limit) {
 
           if((tmp1B = bc_next(obj, tmp1B)) == -1) {
             /* LCOV_EXCL_START*/
-            logprintf_P(F("FATAL: Internal error in %s #%d %d"), __FUNCTION__, __LINE__);
+            log_error(LOG_RULES, "FATAL: Internal error in %s #%d %d", __FUNCTION__, __LINE__);
             exit(-1);
             /* LCOV_EXCL_STOP*/
           }
@@ -2389,7 +2522,7 @@ static void bc_math_move_closest(struct rules_t *obj, int16_t limit) {
 
             if((tmp1C = bc_next(obj, tmp1C)) == -1) {
               /* LCOV_EXCL_START*/
-              logprintf_P(F("FATAL: Internal error in %s #%d %d"), __FUNCTION__, __LINE__);
+              log_error(LOG_RULES, "FATAL: Internal error in %s #%d %d", __FUNCTION__, __LINE__);
               exit(-1);
               /* LCOV_EXCL_STOP*/
             }
@@ -2466,7 +2599,7 @@ static void bc_math_move_closest(struct rules_t *obj, int16_t limit) {
 
             if((tmp1B = bc_next(obj, tmp1B)) == -1) {
               /* LCOV_EXCL_START*/
-              logprintf_P(F("FATAL: Internal error in %s #%d %d"), __FUNCTION__, __LINE__);
+              log_error(LOG_RULES, "FATAL: Internal error in %s #%d %d", __FUNCTION__, __LINE__);
               exit(-1);
               /* LCOV_EXCL_STOP*/
             }
@@ -2523,7 +2656,7 @@ static int32_t bc_parse_math_order(char **text, struct rules_t *obj, uint16_t *p
 
   if(lexer_peek(text, (*pos), &a, &start, &len) < 0) {
     /* LCOV_EXCL_START*/
-    logprintf_P(F("FATAL: Internal error in %s #%d"), __FUNCTION__, __LINE__);
+    log_error(LOG_RULES, "FATAL: Internal error in %s #%d", __FUNCTION__, __LINE__);
     return -1;
     /* LCOV_EXCL_STOP*/
   }
@@ -2568,7 +2701,7 @@ static int32_t bc_parse_math_order(char **text, struct rules_t *obj, uint16_t *p
       (*pos)++;
     } break;
     default: {
-      logprintf_P(F("ERROR: Unexpected token (%d)"), __LINE__);
+      log_error(LOG_RULES, "ERROR: Unexpected token (%d)", __LINE__);
       return -1;
     }
   }
@@ -2581,7 +2714,7 @@ static int32_t bc_parse_math_order(char **text, struct rules_t *obj, uint16_t *p
 
     /* LCOV_EXCL_START*/
     if(idx > nr_rule_operators) {
-      logprintf_P(F("FATAL: Internal error in %s #%d"), __FUNCTION__, __LINE__);
+      log_error(LOG_RULES, "FATAL: Internal error in %s #%d", __FUNCTION__, __LINE__);
       return -1;
     }
     /* LCOV_EXCL_STOP*/
@@ -2629,7 +2762,7 @@ static int32_t bc_parse_math_order(char **text, struct rules_t *obj, uint16_t *p
           }
         } break;
         default: {
-          logprintf_P(F("ERROR: Expected a parenthesis block, function, number or variable"));
+          log_error(LOG_RULES, "ERROR: Expected a parenthesis block, function, number or variable");
           return -1;
         } break;
       }
@@ -2638,7 +2771,7 @@ static int32_t bc_parse_math_order(char **text, struct rules_t *obj, uint16_t *p
     step = bc_parent(obj, rule_operators[idx].opcode, ++(*cnt), heap_in, d);
 
     if(*cnt > (INT8_MAX/2)) {
-      logprintf_P(F("ERROR: Too many stacked conditions"));
+      log_error(LOG_RULES, "ERROR: Too many stacked conditions");
       return -1;
     }
 
@@ -2928,7 +3061,7 @@ uint16_t lexer_clear(struct rules_t *obj, char **text, uint16_t start, uint16_t
       } break;
       /* LCOV_EXCL_START*/
       default: {
-        logprintf_P(F("FATAL: Internal error in %s #%d %d"), __FUNCTION__, __LINE__);
+        log_error(LOG_RULES, "FATAL: Internal error in %s #%d %d", __FUNCTION__, __LINE__);
       } break;
       /* LCOV_EXCL_STOP*/
     }
@@ -2958,7 +3091,7 @@ uint16_t lexer_clear(struct rules_t *obj, char **text, uint16_t start, uint16_t
       setval((*text)[y], tmp & 0xFF);
     } else {
       /* LCOV_EXCL_START*/
-        logprintf_P(F("FATAL: Internal error in %s #%d %d"), __FUNCTION__, __LINE__);
+        log_error(LOG_RULES, "FATAL: Internal error in %s #%d %d", __FUNCTION__, __LINE__);
       /* LCOV_EXCL_STOP*/
     }
   }
@@ -2985,13 +3118,13 @@ static int16_t rule_create(char **text, struct rules_t *obj) {
 
   /* LCOV_EXCL_START*/
   if(lexer_peek(text, 0, &type, &start, &len) < 0) {
-    logprintf_P(F("FATAL: Internal error in %s #%d"), __FUNCTION__, __LINE__);
+    log_error(LOG_RULES, "FATAL: Internal error in %s #%d", __FUNCTION__, __LINE__);
     return -1;
   }
   /* LCOV_EXCL_STOP*/
 
   if(type != TIF && type != TEVENT) {
-    logprintf_P(F("ERROR: Expected an 'if' or an 'on' statement"));
+    log_error(LOG_RULES, "ERROR: Expected an 'if' or an 'on' statement");
     return -1;
   }
 
@@ -3054,14 +3187,14 @@ static int16_t rule_create(char **text, struct rules_t *obj) {
 
         if(lexer_peek(text, pos, &type, &start, &len) < 0) {
           /* LCOV_EXCL_START*/
-          logprintf_P(F("FATAL: Internal error in %s #%d"), __FUNCTION__, __LINE__);
+          log_error(LOG_RULES, "FATAL: Internal error in %s #%d", __FUNCTION__, __LINE__);
           return -1;
           /* LCOV_EXCL_STOP*/
         }
         switch(type) {
           case TELSEIF: {
             if(go == TTHEN) {
-              logprintf_P(F("ERROR: Unexpected token (%d)"), __LINE__);
+              log_error(LOG_RULES, "ERROR: Unexpected token (%d)", __LINE__);
               return -1;
             }
             go = TIF;
@@ -3075,7 +3208,7 @@ static int16_t rule_create(char **text, struct rules_t *obj) {
             go = type;
           } break;
           default: {
-            logprintf_P(F("ERROR: Unexpected token (%d)"), __LINE__);
+            log_error(LOG_RULES, "ERROR: Unexpected token (%d)", __LINE__);
             return -1;
           } break;
         }
@@ -3084,7 +3217,7 @@ static int16_t rule_create(char **text, struct rules_t *obj) {
         if(pos == 0) {
           if(lexer_peek(text, pos, &type, &start, &len) < 0) {
             /* LCOV_EXCL_START*/
-            logprintf_P(F("FATAL: Internal error in %s #%d"), __FUNCTION__, __LINE__);
+            log_error(LOG_RULES, "FATAL: Internal error in %s #%d", __FUNCTION__, __LINE__);
             return -1;
             /* LCOV_EXCL_STOP*/
           }
@@ -3095,7 +3228,7 @@ static int16_t rule_create(char **text, struct rules_t *obj) {
 
           if(lexer_peek(text, pos+1, &type, &start, &len) < 0) {
             /* LCOV_EXCL_START*/
-            logprintf_P(F("FATAL: Internal error in %s #%d"), __FUNCTION__, __LINE__);
+            log_error(LOG_RULES, "FATAL: Internal error in %s #%d", __FUNCTION__, __LINE__);
             return -1;
             /* LCOV_EXCL_STOP*/
           }
@@ -3116,7 +3249,7 @@ static int16_t rule_create(char **text, struct rules_t *obj) {
             } break;
             /* LCOV_EXCL_START*/
             default: {
-              logprintf_P(F("ERROR: Unexpected token (%d)"), __LINE__);
+              log_error(LOG_RULES, "ERROR: Unexpected token (%d)", __LINE__);
               return -1;
             } break;
             /* LCOV_EXCL_STOP*/
@@ -3124,7 +3257,7 @@ static int16_t rule_create(char **text, struct rules_t *obj) {
         } else {
           if(lexer_peek(text, pos, &type, &start, &len) < 0) {
             /* LCOV_EXCL_START*/
-            logprintf_P(F("FATAL: Internal error in %s #%d"), __FUNCTION__, __LINE__);
+            log_error(LOG_RULES, "FATAL: Internal error in %s #%d", __FUNCTION__, __LINE__);
             return -1;
             /* LCOV_EXCL_STOP*/
           }
@@ -3145,7 +3278,7 @@ static int16_t rule_create(char **text, struct rules_t *obj) {
             } break;
             /* LCOV_EXCL_START*/
             default: {
-              logprintf_P(F("ERROR: Unexpected token (%d)"), __LINE__);
+              log_error(LOG_RULES, "ERROR: Unexpected token (%d)", __LINE__);
               return -1;
             } break;
            /* LCOV_EXCL_STOP*/
@@ -3170,7 +3303,7 @@ static int16_t rule_create(char **text, struct rules_t *obj) {
 
         if(lexer_peek(text, pos, &type, &start, &len) < 0) {
           /* LCOV_EXCL_START*/
-          logprintf_P(F("FATAL: Internal error in %s #%d"), __FUNCTION__, __LINE__);
+          log_error(LOG_RULES, "FATAL: Internal error in %s #%d", __FUNCTION__, __LINE__);
           return -1;
           /* LCOV_EXCL_STOP*/
         }
@@ -3184,7 +3317,7 @@ static int16_t rule_create(char **text, struct rules_t *obj) {
           case TVAR: {
           } break;
           default: {
-            logprintf_P(F("ERROR: Unexpected token (%d)"), __LINE__);
+            log_error(LOG_RULES, "ERROR: Unexpected token (%d)", __LINE__);
             return -1;
           } break;
         }
@@ -3198,7 +3331,7 @@ static int16_t rule_create(char **text, struct rules_t *obj) {
           in_child = pos;
           if(lexer_peek(text, pos, &type, &start, &len) < 0) {
             /* LCOV_EXCL_START*/
-            logprintf_P(F("FATAL: Internal error in %s #%d"), __FUNCTION__, __LINE__);
+            log_error(LOG_RULES, "FATAL: Internal error in %s #%d", __FUNCTION__, __LINE__);
             return -1;
             /* LCOV_EXCL_STOP*/
           }
@@ -3209,7 +3342,7 @@ static int16_t rule_create(char **text, struct rules_t *obj) {
             } break;
             /* LCOV_EXCL_START*/
             default: {
-              logprintf_P(F("ERROR: Unexpected token (%d)"), __LINE__);
+              log_error(LOG_RULES, "ERROR: Unexpected token (%d)", __LINE__);
               return -1;
             } break;
             /* LCOV_EXCL_STOP*/
@@ -3224,7 +3357,7 @@ static int16_t rule_create(char **text, struct rules_t *obj) {
             // continue;
           } else if(lexer_peek(text, pos, &type, &start, &len) <= 0) {
             /* LCOV_EXCL_START*/
-            logprintf_P(F("FATAL: Internal error in %s #%d"), __FUNCTION__, __LINE__);
+            log_error(LOG_RULES, "FATAL: Internal error in %s #%d", __FUNCTION__, __LINE__);
             return -1;
             /* LCOV_EXCL_STOP*/
           } else {
@@ -3262,7 +3395,7 @@ static int16_t rule_create(char **text, struct rules_t *obj) {
 
             if(lexer_peek(text, pos, &type, &start, &len) <= 0) {
               /* LCOV_EXCL_START*/
-              logprintf_P(F("FATAL: Internal error in %s #%d"), __FUNCTION__, __LINE__);
+              log_error(LOG_RULES, "FATAL: Internal error in %s #%d", __FUNCTION__, __LINE__);
               return -1;
               /* LCOV_EXCL_STOP*/
             }
@@ -3285,13 +3418,13 @@ static int16_t rule_create(char **text, struct rules_t *obj) {
               case TEND: {
                 if(lexer_peek(text, pos-1, &type, &start, &len) <= 0) {
                   /* LCOV_EXCL_START*/
-                  logprintf_P(F("FATAL: Internal error in %s #%d"), __FUNCTION__, __LINE__);
+                  log_error(LOG_RULES, "FATAL: Internal error in %s #%d", __FUNCTION__, __LINE__);
                   return -1;
                   /* LCOV_EXCL_STOP*/
                 }
                 if(type != TSEMICOLON) {
                   /* LCOV_EXCL_START*/
-                  logprintf_P(F("ERROR: Unexpected token (%d)"), __LINE__);
+                  log_error(LOG_RULES, "ERROR: Unexpected token (%d)", __LINE__);
                   return -1;
                   /* LCOV_EXCL_STOP*/
                 }
@@ -3306,7 +3439,7 @@ static int16_t rule_create(char **text, struct rules_t *obj) {
               } break;
               /* LCOV_EXCL_START*/
               default: {
-                logprintf_P(F("ERROR: Unexpected token (%d)"), __LINE__);
+                log_error(LOG_RULES, "ERROR: Unexpected token (%d)", __LINE__);
                 return -1;
               } break;
               /* LCOV_EXCL_STOP*/
@@ -3337,14 +3470,14 @@ static int16_t rule_create(char **text, struct rules_t *obj) {
           } break;
           /* LCOV_EXCL_START*/
           default: {
-            logprintf_P(F("ERROR: Unexpected token (%d)"), __LINE__);
+            log_error(LOG_RULES, "ERROR: Unexpected token (%d)", __LINE__);
             return -1;
           } break;
           /* LCOV_EXCL_STOP*/
         }
         if(lexer_peek(text, pos+1, &type, &start, &len) <= 0) {
           /* LCOV_EXCL_START*/
-          logprintf_P(F("FATAL: Internal error in %s #%d"), __FUNCTION__, __LINE__);
+          log_error(LOG_RULES, "FATAL: Internal error in %s #%d", __FUNCTION__, __LINE__);
           return -1;
           /* LCOV_EXCL_STOP*/
         }
@@ -3361,7 +3494,7 @@ static int16_t rule_create(char **text, struct rules_t *obj) {
             } else {
               if(lexer_peek(text, pos+2, &type, &start, &len) <= 0) {
                 /* LCOV_EXCL_START*/
-                logprintf_P(F("FATAL: Internal error in %s #%d"), __FUNCTION__, __LINE__);
+                log_error(LOG_RULES, "FATAL: Internal error in %s #%d", __FUNCTION__, __LINE__);
                 return -1;
                 /* LCOV_EXCL_STOP*/
               }
@@ -3372,7 +3505,7 @@ static int16_t rule_create(char **text, struct rules_t *obj) {
                 go = type;
               } else {
                 /* LCOV_EXCL_START*/
-                logprintf_P(F("ERROR: Unexpected token (%d)"), __LINE__);
+                log_error(LOG_RULES, "ERROR: Unexpected token (%d)", __LINE__);
                 return -1;
                 /* LCOV_EXCL_STOP*/
               }
@@ -3402,7 +3535,7 @@ static int16_t rule_create(char **text, struct rules_t *obj) {
           case TOPERATOR: {
           } break;
           default: {
-            logprintf_P(F("ERROR: Unexpected token (%d)"), __LINE__);
+            log_error(LOG_RULES, "ERROR: Unexpected token (%d)", __LINE__);
             return -1;
           } break;
         }
@@ -3422,7 +3555,7 @@ static int16_t rule_create(char **text, struct rules_t *obj) {
         if(in_child > -1) {
           if(lexer_peek(text, in_child, &type, &start, &len) < 0) {
             /* LCOV_EXCL_START*/
-            logprintf_P(F("FATAL: Internal error in %s #%d"), __FUNCTION__, __LINE__);
+            log_error(LOG_RULES, "FATAL: Internal error in %s #%d", __FUNCTION__, __LINE__);
             return -1;
             /* LCOV_EXCL_STOP*/
           }
@@ -3431,7 +3564,7 @@ static int16_t rule_create(char **text, struct rules_t *obj) {
 
         if(lexer_peek(text, pos, &type, &start, &len) < 0) {
           /* LCOV_EXCL_START*/
-          logprintf_P(F("FATAL: Internal error in %s #%d"), __FUNCTION__, __LINE__);
+          log_error(LOG_RULES, "FATAL: Internal error in %s #%d", __FUNCTION__, __LINE__);
           return -1;
           /* LCOV_EXCL_STOP*/
         }
@@ -3446,7 +3579,7 @@ static int16_t rule_create(char **text, struct rules_t *obj) {
             }
           } else {
             /* LCOV_EXCL_START*/
-            logprintf_P(F("FATAL: Internal error in %s #%d"), __FUNCTION__, __LINE__);
+            log_error(LOG_RULES, "FATAL: Internal error in %s #%d", __FUNCTION__, __LINE__);
             return -1;
             /* LCOV_EXCL_STOP*/
           }
@@ -3473,7 +3606,7 @@ static int16_t rule_create(char **text, struct rules_t *obj) {
 
         if(lexer_peek(text, pos+1, &type, &start, &len) < 0) {
           /* LCOV_EXCL_START*/
-          logprintf_P(F("FATAL: Internal error in %s #%d"), __FUNCTION__, __LINE__);
+          log_error(LOG_RULES, "FATAL: Internal error in %s #%d", __FUNCTION__, __LINE__);
           return -1;
           /* LCOV_EXCL_STOP*/
         }
@@ -3484,7 +3617,7 @@ static int16_t rule_create(char **text, struct rules_t *obj) {
           case RPAREN: {
           } break;
           default: {
-            logprintf_P(F("ERROR: Unexpected token (%d)"), __LINE__);
+            log_error(LOG_RULES, "ERROR: Unexpected token (%d)", __LINE__);
             return -1;
           } break;
         }
@@ -3500,7 +3633,7 @@ static int16_t rule_create(char **text, struct rules_t *obj) {
           in_child = pos;
           if(lexer_peek(text, pos, &type, &start, &len) < 0) {
             /* LCOV_EXCL_START*/
-            logprintf_P(F("FATAL: Internal error in %s #%d"), __FUNCTION__, __LINE__);
+            log_error(LOG_RULES, "FATAL: Internal error in %s #%d", __FUNCTION__, __LINE__);
             return -1;
             /* LCOV_EXCL_STOP*/
           }
@@ -3512,7 +3645,7 @@ static int16_t rule_create(char **text, struct rules_t *obj) {
             pos++;
           } else if(lexer_peek(text, pos, &type, &start, &len) < 0) {
             /* LCOV_EXCL_START*/
-            logprintf_P(F("FATAL: Internal error in %s #%d"), __FUNCTION__, __LINE__);
+            log_error(LOG_RULES, "FATAL: Internal error in %s #%d", __FUNCTION__, __LINE__);
             return -1;
             /* LCOV_EXCL_STOP*/
           }
@@ -3557,7 +3690,7 @@ static int16_t rule_create(char **text, struct rules_t *obj) {
             go = type;
           } break;
           default: {
-            logprintf_P(F("ERROR: Unexpected token (%d)"), __LINE__);
+            log_error(LOG_RULES, "ERROR: Unexpected token (%d)", __LINE__);
             return -1;
           } break;
         }
@@ -3565,7 +3698,7 @@ static int16_t rule_create(char **text, struct rules_t *obj) {
       case TVAR: {
         if(lexer_peek(text, pos, &type, &start, &len) < 0) {
           /* LCOV_EXCL_START*/
-          logprintf_P(F("FATAL: Internal error in %s #%d"), __FUNCTION__, __LINE__);
+          log_error(LOG_RULES, "FATAL: Internal error in %s #%d", __FUNCTION__, __LINE__);
           return -1;
           /* LCOV_EXCL_STOP*/
         }
@@ -3585,13 +3718,13 @@ static int16_t rule_create(char **text, struct rules_t *obj) {
             }
             if(lexer_peek(text, tmp-1, &type, &start, &len) < 0) {
               /* LCOV_EXCL_START*/
-              logprintf_P(F("FATAL: Internal error in %s #%d"), __FUNCTION__, __LINE__);
+              log_error(LOG_RULES, "FATAL: Internal error in %s #%d", __FUNCTION__, __LINE__);
               return -1;
               /* LCOV_EXCL_STOP*/
             }
             if(type != TVAR) {
               /* LCOV_EXCL_START*/
-              logprintf_P(F("FATAL: Internal error in %s #%d"), __FUNCTION__, __LINE__);
+              log_error(LOG_RULES, "FATAL: Internal error in %s #%d", __FUNCTION__, __LINE__);
               return -1;
               /* LCOV_EXCL_STOP*/
             }
@@ -3607,7 +3740,7 @@ static int16_t rule_create(char **text, struct rules_t *obj) {
 
             if(lexer_peek(text, pos, &type, &start, &len) < 0) {
               /* LCOV_EXCL_START*/
-              logprintf_P(F("FATAL: Internal error in %s #%d"), __FUNCTION__, __LINE__);
+              log_error(LOG_RULES, "FATAL: Internal error in %s #%d", __FUNCTION__, __LINE__);
               return -1;
               /* LCOV_EXCL_STOP*/
             }
@@ -3619,7 +3752,7 @@ static int16_t rule_create(char **text, struct rules_t *obj) {
           } break;
           /* LCOV_EXCL_START*/
           default: {
-            logprintf_P(F("ERROR: Unexpected token (%d)"), __LINE__);
+            log_error(LOG_RULES, "ERROR: Unexpected token (%d)", __LINE__);
             return -1;
           } break;
           /* LCOV_EXCL_STOP*/
@@ -3629,7 +3762,7 @@ static int16_t rule_create(char **text, struct rules_t *obj) {
       case TFUNCTION: {
         if(lexer_peek(text, pos, &type, &start, &len) < 0) {
           /* LCOV_EXCL_START*/
-          logprintf_P(F("FATAL: Internal error in %s #%d"), __FUNCTION__, __LINE__);
+          log_error(LOG_RULES, "FATAL: Internal error in %s #%d", __FUNCTION__, __LINE__);
           return -1;
           /* LCOV_EXCL_STOP*/
         }
@@ -3646,7 +3779,7 @@ static int16_t rule_create(char **text, struct rules_t *obj) {
               in_child = pos;
               if(lexer_peek(text, pos, &type, &start, &len) < 0) {
                 /* LCOV_EXCL_START*/
-                logprintf_P(F("FATAL: Internal error in %s #%d"), __FUNCTION__, __LINE__);
+                log_error(LOG_RULES, "FATAL: Internal error in %s #%d", __FUNCTION__, __LINE__);
                 return -1;
                 /* LCOV_EXCL_STOP*/
               }
@@ -3654,20 +3787,20 @@ static int16_t rule_create(char **text, struct rules_t *obj) {
               go = type;
               ret = TFUNCTION;
             } else {
-              logprintf_P(F("ERROR: Unexpected token (%d)"), __LINE__);
+              log_error(LOG_RULES, "ERROR: Unexpected token (%d)", __LINE__);
               return -1;
             }
           } break;
           case RPAREN: {
             if(in_child == -1) {
               /* LCOV_EXCL_START*/
-              logprintf_P(F("FATAL: Internal error in %s #%d"), __FUNCTION__, __LINE__);
+              log_error(LOG_RULES, "FATAL: Internal error in %s #%d", __FUNCTION__, __LINE__);
               return -1;
               /* LCOV_EXCL_STOP*/
             }
             if(lexer_peek(text, in_child, &type, &start, &len) < 0) {
               /* LCOV_EXCL_START*/
-              logprintf_P(F("FATAL: Internal error in %s #%d"), __FUNCTION__, __LINE__);
+              log_error(LOG_RULES, "FATAL: Internal error in %s #%d", __FUNCTION__, __LINE__);
               return -1;
               /* LCOV_EXCL_STOP*/
             }
@@ -3700,7 +3833,7 @@ static int16_t rule_create(char **text, struct rules_t *obj) {
             ret = TFUNCTION;
           } break;
           default: {
-            logprintf_P(F("ERROR: Unexpected token (%d)"), __LINE__);
+            log_error(LOG_RULES, "ERROR: Unexpected token (%d)", __LINE__);
             return -1;
           } break;
         }
@@ -3723,14 +3856,14 @@ static int16_t rule_create(char **text, struct rules_t *obj) {
       case RPAREN: {
         if(in_child == -1) {
           /* LCOV_EXCL_START*/
-          logprintf_P(F("FATAL: Internal error in %s #%d"), __FUNCTION__, __LINE__);
+          log_error(LOG_RULES, "FATAL: Internal error in %s #%d", __FUNCTION__, __LINE__);
           return -1;
           /* LCOV_EXCL_STOP*/
         }
 
         if(lexer_peek(text, pos+1, &type, &start, &len) < 0) {
           /* LCOV_EXCL_START*/
-          logprintf_P(F("FATAL: Internal error in %s #%d"), __FUNCTION__, __LINE__);
+          log_error(LOG_RULES, "FATAL: Internal error in %s #%d", __FUNCTION__, __LINE__);
           return -1;
           /* LCOV_EXCL_STOP*/
         }
@@ -3744,7 +3877,7 @@ static int16_t rule_create(char **text, struct rules_t *obj) {
           } break;
           default: {
             /* LCOV_EXCL_START*/
-            logprintf_P(F("ERROR: Unexpected token (%d)"), __LINE__);
+            log_error(LOG_RULES, "ERROR: Unexpected token (%d)", __LINE__);
             return -1;
             /* LCOV_EXCL_STOP*/
           } break;
@@ -3759,7 +3892,7 @@ static int16_t rule_create(char **text, struct rules_t *obj) {
         in_child = -1;
         if(lexer_peek(text, pos, &type, &start, &len) < 0) {
           /* LCOV_EXCL_START*/
-          logprintf_P(F("FATAL: Internal error in %s #%d"), __FUNCTION__, __LINE__);
+          log_error(LOG_RULES, "FATAL: Internal error in %s #%d", __FUNCTION__, __LINE__);
           return -1;
           /* LCOV_EXCL_STOP*/
         }
@@ -3779,7 +3912,7 @@ static int16_t rule_create(char **text, struct rules_t *obj) {
           } break;
           /* LCOV_EXCL_START*/
           default: {
-            logprintf_P(F("ERROR: Unexpected token (%d)"), __LINE__);
+            log_error(LOG_RULES, "ERROR: Unexpected token (%d)", __LINE__);
             return -1;
           } break;
           /* LCOV_EXCL_STOP*/
@@ -3788,7 +3921,7 @@ static int16_t rule_create(char **text, struct rules_t *obj) {
       case VPTR: {
         if(lexer_peek(text, pos, &type, &start, &len) < 0) {
           /* LCOV_EXCL_START*/
-          logprintf_P(F("FATAL: Internal error in %s #%d"), __FUNCTION__, __LINE__);
+          log_error(LOG_RULES, "FATAL: Internal error in %s #%d", __FUNCTION__, __LINE__);
           return -1;
           /* LCOV_EXCL_STOP*/
         }
@@ -3804,14 +3937,14 @@ static int16_t rule_create(char **text, struct rules_t *obj) {
         if(in_child == -1) {
           if(lexer_peek(text, 0, &type, &start, &len) < 0) {
             /* LCOV_EXCL_START*/
-            logprintf_P(F("FATAL: Internal error in %s #%d"), __FUNCTION__, __LINE__);
+            log_error(LOG_RULES, "FATAL: Internal error in %s #%d", __FUNCTION__, __LINE__);
             return -1;
             /* LCOV_EXCL_STOP*/
           }
         } else {
           if(lexer_peek(text, in_child, &type, &start, &len) < 0) {
             /* LCOV_EXCL_START*/
-            logprintf_P(F("FATAL: Internal error in %s #%d"), __FUNCTION__, __LINE__);
+            log_error(LOG_RULES, "FATAL: Internal error in %s #%d", __FUNCTION__, __LINE__);
             return -1;
             /* LCOV_EXCL_STOP*/
           }
@@ -3826,7 +3959,7 @@ static int16_t rule_create(char **text, struct rules_t *obj) {
           break;
           /* LCOV_EXCL_START*/
           default: {
-            logprintf_P(F("ERROR: Unexpected token (%d)"), __LINE__);
+            log_error(LOG_RULES, "ERROR: Unexpected token (%d)", __LINE__);
             return -1;
           } break;
           /* LCOV_EXCL_STOP*/
@@ -3866,7 +3999,7 @@ static int16_t rule_create(char **text, struct rules_t *obj) {
             if(lexer_peek(text, pos-1, &type, &start, &len) >= 0 && type == LPAREN) {
               if(lexer_peek(text, pos, &type, &start, &len) < 0) {
                 /* LCOV_EXCL_START*/
-                logprintf_P(F("FATAL: Internal error in %s #%d"), __FUNCTION__, __LINE__);
+                log_error(LOG_RULES, "FATAL: Internal error in %s #%d", __FUNCTION__, __LINE__);
                 return -1;
                 /* LCOV_EXCL_STOP*/
               }
@@ -3876,7 +4009,7 @@ static int16_t rule_create(char **text, struct rules_t *obj) {
                */
               if(lexer_peek(text, pos, &type, &start, &len) < 0) {
                 /* LCOV_EXCL_START*/
-                logprintf_P(F("FATAL: Internal error in %s #%d"), __FUNCTION__, __LINE__);
+                log_error(LOG_RULES, "FATAL: Internal error in %s #%d", __FUNCTION__, __LINE__);
                 return -1;
                 /* LCOV_EXCL_STOP*/
               }
@@ -3890,7 +4023,7 @@ static int16_t rule_create(char **text, struct rules_t *obj) {
           }
         } else if(lexer_peek(text, pos, &type, &start, &len) < 0) {
           /* LCOV_EXCL_START*/
-          logprintf_P(F("FATAL: Internal error in %s #%d"), __FUNCTION__, __LINE__);
+          log_error(LOG_RULES, "FATAL: Internal error in %s #%d", __FUNCTION__, __LINE__);
           return -1;
           /* LCOV_EXCL_STOP*/
         }
@@ -3903,13 +4036,13 @@ static int16_t rule_create(char **text, struct rules_t *obj) {
           case RPAREN: {
             if(in_child == -1) {
               /* LCOV_EXCL_START*/
-              logprintf_P(F("FATAL: Internal error in %s #%d"), __FUNCTION__, __LINE__);
+              log_error(LOG_RULES, "FATAL: Internal error in %s #%d", __FUNCTION__, __LINE__);
               return -1;
               /* LCOV_EXCL_STOP*/
             }
             if(lexer_peek(text, in_child, &type, &start, &len) < 0) {
               /* LCOV_EXCL_START*/
-              logprintf_P(F("FATAL: Internal error in %s #%d"), __FUNCTION__, __LINE__);
+              log_error(LOG_RULES, "FATAL: Internal error in %s #%d", __FUNCTION__, __LINE__);
               return -1;
               /* LCOV_EXCL_STOP*/
             }
@@ -3948,12 +4081,12 @@ static int16_t rule_create(char **text, struct rules_t *obj) {
             pos++;
             if(lexer_peek(text, pos, &type, &start, &len) < 0) {
               /* LCOV_EXCL_START*/
-              logprintf_P(F("FATAL: Internal error in %s #%d"), __FUNCTION__, __LINE__);
+              log_error(LOG_RULES, "FATAL: Internal error in %s #%d", __FUNCTION__, __LINE__);
               return -1;
               /* LCOV_EXCL_STOP*/
             }
             if(type == TTHEN) {
-              logprintf_P(F("ERROR: Unexpected token (%d)"), __LINE__);
+              log_error(LOG_RULES, "ERROR: Unexpected token (%d)", __LINE__);
               return -1;
             }
           } break;
@@ -3972,13 +4105,13 @@ static int16_t rule_create(char **text, struct rules_t *obj) {
               uint8_t a = 0;
               if(in_child == -1) {
                 /* LCOV_EXCL_START*/
-                logprintf_P(F("FATAL: Internal error in %s #%d"), __FUNCTION__, __LINE__);
+                log_error(LOG_RULES, "FATAL: Internal error in %s #%d", __FUNCTION__, __LINE__);
                 return -1;
                 /* LCOV_EXCL_STOP*/
               }
               if(lexer_peek(text, in_child, &a, &start, &len) < 0) {
                 /* LCOV_EXCL_START*/
-                logprintf_P(F("FATAL: Internal error in %s #%d"), __FUNCTION__, __LINE__);
+                log_error(LOG_RULES, "FATAL: Internal error in %s #%d", __FUNCTION__, __LINE__);
                 return -1;
                 /* LCOV_EXCL_STOP*/
               }
@@ -4002,13 +4135,13 @@ static int16_t rule_create(char **text, struct rules_t *obj) {
               uint8_t a = 0;
               if(in_child == -1) {
                 /* LCOV_EXCL_START*/
-                logprintf_P(F("FATAL: Internal error in %s #%d"), __FUNCTION__, __LINE__);
+                log_error(LOG_RULES, "FATAL: Internal error in %s #%d", __FUNCTION__, __LINE__);
                 return -1;
                 /* LCOV_EXCL_STOP*/
               }
               if(lexer_peek(text, in_child, &a, &start, &len) < 0) {
                 /* LCOV_EXCL_START*/
-                logprintf_P(F("FATAL: Internal error in %s #%d"), __FUNCTION__, __LINE__);
+                log_error(LOG_RULES, "FATAL: Internal error in %s #%d", __FUNCTION__, __LINE__);
                 return -1;
                 /* LCOV_EXCL_STOP*/
               }
@@ -4016,7 +4149,7 @@ static int16_t rule_create(char **text, struct rules_t *obj) {
               if(a == TFUNCTION || a == TEVENT) {
                 if(lexer_peek(text, pos, &a, &start, &len) < 0) {
                   /* LCOV_EXCL_START*/
-                  logprintf_P(F("FATAL: Internal error in %s #%d"), __FUNCTION__, __LINE__);
+                  log_error(LOG_RULES, "FATAL: Internal error in %s #%d", __FUNCTION__, __LINE__);
                   return -1;
                   /* LCOV_EXCL_STOP*/
                 }
@@ -4039,7 +4172,7 @@ static int16_t rule_create(char **text, struct rules_t *obj) {
           } break;
           /* LCOV_EXCL_START*/
           default: {
-            logprintf_P(F("ERROR: Unexpected token (%d)"), __LINE__);
+            log_error(LOG_RULES, "ERROR: Unexpected token (%d)", __LINE__);
             return -1;
           } break;
           /* LCOV_EXCL_STOP*/
@@ -4050,7 +4183,7 @@ static int16_t rule_create(char **text, struct rules_t *obj) {
         int32_t lastjmp = getval(obj->bc.nrbytes);
         if(lexer_peek(text, pos, &type, &start, &len) < 0) {
           /* LCOV_EXCL_START*/
-          logprintf_P(F("FATAL: Internal error in %s #%d"), __FUNCTION__, __LINE__);
+          log_error(LOG_RULES, "FATAL: Internal error in %s #%d", __FUNCTION__, __LINE__);
           return -1;
           /* LCOV_EXCL_STOP*/
         }
@@ -4065,7 +4198,7 @@ static int16_t rule_create(char **text, struct rules_t *obj) {
           pos++;
           if(lexer_peek(text, pos, &type, &start, &len) < 0) {
             /* LCOV_EXCL_START*/
-            logprintf_P(F("FATAL: Internal error in %s #%d"), __FUNCTION__, __LINE__);
+            log_error(LOG_RULES, "FATAL: Internal error in %s #%d", __FUNCTION__, __LINE__);
             return -1;
             /* LCOV_EXCL_STOP*/
           }
@@ -4097,7 +4230,7 @@ static int16_t rule_create(char **text, struct rules_t *obj) {
             } break;
             /* LCOV_EXCL_START*/
             default: {
-              logprintf_P(F("ERROR: Unexpected token (%d)"), __LINE__);
+              log_error(LOG_RULES, "ERROR: Unexpected token (%d)", __LINE__);
               return -1;
             } break;
             /* LCOV_EXCL_STOP*/
@@ -4108,7 +4241,7 @@ static int16_t rule_create(char **text, struct rules_t *obj) {
           depth--;
         } else {
           /* LCOV_EXCL_START*/
-          logprintf_P(F("ERROR: Unexpected token (%d)"), __LINE__);
+          log_error(LOG_RULES, "ERROR: Unexpected token (%d)", __LINE__);
           return -1;
           /* LCOV_EXCL_STOP*/
         }
@@ -4119,6 +4252,639 @@ static int16_t rule_create(char **text, struct rules_t *obj) {
   return 0;
 }
 
+/*
+ * Bytecode optimizer
+ *
+ * Runs once on each rule block after it was compiled.
+ * Math on constants is folded into a constant heap slot,
+ * an if on a constant condition loses its dead branch and
+ * OP_CLEAR on an empty stack as well as jumps to the next
+ * op are dropped. Removed ops get type 0 and are squeezed
+ * out at the end, after which the jump offsets are fixed
+ * and the heap slots no op refers to anymore are released.
+ *
+ * Jumps only go forward, so every analysis below is a
+ * single pass over the bytecode in order.
+ */
+#define OPT_REMOVED 0
+
+/*
+ * Values that can reach an op
+ */
+#define OPT_DEF 1
+#define OPT_OTHER 2
+#define OPT_ENTRY 4
+
+/*
+ * VM state at the start of an op
+ */
+#define OPT_STACK 1
+#define OPT_TEST 2
+
+/*
+ * Math ops address their operands with a byte offset
+ */
+#define OPT_MAX_SLOT 63
+
+static struct vm_top_t *bc_op(struct rules_t *obj, uint16_t i) {
+  return (struct vm_top_t *)&obj->bc.buffer[i*sizeof(struct vm_top_t)];
+}
+
+/*
+ * Collects the operands referring to a heap slot, the
+ * one the op writes to (if any) always comes first.
+ */
+static uint8_t bc_slot_refs(struct vm_top_t *node, int8_t **refs, uint8_t *reads) {
+  uint8_t type = gettype(node->type);
+
+  *reads = 0;
+  if(is_op_and_math(type)) {
+    refs[0] = &node->a;
+    refs[1] = &node->b;
+    refs[2] = &node->c;
+    *reads = 1;
+    return 3;
+  } else if(type == OP_GETVAL || type == OP_CALL) {
+    refs[0] = &node->a;
+    *reads = 1;
+    return 1;
+  } else if(type == OP_TEST || (type == OP_PUSH && (int8_t)getval(node->a) < 0)) {
+    refs[0] = &node->a;
+    return 1;
+  } else if(type == OP_SETVAL && (int8_t)getval(node->b) < 0) {
+    refs[0] = &node->b;
+    return 1;
+  }
+  return 0;
+}
+
+static uint8_t bc_slot_written(struct vm_top_t *node) {
+  int8_t *refs[3];
+  uint8_t reads = 0;
+
+  if(bc_slot_refs(node, refs, &reads) > 0 && reads == 1) {
+    return -(int8_t)getval(*refs[0]);
+  }
+  return 0;
+}
+
+static uint8_t bc_slot_read(struct vm_top_t *node, uint8_t slot) {
+  int8_t *refs[3];
+  uint8_t reads = 0, nr = bc_slot_refs(node, refs, &reads);
+
+  for(;reads<nr;reads++) {
+    if((int8_t)getval(*refs[reads]) == -(int8_t)slot) {
+      return 1;
+    }
+  }
+  return 0;
+}
+
+static void bc_slot_replace(struct vm_top_t *node, uint8_t from, uint8_t to) {
+  int8_t *refs[3];
+  uint8_t reads = 0, nr = bc_slot_refs(node, refs, &reads);
+
+  for(;reads<nr;reads++) {
+    if((int8_t)getval(*refs[reads]) == -(int8_t)from) {
+      setval(*refs[reads], -(int8_t)to);
+    }
+  }
+}
+
+/*
+ * A slot is constant when no op writes to it
+ */
+static int8_t bc_slot_const(struct rules_t *obj, uint16_t nrbc, uint8_t slot, float *out) {
+  uint16_t pos = slot*rule_max_var_bytes(), i = 0;
+
+  if(pos >= getval(obj->heap->nrbytes)) {
+    return 0;
+  }
+  for(i=0;i<nrbc;i++) {
+    if(bc_slot_written(bc_op(obj, i)) == slot) {
+      return 0;
+    }
+  }
+
+  switch(gettype(obj->heap->buffer[pos])) {
+    case VINTEGER: {
+      struct vm_vinteger_t *node = (struct vm_vinteger_t *)&obj->heap->buffer[pos];
+      uint32_t val = 0;
+
+      val |= getval(node->value[0]) << 16;
+      val |= getval(node->value[1]) << 8;
+      val |= getval(node->value[2]);
+
+      if(val & 0x800000) {
+        val |= 0xFF000000;
+        *out = ((float)(val*-1))*-1;
+      } else {
+        *out = (float)val;
+      }
+    } break;
+    case VFLOAT: {
+      struct vm_vfloat_t *node = (struct vm_vfloat_t *)&obj->heap->buffer[pos];
+      uint32_t val = 0;
+
+      val |= (getval(node->type) >> 5) << 29;
+      val |= getval(node->value[0]) << 21;
+      val |= getval(node->value[1]) << 13;
+      val |= getval(node->value[2]) << 5;
+
+      uint322float(val, out);
+    } break;
+    default: {
+      return 0;
+    } break;
+  }
+  return 1;
+}
+
+/*
+ * Same results and encoding as rule_run
+ */
+static float bc_compute(uint8_t type, float x, float y) {
+  switch(type) {
+    case OP_EQ: return (fabs(x-y) < EPSILON);
+    case OP_NE: return (fabs(x-y) >= EPSILON);
+    case OP_LT: return (x < y);
+    case OP_LE: return (x <= y);
+    case OP_GT: return (x > y);
+    case OP_GE: return (x >= y);
+    case OP_AND: return (x > 0 && y > 0);
+    case OP_OR: return (x > 0 || y > 0);
+    case OP_SUB: return x-y;
+    case OP_ADD: return x+y;
+    case OP_DIV: return x/y;
+    case OP_MUL: return x*y;
+    case OP_POW: return pow(x, y);
+    case OP_MOD: return fmodf(x, y);
+  }
+  return 0;
+}
+
+static void bc_encode(float var, uint8_t *out) {
+  float nr = 0;
+
+  if(modff(var, &nr) == 0) {
+    out[0] = VINTEGER;
+    out[1] = ((uint32_t)var >> 16) & 0xFF;
+    out[2] = ((uint32_t)var >> 8) & 0xFF;
+    out[3] = ((uint32_t)var) & 0xFF;
+  } else {
+    float f = float32to27(var);
+    uint32_t x = 0;
+    float2uint32(f, &x);
+
+    out[0] = VFLOAT | ((((uint32_t)x >> 29) & 0x7) << 5);
+    out[1] = ((uint32_t)x >> 21) & 0xFF;
+    out[2] = ((uint32_t)x >> 13) & 0xFF;
+    out[3] = ((uint32_t)x >> 5) & 0xFF;
+  }
+}
+
+/*
+ * Reuses a constant slot holding the same value
+ * or adds one in the space left by rule_prepare.
+ */
+static uint8_t bc_slot_alloc(struct rules_t *obj, uint16_t nrbc, uint16_t heapsize, uint8_t *val) {
+  uint16_t nrbytes = getval(obj->heap->nrbytes), i = 0;
+  uint8_t x = 0;
+  float tmp = 0;
+
+  for(i=rule_max_var_bytes();i<nrbytes && i/rule_max_var_bytes()<=OPT_MAX_SLOT;i+=rule_max_var_bytes()) {
+    for(x=0;x<rule_max_var_bytes();x++) {
+      if(getval(obj->heap->buffer[i+x]) != val[x]) {
+        break;
+      }
+    }
+    if(x == rule_max_var_bytes() && bc_slot_const(obj, nrbc, i/rule_max_var_bytes(), &tmp) == 1) {
+      return i/rule_max_var_bytes();
+    }
+  }
+
+  if(nrbytes+rule_max_var_bytes() > heapsize || nrbytes/rule_max_var_bytes() > OPT_MAX_SLOT) {
+    return 0;
+  }
+  for(x=0;x<rule_max_var_bytes();x++) {
+    setval(obj->heap->buffer[nrbytes+x], val[x]);
+  }
+  setval(obj->heap->nrbytes, nrbytes+rule_max_var_bytes());
+  setval(obj->heap->bufsize, MAX(getval(obj->heap->bufsize), nrbytes+rule_max_var_bytes()));
+
+  return nrbytes/rule_max_var_bytes();
+}
+
+static void bc_flow(struct rules_t *obj, uint16_t nrbc, uint8_t *state, uint16_t i, uint8_t out) {
+  struct vm_top_t *node = bc_op(obj, i);
+  uint8_t type = gettype(node->type);
+
+  if(type == OP_RET) {
+    return;
+  }
+  if(i+1 < nrbc) {
+    state[i+1] |= out;
+  }
+  if(type == OP_JMP && i+(int8_t)getval(node->a) < nrbc) {
+    state[i+(int8_t)getval(node->a)] |= out;
+  }
+}
+
+/*
+ * Lets every read of the slot written by op i use the
+ * constant slot instead, unless another value of that
+ * slot can reach the same read. The heap is kept between
+ * runs, so a slot read before it is written in a run
+ * must keep all its writes.
+ */
+static int8_t bc_propagate(struct rules_t *obj, uint16_t nrbc, uint8_t *state, uint16_t i, uint8_t slot, uint8_t to) {
+  uint16_t x = 0;
+
+  memset(state, 0, nrbc);
+  state[0] = OPT_ENTRY;
+
+  for(x=0;x<nrbc;x++) {
+    struct vm_top_t *node = bc_op(obj, x);
+    uint8_t out = state[x];
+
+    if(bc_slot_read(node, slot) == 1 &&
+       ((state[x] & OPT_ENTRY) == OPT_ENTRY || state[x] == (OPT_DEF | OPT_OTHER))) {
+      return -1;
+    }
+    if(bc_slot_written(node) == slot) {
+      out = (x == i) ? OPT_DEF : OPT_OTHER;
+    }
+    bc_flow(obj, nrbc, state, x, out);
+  }
+
+  for(x=i+1;x<nrbc;x++) {
+    if((state[x] & OPT_DEF) == OPT_DEF) {
+      bc_slot_replace(bc_op(obj, x), slot, to);
+    }
+  }
+  return 0;
+}
+
+static uint16_t bc_next_op(struct rules_t *obj, uint16_t nrbc, uint16_t i) {
+  while(i < nrbc && gettype(bc_op(obj, i)->type) == OPT_REMOVED) {
+    i++;
+  }
+  return i;
+}
+
+/*
+ * Whether any jump outside [start, end) lands
+ * after start and before end.
+ */
+static int8_t bc_jumps_into(struct rules_t *obj, uint16_t nrbc, uint16_t start, uint16_t end) {
+  uint16_t i = 0;
+
+  for(i=0;i<nrbc;i++) {
+    struct vm_top_t *node = bc_op(obj, i);
+    if(gettype(node->type) == OP_JMP && (i < start || i >= end)) {
+      uint16_t to = i+(int8_t)getval(node->a);
+      if(to > start && to < end) {
+        return 1;
+      }
+    }
+  }
+  return 0;
+}
+
+static void bc_remove(struct rules_t *obj, uint16_t start, uint16_t end) {
+  for(;start<end;start++) {
+    setval(bc_op(obj, start)->type, OPT_REMOVED);
+  }
+}
+
+static int8_t bc_fold(struct rules_t *obj, uint16_t nrbc, uint16_t heapsize, uint8_t *state, uint16_t i) {
+  struct vm_top_t *node = bc_op(obj, i);
+  uint8_t type = gettype(node->type);
+  uint8_t val[4], slot = 0;
+  uint16_t jmp = 0, to = 0, end = 0;
+  float x = 0, y = 0, var = 0;
+
+  if(type == OP_TEST) {
+    if(bc_slot_const(obj, nrbc, -(int8_t)getval(node->a), &x) == 0) {
+      return 0;
+    }
+    var = (x > 0);
+  } else if(is_op_and_math(type)) {
+    if(bc_slot_const(obj, nrbc, -(int8_t)getval(node->b), &x) == 0 ||
+       bc_slot_const(obj, nrbc, -(int8_t)getval(node->c), &y) == 0) {
+      return 0;
+    }
+    var = bc_compute(type, x, y);
+    if(isnan(var) || isinf(var)) {
+      return 0;
+    }
+  } else {
+    return 0;
+  }
+
+  /*
+   * Comparisons also set the test flag for the
+   * jump that follows, only fold an if condition
+   */
+  if(!is_math(type)) {
+    jmp = bc_next_op(obj, nrbc, i+1);
+    if(jmp == nrbc || gettype(bc_op(obj, jmp)->type) != OP_JMP) {
+      return 0;
+    }
+    to = jmp+(int8_t)getval(bc_op(obj, jmp)->a);
+    if(var == 0 && bc_jumps_into(obj, nrbc, jmp, to) == 1) {
+      return 0;
+    }
+  }
+
+  if(type != OP_TEST) {
+    bc_encode(var, val);
+    if((slot = bc_slot_alloc(obj, nrbc, heapsize, val)) == 0) {
+      return 0;
+    }
+    if(bc_propagate(obj, nrbc, state, i, -(int8_t)getval(node->a), slot) == -1) {
+      return 0;
+    }
+  }
+
+  setval(node->type, OPT_REMOVED);
+
+  if(is_math(type)) {
+    return 1;
+  }
+
+  /*
+   * The jump itself stays for now, it also clears
+   * the test flag, with an offset of 1 it always
+   * continues with the next op.
+   */
+  setval(bc_op(obj, jmp)->a, 1);
+
+  if(var == 0) {
+    bc_remove(obj, jmp+1, to);
+  } else {
+    /*
+     * The then block ends with a jump over the else
+     * block, which is never run now.
+     */
+    for(end=to-1;end>jmp && gettype(bc_op(obj, end)->type) == OPT_REMOVED;end--);
+    if(end > jmp && gettype(bc_op(obj, end)->type) == OP_JMP) {
+      uint16_t skip = end+(int8_t)getval(bc_op(obj, end)->a);
+      if(skip > to && bc_jumps_into(obj, nrbc, end, skip) == 0) {
+        bc_remove(obj, end, skip);
+      }
+    }
+  }
+  return 1;
+}
+
+static void bc_state(struct rules_t *obj, uint16_t nrbc, uint8_t *state) {
+  uint16_t i = 0;
+
+  memset(state, 0, nrbc);
+
+  /*
+   * Blocks started by an event call may inherit
+   * the stack and test flag of the caller.
+   */
+  state[0] = OPT_STACK | OPT_TEST;
+
+  for(i=0;i<nrbc;i++) {
+    struct vm_top_t *node = bc_op(obj, i);
+    uint8_t type = gettype(node->type), out = state[i];
+
+    if(is_op_and_math(type) && !is_math(type)) {
+      out |= OPT_TEST;
+    } else if(type == OP_TEST) {
+      out |= OPT_TEST;
+    } else if(type == OP_JMP) {
+      out &= ~OPT_TEST;
+    } else if(type == OP_PUSH) {
+      out |= OPT_STACK;
+    } else if(type == OP_CLEAR || (type == OP_SETVAL && (int8_t)getval(node->b) != 0)) {
+      out &= ~OPT_STACK;
+    } else if(type == OP_CALL) {
+      /*
+       * Functions take their arguments from the
+       * stack and the VM takes the result.
+       */
+      if((int8_t)getval(node->c) != 1) {
+        out &= ~OPT_STACK;
+      } else {
+        out |= OPT_STACK | OPT_TEST;
+      }
+    }
+    bc_flow(obj, nrbc, state, i, out);
+  }
+}
+
+static void rule_optimize(struct rules_t *obj, struct pbuf *mempool, uint16_t bcsize, uint16_t heapsize) {
+  uint16_t nrbc = getval(obj->bc.nrbytes)/sizeof(struct vm_top_t);
+  uint16_t oldheap = getval(obj->heap->nrbytes);
+  uint16_t i = 0, x = 0, y = 0;
+  uint8_t *state = NULL, changed = 1;
+  int8_t map[OPT_MAX_SLOT+1];
+
+  if(nrbc == 0) {
+    return;
+  }
+
+  /*
+   * Leave bytecode alone that refers to slots
+   * outside the heap or beyond a math offset.
+   */
+  for(i=0;i<nrbc;i++) {
+    int8_t *refs[3];
+    uint8_t reads = 0, nr = bc_slot_refs(bc_op(obj, i), refs, &reads);
+    for(x=0;x<nr;x++) {
+      int8_t slot = -(int8_t)getval(*refs[x]);
+      if(slot <= 0 || slot > OPT_MAX_SLOT || slot*rule_max_var_bytes() >= oldheap) {
+        return;
+      }
+    }
+  }
+
+  if((state = (uint8_t *)MALLOC(nrbc)) == NULL) {
+    OUT_OF_MEMORY
+    return;
+  }
+
+  while(changed == 1) {
+    changed = 0;
+    for(i=0;i<nrbc;i++) {
+      if(bc_fold(obj, nrbc, heapsize, state, i) == 1) {
+        changed = 1;
+      }
+    }
+  }
+
+  bc_state(obj, nrbc, state);
+  for(i=0;i<nrbc;i++) {
+    struct vm_top_t *node = bc_op(obj, i);
+    uint8_t type = gettype(node->type);
+
+    if(type == OP_CLEAR && (state[i] & OPT_STACK) == 0) {
+      setval(node->type, OPT_REMOVED);
+    } else if(type == OP_JMP && (state[i] & OPT_TEST) == 0 &&
+       bc_next_op(obj, nrbc, i+1) == bc_next_op(obj, nrbc, i+(int8_t)getval(node->a))) {
+      setval(node->type, OPT_REMOVED);
+    }
+  }
+
+  FREE(state);
+
+  /*
+   * Each jump skips the ops left between it and its
+   * target, a removed target continues with the next.
+   */
+  for(i=0;i<nrbc;i++) {
+    struct vm_top_t *node = bc_op(obj, i);
+    if(gettype(node->type) == OP_JMP) {
+      uint16_t to = i+(int8_t)getval(node->a);
+      for(y=0, x=i;x<to;x++) {
+        if(gettype(bc_op(obj, x)->type) != OPT_REMOVED) {
+          y++;
+        }
+      }
+      setval(node->a, y);
+    }
+  }
+
+  for(i=0, x=0;i<nrbc;i++) {
+    struct vm_top_t *node = bc_op(obj, i);
+    if(gettype(node->type) != OPT_REMOVED) {
+      if(x != i) {
+        struct vm_top_t *to = bc_op(obj, x);
+        setval(to->type, getval(node->type));
+        setval(to->a, getval(node->a));
+        setval(to->b, getval(node->b));
+        setval(to->c, getval(node->c));
+      }
+      x++;
+    }
+  }
+  nrbc = x;
+  setval(obj->bc.nrbytes, nrbc*sizeof(struct vm_top_t));
+  setval(obj->bc.bufsize, nrbc*sizeof(struct vm_top_t));
+
+  /*
+   * Release the heap slots no op refers to anymore
+   */
+  {
+    uint16_t nrslots = MIN(getval(obj->heap->nrbytes)/rule_max_var_bytes(), OPT_MAX_SLOT+1);
+    int8_t *refs[3];
+    uint8_t reads = 0, nr = 0;
+
+    memset(map, 0, sizeof(map));
+    for(i=0;i<nrbc;i++) {
+      nr = bc_slot_refs(bc_op(obj, i), refs, &reads);
+      for(x=0;x<nr;x++) {
+        map[-(int8_t)getval(*refs[x])] = 1;
+      }
+    }
+    for(i=1, y=1;i<nrslots;i++) {
+      if(map[i] == 1) {
+        if(i != y) {
+          for(x=0;x<rule_max_var_bytes();x++) {
+            setval(obj->heap->buffer[y*rule_max_var_bytes()+x], getval(obj->heap->buffer[i*rule_max_var_bytes()+x]));
+          }
+        }
+        map[i] = y++;
+      }
+    }
+    for(i=0;i<nrbc;i++) {
+      nr = bc_slot_refs(bc_op(obj, i), refs, &reads);
+      for(x=0;x<nr;x++) {
+        setval(*refs[x], -map[-(int8_t)getval(*refs[x])]);
+      }
+    }
+    setval(obj->heap->nrbytes, y*rule_max_var_bytes());
+    setval(obj->heap->bufsize, y*rule_max_var_bytes());
+  }
+
+  /*
+   * Give the space of the removed ops and the unused
+   * heap reserved by rule_prepare back to the mempool.
+   */
+  {
+    uint16_t nrbytes = getval(obj->bc.nrbytes);
+    uint16_t heapbytes = getval(obj->heap->nrbytes);
+    uint16_t saved = (bcsize-nrbytes)+(oldheap-heapbytes);
+    uint16_t released = heapsize-oldheap;
+    unsigned char *heap = &obj->bc.buffer[nrbytes];
+
+    memmove(heap, obj->heap, sizeof(struct rule_stack_t)+heapbytes);
+    obj->heap = (struct rule_stack_t *)heap;
+    obj->heap->buffer = &heap[sizeof(struct rule_stack_t)];
+
+    mempool->len -= saved+released;
+
+    heap = &((unsigned char *)mempool->payload)[mempool->len];
+    memmove(heap, stack, sizeof(struct rule_stack_t));
+    stack = (struct rule_stack_t *)heap;
+    stack->buffer = &heap[sizeof(struct rule_stack_t)];
+
+    optsaved += saved;
+    optreleased += released;
+
+    log_info(LOG_RULES, "rule #%d optimized, bytecode: %d -> %d, heap: %d -> %d bytes",
+      getval(obj->nr), bcsize, nrbytes, oldheap, heapbytes);
+  }
+}
+
+/*
+ * Functions keeping a state get it reserved right
+ * after the heap values of the rule block, so each
+ * call site finds its own state without a lookup.
+ */
+static int8_t rule_reserve_state(struct rules_t *obj, struct pbuf *input, struct pbuf *mempool) {
+  uint16_t nrbytes = getval(obj->bc.nrbytes), pos = 0, size = 0;
+  unsigned char *end = &((unsigned char *)mempool->payload)[mempool->len];
+  unsigned char *state = &obj->heap->buffer[getval(obj->heap->nrbytes)];
+  char *a = (char *)input->payload, *b = (char *)mempool->payload;
+  uint16_t grow = 0;
+
+  for(pos=0;pos<nrbytes;pos+=sizeof(struct vm_top_t)) {
+    struct vm_top_t *node = (struct vm_top_t *)&obj->bc.buffer[pos];
+    if(gettype(node->type) == OP_CALL && getval(node->c) == 0) {
+      uint8_t x = rule_functions[(int8_t)getval(node->b)].state;
+      if(x > 0) {
+        if(size/sizeof(uint32_t) >= RULE_STATE_MAX) {
+          log_error(LOG_RULES, "ERROR: rule #%d keeps too much function state", getval(obj->nr));
+          return -1;
+        }
+        setval(node->c, ((size/sizeof(uint32_t))+1) << 1);
+        size += (x+3) & ~3;
+      }
+    }
+  }
+
+  if(size == 0) {
+    return 0;
+  }
+
+  if(&state[size] > end) {
+    grow = &state[size]-end;
+    if(&a[0] >= &b[0] && &a[0] <= &b[mempool->tot_len] &&
+       (mempool->len+grow+sizeof(struct rule_stack_t)+getval(stack->bufsize)) >= input->len) {
+      log_error(LOG_RULES, "FATAL #%d: ruleset too large, out of memory", __LINE__);
+      return -1;
+    }
+    if((mempool->len+grow+sizeof(struct rule_stack_t)+getval(stack->bufsize)) >= mempool->tot_len) {
+      log_error(LOG_RULES, "FATAL #%d: ruleset too large, out of memory", __LINE__);
+      return -1;
+    }
+    memmove(&end[grow], stack, sizeof(struct rule_stack_t));
+    stack = (struct rule_stack_t *)&end[grow];
+    stack->buffer = &end[grow+sizeof(struct rule_stack_t)];
+    mempool->len += grow;
+  }
+  setval(obj->heap->bufsize, MAX(getval(obj->heap->bufsize), getval(obj->heap->nrbytes)+size));
+  rule_state_clear(obj);
+
+  return 0;
+}
+
 int8_t rule_run(struct rules_t *obj, uint8_t validate) {
   uint16_t pos = 0;
   uint8_t t = 0;
@@ -4174,9 +4940,13 @@ int8_t rule_run(struct rules_t *obj, uint8_t validate) {
   memset(stack->buffer, 0, getval(stack->bufsize));
   setval(stack->nrbytes, 4);
 
+  nrops = 0;
+  stackpeak = 4;
+
 /*****************/
   BEGIN:
     uint8_t type = gettype(obj->bc.buffer[pos]);
+    nrops++;
 #ifdef DEBUG
     printf("rule #%d, pos: %lu, op_id: %d, op: %s\n", obj->nr, pos/sizeof(struct vm_top_t), type, op_names[type].name);
 #endif
@@ -4192,23 +4962,23 @@ int8_t rule_run(struct rules_t *obj, uint8_t validate) {
 
 #if defined(DEBUG) || defined(COVERALLS)
     if((int8_t)getval(node->a) >= 0) {
-      logprintf_P(F("FATAL: Internal error in %s #%d pos (%d)"), __FUNCTION__, __LINE__, pos/4);
+      log_error(LOG_RULES, "FATAL: Internal error in %s #%d pos (%d)", __FUNCTION__, __LINE__, pos/4);
       return -1;
     }
     if((int8_t)getval(node->b) >= 0) {
-      logprintf_P(F("FATAL: Internal error in %s #%d pos (%d)"), __FUNCTION__, __LINE__, pos/4);
+      log_error(LOG_RULES, "FATAL: Internal error in %s #%d pos (%d)", __FUNCTION__, __LINE__, pos/4);
       return -1;
     }
     if((int8_t)getval(node->c) >= 0) {
-      logprintf_P(F("FATAL: Internal error in %s #%d pos (%d)"), __FUNCTION__, __LINE__, pos/4);
+      log_error(LOG_RULES, "FATAL: Internal error in %s #%d pos (%d)", __FUNCTION__, __LINE__, pos/4);
       return -1;
     }
     if(b > getval(obj->heap->nrbytes)) {
-      logprintf_P(F("FATAL: Internal error in %s #%d pos (%d)"), __FUNCTION__, __LINE__, pos/4);
+      log_error(LOG_RULES, "FATAL: Internal error in %s #%d pos (%d)", __FUNCTION__, __LINE__, pos/4);
       return -1;
     }
     if(c > getval(obj->heap->nrbytes)) {
-      logprintf_P(F("FATAL: Internal error in %s #%d pos (%d)"), __FUNCTION__, __LINE__, pos/4);
+      log_error(LOG_RULES, "FATAL: Internal error in %s #%d pos (%d)", __FUNCTION__, __LINE__, pos/4);
       return -1;
     }
 #endif
@@ -4258,7 +5028,7 @@ int8_t rule_run(struct rules_t *obj, uint8_t validate) {
           break;
         }
       }
-      logprintf_P(F("ERROR: cannot compute %s with a left char value"), op);
+      log_error(LOG_RULES, "ERROR: cannot compute %s with a left char value", op);
       return -1;
     } else if(is_op_and_math(type)) {
       uint8_t i = 0;
@@ -4269,7 +5039,7 @@ int8_t rule_run(struct rules_t *obj, uint8_t validate) {
           break;
         }
       }
-      logprintf_P(F("ERROR: cannot compare %s with a left char value"), op);
+      log_error(LOG_RULES, "ERROR: cannot compare %s with a left char value", op);
       return -1;
     }
     if(y_type == VINTEGER) {
@@ -4309,7 +5079,7 @@ int8_t rule_run(struct rules_t *obj, uint8_t validate) {
           break;
         }
       }
-      logprintf_P(F("ERROR: cannot compute %s with a right char value"), op);
+      log_error(LOG_RULES, "ERROR: cannot compute %s with a right char value", op);
       return -1;
     } else if(is_op_and_math(type)) {
       uint8_t i = 0;
@@ -4320,7 +5090,7 @@ int8_t rule_run(struct rules_t *obj, uint8_t validate) {
           break;
         }
       }
-      logprintf_P(F("ERROR: cannot compare %s with a right char value"), op);
+      log_error(LOG_RULES, "ERROR: cannot compare %s with a right char value", op);
       return -1;
     }
 #ifdef DEBUG
@@ -4493,7 +5263,7 @@ int8_t rule_run(struct rules_t *obj, uint8_t validate) {
 #if defined(DEBUG) || defined(COVERALLS)
     /* LCOV_EXCL_START*/
     if((uint8_t)getval(node->a) <= 0) {
-      logprintf_P(F("FATAL: Internal error in %s #%d pos (%d)"), __FUNCTION__, __LINE__, pos/4);
+      log_error(LOG_RULES, "FATAL: Internal error in %s #%d pos (%d)", __FUNCTION__, __LINE__, pos/4);
       return -1;
     }
     /* LCOV_EXCL_STOP*/
@@ -4575,15 +5345,15 @@ int8_t rule_run(struct rules_t *obj, uint8_t validate) {
 
 #if defined(DEBUG) || defined(COVERALLS)
     if((int8_t)getval(node->b) < 0) {
-      logprintf_P(F("FATAL: Internal error in %s #%d pos (%d)"), __FUNCTION__, __LINE__, pos/4);
+      log_error(LOG_RULES, "FATAL: Internal error in %s #%d pos (%d)", __FUNCTION__, __LINE__, pos/4);
       return -1;
     }
     if((int8_t)getval(node->a) >= 0) {
-      logprintf_P(F("FATAL: Internal error in %s #%d pos (%d)"), __FUNCTION__, __LINE__, pos/4);
+      log_error(LOG_RULES, "FATAL: Internal error in %s #%d pos (%d)", __FUNCTION__, __LINE__, pos/4);
       return -1;
     }
     if(a > getval(obj->heap->nrbytes)) {
-      logprintf_P(F("FATAL: Internal error in %s #%d pos (%d)"), __FUNCTION__, __LINE__, pos/4);
+      log_error(LOG_RULES, "FATAL: Internal error in %s #%d pos (%d)", __FUNCTION__, __LINE__, pos/4);
       return -1;
     }
 #endif
@@ -4595,7 +5365,7 @@ int8_t rule_run(struct rules_t *obj, uint8_t validate) {
 #if defined(DEBUG) || defined(COVERALLS)
     /* LCOV_EXCL_START*/
     if(rules_gettop(obj) < 2) {
-      logprintf_P(F("FATAL: Internal error in %s #%d"), __FUNCTION__, __LINE__);
+      log_error(LOG_RULES, "FATAL: Internal error in %s #%d", __FUNCTION__, __LINE__);
       return -1;
     }
 #endif
@@ -4647,7 +5417,7 @@ int8_t rule_run(struct rules_t *obj, uint8_t validate) {
       } break;
       /* LCOV_EXCL_START*/
       default: {
-        logprintf_P(F("FATAL: Internal error in %s #%d"), __FUNCTION__, __LINE__);
+        log_error(LOG_RULES, "FATAL: Internal error in %s #%d", __FUNCTION__, __LINE__);
         return -1;
       } break;
       /* LCOV_EXCL_STOP*/
@@ -4668,11 +5438,11 @@ int8_t rule_run(struct rules_t *obj, uint8_t validate) {
 
 #if defined(DEBUG) || defined(COVERALLS)
     if((int8_t)getval(node->a) < 0) {
-      logprintf_P(F("FATAL: Internal error in %s #%d pos (%d)"), __FUNCTION__, __LINE__, pos/4);
+      log_error(LOG_RULES, "FATAL: Internal error in %s #%d pos (%d)", __FUNCTION__, __LINE__, pos/4);
       return -1;
     }
     // if((int8_t)getval(node->b) > 0) {
-      // logprintf_P(F("FATAL: Internal error in %s #%d pos (%d)"), __FUNCTION__, __LINE__, pos/4);
+      // log_error(LOG_RULES, "FATAL: Internal error in %s #%d pos (%d)", __FUNCTION__, __LINE__, pos/4);
       // return -1;
     // }
 #endif
@@ -4683,7 +5453,7 @@ int8_t rule_run(struct rules_t *obj, uint8_t validate) {
 
 #if defined(DEBUG) || defined(COVERALLS)
       if(b > getval(obj->heap->nrbytes)) {
-        logprintf_P(F("FATAL: Internal error in %s #%d pos (%d)"), __FUNCTION__, __LINE__, pos/4);
+        log_error(LOG_RULES, "FATAL: Internal error in %s #%d pos (%d)", __FUNCTION__, __LINE__, pos/4);
         return -1;
       }
 #endif
@@ -4727,7 +5497,7 @@ int8_t rule_run(struct rules_t *obj, uint8_t validate) {
 
 #if defined(DEBUG) || defined(COVERALLS)
       if(b > varstack->nrbytes) {
-        logprintf_P(F("FATAL: Internal error in %s #%d pos (%d)"), __FUNCTION__, __LINE__, pos/4);
+        log_error(LOG_RULES, "FATAL: Internal error in %s #%d pos (%d)", __FUNCTION__, __LINE__, pos/4);
         return -1;
       }
 #endif
@@ -4772,7 +5542,7 @@ int8_t rule_run(struct rules_t *obj, uint8_t validate) {
 
 #if defined(DEBUG) || defined(COVERALLS)
       if(a > getval(obj->heap->nrbytes)) {
-        logprintf_P(F("FATAL: Internal error in %s #%d pos (%d)"), __FUNCTION__, __LINE__, pos/4);
+        log_error(LOG_RULES, "FATAL: Internal error in %s #%d pos (%d)", __FUNCTION__, __LINE__, pos/4);
         return -1;
       }
 #endif
@@ -4783,7 +5553,7 @@ int8_t rule_run(struct rules_t *obj, uint8_t validate) {
 
 #if defined(DEBUG) || defined(COVERALLS)
       if(a > varstack->nrbytes) {
-        logprintf_P(F("FATAL: Internal error in %s #%d pos (%d)"), __FUNCTION__, __LINE__, pos/4);
+        log_error(LOG_RULES, "FATAL: Internal error in %s #%d pos (%d)", __FUNCTION__, __LINE__, pos/4);
         return -1;
       }
 #endif
@@ -4802,31 +5572,37 @@ int8_t rule_run(struct rules_t *obj, uint8_t validate) {
     struct vm_top_t *node = (struct vm_top_t *)&obj->bc.buffer[pos];
     uint16_t a = vm_val_pos((int8_t)getval(node->a));
     uint16_t b = (int8_t)getval(node->b);
-    uint16_t c = (int8_t)getval(node->c);
+    uint8_t c = getval(node->c);
 
 #if defined(DEBUG) || defined(COVERALLS)
     if((int8_t)getval(node->a) >= 0) {
-      logprintf_P(F("FATAL: Internal error in %s #%d pos (%d)"), __FUNCTION__, __LINE__, pos/4);
+      log_error(LOG_RULES, "FATAL: Internal error in %s #%d pos (%d)", __FUNCTION__, __LINE__, pos/4);
       return -1;
     }
     if((int8_t)getval(node->b) < 0) {
-      logprintf_P(F("FATAL: Internal error in %s #%d pos (%d)"), __FUNCTION__, __LINE__, pos/4);
+      log_error(LOG_RULES, "FATAL: Internal error in %s #%d pos (%d)", __FUNCTION__, __LINE__, pos/4);
       return -1;
     }
-    if((int8_t)getval(node->c) < 0 || (int8_t)getval(node->c) > 1) {
-      logprintf_P(F("FATAL: Internal error in %s #%d pos (%d)"), __FUNCTION__, __LINE__, pos/4);
+    if(c != 1 && ((c & 1) != 0 || ((c >> 1) > 0 && rule_functions[b].state == 0))) {
+      log_error(LOG_RULES, "FATAL: Internal error in %s #%d pos (%d)", __FUNCTION__, __LINE__, pos/4);
       return -1;
     }
     if(a > getval(obj->heap->nrbytes)) {
-      logprintf_P(F("FATAL: Internal error in %s #%d pos (%d)"), __FUNCTION__, __LINE__, pos/4);
+      log_error(LOG_RULES, "FATAL: Internal error in %s #%d pos (%d)", __FUNCTION__, __LINE__, pos/4);
       return -1;
     }
 #endif
 
-    if(c == 0) {
+    if(c != 1) {
+      if((c >> 1) > 0) {
+        callstate = &obj->heap->buffer[getval(obj->heap->nrbytes)+((c >> 1)-1)*sizeof(uint32_t)];
+        callstatesize = rule_functions[b].state;
+      } else {
+        callstate = NULL;
+      }
       if(rule_functions[b].callback(obj) != 0) {
         /* LCOV_EXCL_START*/
-        logprintf_P(F("FATAL: function call '%s' failed"), rule_functions[b].name);
+        log_error(LOG_RULES, "FATAL: function call '%s' failed", rule_functions[b].name);
         return -1;
         /* LCOV_EXCL_STOP*/
       }
@@ -4875,7 +5651,7 @@ int8_t rule_run(struct rules_t *obj, uint8_t validate) {
           } break;
           /* LCOV_EXCL_START*/
           default: {
-            logprintf_P(F("FATAL: Internal error in %s #%d"), __FUNCTION__, __LINE__);
+            log_error(LOG_RULES, "FATAL: Internal error in %s #%d", __FUNCTION__, __LINE__);
             return -1;
           } break;
           /* LCOV_EXCL_STOP*/
@@ -5011,7 +5787,7 @@ static void print_varstack(void) {
       } break;
       /* LCOV_EXCL_START*/
       default: {
-        logprintf_P(F("FATAL: Internal error in %s #%d"), __FUNCTION__, __LINE__);
+        log_error(LOG_RULES, "FATAL: Internal error in %s #%d", __FUNCTION__, __LINE__);
         return;
       } break;
       /* LCOV_EXCL_STOP*/
@@ -5068,7 +5844,7 @@ static void print_stack(struct rules_t *obj) {
       } break;
       /* LCOV_EXCL_START*/
       default: {
-        logprintf_P(F("FATAL: Internal error in %s #%d"), __FUNCTION__, __LINE__);
+        log_error(LOG_RULES, "FATAL: Internal error in %s #%d", __FUNCTION__, __LINE__);
         return;
       } break;
       /* LCOV_EXCL_STOP*/
@@ -5126,7 +5902,7 @@ void rules_gc(struct rules_t ***rules, uint8_t *nrrules) {
         } break;
         /* LCOV_EXCL_START*/
         default: {
-          logprintf_P(F("FATAL: Internal error in %s #%d"), __FUNCTION__, __LINE__);
+          log_error(LOG_RULES, "FATAL: Internal error in %s #%d", __FUNCTION__, __LINE__);
           return;
         } break;
         /* LCOV_EXCL_STOP*/
@@ -5146,16 +5922,362 @@ void rules_gc(struct rules_t ***rules, uint8_t *nrrules) {
   }
 
   varstack = NULL;
+  optsaved = 0;
+  optreleased = 0;
 
 #if defined(DEBUG) || defined(COVERALLS)
   memused = 0;
 #endif
 }
 
+/*
+ * Compiled rule images
+ *
+ * The bytecode and heap only refer to each other and
+ * to the varstack by offset, so an image is the used
+ * part of the mempool, the varstack strings and a small
+ * relocation table to restore the few raw pointers.
+ */
+#define RULES_IMAGE_MAGIC 0x43424c52 // RLBC
+#define RULES_IMAGE_VERSION 2
+/*
+ * Bump on every change to the bytecode the compiler
+ * and optimizer generate for the same rules, images
+ * of the old compiler are then compiled again.
+ */
+#define RULES_COMPILER_VERSION 3
+
+/*
+ * A new operation changes the generated bytecode, so
+ * it has to come with a new compiler version as well.
+ */
+static_assert(OP_RET == 22, "the operations changed, bump RULES_COMPILER_VERSION and update this check");
+
+typedef struct rules_image_t {
+  uint32_t magic;
+  uint32_t hash;
+  uint32_t engine;
+  uint16_t version;
+  uint16_t objsize;
+  uint16_t memsize;
+  uint16_t memused;
+  uint16_t varsize;
+  uint16_t stack;
+  uint16_t stacksize;
+  uint8_t nrrules;
+  uint8_t pad;
+} __attribute__((aligned(4))) rules_image_t;
+
+typedef struct rules_image_rule_t {
+  uint16_t obj;
+  uint16_t bc;
+  uint16_t heap;
+  uint16_t name;
+} __attribute__((aligned(4))) rules_image_rule_t;
+
+uint32_t rules_hash(uint32_t hash, const unsigned char *buf, uint16_t len) {
+  uint16_t i = 0;
+  if(hash == 0) {
+    hash = 2166136261UL;
+  }
+  for(i=0;i<len;i++) {
+    hash ^= buf[i];
+    hash *= 16777619UL;
+  }
+  return hash;
+}
+
+static uint32_t rules_image_engine(void) {
+  /*
+   * The bytecode calls functions by their position in
+   * rule_functions, so the image is bound to that table,
+   * to the layout of the values it stores and to the
+   * compiler that generated it.
+   */
+  uint8_t sizes[7] = {
+    RULES_IMAGE_VERSION,
+    RULES_COMPILER_VERSION,
+    sizeof(struct vm_top_t),
+    sizeof(struct vm_vchar_t),
+    sizeof(struct vm_vinteger_t),
+    sizeof(struct vm_vfloat_t),
+    sizeof(struct rule_stack_t)
+  };
+  uint32_t hash = rules_hash(0, sizes, sizeof(sizes));
+  uint16_t i = 0;
+
+  for(i=0;i<nr_rule_functions;i++) {
+    hash = rules_hash(hash, (const unsigned char *)rule_functions[i].name, strlen(rule_functions[i].name)+1);
+    hash = rules_hash(hash, &rule_functions[i].state, sizeof(rule_functions[i].state));
+  }
+  return hash;
+}
+
+/*
+ * Every operation of a loaded rule block must be
+ * known and only refer to functions and variables
+ * that exist.
+ */
+static int8_t rules_image_check(struct rules_t *obj) {
+  uint16_t nrbytes = getval(obj->bc.nrbytes), pos = 0;
+
+  if(nrbytes > getval(obj->bc.bufsize) || (nrbytes % sizeof(struct vm_top_t)) != 0 ||
+     getval(obj->heap->nrbytes) > getval(obj->heap->bufsize)) {
+    return -1;
+  }
+  for(pos=0;pos<nrbytes;pos+=sizeof(struct vm_top_t)) {
+    struct vm_top_t *node = (struct vm_top_t *)&obj->bc.buffer[pos];
+    int8_t var = -1;
+
+    switch(gettype(node->type)) {
+      case OP_GETVAL: {
+        var = (int8_t)getval(node->b);
+      } break;
+      case OP_SETVAL: {
+        var = (int8_t)getval(node->a);
+        if((int8_t)getval(node->b) > 0 &&
+           ((int8_t)getval(node->b)-1)*sizeof(struct vm_vchar_t) >= varstack->nrbytes) {
+          return -1;
+        }
+      } break;
+      case OP_CALL: {
+        uint8_t c = getval(node->c), b = getval(node->b);
+        if(c != 1) {
+          if((c & 1) != 0 || (int8_t)b < 0 || b >= nr_rule_functions) {
+            return -1;
+          }
+          if((c >> 1) > 0 && (rule_functions[b].state == 0 ||
+             getval(obj->heap->nrbytes)+((c >> 1)-1)*sizeof(uint32_t)+rule_functions[b].state > getval(obj->heap->bufsize))) {
+            return -1;
+          }
+        }
+      } break;
+      default: {
+        if(gettype(node->type) < OP_EQ || gettype(node->type) > OP_RET) {
+          return -1;
+        }
+      } break;
+    }
+    if(var >= 0 && var*sizeof(struct vm_vchar_t) >= varstack->nrbytes) {
+      return -1;
+    }
+  }
+  return 0;
+}
+
+int8_t rules_image_save(struct rules_t **rules, uint8_t nrrules, struct pbuf *mempool, uint32_t hash, int8_t (*write_cb)(void *ptr, uint16_t len, void *userdata), void *userdata) {
+  unsigned char *base = (unsigned char *)mempool->payload;
+  unsigned char chunk[32] __attribute__((aligned(4)));
+  struct rules_image_t header;
+  uint16_t i = 0, x = 0;
+
+  if(mempool->next != NULL || varstack == NULL || stack == NULL || nrrules == 0) {
+    return -1;
+  }
+
+  memset(&header, 0, sizeof(struct rules_image_t));
+  header.magic = RULES_IMAGE_MAGIC;
+  header.hash = hash;
+  header.engine = rules_image_engine();
+  header.version = RULES_IMAGE_VERSION;
+  header.objsize = sizeof(struct rules_t);
+  header.memsize = mempool->tot_len;
+  header.memused = mempool->len;
+  header.varsize = varstack->nrbytes;
+  header.stack = (unsigned char *)stack - base;
+  header.stacksize = getval(stack->bufsize);
+  header.nrrules = nrrules;
+
+  if(write_cb(&header, sizeof(struct rules_image_t), userdata) == -1) {
+    return -1;
+  }
+
+  for(x=0;x<nrrules;x++) {
+    struct rules_image_rule_t node;
+    struct rules_t *obj = rules[x];
+
+    node.obj = (unsigned char *)obj - base;
+    node.bc = obj->bc.buffer - base;
+    node.heap = (unsigned char *)obj->heap - base;
+    node.name = 0xFFFF;
+    for(i=0;i<varstack->nrbytes;i+=sizeof(struct vm_vchar_t)) {
+      struct vm_vchar_t *var = (struct vm_vchar_t *)&varstack->buffer[i];
+      if(obj->name != NULL && var->value == obj->name) {
+        node.name = i;
+        break;
+      }
+    }
+    if(write_cb(&node, sizeof(struct rules_image_rule_t), userdata) == -1) {
+      return -1;
+    }
+  }
+
+  for(i=0;i<mempool->len;i+=sizeof(chunk)) {
+    x = MIN((uint16_t)sizeof(chunk), (uint16_t)(mempool->len-i));
+    memcpy(chunk, &base[i], x);
+    if(write_cb(chunk, x, userdata) == -1) {
+      return -1;
+    }
+  }
+
+  for(i=0;i<varstack->nrbytes;i+=sizeof(struct vm_vchar_t)) {
+    struct vm_vchar_t *var = (struct vm_vchar_t *)&varstack->buffer[i];
+    uint8_t node[4] = { getval(var->fixed), getval(var->len), getval(var->ref), 0 };
+    if(write_cb(node, sizeof(node), userdata) == -1) {
+      return -1;
+    }
+    if(write_cb(var->value, getval(var->len), userdata) == -1) {
+      return -1;
+    }
+  }
+
+  return 0;
+}
+
+int8_t rules_image_load(struct rules_t ***rules, uint8_t *nrrules, struct pbuf *mempool, uint32_t hash, int8_t (*read_cb)(void *ptr, uint16_t len, void *userdata), void *userdata) {
+  unsigned char *base = (unsigned char *)mempool->payload;
+  unsigned char chunk[32] __attribute__((aligned(4)));
+  struct rules_image_rule_t *nodes = NULL;
+  struct rules_image_t header;
+  uint16_t i = 0, x = 0;
+
+  if(mempool->next != NULL || *nrrules > 0) {
+    return -1;
+  }
+
+  if(read_cb(&header, sizeof(struct rules_image_t), userdata) == -1) {
+    return -1;
+  }
+
+  if(header.magic != RULES_IMAGE_MAGIC ||
+     header.hash != hash ||
+     header.engine != rules_image_engine() ||
+     header.version != RULES_IMAGE_VERSION ||
+     header.objsize != sizeof(struct rules_t) ||
+     header.memsize != mempool->tot_len ||
+     header.nrrules == 0 ||
+     (header.varsize % sizeof(struct vm_vchar_t)) != 0 ||
+     header.stack < header.memused ||
+     header.stack+sizeof(struct rule_stack_t)+header.stacksize > mempool->tot_len) {
+    return -1;
+  }
+
+  if((nodes = (struct rules_image_rule_t *)MALLOC(sizeof(struct rules_image_rule_t)*header.nrrules)) == NULL) {
+    OUT_OF_MEMORY
+  }
+  if(read_cb(nodes, sizeof(struct rules_image_rule_t)*header.nrrules, userdata) == -1) {
+    FREE(nodes);
+    return -1;
+  }
+  for(x=0;x<header.nrrules;x++) {
+    if(nodes[x].obj+sizeof(struct rules_t) > header.memused ||
+       nodes[x].bc > header.memused ||
+       nodes[x].heap+sizeof(struct rule_stack_t) > header.memused ||
+       (nodes[x].name != 0xFFFF && nodes[x].name >= header.varsize)) {
+      FREE(nodes);
+      return -1;
+    }
+  }
+
+  for(i=0;i<header.memused;i+=sizeof(chunk)) {
+    x = MIN((uint16_t)sizeof(chunk), (uint16_t)(header.memused-i));
+    if(read_cb(chunk, x, userdata) == -1) {
+      FREE(nodes);
+      return -1;
+    }
+    memcpy(&base[i], chunk, x);
+  }
+
+  if(varstack == NULL) {
+    if((varstack = (struct rule_stack_t *)MALLOC(sizeof(struct rule_stack_t))) == NULL) {
+      OUT_OF_MEMORY
+    }
+    memset(varstack, 0, sizeof(struct rule_stack_t));
+  }
+  if(header.varsize > 0) {
+    if((varstack->buffer = (unsigned char *)REALLOC(varstack->buffer, header.varsize)) == NULL) {
+      OUT_OF_MEMORY
+    }
+    memset(varstack->buffer, 0, header.varsize);
+  }
+  varstack->bufsize = header.varsize;
+
+  for(i=0;i<header.varsize;i+=sizeof(struct vm_vchar_t)) {
+    struct vm_vchar_t *var = (struct vm_vchar_t *)&varstack->buffer[i];
+    uint8_t node[4];
+
+    if(read_cb(node, sizeof(node), userdata) == -1) {
+      break;
+    }
+    if((var->value = (char *)MALLOC(node[1]+1)) == NULL) {
+      OUT_OF_MEMORY
+    }
+    memset(var->value, 0, node[1]+1);
+    if(node[1] > 0 && read_cb(var->value, node[1], userdata) == -1) {
+      FREE(var->value);
+      break;
+    }
+    setval(var->type, VCHAR);
+    setval(var->fixed, node[0]);
+    setval(var->len, node[1]);
+    setval(var->ref, node[2]);
+    varstack->nrbytes = i+sizeof(struct vm_vchar_t);
+
+    if(node[0] == 1 && rule_options.vm_value_slot != NULL) {
+      setval(var->slot, rule_options.vm_value_slot(var->value));
+    }
+  }
+  if(varstack->nrbytes != header.varsize) {
+    FREE(nodes);
+    rules_gc(rules, nrrules);
+    return -1;
+  }
+
+  if((*rules = (struct rules_t **)REALLOC(*rules, sizeof(struct rules_t **)*header.nrrules)) == NULL) {
+    OUT_OF_MEMORY
+  }
+  for(x=0;x<header.nrrules;x++) {
+    struct rules_t *obj = (struct rules_t *)&base[nodes[x].obj];
+
+    obj->ctx.go = NULL;
+    obj->ctx.ret = NULL;
+    obj->userdata = NULL;
+    obj->bc.buffer = &base[nodes[x].bc];
+    obj->heap = (struct rule_stack_t *)&base[nodes[x].heap];
+    obj->heap->buffer = &base[nodes[x].heap+sizeof(struct rule_stack_t)];
+    obj->name = NULL;
+    if(nodes[x].name != 0xFFFF) {
+      obj->name = ((struct vm_vchar_t *)&varstack->buffer[nodes[x].name])->value;
+    }
+    (*rules)[x] = obj;
+  }
+  *nrrules = header.nrrules;
+  FREE(nodes);
+
+  for(x=0;x<header.nrrules;x++) {
+    if(rules_image_check((*rules)[x]) == -1) {
+      log_error(LOG_RULES, "FATAL #%d: rule #%d of the compiled image is invalid", __LINE__, x+1);
+      rules_gc(rules, nrrules);
+      return -1;
+    }
+    rule_state_clear((*rules)[x]);
+  }
+
+  stack = (struct rule_stack_t *)&base[header.stack];
+  setval(stack->bufsize, header.stacksize);
+  setval(stack->nrbytes, 4);
+  stack->buffer = &base[header.stack+sizeof(struct rule_stack_t)];
+
+  mempool->len = header.memused;
+
+  return 0;
+}
+
 int8_t rule_initialize(struct pbuf *input, struct rules_t ***rules, uint8_t *nrrules, struct pbuf *mempool, void *userdata) {
   struct pbuf *mempool_rule = NULL;
   uint16_t newlen = getval(input->tot_len), max_varstack_size = 4;
   uint16_t heapsize = 4, bcsize = 0, varsize = 0, memsize = 0;
+  uint8_t x = 0;
   if(varstack == NULL) {
     if((varstack = (struct rule_stack_t *)MALLOC(sizeof(struct rule_stack_t))) == NULL) {
       OUT_OF_MEMORY
@@ -5180,6 +6302,15 @@ int8_t rule_initialize(struct pbuf *input, struct rules_t ***rules, uint8_t *nrr
     return 1;
   }
 
+  /*
+   * rule_by_name returns the rule index
+   * as a signed byte.
+   */
+  if(*nrrules >= 127) {
+    log_error(LOG_RULES, "FATAL #%d: ruleset too large, more than 127 rule blocks", __LINE__);
+    return -1;
+  }
+
   {
     char *a = (char *)input->payload;
     while(mempool) {
@@ -5201,7 +6332,7 @@ int8_t rule_initialize(struct pbuf *input, struct rules_t ***rules, uint8_t *nrr
       }
     }
     if(mempool == NULL) {
-      logprintf_P(F("FATAL #%d: ruleset too large, out of memory"), __LINE__);
+      log_error(LOG_RULES, "FATAL #%d: ruleset too large, out of memory", __LINE__);
       return -1;
     }
   }
@@ -5253,7 +6384,7 @@ int8_t rule_initialize(struct pbuf *input, struct rules_t ***rules, uint8_t *nrr
 #if defined(ESP8266) || defined(ESP32)
   timestamp.second = micros();
 
-  logprintf_P(F("rule #%d was prepared in %d microseconds"), mmu_get_uint8(&obj->nr), timestamp.second - timestamp.first);
+  log_info(LOG_RULES, "rule #%d was prepared in %d microseconds", mmu_get_uint8(&obj->nr), timestamp.second - timestamp.first);
 #else
   clock_gettime(CLOCK_MONOTONIC, &timestamp.second);
 
@@ -5300,7 +6431,7 @@ int8_t rule_initialize(struct pbuf *input, struct rules_t ***rules, uint8_t *nrr
         }
       }
       if(mempool == NULL) {
-        logprintf_P(F("FATAL #%d: ruleset too large, out of memory"), __LINE__);
+        log_error(LOG_RULES, "FATAL #%d: ruleset too large, out of memory", __LINE__);
         if((*rules = (struct rules_t **)REALLOC(*rules, sizeof(struct rules_t **)*((*nrrules)))) == NULL) {
           OUT_OF_MEMORY
         }
@@ -5350,7 +6481,7 @@ int8_t rule_initialize(struct pbuf *input, struct rules_t ***rules, uint8_t *nrr
     clock_gettime(CLOCK_MONOTONIC, &timestamp.first);
 #endif
     /*LCOV_EXCL_STOP*/
-    if(rule_create((char **)&input->payload, obj) == -1) {
+    if(rule_create((char **)&input->payload, obj) == -1 || varstack_full() == 1) {
       if((*rules = (struct rules_t **)REALLOC(*rules, sizeof(struct rules_t **)*((*nrrules)))) == NULL) {
         OUT_OF_MEMORY
       }
@@ -5366,8 +6497,8 @@ int8_t rule_initialize(struct pbuf *input, struct rules_t ***rules, uint8_t *nrr
 #if defined(ESP8266) || defined(ESP32)
     timestamp.second = micros();
 
-    logprintf_P(F("rule #%d bytecode was created in %d microseconds"), getval(obj->nr), timestamp.second - timestamp.first);
-    logprintf_P(F("bytecode: %d/%d, heap: %d/%d, stack: %d/%d bytes, varstack: %d/%d bytes"),
+    log_info(LOG_RULES, "rule #%d bytecode was created in %d microseconds", getval(obj->nr), timestamp.second - timestamp.first);
+    log_info(LOG_RULES, "bytecode: %d/%d, heap: %d/%d, stack: %d/%d bytes, varstack: %d/%d bytes",
       getval(obj->bc.nrbytes),
       getval(obj->bc.bufsize),
       getval(obj->heap->nrbytes),
@@ -5424,6 +6555,23 @@ int8_t rule_initialize(struct pbuf *input, struct rules_t ***rules, uint8_t *nrr
   assert(bcsize == getval(obj->bc.nrbytes));
   printf("bcsize: %d, heapsize: %d\n", getval(obj->bc.nrbytes), getval(obj->heap->nrbytes));
 #endif
+/*LCOV_EXCL_STOP*/
+
+  rule_optimize(obj, mempool, bcsize, heapsize);
+
+  if(rule_reserve_state(obj, input, mempool) == -1) {
+    return -1;
+  }
+
+/*LCOV_EXCL_START*/
+#ifdef DEBUG
+  #if !defined(ESP8266) && !defined(ESP32)
+    print_bytecode(obj);
+    printf("\n");
+    print_heap(obj);
+    printf("\n");
+  #endif
+#endif
 /*LCOV_EXCL_STOP*/
 
 /*LCOV_EXCL_START*/
@@ -5434,16 +6582,24 @@ int8_t rule_initialize(struct pbuf *input, struct rules_t ***rules, uint8_t *nrr
 #endif
 /*LCOV_EXCL_STOP*/
 
+  /*
+   * The validation run calls every function, but
+   * the state it leaves behind is not a real one,
+   * also not in the rule blocks it called.
+   */
   if(rule_run(obj, 1) == -1) {
     return -1;
   }
+  for(x=0;x<*nrrules;x++) {
+    rule_state_clear((*rules)[x]);
+  }
 
 /*LCOV_EXCL_START*/
 #if defined(ESP8266) || defined(ESP32)
   timestamp.second = micros();
 
-  logprintf_P(F("rule #%d was executed in %d microseconds"), getval(obj->nr), timestamp.second - timestamp.first);
-  logprintf_P(F("bytecode: %d/%d, heap: %d/%d, stack: %d/%d bytes, varstack: %d/%d bytes"),
+  log_info(LOG_RULES, "rule #%d was executed in %d microseconds", getval(obj->nr), timestamp.second - timestamp.first);
+  log_info(LOG_RULES, "bytecode: %d/%d, heap: %d/%d, stack: %d/%d bytes, varstack: %d/%d bytes",
     getval(obj->bc.nrbytes),
     getval(obj->bc.bufsize),
     getval(obj->heap->nrbytes),
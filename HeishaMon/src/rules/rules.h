@@ -15,8 +15,18 @@
 #include "stack.h"
 
 #if !defined(ESP8266) && !defined(ESP32)
-  #define F
-  #define MEMPOOL_SIZE 16000
+  #ifndef F
+    #define F
+  #endif
+  #ifndef MEMPOOL_SIZE
+    #define MEMPOOL_SIZE 16000
+  #endif
+  /*
+   * Stand-in for lwip/pbuf.h, guarded like it
+   * so the webserver can share it on the host.
+   */
+  #ifndef LWIP_HDR_PBUF_H
+  #define LWIP_HDR_PBUF_H
   typedef struct pbuf {
     struct pbuf *next;
     void *payload;
@@ -26,6 +36,7 @@
     uint8_t flags;
     uint16_t ref;
   } pbuf;
+  #endif
 
   typedef struct serial_t {
     void (*printf)(const char *fmt, ...);
@@ -165,6 +176,13 @@ typedef struct rule_options_t {
   int8_t (*vm_value_set)(struct rules_t *obj);
   int8_t (*vm_value_get)(struct rules_t *obj);
 
+  /*
+   * Optional, resolves a variable name to a
+   * caller defined slot (1-255) while parsing.
+   * Return 0 when the name has no slot.
+   */
+  uint8_t (*vm_value_slot)(const char *name);
+
   /*
    * Events
    */
@@ -192,11 +210,58 @@ void rules_unref(const char *str);
 int rules_tointeger(struct rules_t *obj, int8_t pos);
 float rules_tofloat(struct rules_t *obj, int8_t pos);
 const char *rules_tostring(struct rules_t *obj, int8_t pos);
+uint8_t rules_toslot(struct rules_t *obj, int8_t pos);
 
 void rules_remove(struct rules_t *rule, int8_t pos);
 uint8_t rules_gettop(struct rules_t *rule);
 uint8_t rules_type(struct rules_t *rule, int8_t pos);
 
+/*
+ * Zeroed memory for the function being called that is
+ * kept per call site until the rules are parsed again,
+ * reserved with the rule block from the state size in
+ * rule_functions. NULL when size exceeds that.
+ */
+void *rules_state(struct rules_t *obj, uint8_t size);
+
+/*
+ * Profiling, the counters cover the last rule_run
+ * including the rule blocks it called.
+ */
+uint32_t rules_nrops(void);
+uint16_t rules_stackpeak(void);
+uint16_t rules_heapsize(struct rules_t *rule);
+uint16_t rules_bcsize(struct rules_t *rule);
+
+/*
+ * Walks the variables a rule block reads or writes, starting
+ * with pos at 0. Returns the slot of the next one or -1 after
+ * the last, a variable used more than once is returned again.
+ */
+int16_t rules_nextslot(struct rules_t *rule, uint16_t *pos);
+
+/*
+ * Bytes the optimizer saved on the rule blocks
+ * compiled since the last rules_gc.
+ */
+uint16_t rules_optimized(void);
+/*
+ * Heap reserved by the compiler but never used, given
+ * back after optimizing, since the last rules_gc.
+ */
+uint16_t rules_released(void);
+
+/*
+ * Compiled rule images, the callbacks return -1 on
+ * failure. Loading only succeeds when the hash matches
+ * and the image was written by the same rules engine
+ * and function table. A loaded image is checked for
+ * operations, functions and variables that do not exist.
+ */
+uint32_t rules_hash(uint32_t hash, const unsigned char *buf, uint16_t len);
+int8_t rules_image_save(struct rules_t **rules, uint8_t nrrules, struct pbuf *mempool, uint32_t hash, int8_t (*write_cb)(void *ptr, uint16_t len, void *userdata), void *userdata);
+int8_t rules_image_load(struct rules_t ***rules, uint8_t *nrrules, struct pbuf *mempool, uint32_t hash, int8_t (*read_cb)(void *ptr, uint16_t len, void *userdata), void *userdata);
+
 #if defined(DEBUG) || defined(COVERALLS)
 uint16_t rules_memused(void);
 #endif
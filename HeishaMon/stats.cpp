@@ -0,0 +1,247 @@
+#include "stats.h"
+#include "webfunctions.h"
+#include "loopstats.h"
+#include "rules.h"
+#include "version.h"
+#include "src/common/logqueue.h"
+#include "src/common/progmem.h"
+
+#include <stddef.h>
+
+#define UPTIME_OVERFLOW 4294967295 // Uptime overflow value
+
+#define STATS_UINT 0
+#define STATS_INT 1
+#define STATS_FLOAT 2
+
+/*
+ * The numeric fields are written by one function, as json
+ * member or as prometheus metric, with spaces in the name
+ * replaced by underscores.
+ */
+struct statsField {
+  char name[18];
+  uint8_t type;
+  uint8_t offset;
+};
+
+static const statsField statsFields[] PROGMEM = {
+  { "uptime", STATS_UINT, offsetof(statsStruct, millis) },
+  { "voltage", STATS_FLOAT, offsetof(statsStruct, voltage) },
+  { "free memory", STATS_INT, offsetof(statsStruct, freememory) },
+  { "free heap", STATS_UINT, offsetof(statsStruct, freeheap) },
+  { "wifi", STATS_INT, offsetof(statsStruct, wifi) },
+  { "mqtt reconnects", STATS_INT, offsetof(statsStruct, mqttReconnects) },
+  { "total reads", STATS_UINT, offsetof(statsStruct, totalreads) },
+  { "good reads", STATS_UINT, offsetof(statsStruct, goodreads) },
+  { "bad crc reads", STATS_UINT, offsetof(statsStruct, badcrcread) },
+  { "bad header reads", STATS_UINT, offsetof(statsStruct, badheaderread) },
+  { "too short reads", STATS_UINT, offsetof(statsStruct, tooshortread) },
+  { "too long reads", STATS_UINT, offsetof(statsStruct, toolongread) },
+  { "timeout reads", STATS_UINT, offsetof(statsStruct, timeoutread) },
+  { "rules active", STATS_UINT, offsetof(statsStruct, rules) }
+};
+
+#define STATS_FIELDS (sizeof(statsFields) / sizeof(statsFields[0]))
+//the log dropped counters of the serial, mqtt, websocket and file sink
+#define STATS_LOGSINKS LOGQUEUE_SINKS
+
+#if defined(ESP8266)
+  #define STATS_BOARD "ESP8266"
+#else
+  #define STATS_BOARD "ESP32"
+#endif
+
+statsStruct heishamonStats = {};
+static char statsJson[STATS_JSON_SIZE] = "{}";
+
+uint32_t stats_uptime(void) {
+  static uint32_t last_uptime      = 0;
+  static uint8_t  uptime_overflows = 0;
+
+  if (millis() < last_uptime) {
+    ++uptime_overflows;
+  }
+  last_uptime = millis();
+  return uptime_overflows * (UPTIME_OVERFLOW / 1000) + (last_uptime / 1000);
+}
+
+int stats_uptime_str(char *buf, uint16_t len) {
+  uint32_t t = stats_uptime();
+
+  uint16_t d   = t / 86400L;
+  uint8_t  h   = ((t % 86400L) / 3600L) % 60;
+  uint32_t rem = t % 3600L;
+  uint8_t  m   = rem / 60;
+  uint8_t  sec = rem % 60;
+
+  return snprintf_P(buf, len, PSTR("%d day%s %d hour%s %d minute%s %d second%s"), d, (d == 1) ? "" : "s", h, (h == 1) ? "" : "s", m, (m == 1) ? "" : "s", sec, (sec == 1) ? "" : "s");
+}
+
+static int stats_field(uint8_t nr, bool metric, char *buf, uint16_t len) {
+  struct statsField field;
+  const uint8_t *ptr = NULL;
+  char value[16];
+
+  if (nr >= STATS_FIELDS) {
+    return -1;
+  }
+  memcpy_P(&field, &statsFields[nr], sizeof(field));
+  ptr = (const uint8_t *)&heishamonStats + field.offset;
+
+  switch (field.type) {
+    case STATS_UINT: {
+        snprintf_P(value, sizeof(value), PSTR("%lu"), (unsigned long)*(const uint32_t *)ptr);
+      } break;
+    case STATS_INT: {
+        snprintf_P(value, sizeof(value), PSTR("%d"), *(const int *)ptr);
+      } break;
+    case STATS_FLOAT: {
+        snprintf_P(value, sizeof(value), PSTR("%.2f"), *(const float *)ptr);
+      } break;
+  }
+
+  if (metric) {
+    for (uint8_t i = 0; field.name[i] != '\0'; i++) {
+      if (field.name[i] == ' ') {
+        field.name[i] = '_';
+      }
+    }
+    return snprintf_P(buf, len, PSTR("heishamon_%s %s\n"), field.name, value);
+  }
+  return snprintf_P(buf, len, PSTR("\"%s\":%s"), field.name, value);
+}
+
+static bool stats_fits(int n, uint16_t *pos) {
+  if (n < 0 || *pos + n >= STATS_JSON_SIZE) {
+    return false;
+  }
+  *pos += n;
+  return true;
+}
+
+static void stats_write_json(void) {
+  char loop[192];
+  uint16_t pos = 1;
+  bool fits = true;
+
+  statsJson[0] = '{';
+  for (uint8_t i = 0; i < STATS_FIELDS && fits; i++) {
+    if (i > 0) {
+      statsJson[pos++] = ',';
+    }
+    fits = stats_fits(stats_field(i, false, &statsJson[pos], STATS_JSON_SIZE - pos), &pos);
+  }
+  if (fits) {
+    fits = stats_fits(snprintf_P(&statsJson[pos], STATS_JSON_SIZE - pos, PSTR(",\"version\":\"%s\",\"board\":\"" STATS_BOARD "\""), heishamon_version), &pos);
+  }
+  int len = loopstats_json(loop, sizeof(loop));
+  if (fits && len > 0 && len < (int)sizeof(loop)) {
+    fits = stats_fits(snprintf_P(&statsJson[pos], STATS_JSON_SIZE - pos, PSTR(",\"loop\":%s"), loop), &pos);
+  }
+  if (fits) {
+    fits = stats_fits(snprintf_P(&statsJson[pos], STATS_JSON_SIZE - pos, PSTR(",\"log dropped\":[")), &pos);
+  }
+  for (uint8_t i = 0; i < STATS_LOGSINKS && fits; i++) {
+    fits = stats_fits(snprintf_P(&statsJson[pos], STATS_JSON_SIZE - pos, PSTR("%s%lu"), (i > 0) ? "," : "", (unsigned long)logqueue_dropped(i)), &pos);
+  }
+  if (fits) {
+    fits = stats_fits(snprintf_P(&statsJson[pos], STATS_JSON_SIZE - pos, PSTR("]}")), &pos);
+  }
+  if (!fits) {
+    strcpy_P(statsJson, PSTR("{}"));
+  }
+}
+
+void stats_update(void) {
+  stats_uptime();
+  heishamonStats.millis = millis();
+#if defined(ESP8266)
+  heishamonStats.voltage = ESP.getVcc() / 1024.0;
+  heishamonStats.heapfragmentation = ESP.getHeapFragmentation();
+  heishamonStats.maxfreeblock = ESP.getMaxFreeBlockSize();
+#else
+  heishamonStats.voltage = 3.3;
+  heishamonStats.freepsram = ESP.getFreePsram();
+#endif
+  heishamonStats.freememory = getFreeMemory();
+  heishamonStats.freeheap = ESP.getFreeHeap();
+  heishamonStats.wifi = getWifiQuality();
+  heishamonStats.rssi = WiFi.RSSI();
+  heishamonStats.rules = nrrules;
+  if (heishamonStats.totalreads > 0) {
+    heishamonStats.readpercentage = (((float)heishamonStats.goodreads / (float)heishamonStats.totalreads) * 100);
+  }
+  stats_write_json();
+}
+
+const char *stats_json(void) {
+  return statsJson;
+}
+
+#if defined(ESP32)
+static void stats_ethernet(char *buf, uint16_t len, bool log) {
+  if (ETH.phyAddr() == 0) {
+    strncpy_P(buf, PSTR("not installed"), len);
+  } else if (!ETH.connected()) {
+    strncpy_P(buf, PSTR("not connected"), len);
+  } else if (ETH.hasIP()) {
+    IPAddress ip = ETH.localIP();
+    snprintf_P(buf, len, log ? PSTR("connected (%u.%u.%u.%u)") : PSTR("connected - IP: %u.%u.%u.%u"), ip[0], ip[1], ip[2], ip[3]);
+  } else {
+    strncpy_P(buf, log ? PSTR("connected (no IP)") : PSTR("connected - no IP"), len);
+  }
+  buf[len - 1] = '\0';
+}
+#endif
+
+int stats_log(char *buf, uint16_t len) {
+  char uptime[48];
+
+  stats_uptime_str(uptime, sizeof(uptime));
+#if defined(ESP8266)
+  return snprintf_P(buf, len,
+    PSTR("Heishamon stats: Uptime: %s ## Free memory: %d%% ## Heap fragmentation: %lu%% ## Max free block: %lu bytes ## Free heap: %lu bytes ## Wifi: %d%% (RSSI: %d) ## Mqtt reconnects: %d ## Correct data: %.2f%% Rules active: %lu"),
+    uptime, heishamonStats.freememory, (unsigned long)heishamonStats.heapfragmentation, (unsigned long)heishamonStats.maxfreeblock,
+    (unsigned long)heishamonStats.freeheap, heishamonStats.wifi, heishamonStats.rssi, heishamonStats.mqttReconnects,
+    heishamonStats.readpercentage, (unsigned long)heishamonStats.rules);
+#else
+  char ethernet[40];
+  stats_ethernet(ethernet, sizeof(ethernet), true);
+  return snprintf_P(buf, len,
+    PSTR("Heishamon stats: Uptime: %s ## Free memory: %d%% ## Free PSRAM: %lu bytes ## Free heap: %lu bytes ## Wifi: %d%% (RSSI: %d) ## Ethernet: %s ## Mqtt reconnects: %d ## Correct data: %.2f%% Rules active: %lu"),
+    uptime, heishamonStats.freememory, (unsigned long)heishamonStats.freepsram, (unsigned long)heishamonStats.freeheap,
+    heishamonStats.wifi, heishamonStats.rssi, ethernet, heishamonStats.mqttReconnects,
+    heishamonStats.readpercentage, (unsigned long)heishamonStats.rules);
+#endif
+}
+
+int stats_websocket(char *buf, uint16_t len) {
+  char uptime[48];
+
+  stats_uptime_str(uptime, sizeof(uptime));
+#if defined(ESP32)
+  char ethernet[40];
+  stats_ethernet(ethernet, sizeof(ethernet), false);
+  return snprintf_P(buf, len, PSTR("{\"data\": {\"stats\": {\"wifi\": %d, \"ethernet\": \"%s\", \"memory\": %d, \"correct\": %.0f,\"mqtt\": %d,\"uptime\": \"%s\"}}}"),
+    heishamonStats.wifi, ethernet, heishamonStats.freememory, heishamonStats.readpercentage, heishamonStats.mqttReconnects, uptime);
+#else
+  return snprintf_P(buf, len, PSTR("{\"data\": {\"stats\": {\"wifi\": %d, \"memory\": %d, \"correct\": %.0f,\"mqtt\": %d,\"uptime\": \"%s\"}}}"),
+    heishamonStats.wifi, heishamonStats.freememory, heishamonStats.readpercentage, heishamonStats.mqttReconnects, uptime);
+#endif
+}
+
+int stats_metric(uint8_t nr, char *buf, uint16_t len) {
+  if (nr == 0) {
+    return snprintf_P(buf, len, PSTR("heishamon_info{version=\"%s\",board=\"" STATS_BOARD "\"} 1\n"), heishamon_version);
+  }
+  nr--;
+  if (nr < STATS_FIELDS) {
+    return stats_field(nr, true, buf, len);
+  }
+  nr -= STATS_FIELDS;
+  if (nr < STATS_LOGSINKS) {
+    return snprintf_P(buf, len, PSTR("heishamon_log_dropped{sink=\"%u\"} %lu\n"), nr, (unsigned long)logqueue_dropped(nr));
+  }
+  return -1;
+}
@@ -0,0 +1,57 @@
+#ifndef _STATS_H_
+#define _STATS_H_
+
+#include <Arduino.h>
+
+/*
+ * Heishamon statistics. The counters are kept up to date
+ * by the main loop, stats_update samples the system values
+ * once per waitTime. All output is written into fixed
+ * buffers, a stats cycle doesn't allocate from the heap.
+ */
+typedef struct statsStruct {
+  //heatpump serial reads
+  uint32_t totalreads;
+  uint32_t goodreads;
+  uint32_t badcrcread;
+  uint32_t badheaderread;
+  uint32_t tooshortread;
+  uint32_t toolongread;
+  uint32_t timeoutread;
+  int mqttReconnects;
+  //sampled by stats_update
+  uint32_t millis;
+  float voltage;
+  float readpercentage;
+  int freememory; //percentage of the heap at boot
+  uint32_t freeheap;
+#if defined(ESP8266)
+  uint32_t heapfragmentation;
+  uint32_t maxfreeblock;
+#elif defined(ESP32)
+  uint32_t freepsram;
+#endif
+  int wifi;
+  int rssi;
+  uint32_t rules;
+} statsStruct;
+
+extern statsStruct heishamonStats;
+
+//the json of the last update, for mqtt and http
+#define STATS_JSON_SIZE 768
+
+//system uptime in seconds, corrected for the millis overflow
+uint32_t stats_uptime(void);
+int stats_uptime_str(char *buf, uint16_t len);
+void stats_update(void);
+const char *stats_json(void);
+int stats_log(char *buf, uint16_t len);
+int stats_websocket(char *buf, uint16_t len);
+/*
+ * Writes one metric per call in the prometheus text
+ * format, returns -1 after the last one.
+ */
+int stats_metric(uint8_t nr, char *buf, uint16_t len);
+
+#endif
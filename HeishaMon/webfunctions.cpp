@@ -3,9 +3,15 @@
 #include "version.h"
 #include "htmlcode.h"
 #include "commands.h"
+#include "rules.h"
+#include "loopstats.h"
+#include "stats.h"
+#include "logstore.h"
+#include "HeishaModbusServer.h"
 #include "src/common/progmem.h"
 #include "src/common/webserver.h"
 #include "src/common/timerqueue.h"
+#include "src/common/log.h"
 
 #include "lwip/apps/sntp.h"
 #include "lwip/dns.h"
@@ -13,7 +19,6 @@
 #include <ArduinoJson.h>          //https://github.com/bblanchon/ArduinoJson
 #include <time.h>
 
-#define UPTIME_OVERFLOW 4294967295 // Uptime overflow value
 
 static uint8_t ntpservers = 0;
 
@@ -92,37 +97,6 @@ int getFreeMemory() {
   return (100 * free_memory / total_memory ) ; // as a %
 }
 
-// returns system uptime in seconds
-char *getUptime(void) {
-  static uint32_t last_uptime      = 0;
-  static uint8_t  uptime_overflows = 0;
-
-  if (millis() < last_uptime) {
-    ++uptime_overflows;
-  }
-  last_uptime             = millis();
-  uint32_t t = uptime_overflows * (UPTIME_OVERFLOW / 1000) + (last_uptime / 1000);
-
-  uint8_t  d   = t / 86400L;
-  uint8_t  h   = ((t % 86400L) / 3600L) % 60;
-  uint32_t rem = t % 3600L;
-  uint8_t  m   = rem / 60;
-  uint8_t  sec = rem % 60;
-
-  unsigned int len = snprintf_P(NULL, 0, PSTR("%d day%s %d hour%s %d minute%s %d second%s"), d, (d == 1) ? "" : "s", h, (h == 1) ? "" : "s", m, (m == 1) ? "" : "s", sec, (sec == 1) ? "" : "s");
-
-  char *str = (char *)malloc(len + 2);
-  if (str == NULL) {
-    Serial1.printf("Out of memory %s:#%d\n", __FUNCTION__, __LINE__);
-    ESP.restart();
-    exit(-1);
-  }
-
-  memset(str, 0, len + 2);
-  snprintf_P(str, len + 1, PSTR("%d day%s %d hour%s %d minute%s %d second%s"), d, (d == 1) ? "" : "s", h, (h == 1) ? "" : "s", m, (m == 1) ? "" : "s", sec, (sec == 1) ? "" : "s");
-  return str;
-}
-
 #if defined(ESP8266)
 void ntp_dns_found(const char *name, const ip4_addr *addr, void *arg) {
   sntp_stop();
@@ -215,8 +189,17 @@ void loadSettings(settingsStruct *heishamonSettings) {
           if ( jsonDoc["mqtt_username"] ) strlcpy(heishamonSettings->mqtt_username, jsonDoc["mqtt_username"], sizeof(heishamonSettings->mqtt_username));
           if ( jsonDoc["mqtt_password"] ) strlcpy(heishamonSettings->mqtt_password, jsonDoc["mqtt_password"], sizeof(heishamonSettings->mqtt_password));
           if ( jsonDoc["ntp_servers"] ) strlcpy(heishamonSettings->ntp_servers, jsonDoc["ntp_servers"], sizeof(heishamonSettings->ntp_servers));
+          if ( jsonDoc["modbus_scanlist"].is<const char*>() ) strlcpy(heishamonSettings->modbus_scanlist, jsonDoc["modbus_scanlist"], sizeof(heishamonSettings->modbus_scanlist));
           if ( jsonDoc["timezone"]) heishamonSettings->timezone = jsonDoc["timezone"];
           heishamonSettings->force_rules = ( jsonDoc["force_rules"] == "enabled" ) ? true : false;
+          heishamonSettings->coalesce_rules = ( jsonDoc["coalesce_rules"] == "enabled" ) ? true : false;
+          heishamonSettings->rules_stats_mqtt = ( jsonDoc["rules_stats_mqtt"] == "enabled" ) ? true : false;
+          if ( !jsonDoc["rules_loglevel"].isNull() ) heishamonSettings->rules_loglevel = jsonDoc["rules_loglevel"];
+          if (heishamonSettings->rules_loglevel > 2) heishamonSettings->rules_loglevel = 1;
+          if ( !jsonDoc["loop_budget"].isNull() ) heishamonSettings->loop_budget = jsonDoc["loop_budget"];
+          if ( !jsonDoc["log_level"].isNull() ) heishamonSettings->log_level = jsonDoc["log_level"];
+          if (heishamonSettings->log_level > LOG_COMPILE_LEVEL) heishamonSettings->log_level = LOG_INFO;
+          if ( jsonDoc["log_subsystems"].is<const char*>() ) strlcpy(heishamonSettings->log_subsystems, jsonDoc["log_subsystems"], sizeof(heishamonSettings->log_subsystems));
           heishamonSettings->use_1wire = ( jsonDoc["use_1wire"] == "enabled" ) ? true : false;
           heishamonSettings->use_s0 = ( jsonDoc["use_s0"] == "enabled" ) ? true : false;
           heishamonSettings->hotspot = ( jsonDoc["hotspot"] == "disabled" ) ? false : true; //default to true if not found in settings
@@ -224,6 +207,11 @@ void loadSettings(settingsStruct *heishamonSettings) {
           heishamonSettings->logMqtt = ( jsonDoc["logMqtt"] == "enabled" ) ? true : false;
           heishamonSettings->logHexdump = ( jsonDoc["logHexdump"] == "enabled" ) ? true : false;
           heishamonSettings->logSerial1 = ( jsonDoc["logSerial1"] == "enabled" ) ? true : false;
+          heishamonSettings->logFile = ( jsonDoc["logFile"] == "enabled" ) ? true : false;
+          if ( jsonDoc["logFileSize"]) heishamonSettings->logFileSize = jsonDoc["logFileSize"];
+          heishamonSettings->historyStore = ( jsonDoc["historyStore"] == "enabled" ) ? true : false;
+          heishamonSettings->historySpill = ( jsonDoc["historySpill"] == "enabled" ) ? true : false;
+          if ( jsonDoc["historyRate"]) heishamonSettings->historyRate = jsonDoc["historyRate"];
           heishamonSettings->optionalPCB = ( jsonDoc["optionalPCB"] == "enabled" ) ? true : false;
           heishamonSettings->opentherm = ( jsonDoc["opentherm"] == "enabled" ) ? true : false;
 #ifdef ESP32          
@@ -250,8 +238,9 @@ void loadSettings(settingsStruct *heishamonSettings) {
           if (jsonDoc["s0_2_minpulsewidth"]) heishamonSettings->s0Settings[1].minimalPulseWidth = jsonDoc["s0_2_minpulsewidth"];
           if (jsonDoc["s0_2_maxpulsewidth"]) heishamonSettings->s0Settings[1].maximalPulseWidth = jsonDoc["s0_2_maxpulsewidth"];
           ntpReload(heishamonSettings);
+          log_filter(heishamonSettings->log_level, heishamonSettings->log_subsystems);
         } else {
-          log_message(_F("Failed to load json config, forcing config reset."));
+          log_error(LOG_MAIN, "Failed to load json config, forcing config reset.");
           WiFi.persistent(true);
           WiFi.disconnect();
           WiFi.persistent(false);
@@ -260,13 +249,13 @@ void loadSettings(settingsStruct *heishamonSettings) {
       }
     }
     else {
-      log_message(_F("No config.json exists! Forcing a config reset."));
+      log_warn(LOG_MAIN, "No config.json exists! Forcing a config reset.");
       WiFi.persistent(true);
       WiFi.disconnect();
       WiFi.persistent(false);
     }
   } else {
-    log_message(_F("failed to mount FS"));
+    log_error(LOG_MAIN, "failed to mount FS");
   }
   //end read
 
@@ -355,7 +344,9 @@ int handleFactoryReset(struct webserver_t *client) {
         webserver_send_content_P(client, webFooter, strlen_P(webFooter));
       } break;
     case 2: {
-        timerqueue_insert(1, 0, -1); // Start reboot sequence
+        if (timerqueue_insert(1, 0, -1) == -1) { // Start reboot sequence
+          log_error(LOG_WEB, "Timer queue full, factory reset not scheduled");
+        }
       } break;
   }
 
@@ -377,7 +368,9 @@ int handleReboot(struct webserver_t *client) {
         webserver_send_content_P(client, webFooter, strlen_P(webFooter));
       } break;
     case 2: {
-        timerqueue_insert(5, 0, -2); // Start reboot sequence
+        if (timerqueue_insert(5, 0, -2) == -1) { // Start reboot sequence
+          log_error(LOG_WEB, "Timer queue full, reboot not scheduled");
+        }
       } break;
   }
 
@@ -395,6 +388,8 @@ void settingsToJson(JsonDocument &jsonDoc, settingsStruct *heishamonSettings) {
   jsonDoc["mqtt_port"] = heishamonSettings->mqtt_port;
   jsonDoc["mqtt_username"] = heishamonSettings->mqtt_username;
   jsonDoc["mqtt_password"] = heishamonSettings->mqtt_password;
+  jsonDoc["modbus_scanlist"] = heishamonSettings->modbus_scanlist;
+  jsonDoc["log_subsystems"] = heishamonSettings->log_subsystems;
   if (heishamonSettings->use_1wire) {
     jsonDoc["use_1wire"] = "enabled";
   } else {
@@ -419,6 +414,16 @@ void settingsToJson(JsonDocument &jsonDoc, settingsStruct *heishamonSettings) {
   } else {
     jsonDoc["force_rules"] = "disabled";
   }
+  if (heishamonSettings->coalesce_rules) {
+    jsonDoc["coalesce_rules"] = "enabled";
+  } else {
+    jsonDoc["coalesce_rules"] = "disabled";
+  }
+  if (heishamonSettings->rules_stats_mqtt) {
+    jsonDoc["rules_stats_mqtt"] = "enabled";
+  } else {
+    jsonDoc["rules_stats_mqtt"] = "disabled";
+  }
   if (heishamonSettings->logMqtt) {
     jsonDoc["logMqtt"] = "enabled";
   } else {
@@ -434,6 +439,21 @@ void settingsToJson(JsonDocument &jsonDoc, settingsStruct *heishamonSettings) {
   } else {
     jsonDoc["logSerial1"] = "disabled";
   }
+  if (heishamonSettings->logFile) {
+    jsonDoc["logFile"] = "enabled";
+  } else {
+    jsonDoc["logFile"] = "disabled";
+  }
+  if (heishamonSettings->historyStore) {
+    jsonDoc["historyStore"] = "enabled";
+  } else {
+    jsonDoc["historyStore"] = "disabled";
+  }
+  if (heishamonSettings->historySpill) {
+    jsonDoc["historySpill"] = "enabled";
+  } else {
+    jsonDoc["historySpill"] = "disabled";
+  }
   if (heishamonSettings->optionalPCB) {
     jsonDoc["optionalPCB"] = "enabled";
   } else {
@@ -454,6 +474,11 @@ void settingsToJson(JsonDocument &jsonDoc, settingsStruct *heishamonSettings) {
   jsonDoc["waitTime"] = heishamonSettings->waitTime;
   jsonDoc["waitDallasTime"] = heishamonSettings->waitDallasTime;
   jsonDoc["dallasResolution"] = heishamonSettings->dallasResolution;
+  jsonDoc["rules_loglevel"] = heishamonSettings->rules_loglevel;
+  jsonDoc["loop_budget"] = heishamonSettings->loop_budget;
+  jsonDoc["log_level"] = heishamonSettings->log_level;
+  jsonDoc["logFileSize"] = heishamonSettings->logFileSize;
+  jsonDoc["historyRate"] = heishamonSettings->historyRate;
   jsonDoc["updateAllTime"] = heishamonSettings->updateAllTime;
   jsonDoc["updataAllDallasTime"] = heishamonSettings->updataAllDallasTime;
 }
@@ -477,16 +502,22 @@ int saveSettings(struct webserver_t *client, settingsStruct *heishamonSettings)
 
   bool reconnectWiFi = false;
   bool wrongPassword = false;
+  bool invalidScanList = false;
   JsonDocument jsonDoc;
 
   settingsToJson(jsonDoc, heishamonSettings); //stores current settings in a json document
 
   jsonDoc["force_rules"] = String("disabled");
+  jsonDoc["coalesce_rules"] = String("disabled");
+  jsonDoc["rules_stats_mqtt"] = String("disabled");
   jsonDoc["hotspot"] = String("disabled");
   jsonDoc["listenonly"] = String("disabled");
   jsonDoc["logMqtt"] = String("disabled");
   jsonDoc["logHexdump"] = String("disabled");
   jsonDoc["logSerial1"] = String("disabled");
+  jsonDoc["logFile"] = String("disabled");
+  jsonDoc["historyStore"] = String("disabled");
+  jsonDoc["historySpill"] = String("disabled");
   jsonDoc["optionalPCB"] = String("disabled");
   jsonDoc["opentherm"] = String("disabled");
 
@@ -523,12 +554,34 @@ int saveSettings(struct webserver_t *client, settingsStruct *heishamonSettings)
       jsonDoc["listenonly"] = tmp->value;
     } else if (strcmp(tmp->name.c_str(), "force_rules") == 0) {
       jsonDoc["force_rules"] = tmp->value;
+    } else if (strcmp(tmp->name.c_str(), "coalesce_rules") == 0) {
+      jsonDoc["coalesce_rules"] = tmp->value;
+    } else if (strcmp(tmp->name.c_str(), "rules_stats_mqtt") == 0) {
+      jsonDoc["rules_stats_mqtt"] = tmp->value;
+    } else if (strcmp(tmp->name.c_str(), "rules_loglevel") == 0) {
+      jsonDoc["rules_loglevel"] = tmp->value;
+    } else if (strcmp(tmp->name.c_str(), "loop_budget") == 0) {
+      jsonDoc["loop_budget"] = tmp->value;
+    } else if (strcmp(tmp->name.c_str(), "log_level") == 0) {
+      jsonDoc["log_level"] = tmp->value;
+    } else if (strcmp(tmp->name.c_str(), "log_subsystems") == 0) {
+      jsonDoc["log_subsystems"] = tmp->value;
     } else if (strcmp(tmp->name.c_str(), "logMqtt") == 0) {
       jsonDoc["logMqtt"] = tmp->value;
     } else if (strcmp(tmp->name.c_str(), "logHexdump") == 0) {
       jsonDoc["logHexdump"] = tmp->value;
     } else if (strcmp(tmp->name.c_str(), "logSerial1") == 0) {
       jsonDoc["logSerial1"] = tmp->value;
+    } else if (strcmp(tmp->name.c_str(), "logFile") == 0) {
+      jsonDoc["logFile"] = tmp->value;
+    } else if (strcmp(tmp->name.c_str(), "logFileSize") == 0) {
+      jsonDoc["logFileSize"] = tmp->value;
+    } else if (strcmp(tmp->name.c_str(), "historyStore") == 0) {
+      jsonDoc["historyStore"] = tmp->value;
+    } else if (strcmp(tmp->name.c_str(), "historySpill") == 0) {
+      jsonDoc["historySpill"] = tmp->value;
+    } else if (strcmp(tmp->name.c_str(), "historyRate") == 0) {
+      jsonDoc["historyRate"] = tmp->value;
     } else if (strcmp(tmp->name.c_str(), "optionalPCB") == 0) {
       jsonDoc["optionalPCB"] = tmp->value;
     } else if (strcmp(tmp->name.c_str(), "opentherm") == 0) {
@@ -539,6 +592,8 @@ int saveSettings(struct webserver_t *client, settingsStruct *heishamonSettings)
 #endif      
     } else if (strcmp(tmp->name.c_str(), "ntp_servers") == 0) {
       jsonDoc["ntp_servers"] = tmp->value;
+    } else if (strcmp(tmp->name.c_str(), "modbus_scanlist") == 0) {
+      jsonDoc["modbus_scanlist"] = tmp->value;
     } else if (strcmp(tmp->name.c_str(), "timezone") == 0) {
       jsonDoc["timezone"] = tmp->value;
     } else if (strcmp(tmp->name.c_str(), "waitTime") == 0) {
@@ -612,8 +667,13 @@ int saveSettings(struct webserver_t *client, settingsStruct *heishamonSettings)
     jsonDoc["wifi_password"] = String(wifi_password);
   }
 
-  saveJsonToFile(jsonDoc, "/config.json"); //save to config file
-  loadSettings(heishamonSettings); //load config file to current settings
+  //a scan list the modbus server would refuse is not saved, nor is anything else
+  if (!HeishaModBusServer::checkScanList(jsonDoc["modbus_scanlist"] | "")) {
+    invalidScanList = true;
+  } else {
+    saveJsonToFile(jsonDoc, "/config.json"); //save to config file
+    loadSettings(heishamonSettings); //load config file to current settings
+  }
 
   while (client->userdata) {
     tmp = (struct websettings_t *)client->userdata;
@@ -621,6 +681,11 @@ int saveSettings(struct webserver_t *client, settingsStruct *heishamonSettings)
     delete tmp;
   }
 
+  if (invalidScanList) {
+    client->route = 114;
+    return 0;
+  }
+
   if (wrongPassword) {
     client->route = 111;
     return 0;
@@ -708,6 +773,30 @@ int settingsNewPassword(struct webserver_t *client, settingsStruct *heishamonSet
   return 0;
 }
 
+int settingsInvalidScanList(struct webserver_t *client) {
+  switch (client->content) {
+    case 0: {
+        webserver_send(client, 200, (char *)"text/html", 0);
+        webserver_send_content_P(client, webHeader, strlen_P(webHeader));
+        webserver_send_content_P(client, webCSS, strlen_P(webCSS));
+        webserver_send_content_P(client, webBodyStart, strlen_P(webBodyStart));
+      } break;
+    case 1: {
+        webserver_send_content_P(client, webBodySettings1, strlen_P(webBodySettings1));
+        webserver_send_content_P(client, webBodySettingsScanListWarning, strlen_P(webBodySettingsScanListWarning));
+      } break;
+    case 2: {
+        webserver_send_content_P(client, refreshMeta, strlen_P(refreshMeta));
+        webserver_send_content_P(client, webFooter, strlen_P(webFooter));
+      } break;
+    case 3: {
+        setupConditionals();
+      } break;
+  }
+
+  return 0;
+}
+
 int settingsReconnectWifi(struct webserver_t *client, settingsStruct *heishamonSettings) {
   if (client->content == 0) {
     webserver_send(client, 200, (char *)"text/html", 0);
@@ -720,7 +809,10 @@ int settingsReconnectWifi(struct webserver_t *client, settingsStruct *heishamonS
     webserver_send_content_P(client, webBodySettingsNewWifiWarning, strlen_P(webBodySettingsNewWifiWarning));
     webserver_send_content_P(client, refreshMeta, strlen_P(refreshMeta));
     webserver_send_content_P(client, webFooter, strlen_P(webFooter));
-    timerqueue_insert(5, 0, -3); //handle wifi reconnect after 5 sec to make sure all above data is sent to client so no memory leak is introduced
+    //handle wifi reconnect after 5 sec to make sure all above data is sent to client so no memory leak is introduced
+    if (timerqueue_insert(5, 0, -3) == -1) {
+      log_error(LOG_WEB, "Timer queue full, wifi reconnect not scheduled");
+    }
   }
 
   return 0;
@@ -758,6 +850,8 @@ int getSettings(struct webserver_t *client, settingsStruct *heishamonSettings) {
         webserver_send_content(client, heishamonSettings->mqtt_password, strlen(heishamonSettings->mqtt_password));
         webserver_send_content_P(client, PSTR("\",\"ntp_servers\":\""), 17);
         webserver_send_content(client, heishamonSettings->ntp_servers, strlen(heishamonSettings->ntp_servers));
+        webserver_send_content_P(client, PSTR("\",\"modbus_scanlist\":\""), 21);
+        webserver_send_content(client, heishamonSettings->modbus_scanlist, strlen(heishamonSettings->modbus_scanlist));
         webserver_send_content_P(client, PSTR("\",\"timezone\":"), 13);
 
         {
@@ -797,6 +891,29 @@ int getSettings(struct webserver_t *client, settingsStruct *heishamonSettings) {
 
         itoa(heishamonSettings->force_rules, str, 10);
         webserver_send_content(client, str, strlen(str));
+        webserver_send_content_P(client, PSTR(",\"coalesce_rules\":"), 18);
+
+        itoa(heishamonSettings->coalesce_rules, str, 10);
+        webserver_send_content(client, str, strlen(str));
+        webserver_send_content_P(client, PSTR(",\"rules_stats_mqtt\":"), 20);
+
+        itoa(heishamonSettings->rules_stats_mqtt, str, 10);
+        webserver_send_content(client, str, strlen(str));
+        webserver_send_content_P(client, PSTR(",\"rules_loglevel\":"), 18);
+
+        itoa(heishamonSettings->rules_loglevel, str, 10);
+        webserver_send_content(client, str, strlen(str));
+        webserver_send_content_P(client, PSTR(",\"loop_budget\":"), 15);
+
+        itoa(heishamonSettings->loop_budget, str, 10);
+        webserver_send_content(client, str, strlen(str));
+        webserver_send_content_P(client, PSTR(",\"log_level\":"), 13);
+
+        itoa(heishamonSettings->log_level, str, 10);
+        webserver_send_content(client, str, strlen(str));
+        webserver_send_content_P(client, PSTR(",\"log_subsystems\":\""), 19);
+        webserver_send_content(client, heishamonSettings->log_subsystems, strlen(heishamonSettings->log_subsystems));
+        webserver_send_content_P(client, PSTR("\""), 1);
 
       } break;
     case 7: {
@@ -817,6 +934,26 @@ int getSettings(struct webserver_t *client, settingsStruct *heishamonSettings) {
         itoa(heishamonSettings->logSerial1, str, 10);
         webserver_send_content(client, str, strlen(str));
 
+        webserver_send_content_P(client, PSTR(",\"logFile\":"), 11);
+        itoa(heishamonSettings->logFile, str, 10);
+        webserver_send_content(client, str, strlen(str));
+
+        webserver_send_content_P(client, PSTR(",\"logFileSize\":"), 15);
+        itoa(heishamonSettings->logFileSize, str, 10);
+        webserver_send_content(client, str, strlen(str));
+
+        webserver_send_content_P(client, PSTR(",\"historyStore\":"), 16);
+        itoa(heishamonSettings->historyStore, str, 10);
+        webserver_send_content(client, str, strlen(str));
+
+        webserver_send_content_P(client, PSTR(",\"historySpill\":"), 16);
+        itoa(heishamonSettings->historySpill, str, 10);
+        webserver_send_content(client, str, strlen(str));
+
+        webserver_send_content_P(client, PSTR(",\"historyRate\":"), 15);
+        itoa(heishamonSettings->historyRate, str, 10);
+        webserver_send_content(client, str, strlen(str));
+
         webserver_send_content_P(client, PSTR(",\"optionalPCB\":"), 15);
         itoa(heishamonSettings->optionalPCB, str, 10);
         webserver_send_content(client, str, strlen(str));
@@ -1082,9 +1219,8 @@ int handleRoot(struct webserver_t *client, float readpercentage, int mqttReconne
         itoa(mqttReconnects, str, 10);
         webserver_send_content(client, (char *)str, strlen(str));
         webserver_send_content_P(client, webBodyRootStatusUptime, strlen_P(webBodyRootStatusUptime));
-        char *up = getUptime();
-        webserver_send_content(client, up, strlen(up));
-        free(up);
+        int len = stats_uptime_str(str, sizeof(str));
+        webserver_send_content(client, str, len);
         if (heishamonSettings->listenonly) {
           webserver_send_content_P(client, webBodyRootStatusListenOnly, strlen_P(webBodyRootStatusListenOnly));
         }
@@ -1372,6 +1508,109 @@ int showRules(struct webserver_t *client) {
   return 0;
 }
 
+int handleRulesStats(struct webserver_t *client) {
+  char str[256];
+  int len = 0;
+
+  if (client->content == 0) {
+    webserver_send(client, 200, (char *)"application/json", 0);
+    len = snprintf_P(str, sizeof(str), PSTR("{\"mempool\":{\"used\":%u,\"size\":%u},\"rules\":["), rules_mempool_used(), rules_mempool_size());
+    webserver_send_content(client, str, len);
+  } else if ((client->content - 1) < nrrules) {
+    //one rule block per webloop
+    if (client->content > 1) {
+      webserver_send_content_P(client, PSTR(","), 1);
+    }
+    len = rules_stats_json(client->content - 1, str, sizeof(str));
+    if (len > 0 && len < (int)sizeof(str)) {
+      webserver_send_content(client, str, len);
+    } else {
+      webserver_send_content_P(client, PSTR("{}"), 2);
+    }
+  } else if ((client->content - 1) == nrrules) {
+    webserver_send_content_P(client, PSTR("]}"), 2);
+  }
+  return 0;
+}
+
+int handleLoopStats(struct webserver_t *client) {
+  char str[192];
+  int len = 0;
+
+  if (client->content == 0) {
+    webserver_send(client, 200, (char *)"application/json", 0);
+    webserver_send_content_P(client, PSTR("{\"loop\":"), 8);
+    len = loopstats_json(str, sizeof(str));
+    if (len > 0 && len < (int)sizeof(str)) {
+      webserver_send_content(client, str, len);
+    } else {
+      webserver_send_content_P(client, PSTR("{}"), 2);
+    }
+    webserver_send_content_P(client, PSTR(",\"stages\":["), 11);
+  } else if ((client->content - 1) < LOOP_STAGES) {
+    //one stage per webloop
+    if (client->content > 1) {
+      webserver_send_content_P(client, PSTR(","), 1);
+    }
+    len = loopstats_stage_json(client->content - 1, str, sizeof(str));
+    if (len > 0 && len < (int)sizeof(str)) {
+      webserver_send_content(client, str, len);
+    } else {
+      webserver_send_content_P(client, PSTR("{}"), 2);
+    }
+  } else if ((client->content - 1) == LOOP_STAGES) {
+    webserver_send_content_P(client, PSTR("]}"), 2);
+  }
+  return 0;
+}
+
+int handleStats(struct webserver_t *client) {
+  if (client->content == 0) {
+    const char *json = stats_json();
+    webserver_send(client, 200, (char *)"application/json", 0);
+    webserver_send_content(client, (char *)json, strlen(json));
+  }
+  return 0;
+}
+
+int handleMetrics(struct webserver_t *client) {
+  char str[128];
+
+  //one metric per webloop
+  int len = stats_metric(client->content, str, sizeof(str));
+  if (client->content == 0) {
+    webserver_send(client, 200, (char *)"text/plain; version=0.0.4", 0);
+  }
+  if (len > 0 && len < (int)sizeof(str)) {
+    webserver_send_content(client, str, len);
+  }
+  return 0;
+}
+
+int handleLogStore(struct webserver_t *client) {
+  struct logstore_reader_t *reader = (struct logstore_reader_t *)client->userdata;
+
+  if (reader == NULL) {
+    return 0;
+  }
+  if (client->content == 0) {
+    webserver_send(client, 200, (char *)"text/plain", 0);
+    logstore_reader(reader);
+  }
+
+  //a few records per webloop, decoded straight from flash
+  char buf[LOGSTORE_BUFFER];
+  uint16_t len = logstore_read(reader, buf, sizeof(buf));
+  if (len > 0) {
+    webserver_send_content(client, buf, len);
+  } else {
+    //nothing sent ends the response, the webserver forgets userdata then
+    free(reader);
+    client->userdata = NULL;
+  }
+  return 0;
+}
+
 int showFirmware(struct webserver_t *client) {
   if (client->content == 0) {
     webserver_send(client, 200, (char *)"text/html", 0);
@@ -28,8 +28,13 @@ struct settingsStruct {
   uint16_t waitTime = 5; // how often data is read from heatpump
   uint16_t waitDallasTime = 5; // how often temps are read from 1wire
   uint16_t dallasResolution = 12; // dallas temp resolution (9 to 12)
+  uint8_t rules_loglevel = 1; // 0 = no rule logging, 1 = log rule execution time, 2 = also dump the rule variables after each run
   uint16_t updateAllTime = 300; // how often all data is resend to mqtt
   uint16_t updataAllDallasTime = 300; //how often all 1wire data is resent to mqtt
+  uint16_t loop_budget = 250; // warn when a main loop stage takes longer than its budget, this many ms for stages without their own, 0 = off
+  uint8_t log_level = 2; // 0 = error, 1 = warn, 2 = info, 3 = debug, 4 = trace
+  uint16_t logFileSize = 64; // kB of flash for the log file, in segments of 16 kB
+  uint16_t historyRate = 60; // batches of stored values replayed per minute after an mqtt outage
   uint16_t timezone = 0;
 
   const char* update_path = "/firmware";
@@ -44,8 +49,12 @@ struct settingsStruct {
   char mqtt_password[65];
   char mqtt_topic_base[128] = "panasonic_heat_pump";
   char ntp_servers[254] = "pool.ntp.org";
+  char modbus_scanlist[254] = ""; //comma separated topics for the modbus scan list block, e.g. "TOP1,TOP5:f32,TOP11:u32"
+  char log_subsystems[80] = ""; //comma separated subsystems that log info and below, e.g. "serial,decode", empty is all
 
   bool force_rules = false; //force rules on boot, even after a crash
+  bool coalesce_rules = false; //run each rule block at most once per received frame, after the frame is decoded
+  bool rules_stats_mqtt = false; //publish the per rule block execution stats on mqtt together with the heishamon stats
   bool listenonly = false; //listen only so heishamon can be installed parallel to cz-taw1, set commands will not work though
   bool optionalPCB = false; //do we emulate an optional PCB?
   bool use_1wire = false; //1wire enabled?
@@ -53,6 +62,9 @@ struct settingsStruct {
   bool logMqtt = false; //log to mqtt from start
   bool logHexdump = false; //log hexdump from start
   bool logSerial1 = true; //log to serial1 (gpio2) from start
+  bool logFile = false; //keep a log file on flash, readable at /log
+  bool historyStore = false; //keep changed values while mqtt is offline and replay them later
+  bool historySpill = false; //move stored values to flash when the RAM for them is full
   bool opentherm = false; //opentherm enable flag
   bool hotspot = true; //enable wifi hotspot when wifi is not connected
 #ifdef ESP32
@@ -70,7 +82,6 @@ struct websettings_t {
 
 void setupConditionals();
 int getFreeMemory(void);
-char *getUptime(void);
 void setupWifi(settingsStruct *heishamonSettings);
 int getWifiQuality(void);
 int getFreeMemory(void);
@@ -92,9 +103,15 @@ int handleSettings(struct webserver_t *client);
 int saveSettings(struct webserver_t *client, settingsStruct *heishamonSettings);
 int settingsReconnectWifi(struct webserver_t *client, settingsStruct *heishamonSettings);
 int settingsNewPassword(struct webserver_t *client, settingsStruct *heishamonSettings);
+int settingsInvalidScanList(struct webserver_t *client);
 int cacheSettings(struct webserver_t *client, struct arguments_t * args);
 int handleWifiScan(struct webserver_t *client);
 int showRules(struct webserver_t *client);
+int handleRulesStats(struct webserver_t *client);
+int handleLoopStats(struct webserver_t *client);
+int handleLogStore(struct webserver_t *client);
+int handleStats(struct webserver_t *client);
+int handleMetrics(struct webserver_t *client);
 int showFirmware(struct webserver_t *client);
 int showFirmwareSuccess(struct webserver_t *client);
 int showFirmwareFail(struct webserver_t *client);
@@ -0,0 +1,171 @@
+/*
+  Minimal host-side stand-in for the Arduino core, just enough to compile
+  the HeishaMon decode, modbus and rules code with g++ for benchmarking.
+*/
+
+#ifndef _MOCK_ARDUINO_H_
+#define _MOCK_ARDUINO_H_
+
+#include <stdint.h>
+#include <stdlib.h>
+#include <stdio.h>
+#include <string.h>
+#include <strings.h>
+#include <ctype.h>
+#include <math.h>
+
+typedef uint8_t byte;
+typedef bool boolean;
+typedef char __FlashStringHelper;
+
+#define PROGMEM
+#define IRAM_ATTR
+#define PSTR(a) (a)
+#define F(a) (a)
+
+#define pgm_read_byte(addr) (*(const uint8_t *)(addr))
+#define pgm_read_word(addr) (*(const uint16_t *)(addr))
+#define pgm_read_ptr(addr) (*(void * const *)(addr))
+#define memcpy_P memcpy
+#define strcmp_P strcmp
+#define strncmp_P strncmp
+#define strcasecmp_P strcasecmp
+#define strncasecmp_P strncasecmp
+#define strlen_P strlen
+#define strcpy_P strcpy
+#define sprintf_P sprintf
+#define snprintf_P snprintf
+
+#define INPUT 0x00
+#define OUTPUT 0x01
+#define INPUT_PULLUP 0x02
+#define LOW 0
+#define HIGH 1
+
+unsigned long millis(void);
+unsigned long micros(void);
+
+class IPAddress {
+  public:
+    IPAddress(uint8_t a = 0, uint8_t b = 0, uint8_t c = 0, uint8_t d = 0) : octets{ a, b, c, d } {}
+
+  private:
+    uint8_t octets[4];
+};
+
+static inline uint16_t word(uint8_t h, uint8_t l) {
+  return (h << 8) | l;
+}
+
+static inline void pinMode(uint8_t, uint8_t) {}
+static inline void digitalWrite(uint8_t, uint8_t) {}
+static inline int digitalRead(uint8_t) { return 0; }
+static inline void noInterrupts(void) {}
+static inline void interrupts(void) {}
+
+/*
+ * Called with the bytes a String grows its buffer by, so a
+ * benchmark can count String allocations without wrapping
+ * the libc allocator.
+ */
+inline void (*mockStringAlloc)(size_t bytes) = NULL;
+
+class String {
+  public:
+    String(const char *cstr = "") { assign(cstr, strlen(cstr)); }
+    String(const String &other) { assign(other.buffer, other.len); }
+    String(char c) { char tmp[2] = { c, 0 }; assign(tmp, 1); }
+    String(int value, unsigned char base = 10) { fromLong(value, base); }
+    String(unsigned int value, unsigned char base = 10) { fromUnsigned(value, base); }
+    String(long value, unsigned char base = 10) { fromLong(value, base); }
+    String(unsigned long value, unsigned char base = 10) { fromUnsigned(value, base); }
+    String(float value, unsigned char decimals = 2) { fromDouble(value, decimals); }
+    String(double value, unsigned char decimals = 2) { fromDouble(value, decimals); }
+    ~String() { free(buffer); }
+
+    String &operator=(const String &rhs) {
+      if (this != &rhs) {
+        assign(rhs.buffer, rhs.len);
+      }
+      return *this;
+    }
+    String &operator=(const char *cstr) { assign(cstr, strlen(cstr)); return *this; }
+
+    String &operator+=(const String &rhs) { append(rhs.buffer, rhs.len); return *this; }
+    String &operator+=(const char *cstr) { append(cstr, strlen(cstr)); return *this; }
+    String &operator+=(char c) { append(&c, 1); return *this; }
+
+    friend String operator+(const String &lhs, const String &rhs) { String s(lhs); s += rhs; return s; }
+    friend String operator+(const String &lhs, const char *rhs) { String s(lhs); s += rhs; return s; }
+
+    bool operator==(const String &rhs) const { return (len == rhs.len) && (memcmp(buffer, rhs.buffer, len) == 0); }
+    bool operator!=(const String &rhs) const { return !(*this == rhs); }
+    bool operator==(const char *rhs) const { return strcmp(buffer, rhs) == 0; }
+    bool operator!=(const char *rhs) const { return !(*this == rhs); }
+
+    unsigned int length(void) const { return len; }
+    const char *c_str(void) const { return buffer; }
+    char charAt(unsigned int index) const { return (index < len) ? buffer[index] : 0; }
+    int indexOf(char c) const { const char *p = strchr(buffer, c); return (p == NULL) ? -1 : (int)(p - buffer); }
+    String substring(unsigned int from) const { return (from >= len) ? String() : String(buffer + from); }
+    long toInt(void) const { return atol(buffer); }
+    float toFloat(void) const { return (float)atof(buffer); }
+
+  private:
+    char *buffer = NULL;
+    unsigned int len = 0;
+    unsigned int capacity = 0;
+
+    bool reserve(unsigned int size) {
+      if (size <= capacity) {
+        return true;
+      }
+      char *tmp = (char *)realloc(buffer, size);
+      if (tmp == NULL) {
+        return false;
+      }
+      if (mockStringAlloc != NULL) {
+        mockStringAlloc(size - capacity);
+      }
+      buffer = tmp;
+      capacity = size;
+      return true;
+    }
+    void assign(const char *cstr, unsigned int length) {
+      if (!reserve(length + 1)) {
+        return;
+      }
+      memcpy(buffer, cstr, length);
+      buffer[length] = 0;
+      len = length;
+    }
+    void append(const char *cstr, unsigned int length) {
+      if (!reserve(len + length + 1)) {
+        return;
+      }
+      memcpy(buffer + len, cstr, length);
+      len += length;
+      buffer[len] = 0;
+    }
+    void fromLong(long value, unsigned char base) {
+      char tmp[34];
+      if (base == 10) {
+        snprintf(tmp, sizeof(tmp), "%ld", value);
+      } else {
+        snprintf(tmp, sizeof(tmp), "%lx", value);
+      }
+      assign(tmp, strlen(tmp));
+    }
+    void fromUnsigned(unsigned long value, unsigned char base) {
+      char tmp[34];
+      snprintf(tmp, sizeof(tmp), (base == 10) ? "%lu" : "%lx", value);
+      assign(tmp, strlen(tmp));
+    }
+    void fromDouble(double value, unsigned char decimals) {
+      char tmp[34];
+      snprintf(tmp, sizeof(tmp), "%.*f", decimals, value);
+      assign(tmp, strlen(tmp));
+    }
+};
+
+#endif
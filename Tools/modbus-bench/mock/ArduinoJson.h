@@ -0,0 +1,8 @@
+#ifndef _MOCK_ARDUINOJSON_H_
+#define _MOCK_ARDUINOJSON_H_
+
+// only named in declarations of the code built for the host
+class JsonDocument {
+};
+
+#endif
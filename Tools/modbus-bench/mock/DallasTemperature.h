@@ -0,0 +1,5 @@
+#ifndef _MOCK_DALLASTEMPERATURE_H_
+#define _MOCK_DALLASTEMPERATURE_H_
+#include <Arduino.h>
+typedef uint8_t DeviceAddress[8];
+#endif
@@ -0,0 +1,37 @@
+#ifndef _MOCK_LITTLEFS_H_
+#define _MOCK_LITTLEFS_H_
+
+#include <Arduino.h>
+
+/*
+ * There is no filesystem on the host, it never
+ * mounts and no file exists or can be opened.
+ */
+enum SeekMode {
+  SeekSet = 0,
+  SeekCur = 1,
+  SeekEnd = 2
+};
+
+class File {
+  public:
+    operator bool() const { return false; }
+    size_t size(void) const { return 0; }
+    size_t readBytes(char *, size_t) { return 0; }
+    size_t write(const uint8_t *, size_t) { return 0; }
+    bool seek(uint32_t, SeekMode = SeekSet) { return false; }
+    void close(void) {}
+};
+
+class FS {
+  public:
+    bool begin(void) { return false; }
+    bool exists(const char *) { return false; }
+    File open(const char *, const char *) { return File(); }
+    bool remove(const char *) { return false; }
+    bool rename(const char *, const char *) { return false; }
+};
+
+inline FS LittleFS;
+
+#endif
@@ -0,0 +1,120 @@
+/*
+  Host-side stand-in for eModbus' ModbusMessage and ModbusServerTCPasync.
+  ModbusMessage keeps its PDU in a std::vector like the real class, so
+  heap churn measured through it is representative.
+*/
+
+#ifndef _MOCK_MODBUSSERVERTCPASYNC_H_
+#define _MOCK_MODBUSSERVERTCPASYNC_H_
+
+#include <Arduino.h>
+#include <vector>
+#include <map>
+
+enum FunctionCode : uint8_t {
+  ANY_FUNCTION_CODE = 0x00,
+  READ_COIL = 0x01,
+  READ_DISCR_INPUT = 0x02,
+  READ_HOLD_REGISTER = 0x03,
+  READ_INPUT_REGISTER = 0x04,
+  WRITE_COIL = 0x05,
+  WRITE_HOLD_REGISTER = 0x06
+};
+
+enum Error : uint8_t {
+  SUCCESS = 0x00,
+  ILLEGAL_FUNCTION = 0x01,
+  ILLEGAL_DATA_ADDRESS = 0x02,
+  ILLEGAL_DATA_VALUE = 0x03,
+  SERVER_DEVICE_FAILURE = 0x04
+};
+
+class ModbusMessage {
+  public:
+    ModbusMessage() {}
+    ModbusMessage(uint8_t serverID, uint8_t functionCode, uint16_t p1, uint16_t p2) {
+      add(serverID, functionCode, p1, p2);
+    }
+
+    uint8_t getServerID() const { return (MM_data.size() > 0) ? MM_data[0] : 0; }
+    uint8_t getFunctionCode() const { return (MM_data.size() > 1) ? (MM_data[1] & 0x7F) : 0; }
+    Error getError() const {
+      if ((MM_data.size() > 2) && (MM_data[1] & 0x80)) {
+        return static_cast<Error>(MM_data[2]);
+      }
+      return SUCCESS;
+    }
+    size_t size() const { return MM_data.size(); }
+    const uint8_t *data() const { return MM_data.data(); }
+    void clear() { MM_data.clear(); }
+
+    Error setError(uint8_t serverID, uint8_t functionCode, Error errorCode) {
+      MM_data.clear();
+      add(serverID, static_cast<uint8_t>(functionCode | 0x80), static_cast<uint8_t>(errorCode));
+      return SUCCESS;
+    }
+
+    bool operator==(const ModbusMessage &m) const { return MM_data == m.MM_data; }
+
+    template <class T> uint16_t add(T v) {
+      for (int shift = (sizeof(T) - 1) * 8; shift >= 0; shift -= 8) {
+        MM_data.push_back(static_cast<uint8_t>((v >> shift) & 0xFF));
+      }
+      return MM_data.size();
+    }
+    template <class T, class... Args> uint16_t add(T v, Args... args) {
+      add(v);
+      return add(args...);
+    }
+
+    template <class T> uint16_t get(uint16_t index, T &retval) const {
+      retval = 0;
+      for (size_t i = 0; i < sizeof(T); ++i) {
+        retval = (retval << 8) | MM_data[index + i];
+      }
+      return index + sizeof(T);
+    }
+    template <class T, class... Args> uint16_t get(uint16_t index, T &v, Args &... args) const {
+      return get(get(index, v), args...);
+    }
+
+  private:
+    std::vector<uint8_t> MM_data;
+};
+
+// eModbus echoes the request when a worker returns this
+static const ModbusMessage ECHO_RESPONSE(0xFE, 0xFE, 0, 0);
+
+typedef ModbusMessage (*MBSworker)(ModbusMessage request);
+
+class ModbusServerTCPasync {
+  public:
+    ModbusServerTCPasync() { instance = this; }
+
+    void registerWorker(uint8_t serverID, uint8_t functionCode, MBSworker worker) {
+      workers[(serverID << 8) | functionCode] = worker;
+    }
+    bool start(uint16_t, uint8_t, uint32_t) { return true; }
+
+    // Dispatches like the real server would for a request received over TCP
+    ModbusMessage localRequest(const ModbusMessage &request) {
+      auto it = workers.find((request.getServerID() << 8) | request.getFunctionCode());
+      ModbusMessage response;
+      if (it == workers.end()) {
+        response.setError(request.getServerID(), request.getFunctionCode(), ILLEGAL_FUNCTION);
+        return response;
+      }
+      response = it->second(request);
+      if (response == ECHO_RESPONSE) {
+        return request;
+      }
+      return response;
+    }
+
+    static ModbusServerTCPasync *instance;
+
+  private:
+    std::map<uint16_t, MBSworker> workers;
+};
+
+#endif
@@ -0,0 +1,4 @@
+#ifndef _MOCK_ONEWIRE_H_
+#define _MOCK_ONEWIRE_H_
+#include <Arduino.h>
+#endif
@@ -0,0 +1,12 @@
+#ifndef _MOCK_PUBSUBCLIENT_H_
+#define _MOCK_PUBSUBCLIENT_H_
+
+#include <Arduino.h>
+
+class PubSubClient {
+  public:
+    bool publish(const char *, const char *, bool = false) { return true; }
+    bool publish(const char *, const uint8_t *, unsigned int, bool = false) { return true; }
+};
+
+#endif
@@ -0,0 +1,227 @@
+/*
+  Host-side throughput benchmark for HeishaModBusServer.
+
+  The real FC handlers, decode functions and topic tables are compiled for
+  the host against the small Arduino/eModbus stand-ins in mock/. An
+  in-process load generator sends requests through the registered workers
+  and reports requests/s, p50/p99 latency and heap churn per function code
+  and block size.
+
+  Build and run from this directory:
+
+    g++ -std=gnu++17 -O2 -I mock -o modbus-bench modbus-bench.cpp stubs.cpp \
+      ../../HeishaMon/HeishaModBusServer.cpp ../../HeishaMon/decode.cpp
+    ./modbus-bench [--csv] [--iterations N]
+
+  Absolute numbers are host numbers. Use them to compare changes to the
+  modbus path with each other, not to predict ESP8266/ESP32 throughput.
+*/
+
+#include <Arduino.h>
+#include <ModbusServerTCPasync.h>
+#include <algorithm>
+#include <new>
+#include <time.h>
+#include <vector>
+
+#include "../../HeishaMon/HeishaModbusServer.h"
+#include "../../HeishaMon/commands.h"
+#include "../../HeishaMon/dallas.h"
+
+ModbusServerTCPasync *ModbusServerTCPasync::instance = NULL;
+
+extern char actData[DATASIZE];
+extern char actDataExtra[DATASIZE];
+extern char actOptData[OPTDATASIZE];
+extern uint32_t actDataSequence;
+extern unsigned long actDataMillis;
+extern dallasDataStruct *actDallasData;
+extern int dallasDevicecount;
+
+// decoded values trigger no rules here
+void rules_event_cb(const char *prefix, const char *name) {
+}
+
+void rules_topic_event_cb(uint8_t table, uint16_t nr) {
+}
+
+void rules_frame_begin(uint8_t table) {
+}
+
+void rules_frame_end(uint8_t table) {
+}
+
+static unsigned long heapAllocations = 0;
+static unsigned long heapBytes = 0;
+
+void *operator new(size_t size) {
+  heapAllocations++;
+  heapBytes += size;
+  void *ptr = malloc(size);
+  if (ptr == NULL) {
+    throw std::bad_alloc();
+  }
+  return ptr;
+}
+
+void operator delete(void *ptr) noexcept {
+  free(ptr);
+}
+
+void operator delete(void *ptr, size_t) noexcept {
+  free(ptr);
+}
+
+//the mocked String reports how much its buffer grew
+static void countStringAlloc(size_t bytes) {
+  heapAllocations++;
+  heapBytes += bytes;
+}
+
+struct scenario_t {
+  const char *name;
+  uint8_t unit;
+  uint8_t fc;
+  uint16_t address;
+  uint16_t count;
+};
+
+static const scenario_t scenarios[] = {
+  { "topics", 1, READ_HOLD_REGISTER, 0, 1 },
+  { "topics", 1, READ_HOLD_REGISTER, 0, 10 },
+  { "topics", 1, READ_HOLD_REGISTER, 0, 50 },
+  { "topics", 1, READ_HOLD_REGISTER, 0, 125 },
+  { "float topics", 1, READ_HOLD_REGISTER, 10000, 2 },
+  { "float topics", 1, READ_HOLD_REGISTER, 10000, 124 },
+  { "extra topics", 1, READ_HOLD_REGISTER, 500, 6 },
+  { "scan list", 1, READ_HOLD_REGISTER, 20000, 1 },
+  { "scan list", 1, READ_HOLD_REGISTER, 20000, 26 },
+  { "raw frame", 1, READ_HOLD_REGISTER, 30000, 106 },
+  { "bit topics", 1, READ_DISCR_INPUT, 0, 139 },
+  { "bit fields", 1, READ_DISCR_INPUT, 1000, 278 },
+  { "relay coils", 1, READ_COIL, 0, 3 },
+  { "dallas", 2, READ_HOLD_REGISTER, 0, 16 },
+  { "s0", 3, READ_HOLD_REGISTER, 10, 4 },
+  { "opentherm", 4, READ_HOLD_REGISTER, 0, 4 },
+  { "write command", 1, WRITE_HOLD_REGISTER, 1003, 1 },
+};
+
+static const char scanList[] = "TOP0,TOP1:f32,TOP5:f32,TOP6:f32,TOP7,TOP8,TOP9,TOP10,TOP11:u32,TOP12:u32,"
+                               "TOP14,TOP15,TOP16,TOP20,TOP21,TOP22,TOP23,TOP26,TOP27,TOP36,TOP37";
+
+static void fillFrames(void) {
+  // A frame of plausible raw bytes: bit fields with valid states, temperatures around +128
+  for (int i = 0; i < DATASIZE; i++) {
+    actData[i] = (char)(0x55 + (i * 7) % 60);
+    actDataExtra[i] = (char)(0x10 + (i * 3) % 40);
+  }
+  actData[0] = 0x71;
+  actData[3] = 0x10;
+  actDataExtra[3] = 0x21;
+  for (int i = 0; i < OPTDATASIZE; i++) {
+    actOptData[i] = (char)(i * 13);
+  }
+  actDataSequence = 1;
+  actDataMillis = millis();
+
+  static dallasDataStruct sensors[4];
+  for (int i = 0; i < 4; i++) {
+    sensors[i].temperature = 18.5 + i;
+    sensors[i].lastgoodtime = millis();
+    memset(sensors[i].sensor, 0x28 + i, sizeof(sensors[i].sensor));
+  }
+  actDallasData = sensors;
+  dallasDevicecount = 4;
+}
+
+static unsigned long percentile(std::vector<unsigned long> &samples, int pct) {
+  size_t index = (samples.size() * pct) / 100;
+  if (index >= samples.size()) {
+    index = samples.size() - 1;
+  }
+  std::nth_element(samples.begin(), samples.begin() + index, samples.end());
+  return samples[index];
+}
+
+static unsigned long nanos(void) {
+  struct timespec ts;
+  clock_gettime(CLOCK_MONOTONIC, &ts);
+  return (ts.tv_sec * 1000000000UL) + ts.tv_nsec;
+}
+
+int main(int argc, char **argv) {
+  bool csv = false;
+  unsigned long iterations = 20000;
+
+  for (int i = 1; i < argc; i++) {
+    if (strcmp(argv[i], "--csv") == 0) {
+      csv = true;
+    } else if (strcmp(argv[i], "--iterations") == 0 && i + 1 < argc) {
+      iterations = strtoul(argv[++i], NULL, 10);
+    } else {
+      fprintf(stderr, "usage: %s [--csv] [--iterations N]\n", argv[0]);
+      return 1;
+    }
+  }
+  if (iterations == 0) {
+    iterations = 1;
+  }
+
+  mockStringAlloc = countStringAlloc;
+  fillFrames();
+
+  HeishaModBusServer server;
+  server.setup(false, scanList);
+  ModbusServerTCPasync *mb = ModbusServerTCPasync::instance;
+
+  if (csv) {
+    printf("scenario,unit,fc,address,count,requests,req_per_s,p50_ns,p99_ns,allocs_per_req,bytes_per_req,ns_per_item\n");
+  } else {
+    printf("%-14s %4s %3s %6s %5s %12s %10s %10s %10s %12s %10s\n",
+           "scenario", "unit", "fc", "addr", "count", "req/s", "p50 ns", "p99 ns", "allocs/req", "bytes/req", "ns/item");
+  }
+
+  std::vector<unsigned long> samples;
+  samples.reserve(iterations);
+
+  for (const scenario_t &s : scenarios) {
+    ModbusMessage request(s.unit, s.fc, s.address, s.count);
+
+    ModbusMessage check = mb->localRequest(request);
+    if (check.getError() != SUCCESS) {
+      fprintf(stderr, "%s: request failed with error %d\n", s.name, check.getError());
+      return 1;
+    }
+
+    samples.clear();
+    unsigned long allocations = heapAllocations;
+    unsigned long bytes = heapBytes;
+    unsigned long start = nanos();
+    for (unsigned long i = 0; i < iterations; i++) {
+      unsigned long t = nanos();
+      ModbusMessage response = mb->localRequest(request);
+      samples.push_back(nanos() - t);
+    }
+    unsigned long total = nanos() - start;
+    allocations = heapAllocations - allocations;
+    bytes = heapBytes - bytes;
+
+    double reqPerSec = (iterations * 1e9) / total;
+    unsigned long p50 = percentile(samples, 50);
+    unsigned long p99 = percentile(samples, 99);
+    double allocsPerReq = (double)allocations / iterations;
+    double bytesPerReq = (double)bytes / iterations;
+    // one item is a register for FC 0x03, a bit for FC 0x01/0x02 and a command for FC 0x06
+    uint16_t items = (s.fc == WRITE_HOLD_REGISTER) ? 1 : s.count;
+    double nsPerItem = (double)total / iterations / items;
+
+    if (csv) {
+      printf("%s,%u,%u,%u,%u,%lu,%.0f,%lu,%lu,%.1f,%.0f,%.1f\n",
+             s.name, s.unit, s.fc, s.address, s.count, iterations, reqPerSec, p50, p99, allocsPerReq, bytesPerReq, nsPerItem);
+    } else {
+      printf("%-14s %4u %3u %6u %5u %12.0f %10lu %10lu %10.1f %12.0f %10.1f\n",
+             s.name, s.unit, s.fc, s.address, s.count, reqPerSec, p50, p99, allocsPerReq, bytesPerReq, nsPerItem);
+    }
+  }
+  return 0;
+}
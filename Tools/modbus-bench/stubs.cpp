@@ -0,0 +1,166 @@
+/*
+  Definitions of the firmware globals and callbacks that the modbus,
+  decode and rules code reference, so they can be linked into the host
+  benchmark and the rules tools.
+*/
+
+#include <Arduino.h>
+#include <stdarg.h>
+#include <sys/time.h>
+#include <time.h>
+
+#include "../../HeishaMon/commands.h"
+#include "../../HeishaMon/decode.h"
+#include "../../HeishaMon/dallas.h"
+#include "../../HeishaMon/s0.h"
+#include "../../HeishaMon/HeishaOT.h"
+#include "../../HeishaMon/HeishaOTData.h"
+#include "../../HeishaMon/src/common/log.h"
+#include "../../HeishaMon/src/common/mqttqueue.h"
+#include "../../HeishaMon/history.h"
+#include "../../HeishaMon/webfunctions.h"
+
+char actData[DATASIZE] = { '\0' };
+char actDataExtra[DATASIZE] = { '\0' };
+char actOptData[OPTDATASIZE] = { '\0' };
+uint32_t actDataSequence = 0;
+uint32_t actDataExtraSequence = 0;
+uint32_t actOptDataSequence = 0;
+unsigned long actDataMillis = 0;
+unsigned long actDataExtraMillis = 0;
+unsigned long actOptDataMillis = 0;
+
+dallasDataStruct *actDallasData = NULL;
+int dallasDevicecount = 0;
+volatile s0DataStruct actS0Data[NUM_S0_COUNTERS];
+volatile s0SettingsStruct actS0Settings[NUM_S0_COUNTERS];
+
+byte optionalPCBQuery[OPTIONALPCBQUERYSIZE] = { 0 };
+
+const char *mqtt_topic_values = "main";
+const char *mqtt_topic_xvalues = "extra";
+const char *mqtt_topic_pcbvalues = "optional";
+
+settingsStruct heishamonSettings;
+
+unsigned long commandsSent = 0;
+
+unsigned long micros(void) {
+  struct timespec ts;
+  clock_gettime(CLOCK_MONOTONIC, &ts);
+  return (ts.tv_sec * 1000000UL) + (ts.tv_nsec / 1000);
+}
+
+unsigned long millis(void) {
+  return micros() / 1000;
+}
+
+void log_message(char *string) {
+}
+
+// leveled messages pass the same filter as on the device, a tool can print them
+uint8_t log_level = LOG_INFO;
+uint16_t log_subsystems = 0xFFFF;
+void (*stubLogLine)(uint8_t level, uint8_t subsystem, const char *line) = NULL;
+
+void _logleveled_P(uint8_t level, uint8_t subsystem, const char *fmt, ...) {
+  char str[LOGQUEUE_LINE];
+
+  if (stubLogLine == NULL) {
+    return;
+  }
+  va_list ap;
+  va_start(ap, fmt);
+  vsnprintf(str, sizeof(str), fmt, ap);
+  va_end(ap);
+  stubLogLine(level, subsystem, str);
+}
+
+// decoded values are published to nowhere
+int8_t mqttqueue_publish(const char *topic, const char *payload, uint8_t flags) {
+  return 0;
+}
+
+void history_add(uint8_t table, uint8_t nr, const char *value) {
+}
+
+// commands are counted, never sent
+bool send_command(byte *command, int length) {
+  commandsSent++;
+  return true;
+}
+
+void send_heatpump_command(char *topic, char *msg, bool (*send_command)(byte *, int), void (*log_message)(char *), bool optionalPCB) {
+  commandsSent++;
+}
+
+void websocket_write_all(char *data, uint16_t data_len) {
+}
+
+static bool relay1 = false;
+
+void setRelay1(bool state) {
+  relay1 = state;
+}
+
+bool getRelay1() {
+  return relay1;
+}
+
+#define STUB_COMMAND(name) unsigned int name(char *msg, unsigned char *cmd, char *log_msg) { return 0; }
+#define STUB_OPTIONAL_COMMAND(name) unsigned int name(char *msg, char *log_msg) { return 0; }
+
+STUB_COMMAND(set_heatpump_state)
+STUB_COMMAND(set_pump)
+STUB_COMMAND(set_max_pump_duty)
+STUB_COMMAND(set_quiet_mode)
+STUB_COMMAND(set_z1_heat_request_temperature)
+STUB_COMMAND(set_z1_cool_request_temperature)
+STUB_COMMAND(set_z2_heat_request_temperature)
+STUB_COMMAND(set_z2_cool_request_temperature)
+STUB_COMMAND(set_force_DHW)
+STUB_COMMAND(set_force_defrost)
+STUB_COMMAND(set_force_sterilization)
+STUB_COMMAND(set_holiday_mode)
+STUB_COMMAND(set_powerful_mode)
+STUB_COMMAND(set_operation_mode)
+STUB_COMMAND(set_DHW_temp)
+STUB_COMMAND(set_curves)
+STUB_COMMAND(set_zones)
+STUB_COMMAND(set_floor_heat_delta)
+STUB_COMMAND(set_floor_cool_delta)
+STUB_COMMAND(set_dhw_heat_delta)
+STUB_COMMAND(set_reset)
+STUB_COMMAND(set_heater_delay_time)
+STUB_COMMAND(set_heater_start_delta)
+STUB_COMMAND(set_heater_stop_delta)
+STUB_COMMAND(set_main_schedule)
+STUB_COMMAND(set_alt_external_sensor)
+STUB_COMMAND(set_external_pad_heater)
+STUB_COMMAND(set_buffer_delta)
+STUB_COMMAND(set_buffer)
+STUB_COMMAND(set_heatingoffoutdoortemp)
+STUB_COMMAND(set_bivalent_control)
+STUB_COMMAND(set_bivalent_mode)
+STUB_COMMAND(set_bivalent_start_temp)
+STUB_COMMAND(set_bivalent_ap_start_temp)
+STUB_COMMAND(set_bivalent_ap_stop_temp)
+STUB_COMMAND(set_external_control)
+STUB_COMMAND(set_external_error)
+STUB_COMMAND(set_external_compressor_control)
+STUB_COMMAND(set_external_heat_cool_control)
+
+STUB_OPTIONAL_COMMAND(set_heat_cool_mode)
+STUB_OPTIONAL_COMMAND(set_compressor_state)
+STUB_OPTIONAL_COMMAND(set_smart_grid_mode)
+STUB_OPTIONAL_COMMAND(set_external_thermostat_1_state)
+STUB_OPTIONAL_COMMAND(set_external_thermostat_2_state)
+STUB_OPTIONAL_COMMAND(set_demand_control)
+STUB_OPTIONAL_COMMAND(set_pool_temp)
+STUB_OPTIONAL_COMMAND(set_buffer_temp)
+STUB_OPTIONAL_COMMAND(set_z1_room_temp)
+STUB_OPTIONAL_COMMAND(set_z1_water_temp)
+STUB_OPTIONAL_COMMAND(set_z2_room_temp)
+STUB_OPTIONAL_COMMAND(set_z2_water_temp)
+STUB_OPTIONAL_COMMAND(set_solar_temp)
+STUB_OPTIONAL_COMMAND(set_byte_9)
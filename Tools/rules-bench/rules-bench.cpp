@@ -0,0 +1,241 @@
+/*
+  Host-side benchmark for the HeishaMon rules engine.
+
+  The engine from HeishaMon/src/rules is compiled for the host together
+  with the firmware glue in HeishaMon/rules.cpp. A set of generated workloads is
+  compiled and run repeatedly to report lexing/compiling throughput and
+  rule_run ops/s for arithmetic, branches, constant expressions, strings,
+  function calls and variable access with a growing number of variables.
+
+  Build and run from this directory:
+
+    g++ -std=gnu++17 -O2 -DMEMPOOL_SIZE=65000 -I ../modbus-bench/mock -include Arduino.h \
+      -o rules-bench rules-bench.cpp ../rules-compiler/host.cpp ../modbus-bench/stubs.cpp \
+      ../../HeishaMon/{rules,decode,loopstats}.cpp ../../HeishaMon/src/rules/{rules,operator,function}.cpp \
+      ../../HeishaMon/src/rules/functions/[a-z]*.cpp \
+      ../../HeishaMon/src/common/{mem,uint32float,stricmp,strnicmp,timerqueue}.cpp
+    ./rules-bench [--csv] [--iterations N] [--filter NAME]
+
+  Absolute numbers are host numbers. Use them to compare changes to the
+  rules engine with each other, not to predict ESP8266/ESP32 speed.
+*/
+
+#include <Arduino.h>
+#include <algorithm>
+#include <string>
+#include <vector>
+
+#include "../rules-compiler/host.h"
+
+typedef std::string (*workload_cb)(unsigned int size);
+
+struct workload_t {
+  const char *name;
+  workload_cb generate;
+  unsigned int size;
+};
+
+static std::string arithmetic(unsigned int size) {
+  std::string rule = "on bench then\n  $a = 1;\n  $b = 2.5;\n";
+  for (unsigned int i = 0; i < size; i++) {
+    rule += "  $a = ($a * 3 + $b) % 97;\n";
+    rule += "  $b = ($b + $a / 2) - 1.25 * $a;\n";
+  }
+  return rule + "end\n";
+}
+
+static std::string branches(unsigned int size) {
+  std::string rule = "on bench then\n  $a = 1;\n  $b = 0;\n";
+  for (unsigned int i = 0; i < size; i++) {
+    rule += "  if $a > 10 then\n    $a = $a - 3;\n  elseif $a > 5 then\n    $a = $a + 2;\n  else\n    $a = $a + 7;\n  end\n";
+    rule += "  if $b == 1 && $a < 50 then\n    $b = 0;\n  else\n    $b = 1;\n  end\n";
+  }
+  return rule + "end\n";
+}
+
+static std::string constants(unsigned int size) {
+  std::string rule = "on bench then\n  $a = 1;\n";
+  for (unsigned int i = 0; i < size; i++) {
+    rule += "  $a = ($a + 3 * 60 * 1000) % (24 * 3600);\n";
+    rule += "  if 1 == 1 then\n    $b = $a / (2 * 1.5);\n  else\n    $b = 0;\n  end\n";
+  }
+  return rule + "end\n";
+}
+
+static std::string strings(unsigned int size) {
+  std::string rule = "on bench then\n  $s = 'heat';\n";
+  for (unsigned int i = 0; i < size; i++) {
+    rule += "  $t = concat($s, '_', 'pump');\n";
+    rule += "  $s = concat('mode', ':', 1);\n";
+  }
+  return rule + "end\n";
+}
+
+static std::string functions(unsigned int size) {
+  std::string rule = "on bench then\n  $a = 21.5;\n  $b = 19;\n";
+  for (unsigned int i = 0; i < size; i++) {
+    rule += "  $c = max($a, $b, 20) - min($a, $b);\n";
+    rule += "  $d = round($c * 1.7) + floor($a) - ceil($b);\n";
+    rule += "  $e = coalesce($x, $d);\n";
+  }
+  return rule + "end\n";
+}
+
+static std::string variables(char scope, unsigned int size) {
+  std::string rule = "on bench then\n";
+  char line[64];
+  for (unsigned int i = 0; i < size; i++) {
+    snprintf(line, sizeof(line), "  %cv%u = %u;\n", scope, i, i % 10);
+    rule += line;
+  }
+  // read back in reverse, so a linear lookup pays for every variable
+  for (unsigned int i = size; i > 0; i--) {
+    snprintf(line, sizeof(line), "  %cv%u = %cv%u + 1;\n", scope, i - 1, scope, i - 1);
+    rule += line;
+  }
+  return rule + "end\n";
+}
+
+static std::string locals(unsigned int size) {
+  return variables('$', size);
+}
+
+static std::string globals(unsigned int size) {
+  return variables('#', size);
+}
+
+static std::string topics(unsigned int size) {
+  std::string rule = "on bench then\n";
+  for (unsigned int i = 0; i < size; i++) {
+    rule += "  $a = @Main_Outlet_Temp - @Main_Inlet_Temp + @Outside_Temp;\n";
+  }
+  return rule + "end\n";
+}
+
+/*
+ * Variable names are addressed with a signed byte in the
+ * bytecode, so a rule set cannot use more than 127 names.
+ */
+static const workload_t workloads[] = {
+  { "arithmetic", arithmetic, 20 },
+  { "branches", branches, 10 },
+  { "constants", constants, 10 },
+  { "strings", strings, 10 },
+  { "functions", functions, 10 },
+  { "locals", locals, 8 },
+  { "locals", locals, 32 },
+  { "locals", locals, 64 },
+  { "globals", globals, 8 },
+  { "globals", globals, 32 },
+  { "globals", globals, 64 },
+  { "topics", topics, 10 },
+};
+
+static unsigned long percentile(std::vector<unsigned long> &samples, int pct) {
+  size_t index = (samples.size() * pct) / 100;
+  if (index >= samples.size()) {
+    index = samples.size() - 1;
+  }
+  std::nth_element(samples.begin(), samples.begin() + index, samples.end());
+  return samples[index];
+}
+
+int main(int argc, char **argv) {
+  bool csv = false;
+  unsigned long iterations = 20000;
+  const char *filter = NULL;
+
+  for (int i = 1; i < argc; i++) {
+    if (strcmp(argv[i], "--csv") == 0) {
+      csv = true;
+    } else if (strcmp(argv[i], "--iterations") == 0 && i + 1 < argc) {
+      iterations = strtoul(argv[++i], NULL, 10);
+    } else if (strcmp(argv[i], "--filter") == 0 && i + 1 < argc) {
+      filter = argv[++i];
+    } else {
+      fprintf(stderr, "usage: %s [--csv] [--iterations N] [--filter NAME]\n", argv[0]);
+      return 1;
+    }
+  }
+  if (iterations == 0) {
+    iterations = 1;
+  }
+  // compiling is a lot slower than running, keep the total time sane
+  unsigned long compiles = (iterations / 1000 > 0) ? iterations / 1000 : 1;
+
+  host_setup();
+
+  if (csv) {
+    printf("workload,size,bytes,compile_us,compile_kb_per_s,bytecode,heap,ops,runs,ns_per_run,p50_ns,p99_ns,ns_per_op,mops_per_s\n");
+  } else {
+    printf("%-11s %5s %6s %10s %8s %6s %6s %6s %10s %8s %8s %8s %8s\n",
+           "workload", "size", "bytes", "compile us", "kB/s", "bc", "heap", "ops", "ns/run", "p50 ns", "p99 ns", "ns/op", "Mops/s");
+  }
+
+  std::vector<unsigned long> samples;
+  samples.reserve(iterations);
+
+  for (const workload_t &w : workloads) {
+    if (filter != NULL && strcmp(filter, w.name) != 0) {
+      continue;
+    }
+    std::string rule = w.generate(w.size);
+    int ret = 0;
+
+    int saved = quiet_begin();
+    unsigned long start = nanos();
+    for (unsigned long i = 0; i < compiles; i++) {
+      if ((ret = rules_parse_text(rule.c_str(), rule.length())) != 0) {
+        break;
+      }
+    }
+    unsigned long compiletime = (nanos() - start) / compiles;
+    quiet_end(saved);
+
+    if (ret != 0 || nrrules != 1) {
+      fprintf(stderr, "%s/%u: failed to compile\n", w.name, w.size);
+      return 1;
+    }
+
+    struct rules_t *obj = rules[0];
+    samples.clear();
+    saved = quiet_begin();
+    start = nanos();
+    for (unsigned long i = 0; i < iterations; i++) {
+      unsigned long t = nanos();
+      ret = rule_run(obj, 0);
+      samples.push_back(nanos() - t);
+      rules_free_stack();
+      if (ret == -1) {
+        break;
+      }
+    }
+    unsigned long total = nanos() - start;
+    quiet_end(saved);
+
+    if (ret == -1) {
+      fprintf(stderr, "%s/%u: failed to run\n", w.name, w.size);
+      return 1;
+    }
+
+    uint32_t ops = rules_nrops();
+    double nsPerRun = (double)total / iterations;
+    double nsPerOp = nsPerRun / ops;
+    double kbPerSec = (rule.length() * 1e6) / compiletime;
+    unsigned long p50 = percentile(samples, 50);
+    unsigned long p99 = percentile(samples, 99);
+
+    if (csv) {
+      printf("%s,%u,%u,%.1f,%.0f,%u,%u,%u,%lu,%.0f,%lu,%lu,%.1f,%.2f\n",
+             w.name, w.size, (unsigned int)rule.length(), compiletime / 1e3, kbPerSec,
+             rules_bcsize(obj), rules_heapsize(obj), ops, iterations, nsPerRun, p50, p99, nsPerOp, 1e3 / nsPerOp);
+    } else {
+      printf("%-11s %5u %6u %10.1f %8.0f %6u %6u %6u %10.0f %8lu %8lu %8.1f %8.2f\n",
+             w.name, w.size, (unsigned int)rule.length(), compiletime / 1e3, kbPerSec,
+             rules_bcsize(obj), rules_heapsize(obj), ops, nsPerRun, p50, p99, nsPerOp, 1e3 / nsPerOp);
+    }
+  }
+
+  rules_deinitialize();
+  return 0;
+}
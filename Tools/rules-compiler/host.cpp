@@ -0,0 +1,100 @@
+/*
+  Host-side helpers for the rules compiler and the rules benchmark. The
+  rules glue itself is the firmware one from HeishaMon/rules.cpp, built
+  against the stand-ins in ../modbus-bench. Heatpump values are decoded
+  from a synthetic frame and commands are only counted.
+*/
+
+#include <Arduino.h>
+#include <time.h>
+#include <unistd.h>
+#include <fcntl.h>
+
+#include "../../HeishaMon/commands.h"
+#include "../../HeishaMon/decode.h"
+#include "host.h"
+
+extern char actData[DATASIZE];
+extern char actDataExtra[DATASIZE];
+extern char actOptData[OPTDATASIZE];
+extern uint32_t actDataSequence;
+extern uint32_t actDataExtraSequence;
+extern uint32_t actOptDataSequence;
+
+bool verbose = false;
+
+/*
+ * Log lines of the firmware code, e.g. the rule errors, are
+ * only printed with --verbose and never by the repeated
+ * timing runs.
+ */
+static bool muted = false;
+
+extern void (*stubLogLine)(uint8_t level, uint8_t subsystem, const char *line);
+
+static void hostLogLine(uint8_t level, uint8_t subsystem, const char *line) {
+  if (verbose && !muted) {
+    printf("%s\n", line);
+  }
+}
+
+void host_mute(bool mute) {
+  muted = mute;
+}
+
+// setTimer() only needs to be accepted, timers never fire here
+void timer_cb(int nr) {
+}
+
+static void fillFrames(void) {
+  // A frame of plausible raw bytes: bit fields with valid states, temperatures around +128
+  for (int i = 0; i < DATASIZE; i++) {
+    actData[i] = (char)(0x55 + (i * 7) % 60);
+    actDataExtra[i] = (char)(0x10 + (i * 3) % 40);
+  }
+  actData[0] = 0x71;
+  actData[3] = 0x10;
+  actDataExtra[3] = 0x21;
+  for (int i = 0; i < OPTDATASIZE; i++) {
+    actOptData[i] = (char)(i * 13);
+  }
+  actDataSequence = 1;
+  actDataExtraSequence = 1;
+  actOptDataSequence = 1;
+}
+
+unsigned long nanos(void) {
+  struct timespec ts;
+  clock_gettime(CLOCK_MONOTONIC, &ts);
+  return (ts.tv_sec * 1000000000UL) + ts.tv_nsec;
+}
+
+/*
+ * The engine prints its own progress to stdout on the host,
+ * only show it when asked for.
+ */
+int quiet_begin(void) {
+  if (verbose) {
+    return -1;
+  }
+  fflush(stdout);
+  int saved = dup(STDOUT_FILENO);
+  int null = open("/dev/null", O_WRONLY);
+  dup2(null, STDOUT_FILENO);
+  close(null);
+  return saved;
+}
+
+void quiet_end(int saved) {
+  if (saved == -1) {
+    return;
+  }
+  fflush(stdout);
+  dup2(saved, STDOUT_FILENO);
+  close(saved);
+}
+
+void host_setup(void) {
+  stubLogLine = hostLogLine;
+  fillFrames();
+}
@@ -0,0 +1,24 @@
+/*
+  Host-side helpers around the HeishaMon rules glue, see host.cpp.
+*/
+
+#ifndef _RULES_HOST_H_
+#define _RULES_HOST_H_
+
+#include <stdint.h>
+
+#include "../../HeishaMon/src/rules/rules.h"
+#include "../../HeishaMon/rules.h"
+
+extern bool verbose;
+extern unsigned long commandsSent;
+
+void host_setup(void);
+//silences the firmware log lines, also with verbose set
+void host_mute(bool mute);
+
+unsigned long nanos(void);
+int quiet_begin(void);
+void quiet_end(int saved);
+
+#endif
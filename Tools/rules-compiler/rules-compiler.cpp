@@ -0,0 +1,171 @@
+/*
+  Host-side compiler and validator for HeishaMon rules.
+
+  The rules engine from HeishaMon/src/rules is compiled for the host
+  together with the firmware glue in HeishaMon/rules.cpp and the real
+  topic, command and opentherm tables, so a rules file is accepted or
+  rejected the same way the firmware does it. The host mempool is larger
+  than the firmware one, its usage is converted to the 32-bit layout of
+  the firmware and checked against the ESP8266 and ESP32 mempool sizes.
+  Afterwards every rule block is run against a synthetic heatpump frame
+  to report the bytecode ops executed and the execution time per block.
+
+  Build and run from this directory:
+
+    g++ -std=gnu++17 -O2 -DMEMPOOL_SIZE=65000 -I ../modbus-bench/mock -include Arduino.h \
+      -o rules-compiler rules-compiler.cpp host.cpp ../modbus-bench/stubs.cpp \
+      ../../HeishaMon/{rules,decode,loopstats}.cpp ../../HeishaMon/src/rules/{rules,operator,function}.cpp \
+      ../../HeishaMon/src/rules/functions/[a-z]*.cpp \
+      ../../HeishaMon/src/common/{mem,uint32float,stricmp,strnicmp,timerqueue}.cpp
+    ./rules-compiler [--verbose] [--iterations N] rules.txt
+
+  The exit code is 0 when the rules fit both targets, 1 on parse or run
+  errors and 2 when they do not fit the ESP8266 mempool.
+
+  Times are host times. Use them to compare rule blocks with each other,
+  not to predict ESP8266/ESP32 execution times.
+*/
+
+#include <Arduino.h>
+
+#include "../../HeishaMon/src/common/mem.h"
+#include "host.h"
+
+/*
+ * The firmware is 32-bit, the host is not. Only the rule block
+ * and heap headers in the mempool hold pointers, so their size
+ * difference is subtracted to get the bytes used on the device.
+ */
+#define TARGET_RULES_T_SIZE 36
+#define TARGET_STACK_T_SIZE 8
+
+static const struct {
+  const char *name;
+  uint16_t size;
+} targets[] = {
+  { "ESP8266", 16000 },
+  { "ESP32", 32 * 1024 },
+};
+
+int main(int argc, char **argv) {
+  unsigned long iterations = 1000;
+  const char *file = NULL;
+
+  for (int i = 1; i < argc; i++) {
+    if (strcmp(argv[i], "--verbose") == 0) {
+      verbose = true;
+    } else if (strcmp(argv[i], "--iterations") == 0 && i + 1 < argc) {
+      iterations = strtoul(argv[++i], NULL, 10);
+    } else if (file == NULL && argv[i][0] != '-') {
+      file = argv[i];
+    } else {
+      file = NULL;
+      break;
+    }
+  }
+  if (file == NULL) {
+    fprintf(stderr, "usage: %s [--verbose] [--iterations N] rules.txt\n", argv[0]);
+    return 1;
+  }
+  if (iterations == 0) {
+    iterations = 1;
+  }
+
+  FILE *fp = fopen(file, "rb");
+  if (fp == NULL) {
+    fprintf(stderr, "cannot open %s\n", file);
+    return 1;
+  }
+  static char text[MEMPOOL_SIZE / 2];
+  long len = fread(text, 1, sizeof(text), fp);
+  bool more = (fgetc(fp) != EOF);
+  fclose(fp);
+  if (len <= 0 || more) {
+    fprintf(stderr, "%s: empty or too large\n", file);
+    return 1;
+  }
+
+  host_setup();
+
+  int saved = quiet_begin();
+  unsigned long start = nanos();
+  int ret = rules_parse_text(text, len);
+  unsigned long parsetime = nanos() - start;
+  quiet_end(saved);
+
+  if (ret != 0) {
+    fprintf(stderr, "%s: parse error in rule block #%d\n", file, nrrules + 1);
+    return 1;
+  }
+
+  unsigned int overhead = (sizeof(struct rules_t) - TARGET_RULES_T_SIZE) + (sizeof(struct rule_stack_t) - TARGET_STACK_T_SIZE);
+  unsigned int used = rules_mempool_used() - (nrrules * overhead);
+  unsigned int source = alignedbuffer(len + 5);
+
+  printf("%s: %d rule blocks, %ld bytes of source, parsed in %.3f ms, %u bytes saved by the optimizer, %u bytes of unused heap released\n\n",
+         file, nrrules, len, parsetime / 1e6, rules_optimized(), rules_released());
+
+  printf("%-24s %6s %6s %8s %8s %10s %10s\n", "block", "bc", "heap", "ops", "stack", "avg ns", "max ns");
+
+  int errors = 0;
+  uint16_t stackpeak = 0;
+  for (uint8_t x = 0; x < nrrules; x++) {
+    unsigned long total = 0, max = 0;
+    uint32_t ops = 0;
+    uint16_t stack = 0;
+    unsigned long i = 0;
+
+    saved = quiet_begin();
+    for (i = 0; i < iterations; i++) {
+      //only the first run logs
+      host_mute(i > 0);
+      unsigned long t = nanos();
+      int8_t r = rule_run(rules[x], 0);
+      t = nanos() - t;
+      if (r == -1) {
+        break;
+      }
+      total += t;
+      max = (t > max) ? t : max;
+      ops = rules_nrops();
+      stack = (rules_stackpeak() > stack) ? rules_stackpeak() : stack;
+      rules_free_stack();
+    }
+    host_mute(false);
+    quiet_end(saved);
+
+    const char *name = (rules[x]->name == NULL) ? "" : rules[x]->name;
+    if (i < iterations) {
+      fprintf(stderr, "%s: rule block '%s' failed to run\n", file, name);
+      errors++;
+      continue;
+    }
+    stackpeak = (stack > stackpeak) ? stack : stackpeak;
+    printf("%-24s %6u %6u %8u %8u %10lu %10lu\n",
+           name, rules_bcsize(rules[x]), rules_heapsize(rules[x]), ops, stack, total / iterations, max);
+  }
+
+  unsigned int runtime = used + TARGET_STACK_T_SIZE + stackpeak;
+  unsigned int parsing = used + source;
+
+  printf("\n%-8s %8s %8s %8s %8s  %s\n", "target", "mempool", "used", "runtime", "parsing", "result");
+  int fits = 0;
+  for (uint8_t t = 0; t < sizeof(targets) / sizeof(targets[0]); t++) {
+    const char *result = "ok";
+    if (runtime > targets[t].size) {
+      result = "too large";
+    } else if (parsing > targets[t].size) {
+      // the source text is consumed while parsing, so this is an upper bound
+      result = "may not parse, source text does not fit next to the bytecode";
+    } else if (t == 0) {
+      fits = 1;
+    }
+    printf("%-8s %8u %8u %8u %8u  %s\n", targets[t].name, targets[t].size, used, runtime, parsing, result);
+  }
+  printf("\n%lu commands would have been sent\n", commandsSent / iterations);
+
+  if (errors > 0) {
+    return 1;
+  }
+  return (fits == 1) ? 0 : 2;
+}
@@ -0,0 +1,166 @@
+/*
+  Host-side benchmark for the HeishaMon timer queue.
+
+  The queue from HeishaMon/src/common/timerqueue.cpp is compiled for the
+  host with room for thousands of timers. For a growing number of pending
+  timers it reports the cost of scheduling, rescheduling and cancelling a
+  timer, of a timerqueue_update() pass in loop() with nothing due and of
+  firing due timers.
+
+  Build and run from this directory:
+
+    g++ -std=gnu++17 -O2 -DTIMERQUEUE_SIZE=8192 -o timerqueue-bench \
+      timerqueue-bench.cpp ../../HeishaMon/src/common/timerqueue.cpp
+    ./timerqueue-bench [--csv] [--rounds N]
+
+  Absolute numbers are host numbers. Use them to compare changes to the
+  timer queue with each other, not to predict ESP8266/ESP32 speed.
+*/
+
+#include <stdio.h>
+#include <stdlib.h>
+#include <string.h>
+#include <time.h>
+#include <algorithm>
+#include <vector>
+
+#include "../../HeishaMon/src/common/timerqueue.h"
+
+static unsigned long fired = 0;
+static int lastfired = 0;
+
+void timer_cb(int nr) {
+  fired++;
+  lastfired = nr;
+}
+
+static unsigned long nanos(void) {
+  struct timespec ts;
+  clock_gettime(CLOCK_MONOTONIC, &ts);
+  return (ts.tv_sec * 1000000000UL) + ts.tv_nsec;
+}
+
+static unsigned int seed = 1;
+
+// deterministic, so runs can be compared with each other
+static unsigned int rnd(void) {
+  seed = seed * 1103515245 + 12345;
+  return (seed >> 8) & 0xFFFFFF;
+}
+
+static void fill(const std::vector<int> &nrs) {
+  timerqueue_clear();
+  for (int nr : nrs) {
+    timerqueue_insert(60 + rnd() % 3600, rnd() % 1000000, nr);
+  }
+}
+
+/*
+ * Rule timers are small numbers, the firmware uses
+ * a few negative ones for its own housekeeping.
+ */
+static const unsigned int sizes[] = { 16, 64, 256, 1024, 4096, 8192 };
+
+int main(int argc, char **argv) {
+  bool csv = false;
+  unsigned long rounds = 20;
+
+  for (int i = 1; i < argc; i++) {
+    if (strcmp(argv[i], "--csv") == 0) {
+      csv = true;
+    } else if (strcmp(argv[i], "--rounds") == 0 && i + 1 < argc) {
+      rounds = strtoul(argv[++i], NULL, 10);
+    } else {
+      fprintf(stderr, "usage: %s [--csv] [--rounds N]\n", argv[0]);
+      return 1;
+    }
+  }
+  if (rounds == 0) {
+    rounds = 1;
+  }
+
+  if (csv) {
+    printf("timers,insert_ns,reschedule_ns,cancel_ns,idle_update_ns,fire_ns\n");
+  } else {
+    printf("%7s %10s %10s %10s %10s %10s\n", "timers", "insert", "reschedule", "cancel", "idle upd", "fire");
+  }
+
+  for (unsigned int size : sizes) {
+    if (size > TIMERQUEUE_SIZE) {
+      continue;
+    }
+    std::vector<int> nrs;
+    for (unsigned int i = 0; i < size; i++) {
+      nrs.push_back((i % 8 == 7) ? -(int)i : (int)i + 1);
+    }
+
+    unsigned long insert = 0, reschedule = 0, cancel = 0, idle = 0, fire = 0;
+
+    for (unsigned long r = 0; r < rounds; r++) {
+      std::random_shuffle(nrs.begin(), nrs.end(), [](int n) { return (int)(rnd() % n); });
+
+      unsigned long start = nanos();
+      fill(nrs);
+      insert += nanos() - start;
+      if (timerqueue_size() != size) {
+        fprintf(stderr, "%u: queue holds %u timers\n", size, timerqueue_size());
+        return 1;
+      }
+
+      start = nanos();
+      for (int nr : nrs) {
+        timerqueue_insert(60 + rnd() % 3600, rnd() % 1000000, nr);
+      }
+      reschedule += nanos() - start;
+
+      // what every loop() pays while nothing is due
+      start = nanos();
+      for (unsigned int i = 0; i < 1000; i++) {
+        timerqueue_update();
+      }
+      idle += nanos() - start;
+
+      start = nanos();
+      for (int nr : nrs) {
+        timerqueue_insert(0, 0, nr);
+      }
+      cancel += nanos() - start;
+      if (timerqueue_size() != 0) {
+        fprintf(stderr, "%u: %u timers left after cancelling\n", size, timerqueue_size());
+        return 1;
+      }
+
+      // spread over 2ms and wait for all of them to be due
+      for (int nr : nrs) {
+        timerqueue_insert(0, 1 + rnd() % 2000, nr);
+      }
+      uint64_t last = timerqueue_micros() + 2001;
+      while (timerqueue_micros() < last);
+
+      fired = 0;
+      start = nanos();
+      timerqueue_update();
+      fire += nanos() - start;
+      if (fired != size || timerqueue_size() != 0) {
+        fprintf(stderr, "%u: %lu of the timers fired\n", size, fired);
+        return 1;
+      }
+    }
+
+    double n = (double)rounds * size;
+    if (csv) {
+      printf("%u,%.1f,%.1f,%.1f,%.1f,%.1f\n",
+             size, insert / n, reschedule / n, cancel / n, idle / (rounds * 1000.0), fire / n);
+    } else {
+      printf("%7u %10.1f %10.1f %10.1f %10.1f %10.1f\n",
+             size, insert / n, reschedule / n, cancel / n, idle / (rounds * 1000.0), fire / n);
+    }
+  }
+
+  if (!csv) {
+    printf("\nns per timer, idle update in ns per timerqueue_update() call\n");
+  }
+
+  timerqueue_clear();
+  return 0;
+}